@@ -3,21 +3,84 @@
 #include <string.h>
 
 #include "src/ast.h"
+#include "src/ast_manip.h"
 #include "src/stringify.h"
+#include "src/interpreter/image.h"
 #include "src/interpreter/interpreter.h"
+#include "src/interpreter/output.h"
 #include "src/intern.h"
+#include "src/serve.h"
 #include "src/util.h"
 
 void printusage(const char *progname) {
-	fprintf(stderr, "USAGE:\t%s [-f] [ -e script | file ]\n\n", progname);
+	fprintf(stderr, "USAGE:\t%s [-f] [--dump-optimized] [--no-optimize] [--heap-frames] [--no-compile] [--no-jit] [--workers n] [--base lib]... [--image file] [--save-image file] [--serve socket] [ -e script | file ]\n", progname);
+	fprintf(stderr, "\t%s --connect socket [ -e script | file ]\n\n", progname);
 
 	fprintf(stderr, "FLAGS:\n");
 	fprintf(stderr, "\t-f\tformat the given file\n");
+	fprintf(stderr, "\t--dump-optimized\tprint the given file after optimizing it\n");
+	fprintf(stderr, "\t--no-optimize\trun the program as it's written\n");
+	fprintf(stderr, "\t--heap-frames\tkeep evaluation frames on the heap, so deep recursion doesn't overflow the stack\n");
+	fprintf(stderr, "\t--no-compile\tevaluate function bodies without compiling them\n");
+	fprintf(stderr, "\t--no-jit\tdon't compile hot numeric functions to machine code\n");
+	fprintf(stderr, "\t--workers n\trun pmap, pfilter, preduce and futures on n threads instead of one per CPU, 1 runs futures where they're made\n");
+	fprintf(stderr, "\t--base lib\tload lib once, into an image every isolate starts from, instead of into each of them\n");
+	fprintf(stderr, "\t--image file\tstart from an image file instead, whose variables are read when they're first used\n");
+	fprintf(stderr, "\t--save-image file\tsave the variables the program leaves behind to an image file\n");
+	fprintf(stderr, "\t--serve socket\trun the given program, if any, then run the programs clients send to the socket, each in a fork of the result\n");
+	fprintf(stderr, "\t--connect socket\trun the given program on the server at the socket, with the standard streams and directory of this one\n");
+}
+
+// Parses src, which it frees, and prints the error if it fails.
+static bool parseSource(char *src, ProgramParseResult *program) {
+	*program = parseprogram(src);
+	free(src);
+	if (program->err) {
+		fprintf(stderr, "Program error: %s at line %d col %d\n", program->err, program->errloc.line, program->errloc.col);
+		return false;
+	} else if (program->len == 0) {
+		fprintf(stderr, "Program is empty\n");
+		return false;
+	}
+	return true;
+}
+
+// Runs src, which it frees, in the root scope ctx and returns the exit status.
+// What it printed is written before it returns, since the forks of --serve
+// exit without flushing, and the server mustn't leave it to them.
+static int runSource(void *ctx, char *src) {
+	ProgramParseResult program;
+	if (!parseSource(src, &program)) {
+		return 1;
+	}
+
+	RunResult res = runNodes(ctx, program.len, program.nodes, true);
+	node_free(res.node);
+	char *err = output_flush_all();
+	if (res.err == NULL) {
+		res.err = err;
+	} else {
+		free(err);
+	}
+	if (res.err != NULL) {
+		fprintf(stderr, "Error while executing code: %s\n", res.err);
+		free(res.err);
+		return 1;
+	}
+	return 0;
 }
 
 int main(int argc, char **argv) {
 	char *src = NULL;
+	const char *file = NULL;
 	bool format = false;
+	bool dump = false;
+	const char **libs = malloc(argc, sizeof(char*));
+	size_t nlibs = 0;
+	const char *imageFile = NULL;
+	const char *saveImage = NULL;
+	const char *serveSocket = NULL;
+	const char *connectSocket = NULL;
 
 #define FLAG(s, l) (!skip && (streq(argv[i], s) || streq(argv[i], l)))
 	bool skip = false;
@@ -29,62 +92,134 @@ int main(int argc, char **argv) {
 
 		if (FLAG("-e", "--eval")) {
 			i++;
+			free(src);
 			src = astrcpy(argv[i]);
+			file = NULL;
 		} else if (FLAG("-f", "--format")) {
 			format = true;
+		} else if (FLAG("--dump-optimized", "--dump-optimized")) {
+			dump = true;
+		} else if (FLAG("--no-optimize", "--no-optimize")) {
+			setOptimize(false);
+		} else if (FLAG("--heap-frames", "--heap-frames")) {
+			setHeapFrames(true);
+		} else if (FLAG("--no-compile", "--no-compile")) {
+			setCompile(false);
+		} else if (FLAG("--no-jit", "--no-jit")) {
+			setJit(false);
+		} else if (FLAG("--workers", "--workers")) {
+			i++;
+			char *end;
+			const long n = i < argc ? strtol(argv[i], &end, 10) : 0;
+			if (n < 1 || *end != '\0') {
+				fprintf(stderr, "expected a positive number of workers\n");
+				return 1;
+			}
+			setWorkers(n);
+		} else if (FLAG("--base", "--base")) {
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "expected a library\n");
+				return 1;
+			}
+			libs[nlibs++] = argv[i];
+		} else if (FLAG("--image", "--image") || FLAG("--save-image", "--save-image")) {
+			const bool save = streq(argv[i], "--save-image");
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "expected a file\n");
+				return 1;
+			}
+			*(save ? &saveImage : &imageFile) = argv[i];
+		} else if (FLAG("--serve", "--serve") || FLAG("--connect", "--connect")) {
+			const bool connect = streq(argv[i], "--connect");
+			i++;
+			if (i == argc) {
+				fprintf(stderr, "expected a socket\n");
+				return 1;
+			}
+			*(connect ? &connectSocket : &serveSocket) = argv[i];
 		} else if (FLAG("-h", "--help")) {
 			printusage(argv[0]);
 			return 0;
 		} else {
-			src = readfile(argv[i]);
-			if (src == NULL) {
-				fprintf(stderr, "couldn't read file: '%s'\n", argv[i]);
-				return 1;
-			}
+			free(src);
+			src = NULL;
+			file = argv[i];
 		}
 	}
 #undef FLAG
 
-	if (src == NULL) {
+	if (connectSocket != NULL) {
+		if (src == NULL && file == NULL) {
+			printusage(argv[0]);
+			return 1;
+		}
+		// the server reads the file, from the same directory
+		return serve_connect(connectSocket, src != NULL ? src : file, src == NULL);
+	}
+
+	if (file != NULL) {
+		src = readfile(file);
+		if (src == NULL) {
+			fprintf(stderr, "couldn't read file: '%s'\n", file);
+			return 1;
+		}
+	} else if (src == NULL && serveSocket == NULL) {
 		printusage(argv[0]);
 		return 1;
 	}
 
-	ProgramParseResult program = parseprogram(src);
-	if (program.err) {
-		fprintf(stderr, "Program error: %s at line %d col %d\n", program.err, program.errloc.line, program.errloc.col);
-		return 1;
-	} else if (program.len == 0) {
-		fprintf(stderr, "Program is empty\n");
+	if (nlibs > 0 && imageFile != NULL) {
+		fprintf(stderr, "expected either --base or --image\n");
 		return 1;
+	} else if (nlibs > 0 || imageFile != NULL) {
+		char *err;
+		Image *image = imageFile != NULL ? image_open(imageFile, &err) : image_make(nlibs, libs, &err);
+		if (image == NULL) {
+			fprintf(stderr, "%s\n", err);
+			return 1;
+		}
+		setBaseImage(image);
 	}
+	free(libs);
 
-	free(src);
+	if (dump || format) {
+		ProgramParseResult program;
+		if (!parseSource(src, &program)) {
+			return 1;
+		}
 
-	if (format) {
+		Scope *scope = scope_make(NULL, true);
+		BoundNames *bound = bound_names(program.nodes, program.len);
 		for (size_t i = 0; i < program.len; i++) {
+			if (dump) {
+				program.nodes[i] = ast_optimize(scope, bound, program.nodes[i]);
+			}
 			printf("%s\n", stringify(program.nodes[i], 0));
 		}
 		return 0;
 	}
 
 	Scope *scope = scope_make(NULL, true);
-	InternEnvironment *env = ie_make(); // TODO: free
-	for (size_t i = 0; i < program.len; i++) {
-		if (program.nodes[i]->type != AST_EXPR) {
-			continue;
+	if (src != NULL) {
+		const int status = runSource(scope, src);
+		if (status != 0) {
+			return status;
 		}
+	}
+
+	if (serveSocket != NULL) {
+		return serve(serveSocket, runSource, scope);
+	}
 
-		InternedNode interned = intern(program.nodes[i], env);
-		RunResult res = in_run(scope, interned);
-		node_free(interned.node);
-		//in_destroy(is);
-		if (res.err != NULL) {
-			fprintf(stderr, "Error while executing code: %s\n", res.err);
+	if (saveImage != NULL) {
+		char *err = image_save(scope, saveImage);
+		if (err != NULL) {
+			fprintf(stderr, "%s\n", err);
 			return 1;
 		}
 	}
-	ie_free(env, false);
 
 	return 0;
 }
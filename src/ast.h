@@ -8,6 +8,26 @@ struct RunResult;
 typedef struct RunResult RunResult;
 struct Scope;
 typedef struct Scope Scope;
+struct Vector;
+typedef struct Vector Vector;
+struct F64Array;
+typedef struct F64Array F64Array;
+struct Dict;
+typedef struct Dict Dict;
+struct Generator;
+typedef struct Generator Generator;
+struct Code;
+typedef struct Code Code;
+struct Jit;
+typedef struct Jit Jit;
+struct Memo;
+typedef struct Memo Memo;
+struct Channel;
+typedef struct Channel Channel;
+struct Future;
+typedef struct Future Future;
+struct Coroutine;
+typedef struct Coroutine Coroutine;
 
 typedef enum ASTtype {
 	AST_QUOTED,
@@ -18,6 +38,14 @@ typedef enum ASTtype {
 	AST_COMMENT,
 
 	AST_FUN, // not a real AST node, actually.
+	AST_VECTOR, // neither is this one.
+	AST_ARRAY, // or this one.
+	AST_DICT,
+	AST_GENERATOR,
+	AST_RANGE,
+	AST_CHANNEL,
+	AST_FUTURE,
+	AST_COROUTINE,
 } ASTtype;
 
 typedef struct Node Node;
@@ -49,17 +77,41 @@ typedef struct Comment {
 	char *content;
 } Comment;
 
+// The numbers from, from + step, ... up to but not including some end, of
+// which there are len. Items are only made when they're used.
+typedef struct Range {
+	double from;
+	double step;
+	size_t len;
+} Range;
+
+// The code of a user defined function. It's shared by all copies of the
+// function value, so it's reference counted.
+typedef struct Lambda {
+	size_t refs;
+	Expression args;
+	Node *body;
+	Scope *scope;
+	// the compiled body, made when the function is first called
+	Code *code;
+	// machine code, made once the function is hot
+	Jit *jit;
+	size_t calls;
+	// the result cache of memoized functions, see memo.h
+	Memo *memo;
+} Lambda;
+
 typedef struct Function {
 	bool isBuiltin;
 	union {
 	// if isBuiltin:
-		RunResult (*fn)(Scope*, const char*, size_t, const Node**);
-	// else:
 		struct {
-			Expression args;
-			Node *body;
-			Scope *scope;
+			RunResult (*fn)(Scope*, const char*, size_t, const Node**);
+			const char *name;
+			unsigned flags;
 		};
+	// else:
+		Lambda *lambda;
 	};
 } Function;
 
@@ -73,6 +125,14 @@ struct Node {
 		Number num;
 		Comment comment;
 		Function function;
+		Vector *vector;
+		F64Array *array;
+		Dict *dict;
+		Generator *generator;
+		Range range;
+		Channel *channel;
+		Future *future;
+		Coroutine *coroutine;
 	};
 };
 
@@ -101,3 +161,6 @@ ParseResult parse(const char *code);
 ProgramParseResult parseprogram(const char *code);
 void node_free(Node *node);
 Node *node_copy(const Node *node);
+
+Lambda *lambda_retain(Lambda*);
+void lambda_release(Lambda*);
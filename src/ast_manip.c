@@ -1,7 +1,15 @@
 #include <stdlib.h>
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 #include "./ast_manip.h"
+#include "./vector.h"
+#include "./f64array.h"
+#include "./dict.h"
+#include "./interpreter/internal.h"
+#include "./interpreter/builtins.h"
+#include "./interpreter/builtins/math.h"
+#include "./interpreter/builtins/stdio.h"
 
 #define malloc(n, type) (type*)malloc(n * sizeof(type))
 #define realloc(ptr, count, type) (type*)realloc(ptr, count * sizeof(type))
@@ -66,3 +74,602 @@ Node *array_to_list(const Node **nodes, size_t len) {
 	}
 	return res;
 }
+
+struct BoundNames {
+	// set when a name could come from anywhere
+	bool all;
+
+	size_t len;
+	size_t cap;
+	char **names;
+};
+
+static void bound_add(BoundNames *bound, const Node *node) {
+	if (node->type != AST_VAR) {
+		return;
+	}
+
+	for (size_t i = 0; i < bound->len; i++) {
+		if (strcmp(bound->names[i], node->var.name) == 0) {
+			return;
+		}
+	}
+
+	if (bound->len == bound->cap) {
+		bound->cap = bound->cap * 2 + 8;
+		bound->names = realloc(bound->names, bound->cap, char*);
+	}
+	size_t size = strlen(node->var.name) + 1;
+	char *name = malloc(size, char);
+	memcpy(name, node->var.name, size);
+	bound->names[bound->len++] = name;
+}
+
+static void bound_add_all(BoundNames *bound, const Node *node) {
+	if (node->type != AST_EXPR) {
+		return;
+	}
+	for (size_t i = 0; i < node->expr.len; i++) {
+		bound_add(bound, node->expr.nodes[i]);
+	}
+}
+
+static bool isCall(const Node *node, const char *name) {
+	return (
+		node->type == AST_EXPR &&
+		node->expr.len > 0 &&
+		node->expr.nodes[0]->type == AST_VAR &&
+		strcmp(node->expr.nodes[0]->var.name, name) == 0
+	);
+}
+
+static void bound_scan(BoundNames *bound, const Node *node, bool quoted) {
+	switch (node->type) {
+	case AST_QUOTED:
+		bound_scan(bound, node->quoted.node, true);
+		return;
+
+	case AST_VAR:
+		if (quoted) {
+			bound_add(bound, node);
+		}
+		return;
+
+	case AST_EXPR:
+		break;
+
+	default:
+		return;
+	}
+
+	Node **nodes = node->expr.nodes;
+	const size_t len = node->expr.len;
+	if ((isCall(node, "set") || isCall(node, "set-memo")) && len >= 2) {
+		bound_add(bound, nodes[1]);
+		if (len >= 4) {
+			bound_add_all(bound, nodes[2]);
+		}
+	} else if (isCall(node, "fun") && len >= 2) {
+		bound_add_all(bound, nodes[1]);
+	} else if ((isCall(node, "times") || isCall(node, "for") || isCall(node, "each")) && len >= 2) {
+		bound_add(bound, nodes[1]);
+	} else if (isCall(node, "let") && len >= 2 && nodes[1]->type == AST_EXPR) {
+		for (size_t i = 0; i < nodes[1]->expr.len; i++) {
+			const Node *pair = nodes[1]->expr.nodes[i];
+			if (pair->type == AST_EXPR && pair->expr.len > 0) {
+				bound_add(bound, pair->expr.nodes[0]);
+			} else {
+				bound->all = true;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		bound_scan(bound, nodes[i], quoted);
+	}
+}
+
+bool captures_scope(const Node *node) {
+	if (node->type != AST_EXPR) {
+		return false;
+	} else if (
+		isCall(node, "fun") ||
+		isCall(node, "set-memo") ||
+		(isCall(node, "set") && node->expr.len >= 4) ||
+		isCall(node, "eval") ||
+		isCall(node, "load")
+	) {
+		return true;
+	}
+
+	for (size_t i = 0; i < node->expr.len; i++) {
+		if (captures_scope(node->expr.nodes[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+BoundNames *bound_names(Node *const *nodes, size_t len) {
+	BoundNames *bound = malloc(1, BoundNames);
+	*bound = (BoundNames){ .all = false };
+	for (size_t i = 0; i < len; i++) {
+		bound_scan(bound, nodes[i], false);
+	}
+	return bound;
+}
+
+void bound_names_free(BoundNames *bound) {
+	if (bound == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < bound->len; i++) {
+		free(bound->names[i]);
+	}
+	free(bound->names);
+	free(bound);
+}
+
+// Returns the builtin that node names, if it can be relied on.
+static const Builtin *known_builtin(Scope *scope, const BoundNames *bound, const Node *node) {
+	if (node->type != AST_VAR || bound->all || *bindingCount(node->var.name) != 0) {
+		return NULL;
+	}
+	for (size_t i = 0; i < bound->len; i++) {
+		if (strcmp(bound->names[i], node->var.name) == 0) {
+			return NULL;
+		}
+	}
+	return getBuiltin(scope_get_root(scope)->builtins, node->var.name);
+}
+
+static bool isLiteral(const Node *node) {
+	return node->type == AST_NUM || node->type == AST_STR;
+}
+
+// Frees expr, except for the item at i, which is returned.
+static Node *take(Node *expr, size_t i) {
+	Node *res = expr->expr.nodes[i];
+	expr->expr.nodes[i] = NULL;
+	node_free(expr);
+	return res;
+}
+
+// Calls builtin with literal arguments, returns NULL if that fails or the
+// result isn't a literal.
+static Node *evaluate(Scope *scope, const Builtin *builtin, Node **args, size_t nargs) {
+	const Function *fn = &builtin->function;
+	RunResult rr = callBuiltin(scope, fn, nargs, (const Node**)args);
+	if (rr.err != NULL) {
+		free(rr.err);
+		return NULL;
+	} else if (rr.node == NULL || !isLiteral(rr.node) || (rr.node->type == AST_NUM && !isfinite(rr.node->num.val))) {
+		// inf and nan can't be written back as source, see --dump-optimized
+		node_free(rr.node);
+		return NULL;
+	}
+	return rr.node;
+}
+
+static Node *optimize_call(Scope*, const BoundNames*, const Builtin*, Node*);
+
+// Replaces cond by (do body...) of its clause at i, if do can be relied on.
+static Node *take_clause(Scope *scope, const BoundNames *bound, Node *cond, size_t i) {
+	Node *head = makeVar("do");
+	const Builtin *builtin = known_builtin(scope, bound, head);
+	if (builtin == NULL || builtin->function.fn != builtin_do) {
+		node_free(head);
+		return cond;
+	}
+
+	Node *clause = take(cond, i);
+	node_free(clause->expr.nodes[0]);
+	clause->expr.nodes[0] = head;
+	return optimize_call(scope, bound, builtin, clause);
+}
+
+static bool isElse(const Node *node) {
+	return (
+		node->type == AST_QUOTED &&
+		node->quoted.node->type == AST_VAR &&
+		strcmp(node->quoted.node->var.name, "else") == 0
+	);
+}
+
+// Drops the clauses that are never taken. When the first clause left is
+// always taken, or only else clauses are left, the cond is replaced by its
+// body.
+static Node *optimize_cond(Scope *scope, const BoundNames *bound, Node *node) {
+	Node **nodes = node->expr.nodes;
+	for (size_t i = 1; i < node->expr.len; i++) {
+		if (nodes[i]->type != AST_EXPR || nodes[i]->expr.len == 0) {
+			return node;
+		}
+	}
+
+	size_t len = 1;
+	bool taken = false;
+	for (size_t i = 1; i < node->expr.len; i++) {
+		const Node *cond = nodes[i]->expr.nodes[0];
+		if (taken || (cond->type == AST_NUM && !cond->num.val)) {
+			node_free(nodes[i]);
+			continue;
+		}
+		taken = cond->type == AST_NUM;
+		nodes[len++] = nodes[i];
+	}
+	node->expr.len = len;
+
+	// clauses with quoted conditions are only taken if they're else clauses
+	// and no other clause is
+	size_t otherwise = 0;
+	for (size_t i = 1; i < len; i++) {
+		const Node *cond = nodes[i]->expr.nodes[0];
+		if (cond->type == AST_NUM) {
+			return take_clause(scope, bound, node, i);
+		} else if (cond->type != AST_QUOTED) {
+			return node;
+		} else if (otherwise == 0 && isElse(cond)) {
+			otherwise = i;
+		}
+	}
+	return otherwise != 0 ? take_clause(scope, bound, node, otherwise) : node;
+}
+
+static Node *optimize_call(Scope *scope, const BoundNames *bound, const Builtin *builtin, Node *node) {
+	Node **nodes = node->expr.nodes;
+	const size_t nargs = node->expr.len - 1;
+	const BuiltinFn fn = builtin->function.fn;
+
+	if (fn == builtin_if) {
+		if (nargs >= 2 && nargs <= 3 && nodes[1]->type == AST_NUM) {
+			if (nodes[1]->num.val) {
+				return take(node, 2);
+			} else if (nargs == 3) {
+				return take(node, 3);
+			}
+		}
+		return node;
+	}
+
+	if (fn == builtin_cond) {
+		return optimize_cond(scope, bound, node);
+	}
+
+	if (fn == builtin_do) {
+		// splice in nested do blocks
+		for (size_t i = 1; i < node->expr.len; i++) {
+			Node *inner = node->expr.nodes[i];
+			if (!isCall(inner, builtin->name) || inner->expr.len < 2) {
+				continue;
+			}
+			size_t n = inner->expr.len - 1;
+			node->expr.nodes = realloc(node->expr.nodes, (node->expr.len + n - 1), Node*);
+			memmove(
+				node->expr.nodes + i + n,
+				node->expr.nodes + i + 1,
+				(node->expr.len - i - 1) * sizeof(Node*)
+			);
+			memcpy(node->expr.nodes + i, inner->expr.nodes + 1, n * sizeof(Node*));
+			node->expr.len += n - 1;
+			inner->expr.len = 1;
+			node_free(inner);
+			i += n - 1;
+		}
+
+		size_t len = 1;
+		for (size_t i = 1; i < node->expr.len; i++) {
+			if (i != node->expr.len - 1 && isLiteral(node->expr.nodes[i])) {
+				node_free(node->expr.nodes[i]);
+				continue;
+			}
+			node->expr.nodes[len++] = node->expr.nodes[i];
+		}
+		node->expr.len = len;
+		return len == 2 ? take(node, 1) : node;
+	}
+
+	if (!(builtin->function.flags & BUILTIN_PURE)) {
+		return node;
+	}
+
+	size_t literals = 0;
+	while (literals < nargs && isLiteral(nodes[literals + 1])) {
+		literals++;
+	}
+
+	if (literals == nargs) {
+		Node *res = evaluate(scope, builtin, nodes + 1, nargs);
+		if (res != NULL) {
+			node_free(node);
+			return res;
+		}
+	} else if (fn == builtin_arith && literals >= 2) {
+		// arithmetic folds from the left, so leading literals can be combined
+		Node *res = evaluate(scope, builtin, nodes + 1, literals);
+		if (res != NULL) {
+			for (size_t i = 1; i <= literals; i++) {
+				node_free(nodes[i]);
+			}
+			nodes[1] = res;
+			memmove(nodes + 2, nodes + literals + 1, (nargs - literals) * sizeof(Node*));
+			node->expr.len -= literals - 1;
+		}
+	}
+	return node;
+}
+
+static void optimize_items(Scope *scope, const BoundNames *bound, Node *expr, size_t from) {
+	for (size_t i = from; i < expr->expr.len; i++) {
+		expr->expr.nodes[i] = ast_optimize(scope, bound, expr->expr.nodes[i]);
+	}
+}
+
+Node *ast_optimize(Scope *scope, const BoundNames *bound, Node *node) {
+	if (node->type != AST_EXPR || node->expr.len == 0) {
+		return node;
+	}
+
+	Node *head = node->expr.nodes[0];
+	const Builtin *builtin = known_builtin(scope, bound, head);
+	if (builtin == NULL) {
+		// a function that's called with the values of its arguments, unless
+		// it's a builtin that might be shadowed
+		if (head->type == AST_EXPR ||
+			(head->type == AST_VAR && getBuiltin(scope_get_root(scope)->builtins, head->var.name) == NULL)) {
+			optimize_items(scope, bound, node, 0);
+		}
+		return node;
+	}
+
+	// the forms with arguments that aren't all expressions
+	const BuiltinFn fn = builtin->function.fn;
+	const size_t len = node->expr.len;
+	if (fn == builtin_fun) {
+		optimize_items(scope, bound, node, 2);
+	} else if (fn == builtin_set) {
+		optimize_items(scope, bound, node, len == 3 ? 2 : 3);
+	} else if (fn == builtin_times || fn == builtin_for || fn == builtin_each) {
+		optimize_items(scope, bound, node, 3);
+	} else if (fn == builtin_let) {
+		if (len >= 2 && node->expr.nodes[1]->type == AST_EXPR) {
+			Node *pairs = node->expr.nodes[1];
+			for (size_t i = 0; i < pairs->expr.len; i++) {
+				if (pairs->expr.nodes[i]->type == AST_EXPR) {
+					optimize_items(scope, bound, pairs->expr.nodes[i], 1);
+				}
+			}
+		}
+		optimize_items(scope, bound, node, 2);
+	} else if (fn == builtin_cond) {
+		for (size_t i = 1; i < len; i++) {
+			if (node->expr.nodes[i]->type == AST_EXPR) {
+				optimize_items(scope, bound, node->expr.nodes[i], 0);
+			}
+		}
+	} else if (builtin->function.flags & (BUILTIN_STRICT | BUILTIN_PURE) ||
+		fn == builtin_do || fn == builtin_if || fn == builtin_while || fn == builtin_print || fn == builtin_print_to) {
+		optimize_items(scope, bound, node, 1);
+	} else {
+		// the unevaluated arguments may matter, like for assert
+		return node;
+	}
+
+	return optimize_call(scope, bound, builtin, node);
+}
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+static uint64_t hash_mix(uint64_t h, uint64_t v) {
+	// splitmix64 finalizer over the combined value
+	h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static uint64_t hash_bytes(uint64_t h, const char *str, size_t len) {
+	// FNV-1a
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)str[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t hash_double(double val) {
+	if (val == 0) {
+		val = 0; // -0 == 0
+	}
+	uint64_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	return bits;
+}
+
+uint64_t node_hash(const Node *node) {
+	if (node == NULL) {
+		return hash_mix(HASH_SEED, 0);
+	}
+
+	uint64_t h = hash_mix(HASH_SEED, node->type + 1);
+
+	switch (node->type) {
+	case AST_QUOTED:
+		return hash_mix(h, node_hash(node->quoted.node));
+
+	case AST_EXPR:
+		for (size_t i = 0; i < node->expr.len; i++) {
+			h = hash_mix(h, node_hash(node->expr.nodes[i]));
+		}
+		return h;
+
+	case AST_VAR:
+		return hash_bytes(h, node->var.name, strlen(node->var.name));
+
+	case AST_STR:
+		return hash_bytes(h, node->str.str, strlen(node->str.str));
+
+	case AST_NUM:
+		return hash_mix(h, hash_double(node->num.val));
+
+	case AST_COMMENT:
+		return h;
+
+	case AST_FUN:
+		if (node->function.isBuiltin) {
+			return hash_mix(h, (uintptr_t)node->function.fn);
+		}
+		return hash_mix(h, (uintptr_t)node->function.lambda);
+
+	case AST_VECTOR:
+		for (size_t i = 0; i < vector_length(node->vector); i++) {
+			h = hash_mix(h, node_hash(vector_get(node->vector, i)));
+		}
+		return h;
+
+	case AST_ARRAY:
+		for (size_t i = 0; i < node->array->len; i++) {
+			h = hash_mix(h, hash_double(node->array->data[i]));
+		}
+		return h;
+
+	case AST_DICT: {
+		// order independent, as two equal dicts may iterate differently
+		uint64_t acc = 0;
+		DictIter it;
+		dict_iter_init(&it, node->dict);
+		const Node *key, *val;
+		while (dict_iter_next(&it, &key, &val)) {
+			acc += hash_mix(node_hash(key), node_hash(val));
+		}
+		return hash_mix(h, acc);
+	}
+
+	case AST_GENERATOR:
+		return hash_mix(h, (uintptr_t)node->generator);
+
+	case AST_CHANNEL:
+		return hash_mix(h, (uintptr_t)node->channel);
+
+	case AST_FUTURE:
+		return hash_mix(h, (uintptr_t)node->future);
+
+	case AST_COROUTINE:
+		return hash_mix(h, (uintptr_t)node->coroutine);
+
+	case AST_RANGE:
+		h = hash_mix(h, hash_double(node->range.from));
+		h = hash_mix(h, hash_double(node->range.step));
+		return hash_mix(h, node->range.len);
+	}
+
+	return h;
+}
+
+bool node_equal(const Node *a, const Node *b) {
+	if (a == b) {
+		return true;
+	} else if (a == NULL || b == NULL || a->type != b->type) {
+		return false;
+	}
+
+	switch (a->type) {
+	case AST_QUOTED:
+		return node_equal(a->quoted.node, b->quoted.node);
+
+	case AST_EXPR:
+		if (a->expr.len != b->expr.len) {
+			return false;
+		}
+		for (size_t i = 0; i < a->expr.len; i++) {
+			if (!node_equal(a->expr.nodes[i], b->expr.nodes[i])) {
+				return false;
+			}
+		}
+		return true;
+
+	case AST_VAR:
+		return strcmp(a->var.name, b->var.name) == 0;
+
+	case AST_STR:
+		return strcmp(a->str.str, b->str.str) == 0;
+
+	case AST_NUM:
+		return a->num.val == b->num.val;
+
+	case AST_COMMENT:
+		return strcmp(a->comment.content, b->comment.content) == 0;
+
+	case AST_FUN: {
+		// functions are equal when they're copies of the same function
+		const Function *fa = &a->function, *fb = &b->function;
+		if (fa->isBuiltin || fb->isBuiltin) {
+			return fa->isBuiltin == fb->isBuiltin && fa->fn == fb->fn && fa->name == fb->name;
+		}
+		return fa->lambda == fb->lambda;
+	}
+
+	case AST_VECTOR: {
+		size_t len = vector_length(a->vector);
+		if (len != vector_length(b->vector)) {
+			return false;
+		}
+		for (size_t i = 0; i < len; i++) {
+			if (!node_equal(vector_get(a->vector, i), vector_get(b->vector, i))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	case AST_ARRAY:
+		if (a->array->len != b->array->len) {
+			return false;
+		}
+		for (size_t i = 0; i < a->array->len; i++) {
+			if (a->array->data[i] != b->array->data[i]) {
+				return false;
+			}
+		}
+		return true;
+
+	case AST_DICT: {
+		if (dict_size(a->dict) != dict_size(b->dict)) {
+			return false;
+		}
+		DictIter it;
+		dict_iter_init(&it, a->dict);
+		const Node *key, *val, *other;
+		while (dict_iter_next(&it, &key, &val)) {
+			if (!dict_get(b->dict, key, &other) || !node_equal(val, other)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	case AST_GENERATOR:
+		return a->generator == b->generator;
+
+	case AST_CHANNEL:
+		return a->channel == b->channel;
+
+	case AST_FUTURE:
+		return a->future == b->future;
+
+	case AST_COROUTINE:
+		return a->coroutine == b->coroutine;
+
+	case AST_RANGE:
+		return (
+			a->range.from == b->range.from &&
+			a->range.step == b->range.step &&
+			a->range.len == b->range.len
+		);
+	}
+
+	return false;
+}
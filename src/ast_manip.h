@@ -9,3 +9,35 @@ bool expr_append(Node *expr, const Node *node);
 bool expr_remove(Node *expr, size_t at);
 
 Node *array_to_list(const Node**, size_t);
+
+// Names that a program might bind as variables: the names set by set,
+// set-memo, let and times, parameters, and every symbol in quoted code, which can be
+// evaluated or used as a name by let.
+typedef struct BoundNames BoundNames;
+
+BoundNames *bound_names(Node *const *nodes, size_t len);
+void bound_names_free(BoundNames*);
+
+// Returns whether evaluating node could leave something that refers to the
+// scope it's evaluated in after it's done: functions made by fun and set
+// remember their scope, and code run by eval or load could make them. Values
+// are copied out of scopes, so they never do.
+bool captures_scope(const Node *node);
+
+// Rewrites node, which is consumed, before it's evaluated in scope:
+//
+//  - calls to pure builtins with literal arguments are replaced by their
+//    value, and leading literal operands of arithmetic are combined;
+//  - if and cond with literal conditions are replaced by the branch that's
+//    taken;
+//  - nested do blocks are flattened and literals in them that aren't the
+//    result are dropped.
+//
+// Only builtins that have never been bound as a variable, and that aren't in
+// bound, are rewritten. Calls that fail are left to fail at run time.
+Node *ast_optimize(Scope*, const BoundNames *bound, Node *node);
+
+// Structural hashing and equality of values. Numbers compare by value,
+// strings by content and quoted symbols by name, aggregates item by item.
+uint64_t node_hash(const Node*);
+bool node_equal(const Node*, const Node*);
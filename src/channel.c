@@ -0,0 +1,187 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "channel.h"
+#include "util.h"
+#include "watchers.h"
+
+// A bounded queue after Dmitry Vyukov's: every cell has a sequence number
+// that says whether it's ready for the send or the receive at some position.
+typedef struct Cell {
+	atomic_size_t seq;
+	Node *val;
+	char *err;
+} Cell;
+
+struct Channel {
+	atomic_size_t refs;
+	size_t cap;
+	Cell *cells;
+
+	// the positions of the next send and receive
+	atomic_size_t head;
+	atomic_size_t tail;
+
+	// the number of threads blocked on changed, and the event loops that
+	// wait for it
+	atomic_size_t waiting;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	Watchers watchers;
+};
+
+Channel *chan_make(size_t cap) {
+	// a single cell can't tell a full queue from an empty one
+	if (cap < 2) {
+		cap = 2;
+	}
+
+	Channel *ch = malloc(1, sizeof(Channel));
+	atomic_init(&ch->refs, 1);
+	ch->cap = cap;
+	ch->cells = malloc(cap, sizeof(Cell));
+	for (size_t i = 0; i < cap; i++) {
+		atomic_init(&ch->cells[i].seq, i);
+		ch->cells[i].val = NULL;
+		ch->cells[i].err = NULL;
+	}
+	atomic_init(&ch->head, 0);
+	atomic_init(&ch->tail, 0);
+	atomic_init(&ch->waiting, 0);
+	pthread_mutex_init(&ch->lock, NULL);
+	pthread_cond_init(&ch->changed, NULL);
+	watchers_init(&ch->watchers, &ch->lock);
+	return ch;
+}
+
+Channel *chan_retain(Channel *ch) {
+	atomic_fetch_add_explicit(&ch->refs, 1, memory_order_relaxed);
+	return ch;
+}
+
+void chan_release(Channel *ch) {
+	if (ch == NULL || atomic_fetch_sub_explicit(&ch->refs, 1, memory_order_acq_rel) > 1) {
+		return;
+	}
+
+	// the messages that were never received
+	const size_t head = atomic_load(&ch->head);
+	for (size_t pos = atomic_load(&ch->tail); pos != head; pos++) {
+		Cell *cell = &ch->cells[pos % ch->cap];
+		node_free(cell->val);
+		free(cell->err);
+	}
+
+	pthread_mutex_destroy(&ch->lock);
+	pthread_cond_destroy(&ch->changed);
+	watchers_free(&ch->watchers);
+	free(ch->cells);
+	free(ch);
+}
+
+static bool try_send(Channel *ch, Node *val, char *err) {
+	size_t pos = atomic_load_explicit(&ch->head, memory_order_relaxed);
+	for (;;) {
+		Cell *cell = &ch->cells[pos % ch->cap];
+		const size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff < 0) {
+			return false; // the receive of the previous round hasn't happened
+		} else if (diff > 0) {
+			pos = atomic_load_explicit(&ch->head, memory_order_relaxed);
+		} else if (atomic_compare_exchange_weak_explicit(
+			&ch->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed
+		)) {
+			cell->val = val;
+			cell->err = err;
+			atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+			return true;
+		}
+	}
+}
+
+static bool try_recv(Channel *ch, Node **val, char **err) {
+	size_t pos = atomic_load_explicit(&ch->tail, memory_order_relaxed);
+	for (;;) {
+		Cell *cell = &ch->cells[pos % ch->cap];
+		const size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff < 0) {
+			return false; // nothing was sent at pos yet
+		} else if (diff > 0) {
+			pos = atomic_load_explicit(&ch->tail, memory_order_relaxed);
+		} else if (atomic_compare_exchange_weak_explicit(
+			&ch->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed
+		)) {
+			*val = cell->val;
+			*err = cell->err;
+			atomic_store_explicit(&cell->seq, pos + ch->cap, memory_order_release);
+			return true;
+		}
+	}
+}
+
+// Wakes the blocked threads and the watching event loops after a send or
+// receive. The fence pairs with the increment of waiting or of the watchers,
+// so either the waiter sees the change when it tries again, or it's seen here.
+static void wake(Channel *ch) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (
+		atomic_load_explicit(&ch->waiting, memory_order_relaxed) > 0 ||
+		atomic_load_explicit(&ch->watchers.len, memory_order_relaxed) > 0
+	) {
+		pthread_mutex_lock(&ch->lock);
+		pthread_cond_broadcast(&ch->changed);
+		watchers_notify(&ch->watchers);
+		pthread_mutex_unlock(&ch->lock);
+	}
+}
+
+bool chan_try_send(Channel *ch, Node *val, char *err) {
+	if (!try_send(ch, val, err)) {
+		return false;
+	}
+	wake(ch);
+	return true;
+}
+
+bool chan_try_recv(Channel *ch, Node **val, char **err) {
+	if (!try_recv(ch, val, err)) {
+		return false;
+	}
+	wake(ch);
+	return true;
+}
+
+Watchers *chan_watchers(Channel *ch) {
+	return &ch->watchers;
+}
+
+void chan_send(Channel *ch, Node *val, char *err) {
+	if (!try_send(ch, val, err)) {
+		pthread_mutex_lock(&ch->lock);
+		atomic_fetch_add(&ch->waiting, 1);
+		while (!try_send(ch, val, err)) {
+			pthread_cond_wait(&ch->changed, &ch->lock);
+		}
+		atomic_fetch_sub(&ch->waiting, 1);
+		pthread_mutex_unlock(&ch->lock);
+	}
+	wake(ch);
+}
+
+void chan_recv(Channel *ch, Node **val, char **err) {
+	if (!try_recv(ch, val, err)) {
+		pthread_mutex_lock(&ch->lock);
+		atomic_fetch_add(&ch->waiting, 1);
+		while (!try_recv(ch, val, err)) {
+			pthread_cond_wait(&ch->changed, &ch->lock);
+		}
+		atomic_fetch_sub(&ch->waiting, 1);
+		pthread_mutex_unlock(&ch->lock);
+	}
+	wake(ch);
+}
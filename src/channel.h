@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ast.h"
+#include "watchers.h"
+
+// Bounded multi-producer multi-consumer queue of values, which is how
+// isolates talk to each other. Sending and receiving are lock free, only a
+// sender that finds the channel full or a receiver that finds it empty
+// blocks, on a condition variable or in the event loop of its coroutines.
+//
+// The values in a channel belong to no isolate: senders hand over copies that
+// share nothing with their heap, see isolate.h. Channels themselves are the
+// only values shared between threads, so their reference count is atomic.
+//
+// A message is a value, NULL for nil, or an error. Errors are what a spawned
+// function that failed sends.
+
+Channel *chan_make(size_t cap);
+Channel *chan_retain(Channel*);
+void chan_release(Channel*);
+
+// Blocks while the channel is full. Takes ownership of val and err.
+void chan_send(Channel*, Node *val, char *err);
+// Blocks while the channel is empty. The value or error is the caller's.
+void chan_recv(Channel*, Node **val, char **err);
+
+// Like chan_send and chan_recv, but return false instead of blocking, for
+// threads that wait for the channel through the event loop of their
+// coroutines. Those are watchers of the channel in the meantime.
+bool chan_try_send(Channel*, Node *val, char *err);
+bool chan_try_recv(Channel*, Node **val, char **err);
+Watchers *chan_watchers(Channel*);
@@ -0,0 +1,130 @@
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "deque.h"
+#include "util.h"
+
+// A circular array, which is replaced by one twice as big when it fills up.
+typedef struct Buffer {
+	size_t cap;
+	_Atomic(void*) *items;
+} Buffer;
+
+struct Deque {
+	// top only ever grows, the items are at [top, bottom)
+	_Atomic int64_t top;
+	_Atomic int64_t bottom;
+	_Atomic(Buffer*) buf;
+
+	// buffers that were replaced, which thieves may still be reading
+	Buffer **old;
+	size_t nold;
+};
+
+static Buffer *buffer_make(size_t cap) {
+	Buffer *buf = malloc(1, sizeof(Buffer));
+	buf->cap = cap;
+	buf->items = malloc(cap, sizeof(_Atomic(void*)));
+	return buf;
+}
+
+static void *get(Buffer *buf, int64_t i) {
+	return atomic_load_explicit(&buf->items[(size_t)i % buf->cap], memory_order_relaxed);
+}
+
+static void put(Buffer *buf, int64_t i, void *item) {
+	atomic_store_explicit(&buf->items[(size_t)i % buf->cap], item, memory_order_relaxed);
+}
+
+Deque *deque_make(void) {
+	Deque *d = malloc(1, sizeof(Deque));
+	atomic_init(&d->top, 0);
+	atomic_init(&d->bottom, 0);
+	atomic_init(&d->buf, buffer_make(64));
+	d->old = NULL;
+	d->nold = 0;
+	return d;
+}
+
+void deque_free(Deque *d) {
+	Buffer *buf = atomic_load(&d->buf);
+	free(buf->items);
+	free(buf);
+	for (size_t i = 0; i < d->nold; i++) {
+		free(d->old[i]->items);
+		free(d->old[i]);
+	}
+	free(d->old);
+	free(d);
+}
+
+static Buffer *grow(Deque *d, Buffer *buf, int64_t top, int64_t bottom) {
+	Buffer *next = buffer_make(buf->cap * 2);
+	for (int64_t i = top; i < bottom; i++) {
+		put(next, i, get(buf, i));
+	}
+
+	d->old = realloc(d->old, (d->nold + 1), sizeof(Buffer*));
+	d->old[d->nold++] = buf;
+	atomic_store_explicit(&d->buf, next, memory_order_release);
+	return next;
+}
+
+void deque_push(Deque *d, void *item) {
+	const int64_t bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	const int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+	Buffer *buf = atomic_load_explicit(&d->buf, memory_order_relaxed);
+	if (bottom - top > (int64_t)buf->cap - 1) {
+		buf = grow(d, buf, top, bottom);
+	}
+
+	put(buf, bottom, item);
+	// a release store instead of a fence and a relaxed one, which makes the
+	// item visible to thieves the same way, and is what thread sanitizers
+	// understand
+	atomic_store_explicit(&d->bottom, bottom + 1, memory_order_release);
+}
+
+void *deque_take(Deque *d) {
+	const int64_t bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	Buffer *buf = atomic_load_explicit(&d->buf, memory_order_relaxed);
+	atomic_store_explicit(&d->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+	if (top > bottom) {
+		// it was empty
+		atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	void *item = get(buf, bottom);
+	if (top == bottom) {
+		// the last item, which a thief may be after too
+		if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+			item = NULL;
+		}
+		atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+	}
+	return item;
+}
+
+void *deque_steal(Deque *d) {
+	int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	const int64_t bottom = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	if (top >= bottom) {
+		return NULL;
+	}
+
+	Buffer *buf = atomic_load_explicit(&d->buf, memory_order_acquire);
+	void *item = get(buf, top);
+	if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+		return NULL;
+	}
+	return item;
+}
+
+bool deque_busy(Deque *d) {
+	return atomic_load(&d->top) < atomic_load(&d->bottom);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+// A work-stealing deque after Chase and Lev, in the C11 formulation of Lê et
+// al. The thread that owns the deque pushes and takes items at the bottom,
+// other threads steal them from the top. Only a steal of the last item
+// contends with the owner, everything else is a plain store or a single CAS.
+//
+// The items are pointers the deque doesn't look at, NULL can't be pushed.
+
+typedef struct Deque Deque;
+
+Deque *deque_make(void);
+void deque_free(Deque*);
+
+// Only for the owner.
+void deque_push(Deque*, void *item);
+void *deque_take(Deque*);
+
+// For any thread. Returns NULL if the deque is empty, or if another thread
+// got the top item first.
+void *deque_steal(Deque*);
+
+// Whether the deque might have items, for threads deciding whether to sleep.
+bool deque_busy(Deque*);
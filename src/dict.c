@@ -0,0 +1,621 @@
+#include <assert.h>
+#include <string.h>
+#include "dict.h"
+#include "ast_manip.h"
+#include "util.h"
+
+#define BITS 5
+#define MASK ((1 << BITS) - 1)
+#define MAX_SHIFT 60 // deeper than this the hash bits run out
+
+// immutable dicts: a CHAMP style hash array mapped trie. Every node stores
+// its entries first and its subnodes after them, datamap and nodemap tell
+// which hash fragments they belong to.
+
+typedef struct Entry {
+	size_t refs;
+	uint64_t hash;
+	Node *key;
+	Node *val;
+} Entry;
+
+typedef struct HamtNode {
+	size_t refs;
+	bool collision; // all slots are entries with the same hash
+	uint32_t datamap;
+	uint32_t nodemap;
+	size_t len;
+	void *slots[];
+} HamtNode;
+
+// mutable dicts: an insertion ordered table. entries is dense, index maps
+// hash slots to positions in entries.
+
+#define INDEX_EMPTY ((size_t)-1)
+#define INDEX_DELETED ((size_t)-2)
+
+typedef struct TableEntry {
+	uint64_t hash;
+	Node *key; // NULL if the entry was removed
+	Node *val;
+} TableEntry;
+
+struct Dict {
+	size_t refs;
+	bool isMutable;
+	size_t size;
+
+	// if !isMutable
+	HamtNode *root;
+
+	// if isMutable
+	TableEntry *entries;
+	size_t nentries;
+	size_t entriescap;
+	size_t *index;
+	size_t indexcap;
+};
+
+static Entry *entry_make(uint64_t hash, Node *key, Node *val) {
+	Entry *res = malloc(1, sizeof(Entry));
+	assert(res);
+	res->refs = 1;
+	res->hash = hash;
+	res->key = key;
+	res->val = val;
+	return res;
+}
+
+static Entry *entry_retain(Entry *entry) {
+	entry->refs++;
+	return entry;
+}
+
+static void entry_release(Entry *entry) {
+	if (--entry->refs > 0) {
+		return;
+	}
+	node_free(entry->key);
+	node_free(entry->val);
+	free(entry);
+}
+
+static size_t popcount(uint32_t x) {
+	return __builtin_popcount(x);
+}
+
+static size_t ndata(const HamtNode *node) {
+	return node->collision ? node->len : popcount(node->datamap);
+}
+
+static HamtNode *hamt_alloc(size_t len) {
+	HamtNode *res = malloc(1, sizeof(HamtNode) + len * sizeof(void*));
+	assert(res);
+	res->refs = 1;
+	res->collision = false;
+	res->datamap = 0;
+	res->nodemap = 0;
+	res->len = len;
+	return res;
+}
+
+static HamtNode *hamt_retain(HamtNode *node) {
+	node->refs++;
+	return node;
+}
+
+static void hamt_release(HamtNode *node) {
+	if (node == NULL || --node->refs > 0) {
+		return;
+	}
+
+	size_t n = ndata(node);
+	for (size_t i = 0; i < node->len; i++) {
+		if (i < n) {
+			entry_release(node->slots[i]);
+		} else {
+			hamt_release(node->slots[i]);
+		}
+	}
+	free(node);
+}
+
+static uint32_t bitpos(uint64_t hash, unsigned shift) {
+	return (uint32_t)1 << ((hash >> shift) & MASK);
+}
+
+static size_t dataindex(const HamtNode *node, uint32_t bit) {
+	return popcount(node->datamap & (bit - 1));
+}
+
+static size_t nodeindex(const HamtNode *node, uint32_t bit) {
+	return popcount(node->datamap) + popcount(node->nodemap & (bit - 1));
+}
+
+static const Entry *hamt_get(const HamtNode *node, uint64_t hash, const Node *key) {
+	for (unsigned shift = 0; ; shift += BITS) {
+		if (node->collision) {
+			for (size_t i = 0; i < node->len; i++) {
+				const Entry *entry = node->slots[i];
+				if (node_equal(entry->key, key)) {
+					return entry;
+				}
+			}
+			return NULL;
+		}
+
+		uint32_t bit = bitpos(hash, shift);
+		if (node->datamap & bit) {
+			const Entry *entry = node->slots[dataindex(node, bit)];
+			if (entry->hash == hash && node_equal(entry->key, key)) {
+				return entry;
+			}
+			return NULL;
+		} else if (node->nodemap & bit) {
+			node = node->slots[nodeindex(node, bit)];
+		} else {
+			return NULL;
+		}
+	}
+}
+
+// Makes a node holding the two given entries, which don't fit in one slot on
+// the level above.
+static HamtNode *hamt_merge(Entry *a, Entry *b, unsigned shift) {
+	if (shift > MAX_SHIFT) {
+		HamtNode *res = hamt_alloc(2);
+		res->collision = true;
+		res->slots[0] = a;
+		res->slots[1] = b;
+		return res;
+	}
+
+	uint32_t bita = bitpos(a->hash, shift);
+	uint32_t bitb = bitpos(b->hash, shift);
+	if (bita == bitb) {
+		HamtNode *res = hamt_alloc(1);
+		res->nodemap = bita;
+		res->slots[0] = hamt_merge(a, b, shift + BITS);
+		return res;
+	}
+
+	HamtNode *res = hamt_alloc(2);
+	res->datamap = bita | bitb;
+	res->slots[0] = bita < bitb ? a : b;
+	res->slots[1] = bita < bitb ? b : a;
+	return res;
+}
+
+// Returns a copy of node with the slot at i replaced or inserted.
+static HamtNode *with_slot(const HamtNode *node, size_t i, void *slot, bool insert) {
+	HamtNode *res = hamt_alloc(node->len + insert);
+	res->collision = node->collision;
+	res->datamap = node->datamap;
+	res->nodemap = node->nodemap;
+
+	size_t n = ndata(node);
+	for (size_t j = 0, k = 0; j < res->len; j++) {
+		if (j == i) {
+			res->slots[j] = slot;
+			if (!insert) {
+				k++;
+			}
+			continue;
+		}
+
+		res->slots[j] = node->slots[k];
+		if (k < n) {
+			entry_retain(res->slots[j]);
+		} else {
+			hamt_retain(res->slots[j]);
+		}
+		k++;
+	}
+	return res;
+}
+
+// Returns a copy of node without the slot at i.
+static HamtNode *without_slot(const HamtNode *node, size_t i) {
+	HamtNode *res = hamt_alloc(node->len - 1);
+	res->collision = node->collision;
+	res->datamap = node->datamap;
+	res->nodemap = node->nodemap;
+
+	size_t n = ndata(node);
+	for (size_t j = 0, k = 0; k < node->len; k++) {
+		if (k == i) {
+			continue;
+		}
+		res->slots[j] = node->slots[k];
+		if (k < n) {
+			entry_retain(res->slots[j]);
+		} else {
+			hamt_retain(res->slots[j]);
+		}
+		j++;
+	}
+	return res;
+}
+
+static HamtNode *hamt_put(const HamtNode *node, unsigned shift, Entry *entry, bool *added) {
+	if (node->collision) {
+		for (size_t i = 0; i < node->len; i++) {
+			const Entry *other = node->slots[i];
+			if (node_equal(other->key, entry->key)) {
+				return with_slot(node, i, entry, false);
+			}
+		}
+		*added = true;
+		return with_slot(node, node->len, entry, true);
+	}
+
+	uint32_t bit = bitpos(entry->hash, shift);
+	if (node->datamap & bit) {
+		size_t i = dataindex(node, bit);
+		Entry *other = node->slots[i];
+		if (other->hash == entry->hash && node_equal(other->key, entry->key)) {
+			return with_slot(node, i, entry, false);
+		}
+
+		// push both entries down into a new subnode
+		*added = true;
+		HamtNode *sub = hamt_merge(entry_retain(other), entry, shift + BITS);
+		HamtNode *tmp = without_slot(node, i);
+		tmp->datamap &= ~bit;
+		tmp->nodemap |= bit;
+		HamtNode *res = with_slot(tmp, nodeindex(tmp, bit), sub, true);
+		hamt_release(tmp);
+		return res;
+	} else if (node->nodemap & bit) {
+		size_t i = nodeindex(node, bit);
+		HamtNode *sub = hamt_put(node->slots[i], shift + BITS, entry, added);
+		return with_slot(node, i, sub, false);
+	}
+
+	*added = true;
+	HamtNode *res = with_slot(node, dataindex(node, bit), entry, true);
+	res->datamap |= bit;
+	return res;
+}
+
+// If node only holds a single entry, return it.
+static Entry *single_entry(const HamtNode *node) {
+	if (node->collision) {
+		return node->len == 1 ? node->slots[0] : NULL;
+	} else if (node->nodemap == 0 && popcount(node->datamap) == 1) {
+		return node->slots[0];
+	}
+	return NULL;
+}
+
+// Returns NULL when the key isn't found.
+static HamtNode *hamt_remove(const HamtNode *node, unsigned shift, uint64_t hash, const Node *key) {
+	if (node->collision) {
+		for (size_t i = 0; i < node->len; i++) {
+			const Entry *entry = node->slots[i];
+			if (node_equal(entry->key, key)) {
+				return without_slot(node, i);
+			}
+		}
+		return NULL;
+	}
+
+	uint32_t bit = bitpos(hash, shift);
+	if (node->datamap & bit) {
+		size_t i = dataindex(node, bit);
+		const Entry *entry = node->slots[i];
+		if (entry->hash != hash || !node_equal(entry->key, key)) {
+			return NULL;
+		}
+		HamtNode *res = without_slot(node, i);
+		res->datamap &= ~bit;
+		return res;
+	} else if (node->nodemap & bit) {
+		size_t i = nodeindex(node, bit);
+		HamtNode *sub = hamt_remove(node->slots[i], shift + BITS, hash, key);
+		if (sub == NULL) {
+			return NULL;
+		}
+
+		Entry *single = single_entry(sub);
+		if (single == NULL) {
+			return with_slot(node, i, sub, false);
+		}
+
+		// inline the last entry of the subnode into this node
+		entry_retain(single);
+		hamt_release(sub);
+		HamtNode *tmp = without_slot(node, i);
+		tmp->nodemap &= ~bit;
+		HamtNode *res = with_slot(tmp, dataindex(tmp, bit), single, true);
+		res->datamap |= bit;
+		hamt_release(tmp);
+		return res;
+	}
+
+	return NULL;
+}
+
+// mutable tables
+
+static void table_reindex(Dict *dict, size_t indexcap) {
+	// compact the entries while we're at it
+	size_t j = 0;
+	for (size_t i = 0; i < dict->nentries; i++) {
+		if (dict->entries[i].key != NULL) {
+			dict->entries[j++] = dict->entries[i];
+		}
+	}
+	dict->nentries = j;
+
+	free(dict->index);
+	dict->indexcap = indexcap;
+	dict->index = malloc(indexcap, sizeof(size_t));
+	assert(dict->index);
+	for (size_t i = 0; i < indexcap; i++) {
+		dict->index[i] = INDEX_EMPTY;
+	}
+
+	for (size_t i = 0; i < dict->nentries; i++) {
+		size_t slot = dict->entries[i].hash & (indexcap - 1);
+		while (dict->index[slot] != INDEX_EMPTY) {
+			slot = (slot + 1) & (indexcap - 1);
+		}
+		dict->index[slot] = i;
+	}
+}
+
+// Finds the index slot of key, or returns INDEX_EMPTY.
+static size_t table_find(const Dict *dict, uint64_t hash, const Node *key) {
+	size_t slot = hash & (dict->indexcap - 1);
+	while (dict->index[slot] != INDEX_EMPTY) {
+		size_t i = dict->index[slot];
+		if (
+			i != INDEX_DELETED &&
+			dict->entries[i].hash == hash &&
+			node_equal(dict->entries[i].key, key)
+		) {
+			return slot;
+		}
+		slot = (slot + 1) & (dict->indexcap - 1);
+	}
+	return INDEX_EMPTY;
+}
+
+static void table_insert(Dict *dict, uint64_t hash, Node *key, Node *val) {
+	size_t slot = table_find(dict, hash, key);
+	if (slot != INDEX_EMPTY) {
+		TableEntry *entry = &dict->entries[dict->index[slot]];
+		node_free(entry->key);
+		node_free(entry->val);
+		entry->key = key;
+		entry->val = val;
+		return;
+	}
+
+	// keep the index at most 2/3 full, counting removed entries as well
+	if ((dict->nentries + 1) * 3 > dict->indexcap * 2) {
+		size_t cap = dict->indexcap;
+		while ((dict->size + 1) * 3 > cap) {
+			cap *= 2;
+		}
+		table_reindex(dict, cap);
+	}
+	if (dict->nentries == dict->entriescap) {
+		dict->entriescap *= 2;
+		dict->entries = realloc(dict->entries, dict->entriescap, sizeof(TableEntry));
+		assert(dict->entries);
+	}
+
+	size_t i = dict->nentries++;
+	dict->entries[i].hash = hash;
+	dict->entries[i].key = key;
+	dict->entries[i].val = val;
+
+	slot = hash & (dict->indexcap - 1);
+	while (dict->index[slot] != INDEX_EMPTY && dict->index[slot] != INDEX_DELETED) {
+		slot = (slot + 1) & (dict->indexcap - 1);
+	}
+	dict->index[slot] = i;
+	dict->size++;
+}
+
+// dicts
+
+Dict *dict_make(bool isMutable) {
+	Dict *res = malloc(1, sizeof(Dict));
+	assert(res);
+	res->refs = 1;
+	res->isMutable = isMutable;
+	res->size = 0;
+
+	res->root = NULL;
+	res->entries = NULL;
+	res->index = NULL;
+
+	if (isMutable) {
+		res->nentries = 0;
+		res->entriescap = 8;
+		res->entries = malloc(res->entriescap, sizeof(TableEntry));
+		assert(res->entries);
+		table_reindex(res, 16);
+	} else {
+		res->root = hamt_alloc(0);
+	}
+
+	return res;
+}
+
+Dict *dict_retain(Dict *dict) {
+	dict->refs++;
+	return dict;
+}
+
+void dict_release(Dict *dict) {
+	if (dict == NULL || --dict->refs > 0) {
+		return;
+	}
+
+	if (dict->isMutable) {
+		for (size_t i = 0; i < dict->nentries; i++) {
+			node_free(dict->entries[i].key);
+			node_free(dict->entries[i].val);
+		}
+		free(dict->entries);
+		free(dict->index);
+	} else {
+		hamt_release(dict->root);
+	}
+	free(dict);
+}
+
+bool dict_is_mutable(const Dict *dict) {
+	return dict->isMutable;
+}
+
+size_t dict_size(const Dict *dict) {
+	return dict->size;
+}
+
+bool dict_get(const Dict *dict, const Node *key, const Node **val) {
+	uint64_t hash = node_hash(key);
+
+	if (dict->isMutable) {
+		size_t slot = table_find(dict, hash, key);
+		if (slot == INDEX_EMPTY) {
+			return false;
+		}
+		*val = dict->entries[dict->index[slot]].val;
+		return true;
+	}
+
+	const Entry *entry = hamt_get(dict->root, hash, key);
+	if (entry == NULL) {
+		return false;
+	}
+	*val = entry->val;
+	return true;
+}
+
+static Dict *dict_copy_table(const Dict *dict) {
+	Dict *res = dict_make(true);
+	for (size_t i = 0; i < dict->nentries; i++) {
+		const TableEntry *entry = &dict->entries[i];
+		if (entry->key != NULL) {
+			table_insert(res, entry->hash, node_copy(entry->key), node_copy(entry->val));
+		}
+	}
+	return res;
+}
+
+static Dict *dict_with_root(const Dict *dict, HamtNode *root, size_t size) {
+	Dict *res = malloc(1, sizeof(Dict));
+	assert(res);
+	memcpy(res, dict, sizeof(Dict));
+	res->refs = 1;
+	res->root = root;
+	res->size = size;
+	return res;
+}
+
+Dict *dict_put(const Dict *dict, Node *key, Node *val) {
+	if (dict->isMutable) {
+		Dict *res = dict_copy_table(dict);
+		dict_put_mut(res, key, val);
+		return res;
+	}
+
+	bool added = false;
+	Entry *entry = entry_make(node_hash(key), key, val);
+	HamtNode *root = hamt_put(dict->root, 0, entry, &added);
+	return dict_with_root(dict, root, dict->size + added);
+}
+
+Dict *dict_remove(const Dict *dict, const Node *key) {
+	if (dict->isMutable) {
+		Dict *res = dict_copy_table(dict);
+		dict_remove_mut(res, key);
+		return res;
+	}
+
+	HamtNode *root = hamt_remove(dict->root, 0, node_hash(key), key);
+	if (root == NULL) {
+		return dict_retain((Dict*)dict);
+	}
+	return dict_with_root(dict, root, dict->size - 1);
+}
+
+void dict_put_mut(Dict *dict, Node *key, Node *val) {
+	assert(dict->isMutable);
+	table_insert(dict, node_hash(key), key, val);
+}
+
+bool dict_remove_mut(Dict *dict, const Node *key) {
+	assert(dict->isMutable);
+
+	size_t slot = table_find(dict, node_hash(key), key);
+	if (slot == INDEX_EMPTY) {
+		return false;
+	}
+
+	TableEntry *entry = &dict->entries[dict->index[slot]];
+	node_free(entry->key);
+	node_free(entry->val);
+	entry->key = NULL;
+	entry->val = NULL;
+	dict->index[slot] = INDEX_DELETED;
+	dict->size--;
+	return true;
+}
+
+void dict_iter_init(DictIter *it, const Dict *dict) {
+	it->dict = dict;
+	it->index = 0;
+	it->depth = 0;
+	if (!dict->isMutable) {
+		it->depth = 1;
+		it->stack[0] = dict->root;
+		it->pos[0] = 0;
+	}
+}
+
+bool dict_iter_next(DictIter *it, const Node **key, const Node **val) {
+	const Dict *dict = it->dict;
+
+	if (dict->isMutable) {
+		while (it->index < dict->nentries) {
+			const TableEntry *entry = &dict->entries[it->index++];
+			if (entry->key != NULL) {
+				*key = entry->key;
+				*val = entry->val;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	while (it->depth > 0) {
+		const HamtNode *node = it->stack[it->depth - 1];
+		size_t pos = it->pos[it->depth - 1];
+
+		if (pos == node->len) {
+			it->depth--;
+			continue;
+		}
+		it->pos[it->depth - 1]++;
+
+		if (pos < ndata(node)) {
+			const Entry *entry = node->slots[pos];
+			*key = entry->key;
+			*val = entry->val;
+			return true;
+		}
+
+		assert(it->depth < sizeof(it->stack) / sizeof(it->stack[0]));
+		it->stack[it->depth] = node->slots[pos];
+		it->pos[it->depth] = 0;
+		it->depth++;
+	}
+
+	return false;
+}
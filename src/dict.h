@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ast.h"
+
+// Hash map from values to values, in two flavours:
+//
+//  - immutable dicts are hash array mapped tries. Updates return a new dict
+//    that shares everything but the path to the changed entry.
+//  - mutable dicts are insertion ordered open addressing hash tables that are
+//    updated in place. Every copy of the node sees the changes.
+//
+// Both are reference counted. Stored keys and values are owned by the dict,
+// a nil value is stored as NULL.
+
+typedef struct Dict Dict;
+
+Dict *dict_make(bool isMutable);
+Dict *dict_retain(Dict*);
+void dict_release(Dict*);
+
+bool dict_is_mutable(const Dict*);
+size_t dict_size(const Dict*);
+
+// Looks up key, storing its value in val if found.
+bool dict_get(const Dict*, const Node *key, const Node **val);
+
+// Persistent updates, these work on both flavours and never touch the given
+// dict. dict_put takes ownership of key and val.
+Dict *dict_put(const Dict*, Node *key, Node *val);
+Dict *dict_remove(const Dict*, const Node *key);
+
+// In place updates, only for mutable dicts. dict_put_mut takes ownership of
+// key and val.
+void dict_put_mut(Dict*, Node *key, Node *val);
+bool dict_remove_mut(Dict*, const Node *key);
+
+typedef struct DictIter {
+	const Dict *dict;
+	size_t index;
+	// trie walk state for immutable dicts
+	size_t depth;
+	const void *stack[16];
+	size_t pos[16];
+} DictIter;
+
+void dict_iter_init(DictIter*, const Dict*);
+bool dict_iter_next(DictIter*, const Node **key, const Node **val);
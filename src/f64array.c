@@ -0,0 +1,44 @@
+#include <assert.h>
+#include "f64array.h"
+#include "util.h"
+
+F64Array *f64_make(size_t len) {
+	F64Array *res = malloc(1, sizeof(F64Array));
+	assert(res);
+	res->refs = 1;
+	res->len = len;
+	res->data = malloc((len > 0 ? len : 1), sizeof(double));
+	assert(res->data);
+	res->base = NULL;
+	return res;
+}
+
+F64Array *f64_slice(F64Array *arr, size_t from, size_t to) {
+	assert(from <= to && to <= arr->len);
+
+	F64Array *res = malloc(1, sizeof(F64Array));
+	assert(res);
+	res->refs = 1;
+	res->len = to - from;
+	res->data = arr->data + from;
+	res->base = f64_retain(arr->base != NULL ? arr->base : arr);
+	return res;
+}
+
+F64Array *f64_retain(F64Array *arr) {
+	arr->refs++;
+	return arr;
+}
+
+void f64_release(F64Array *arr) {
+	if (arr == NULL || --arr->refs > 0) {
+		return;
+	}
+
+	if (arr->base != NULL) {
+		f64_release(arr->base);
+	} else {
+		free(arr->data);
+	}
+	free(arr);
+}
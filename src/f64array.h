@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include "ast.h"
+
+// Unboxed array of doubles. Slices share the buffer of the array they were
+// taken from, so arrays are reference counted and never mutated after they
+// have been handed out.
+typedef struct F64Array F64Array;
+struct F64Array {
+	size_t refs;
+	size_t len;
+	double *data;
+	F64Array *base; // owner of data, NULL if this array owns it
+};
+
+F64Array *f64_make(size_t len);
+F64Array *f64_slice(F64Array*, size_t from, size_t to);
+F64Array *f64_retain(F64Array*);
+void f64_release(F64Array*);
+
+typedef enum F64Op {
+	F64_ADD,
+	F64_SUB,
+	F64_MUL,
+	F64_DIV,
+} F64Op;
+
+// Vectorized kernels. The best implementation for the CPU we're running on is
+// picked the first time f64_kernels() is called.
+typedef struct F64Kernels {
+	const char *name;
+
+	double (*sum)(const double*, size_t);
+	double (*min)(const double*, size_t);
+	double (*max)(const double*, size_t);
+	double (*dot)(const double*, const double*, size_t);
+
+	// out[i] = a[i] op b[i]
+	void (*binop[4])(double *out, const double *a, const double *b, size_t);
+	// out[i] = a[i] op s
+	void (*scalarop[4])(double *out, const double *a, double s, size_t);
+} F64Kernels;
+
+const F64Kernels *f64_kernels(void);
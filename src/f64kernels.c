@@ -0,0 +1,331 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "f64array.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+// scalar kernels, used for the remainders of the vector loops as well
+
+// min and max propagate NaN: if any element is NaN, so is the result. The
+// vector kernels fall back to the scalar ones when they see a NaN, so every
+// implementation returns the same value.
+
+static double min2(double a, double b) {
+	return a < b || isnan(a) ? a : b;
+}
+
+static double max2(double a, double b) {
+	return a > b || isnan(a) ? a : b;
+}
+
+static double sum_scalar(const double *a, size_t n) {
+	double res = 0;
+	for (size_t i = 0; i < n; i++) {
+		res += a[i];
+	}
+	return res;
+}
+
+static double min_scalar(const double *a, size_t n) {
+	double res = a[0];
+	for (size_t i = 1; i < n; i++) {
+		res = min2(res, a[i]);
+	}
+	return res;
+}
+
+static double max_scalar(const double *a, size_t n) {
+	double res = a[0];
+	for (size_t i = 1; i < n; i++) {
+		res = max2(res, a[i]);
+	}
+	return res;
+}
+
+static double dot_scalar(const double *a, const double *b, size_t n) {
+	double res = 0;
+	for (size_t i = 0; i < n; i++) {
+		res += a[i] * b[i];
+	}
+	return res;
+}
+
+#define SCALAR_OPS(name, op) \
+	static void name##_scalar(double *out, const double *a, const double *b, size_t n) { \
+		for (size_t i = 0; i < n; i++) { \
+			out[i] = a[i] op b[i]; \
+		} \
+	} \
+	static void name##s_scalar(double *out, const double *a, double s, size_t n) { \
+		for (size_t i = 0; i < n; i++) { \
+			out[i] = a[i] op s; \
+		} \
+	}
+
+SCALAR_OPS(add, +)
+SCALAR_OPS(sub, -)
+SCALAR_OPS(mul, *)
+SCALAR_OPS(div, /)
+
+static const F64Kernels kernels_scalar = {
+	.name = "scalar",
+	.sum = sum_scalar,
+	.min = min_scalar,
+	.max = max_scalar,
+	.dot = dot_scalar,
+	.binop = { add_scalar, sub_scalar, mul_scalar, div_scalar },
+	.scalarop = { adds_scalar, subs_scalar, muls_scalar, divs_scalar },
+};
+
+#if HAVE_X86_KERNELS
+
+// SSE2 is part of x86-64, so these are always available there.
+
+static double sum_sse2(const double *a, size_t n) {
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+		acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + sum_scalar(a + i, n - i);
+}
+
+static double min_sse2(const double *a, size_t n) {
+	if (n < 2) {
+		return min_scalar(a, n);
+	}
+	__m128d acc = _mm_loadu_pd(a);
+	__m128d nan = _mm_cmpunord_pd(acc, acc);
+	size_t i = 2;
+	for (; i + 2 <= n; i += 2) {
+		__m128d v = _mm_loadu_pd(a + i);
+		nan = _mm_or_pd(nan, _mm_cmpunord_pd(v, v));
+		acc = _mm_min_pd(acc, v);
+	}
+	if (_mm_movemask_pd(nan) != 0) {
+		return min_scalar(a, n);
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	double res = min_scalar(lanes, 2);
+	for (; i < n; i++) {
+		res = min2(res, a[i]);
+	}
+	return res;
+}
+
+static double max_sse2(const double *a, size_t n) {
+	if (n < 2) {
+		return max_scalar(a, n);
+	}
+	__m128d acc = _mm_loadu_pd(a);
+	__m128d nan = _mm_cmpunord_pd(acc, acc);
+	size_t i = 2;
+	for (; i + 2 <= n; i += 2) {
+		__m128d v = _mm_loadu_pd(a + i);
+		nan = _mm_or_pd(nan, _mm_cmpunord_pd(v, v));
+		acc = _mm_max_pd(acc, v);
+	}
+	if (_mm_movemask_pd(nan) != 0) {
+		return max_scalar(a, n);
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	double res = max_scalar(lanes, 2);
+	for (; i < n; i++) {
+		res = max2(res, a[i]);
+	}
+	return res;
+}
+
+static double dot_sse2(const double *a, const double *b, size_t n) {
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + dot_scalar(a + i, b + i, n - i);
+}
+
+#define SSE2_OPS(name, intrin) \
+	static void name##_sse2(double *out, const double *a, const double *b, size_t n) { \
+		size_t i = 0; \
+		for (; i + 2 <= n; i += 2) { \
+			_mm_storeu_pd(out + i, intrin(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))); \
+		} \
+		name##_scalar(out + i, a + i, b + i, n - i); \
+	} \
+	static void name##s_sse2(double *out, const double *a, double s, size_t n) { \
+		__m128d vs = _mm_set1_pd(s); \
+		size_t i = 0; \
+		for (; i + 2 <= n; i += 2) { \
+			_mm_storeu_pd(out + i, intrin(_mm_loadu_pd(a + i), vs)); \
+		} \
+		name##s_scalar(out + i, a + i, s, n - i); \
+	}
+
+SSE2_OPS(add, _mm_add_pd)
+SSE2_OPS(sub, _mm_sub_pd)
+SSE2_OPS(mul, _mm_mul_pd)
+SSE2_OPS(div, _mm_div_pd)
+
+static const F64Kernels kernels_sse2 = {
+	.name = "sse2",
+	.sum = sum_sse2,
+	.min = min_sse2,
+	.max = max_sse2,
+	.dot = dot_sse2,
+	.binop = { add_sse2, sub_sse2, mul_sse2, div_sse2 },
+	.scalarop = { adds_sse2, subs_sse2, muls_sse2, divs_sse2 },
+};
+
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 double hsum256(__m256d v) {
+	double lanes[4];
+	_mm256_storeu_pd(lanes, v);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static AVX2 double sum_avx2(const double *a, size_t n) {
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+		acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+	}
+	return hsum256(_mm256_add_pd(acc0, acc1)) + sum_scalar(a + i, n - i);
+}
+
+static AVX2 double min_avx2(const double *a, size_t n) {
+	if (n < 4) {
+		return min_scalar(a, n);
+	}
+	__m256d acc = _mm256_loadu_pd(a);
+	__m256d nan = _mm256_cmp_pd(acc, acc, _CMP_UNORD_Q);
+	size_t i = 4;
+	for (; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_loadu_pd(a + i);
+		nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+		acc = _mm256_min_pd(acc, v);
+	}
+	if (_mm256_movemask_pd(nan) != 0) {
+		return min_scalar(a, n);
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	double res = min_scalar(lanes, 4);
+	for (; i < n; i++) {
+		res = min2(res, a[i]);
+	}
+	return res;
+}
+
+static AVX2 double max_avx2(const double *a, size_t n) {
+	if (n < 4) {
+		return max_scalar(a, n);
+	}
+	__m256d acc = _mm256_loadu_pd(a);
+	__m256d nan = _mm256_cmp_pd(acc, acc, _CMP_UNORD_Q);
+	size_t i = 4;
+	for (; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_loadu_pd(a + i);
+		nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+		acc = _mm256_max_pd(acc, v);
+	}
+	if (_mm256_movemask_pd(nan) != 0) {
+		return max_scalar(a, n);
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	double res = max_scalar(lanes, 4);
+	for (; i < n; i++) {
+		res = max2(res, a[i]);
+	}
+	return res;
+}
+
+static AVX2 double dot_avx2(const double *a, const double *b, size_t n) {
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+	}
+	return hsum256(_mm256_add_pd(acc0, acc1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+#define AVX2_OPS(name, intrin) \
+	static AVX2 void name##_avx2(double *out, const double *a, const double *b, size_t n) { \
+		size_t i = 0; \
+		for (; i + 4 <= n; i += 4) { \
+			_mm256_storeu_pd(out + i, intrin(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+		} \
+		name##_scalar(out + i, a + i, b + i, n - i); \
+	} \
+	static AVX2 void name##s_avx2(double *out, const double *a, double s, size_t n) { \
+		__m256d vs = _mm256_set1_pd(s); \
+		size_t i = 0; \
+		for (; i + 4 <= n; i += 4) { \
+			_mm256_storeu_pd(out + i, intrin(_mm256_loadu_pd(a + i), vs)); \
+		} \
+		name##s_scalar(out + i, a + i, s, n - i); \
+	}
+
+AVX2_OPS(add, _mm256_add_pd)
+AVX2_OPS(sub, _mm256_sub_pd)
+AVX2_OPS(mul, _mm256_mul_pd)
+AVX2_OPS(div, _mm256_div_pd)
+
+static const F64Kernels kernels_avx2 = {
+	.name = "avx2",
+	.sum = sum_avx2,
+	.min = min_avx2,
+	.max = max_avx2,
+	.dot = dot_avx2,
+	.binop = { add_avx2, sub_avx2, mul_avx2, div_avx2 },
+	.scalarop = { adds_avx2, subs_avx2, muls_avx2, divs_avx2 },
+};
+
+#endif
+
+const F64Kernels *f64_kernels(void) {
+	static _Thread_local const F64Kernels *kernels = NULL;
+	if (kernels != NULL) {
+		return kernels;
+	}
+
+	// SCHYM_SIMD can be used to force a less capable implementation, for
+	// example to compare results against the scalar kernels.
+	const char *force = getenv("SCHYM_SIMD");
+	kernels = &kernels_scalar;
+
+#if HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (force != NULL && strcmp(force, "scalar") == 0) {
+		kernels = &kernels_scalar;
+	} else if (force != NULL && strcmp(force, "sse2") == 0) {
+		kernels = &kernels_sse2;
+	} else if (__builtin_cpu_supports("avx2")) {
+		kernels = &kernels_avx2;
+	} else {
+		kernels = &kernels_sse2;
+	}
+#else
+	(void)force;
+#endif
+
+	return kernels;
+}
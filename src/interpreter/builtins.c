@@ -3,39 +3,40 @@
 #include <stdarg.h>
 #include <strings.h>
 #include "../ast.h"
+#include "../ast_manip.h"
 #include "internal.h"
 #include "../stringify.h"
 #include "../util.h"
 #include "./builtins.h"
 #include "interpreter.h"
+#include "iter.h"
 
 #include "builtins/lists.h"
 #include "builtins/strings.h"
 #include "builtins/math.h"
 #include "builtins/stdio.h"
-
-static bool isQuoted(const Node *node, const char *str) {
-	return (
-		node->type == AST_QUOTED &&
-		node->quoted.node->type == AST_VAR &&
-		streq(node->quoted.node->var.name, str)
-	);
-}
+#include "builtins/vectors.h"
+#include "builtins/generators.h"
+#include "builtins/memo.h"
+#include "builtins/isolates.h"
+#include "builtins/parallel.h"
+#include "builtins/coroutines.h"
+#include "builtins/files.h"
 
 RunResult builtin_do(Scope *scope, const char *name, size_t nargs, const Node **args) {
 	(void)name;
 
 	EXPECT(>=, 1);
 
-	RunResult rr;
-	for (size_t i = 0; i < nargs; i++) {
-		rr = run(scope, args[i]);
+	for (size_t i = 0; i < nargs-1; i++) {
+		RunResult rr = run(scope, args[i]);
 		if (rr.err != NULL) {
 			return rr;
 		}
+		node_free(rr.node);
 	}
 
-	return rr;
+	return rr_tail(args[nargs-1]);
 }
 
 RunResult builtin_if(Scope *scope, const char *name, size_t nargs, const Node **args) {
@@ -48,13 +49,17 @@ RunResult builtin_if(Scope *scope, const char *name, size_t nargs, const Node **
 	if (cond_rr.err != NULL) {
 		return cond_rr;
 	} else if (cond_rr.node->type != AST_NUM) {
+		node_free(cond_rr.node);
 		return rr_errf("expected cond to have type AST_NUM");
 	}
 
-	if (cond_rr.node->num.val) {
-		return run(scope, args[1]);
+	bool cond = cond_rr.node->num.val;
+	node_free(cond_rr.node);
+
+	if (cond) {
+		return rr_tail(args[1]);
 	} else if (nargs == 3) {
-		return run(scope, args[2]);
+		return rr_tail(args[2]);
 	}
 
 	return rr_null();
@@ -74,17 +79,20 @@ RunResult builtin_fun(Scope *scope, const char *name, size_t nargs, const Node *
 	EXPECT(>=, 2);
 	EXPECT_TYPE(0, AST_EXPR);
 
-	Node *node = malloc(1, sizeof(Node));
-	node->type = AST_FUN;
-	node->function.isBuiltin = false;
-	node->function.scope = scope_make(scope, true);
+	Lambda *lambda = malloc(1, sizeof(Lambda));
+	lambda->refs = 1;
+	lambda->code = NULL;
+	lambda->jit = NULL;
+	lambda->calls = 0;
+	lambda->memo = NULL;
+	lambda->scope = scope_make(scope, true);
 
 	size_t fn_nargs = args[0]->expr.len;
-	node->function.args.len = fn_nargs;
-	node->function.args.nodes = malloc(fn_nargs, sizeof(Node*));
+	lambda->args.len = fn_nargs;
+	lambda->args.nodes = malloc(fn_nargs, sizeof(Node*));
 	for (size_t i = 0; i < fn_nargs; i++) {
 		assert(args[0]->expr.nodes[i]->type == AST_VAR); // TODO
-		node->function.args.nodes[i] = node_copy(args[0]->expr.nodes[i]);
+		lambda->args.nodes[i] = node_copy(args[0]->expr.nodes[i]);
 	}
 
 	Node *body = malloc(1, sizeof(Node));
@@ -95,7 +103,12 @@ RunResult builtin_fun(Scope *scope, const char *name, size_t nargs, const Node *
 	for (size_t i = 1; i < nargs; i++) {
 		body->expr.nodes[i] = node_copy(args[i]);
 	}
-	node->function.body = body;
+	lambda->body = body;
+
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_FUN;
+	node->function.isBuiltin = false;
+	node->function.lambda = lambda;
 
 	return rr_node(node);
 }
@@ -118,18 +131,12 @@ RunResult builtin_set(Scope *scope, const char *name, size_t nargs, const Node *
 	}
 
 	// REVIEW: what the fuck are we doing here lol
-	while (scope->parent != NULL) {
-		const Node *node = varmap_getItem(scope->variables, name);
-		if (node != NULL) {
-			break;
-		}
-		scope = scope->parent;
-	}
+	scope = scope_find(scope, name);
 
 	if (rr.node == NULL) {
 		varmap_removeItem(scope->variables, args[0]->var.name);
 	} else {
-		varmap_setItem(scope->variables, args[0]->var.name, rr.node);
+		varmap_moveItem(scope->variables, args[0]->var.name, rr.node);
 	}
 
 	return rr_null();
@@ -139,45 +146,59 @@ RunResult builtin_let(Scope *scope, const char *name, size_t nargs, const Node *
 	(void)name;
 
 	EXPECT(>=, 2);
+	EXPECT_TYPE(0, AST_EXPR);
 
-	Scope *newScope = scope_make(scope, true);
+	// Unless the body makes a function, which remembers the scope it's made
+	// in, nothing can refer to the scope once the body is done, so it doesn't
+	// need its own allocation.
+	bool escapes = false;
+	for (size_t i = 1; i < nargs; i++) {
+		escapes = escapes || captures_scope(args[i]);
+	}
 
-	EXPECT_TYPE(0, AST_EXPR);
-	for (size_t i = 0; i < args[0]->expr.len; i++) {
+	Scope local;
+	Scope *newScope;
+	if (escapes) {
+		// TODO: this should be freed, but it can be binded to a function.
+		// I have now idea what a simple way to fix this should be.
+		newScope = scope_make(scope, true);
+	} else {
+		scope_enter(&local, scope);
+		newScope = &local;
+	}
+
+	RunResult rr = rr_null();
+	for (size_t i = 0; i < args[0]->expr.len && rr.err == NULL; i++) {
 		const Node *node = args[0]->expr.nodes[i];
+		Node *owned = NULL;
 		if (node->type != AST_EXPR) {
-			RunResult rr = run(scope, node);
+			rr = run(scope, node);
 			if (rr.err != NULL) {
-				return rr;
+				break;
 			}
-			node = rr.node;
+			node = owned = rr.node;
 		}
 
 		const Expression *pair = &node->expr;
 		assert(pair->len == 2); // TODO
 
-		RunResult rr = run(scope, pair->nodes[1]);
-		if (rr.err != NULL) {
-			return rr;
+		rr = run(scope, pair->nodes[1]);
+		if (rr.err == NULL) {
+			varmap_moveItem(newScope->variables, pair->nodes[0]->var.name, rr.node);
 		}
-
-		const char *name = pair->nodes[0]->var.name;
-		const Node *val = rr.node;
-		varmap_setItem(newScope->variables, name, val);
+		node_free(owned);
 	}
 
-	RunResult rr;
-	for (size_t i = 1; i < nargs; i++) {
-		rr = run(newScope, args[i]);
-		if (rr.err != NULL) {
-			return rr;
+	for (size_t i = 1; i < nargs && rr.err == NULL; i++) {
+		if (i > 1) {
+			node_free(rr.node);
 		}
+		rr = run(newScope, args[i]);
 	}
 
-	// TODO: this should be freed, but it can be binded to a function.
-	// I have now idea what a simple way to fix this should be.
-	//scope_free(newScope);
-
+	if (!escapes) {
+		scope_leave(&local);
+	}
 	return rr;
 }
 
@@ -194,38 +215,145 @@ Node *mkQuotedExpr(size_t len) {
 	return res;
 }
 
+// Whether the second argument of times is a pair of bounds instead of an
+// expression that makes a sequence, like (0 n) versus (range 0 n 2).
+static bool isBounds(const Scope *scope, const Node *node) {
+	if (node->type != AST_EXPR || node->expr.len != 2) {
+		return false;
+	}
+
+	const Node *head = node->expr.nodes[0];
+	if (head->type == AST_VAR) {
+		const Node *val = getVar(scope, head->var.name);
+		return val != NULL && val->type == AST_NUM;
+	}
+	return head->type == AST_NUM;
+}
+
+// Runs the bounds (from to) or (from to step) and makes the range between
+// them.
+static RunResult run_bounds(Scope *scope, const Node *node) {
+	if (node->type != AST_EXPR || node->expr.len < 2 || node->expr.len > 3) {
+		return rr_errf("expected bounds like (from to) or (from to step)");
+	}
+
+	double bounds[3] = { 0, 0, 1 };
+	for (size_t i = 0; i < node->expr.len; i++) {
+		RunResult rr = run(scope, node->expr.nodes[i]);
+		if (rr.err != NULL) {
+			return rr;
+		} else if (rr.node == NULL || rr.node->type != AST_NUM) {
+			node_free(rr.node);
+			return rr_errf("expected bounds to be numbers");
+		}
+		bounds[i] = rr.node->num.val;
+		node_free(rr.node);
+	}
+
+	return range_make(bounds[0], bounds[1], bounds[2]);
+}
+
+RunResult loop_head(Scope *scope, BuiltinFn form, size_t nargs, const Node **args, Iter *it) {
+	EXPECT(>=, 2);
+	if (args[0]->type != AST_VAR) {
+		return rr_errf("expected a loop variable but got %s", typetostr(args[0]));
+	}
+
+	const bool bounds = form == builtin_for || (form == builtin_times && isBounds(scope, args[1]));
+	RunResult rr = bounds ? run_bounds(scope, args[1]) : run(scope, args[1]);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (!iter_make(it, rr.node)) {
+		node_free(rr.node);
+		return rr_errf("expected loop over a list, vector, f64 array or range");
+	}
+	return rr_null();
+}
+
+void loop_bind(Scope *scope, const char *var, Iter *it, size_t i) {
+	Node *cur = varmap_getItem(scope->variables, var);
+	double val;
+	if (cur != NULL && cur->type == AST_NUM && iter_num(it, i, &val)) {
+		cur->num.val = val;
+	} else {
+		varmap_moveItem(scope->variables, var, iter_take(it, i));
+	}
+}
+
+// Implements times, for and each, which run the body with the loop variable
+// bound to every item in turn. They evaluate to nil.
+static RunResult run_loop(Scope *scope, BuiltinFn form, size_t nargs, const Node **args) {
+	Iter it;
+	RunResult rr = loop_head(scope, form, nargs, args, &it);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	const char *var = args[0]->var.name;
+	for (size_t i = 0; i < it.len && rr.err == NULL; i++) {
+		loop_bind(scope, var, &it, i);
+
+		for (size_t j = 2; j < nargs && rr.err == NULL; j++) {
+			rr = run(scope, args[j]);
+			node_free(rr.node);
+			rr.node = NULL;
+		}
+	}
+
+	iter_free(&it);
+	varmap_removeItem(scope->variables, var);
+	return rr;
+}
+
+// (times i (from to) body...) runs body with i bound to from, from + 1, ... up
+// to but not including to. (times i seq body...) runs it for every item of a
+// list, vector, f64 array or range instead.
 RunResult builtin_times(Scope *scope, const char *name, size_t nargs, const Node **args) {
 	(void)name;
+	return run_loop(scope, builtin_times, nargs, args);
+}
 
-	EXPECT(>=, 3);
-	EXPECT_TYPE(0, AST_VAR);
-	EXPECT_TYPE(1, AST_EXPR);
+// (for i (from to) body...) or (for i (from to step) body...) always takes
+// bounds.
+RunResult builtin_for(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	return run_loop(scope, builtin_for, nargs, args);
+}
 
-	const Node *fromNode = args[1]->expr.nodes[0];
-	assert(fromNode->num.val == (int)fromNode->num.val);
-	const Node *toNode = args[1]->expr.nodes[1];
-	assert(toNode->num.val == (int)toNode->num.val);
+// (each x seq body...) always takes a sequence.
+RunResult builtin_each(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	return run_loop(scope, builtin_each, nargs, args);
+}
 
-	RunResult rr;
+// (while cond body...) runs body for as long as cond is true.
+RunResult builtin_while(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 1);
 
-	for (int i = fromNode->num.val; i < toNode->num.val; i++) {
-		Node *node = malloc(1, sizeof(Node));
-		node->type = AST_NUM;
-		node->num.val = i;
-		varmap_setItem(scope->variables, args[0]->var.name, node);
-		node_free(node);
+	for (;;) {
+		RunResult rr = run(scope, args[0]);
+		if (rr.err != NULL) {
+			return rr;
+		} else if (rr.node == NULL || rr.node->type != AST_NUM) {
+			node_free(rr.node);
+			return rr_errf("expected cond to have type AST_NUM");
+		}
 
-		for (size_t j = 2; j < nargs; j++) {
-			rr = run(scope, args[j]);
+		const bool cond = rr.node->num.val;
+		node_free(rr.node);
+		if (!cond) {
+			return rr_null();
+		}
+
+		for (size_t i = 1; i < nargs; i++) {
+			rr = run(scope, args[i]);
 			if (rr.err != NULL) {
-				goto exit;
+				return rr;
 			}
+			node_free(rr.node);
 		}
 	}
-
-exit:
-	varmap_removeItem(scope->variables, args[0]->var.name);
-	return rr;
 }
 
 RunResult builtin_eval(Scope *scope, const char *name, size_t nargs, const Node **args) {
@@ -233,15 +361,17 @@ RunResult builtin_eval(Scope *scope, const char *name, size_t nargs, const Node
 
 	EXPECT(==, 1);
 
-	RunResult rr = run(scope, args[0]);
+	RunResult rr = takeArg(scope, args[0]);
 	if (rr.err != NULL) {
 		return rr;
-	} else if (rr.node->type != AST_QUOTED) {
+	} else if (rr.node == NULL || rr.node->type != AST_QUOTED) {
+		node_free(rr.node);
 		return rr_errf("expected expr to have type AST_QUOTED");
 	}
 
-	Node *node = rr.node->quoted.node;
-	return in_run(scope, skipIntern(node));
+	RunResult res = in_run(scope, skipIntern(rr.node->quoted.node));
+	node_free(rr.node);
+	return res;
 }
 
 RunResult builtin_assert(Scope *scope, const char *name, size_t nargs, const Node **args) {
@@ -252,11 +382,15 @@ RunResult builtin_assert(Scope *scope, const char *name, size_t nargs, const Nod
 	RunResult rr = run(scope, args[0]);
 	if (rr.err != NULL) {
 		return rr;
-	} else if (rr.node->type != AST_NUM) {
+	} else if (rr.node == NULL || rr.node->type != AST_NUM) {
+		node_free(rr.node);
 		return rr_errf("expected cond to have type AST_NUM");
 	}
 
-	if (!rr.node->num.val) {
+	bool ok = rr.node->num.val;
+	node_free(rr.node);
+
+	if (!ok) {
 		char *str = stringify(args[0], 0);
 		fprintf(stderr, "assertion failed: %s\n", str);
 		free(str);
@@ -279,11 +413,15 @@ RunResult builtin_cond(Scope *scope, const char *name, size_t nargs, const Node
 		}
 
 		if (cond_rr.node->type == AST_QUOTED) {
+			node_free(cond_rr.node);
 			continue;
 		}
 		assert(cond_rr.node->type == AST_NUM);
 
-		if (cond_rr.node->num.val) {
+		bool cond = cond_rr.node->num.val;
+		node_free(cond_rr.node);
+
+		if (cond) {
 			return builtin_do(
 				scope,
 				"do",
@@ -312,7 +450,7 @@ RunResult builtin_cond(Scope *scope, const char *name, size_t nargs, const Node
 	return rr_null();
 }
 
-static Builtin makeBuiltin(const char *name, RunResult (*fn)(Scope*, const char*, size_t, const Node**)) {
+static Builtin makeBuiltin(const char *name, RunResult (*fn)(Scope*, const char*, size_t, const Node**), unsigned flags) {
 	Builtin res;
 
 	res.name = name;
@@ -320,6 +458,8 @@ static Builtin makeBuiltin(const char *name, RunResult (*fn)(Scope*, const char*
 
 	res.function.isBuiltin = true;
 	res.function.fn = fn;
+	res.function.name = name;
+	res.function.flags = flags;
 
 	return res;
 }
@@ -347,15 +487,25 @@ BuiltinList *builtins_make(bool addPrelude) {
 	addBuiltin(res, "let", builtin_let);
 	addBuiltin(res, "fun", builtin_fun);
 	addBuiltin(res, "times", builtin_times);
-	addBuiltin(res, "eval", builtin_eval);
+	addBuiltin(res, "for", builtin_for);
+	addBuiltin(res, "each", builtin_each);
+	addBuiltin(res, "while", builtin_while);
+	addBuiltinFlags(res, "eval", builtin_eval, BUILTIN_STRICT);
 	addBuiltin(res, "assert", builtin_assert);
 	addBuiltin(res, "cond", builtin_cond);
 
 
 	init_builtins_lists(res);
+	init_builtins_vectors(res);
 	init_builtins_strings(res);
 	init_builtins_stdio(res);
 	init_builtins_math(res);
+	init_builtins_generators(res);
+	init_builtins_memo(res);
+	init_builtins_isolates(res);
+	init_builtins_parallel(res);
+	init_builtins_coroutines(res);
+	init_builtins_files(res);
 
 	return res;
 }
@@ -368,7 +518,6 @@ BuiltinList *builtins_copy(const BuiltinList *builtins) {
 	BuiltinList *res = malloc(1, sizeof(BuiltinList));
 
 	res->cap = builtins->cap;
-	printf("%zu\n", res->cap);
 	res->len = builtins->len;
 
 	res->items = calloc(res->cap, sizeof(Builtin));
@@ -386,13 +535,138 @@ void builtins_free(BuiltinList *builtins) {
 	free(builtins);
 }
 
+// Hash table of the names of all builtins and bound variables, shared by
+// every builtin list of an isolate. Entries are never removed.
+#define NAME_SLOTS 4096
+
+struct Bindings {
+	struct {
+		char *name;
+		size_t bindings;
+		bool watched;
+	} names[NAME_SLOTS];
+	size_t nnames;
+	// the bindingEpoch of the isolate that was running before, see
+	// bindings_enter
+	size_t epoch;
+};
+
+// the table of the isolate running on this thread, made when it's first used
+static _Thread_local Bindings *table = NULL;
+
+_Thread_local size_t bindingEpoch = 0;
+
+static Bindings *current(void) {
+	if (table == NULL) {
+		table = calloc(1, sizeof(Bindings));
+	}
+	return table;
+}
+
+// Returns the slot of name, adding it if there's room. Returns NAME_SLOTS if
+// there isn't.
+static size_t nameSlot(const char *name) {
+	Bindings *t = current();
+
+	size_t h = 5381;
+	for (const char *c = name; *c != '\0'; c++) {
+		h = h * 33 + (unsigned char)*c;
+	}
+
+	size_t i = h % NAME_SLOTS;
+	while (t->names[i].name != NULL) {
+		if (streq(t->names[i].name, name)) {
+			return i;
+		}
+		i = (i + 1) % NAME_SLOTS;
+	}
+
+	if ((t->nnames + 1) * 4 > NAME_SLOTS * 3) {
+		return NAME_SLOTS;
+	}
+	t->nnames++;
+	t->names[i].name = astrcpy(name);
+	return i;
+}
+
+const size_t *bindingCount(const char *name) {
+	static const size_t unknown = SIZE_MAX;
+	size_t i = nameSlot(name);
+	return i == NAME_SLOTS ? &unknown : &table->names[i].bindings;
+}
+
+void watchBinding(const char *name) {
+	size_t i = nameSlot(name);
+	if (i != NAME_SLOTS) {
+		table->names[i].watched = true;
+	}
+}
+
+void noteBinding(const char *name) {
+	size_t i = nameSlot(name);
+	if (i == NAME_SLOTS) {
+		return;
+	}
+
+	table->names[i].bindings++;
+	if (table->names[i].watched) {
+		bindingEpoch++;
+	}
+}
+
+void bindings_destroy(Bindings *t) {
+	if (t == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < NAME_SLOTS; i++) {
+		free(t->names[i].name);
+	}
+	free(t);
+}
+
+void bindings_free(void) {
+	bindings_destroy(table);
+	table = NULL;
+}
+
+Bindings *bindings_make(void) {
+	return calloc(1, sizeof(Bindings));
+}
+
+Bindings *bindings_swap(Bindings *t) {
+	Bindings *res = table;
+	table = t;
+	// neither table's code can tell what the other one bound in the
+	// meantime
+	bindingEpoch++;
+	return res;
+}
+
+Bindings *bindings_enter(void) {
+	Bindings *outer = table;
+	table = calloc(1, sizeof(Bindings));
+	table->epoch = bindingEpoch;
+	return outer;
+}
+
+void bindings_leave(Bindings *outer) {
+	const size_t epoch = table->epoch;
+	bindings_free();
+	table = outer;
+	bindingEpoch = epoch;
+}
+
 void addBuiltin(BuiltinList* builtins, const char *name, BuiltinFn fn) {
+	addBuiltinFlags(builtins, name, fn, 0);
+}
+
+void addBuiltinFlags(BuiltinList* builtins, const char *name, BuiltinFn fn, unsigned flags) {
 	builtins->len++;
 	if (builtins->cap < builtins->len) {
 		builtins->cap *= 2;
 		builtins->items = realloc(builtins->items, builtins->cap, sizeof(Builtin));
 	}
-	builtins->items[builtins->len - 1] = makeBuiltin(name, fn);
+	builtins->items[builtins->len - 1] = makeBuiltin(name, fn, flags);
 }
 
 Builtin *getBuiltin(BuiltinList *builtins, const char *name) {
@@ -406,6 +680,18 @@ Builtin *getBuiltin(BuiltinList *builtins, const char *name) {
 	return NULL;
 }
 
+uint64_t builtins_hash(const BuiltinList *builtins) {
+	uint64_t h = 5381;
+	for (size_t i = 0; i < builtins->len; i++) {
+		for (const char *c = builtins->items[i].name; *c != '\0'; c++) {
+			h = h * 33 + (unsigned char)*c;
+		}
+		h = h * 33;
+	}
+	return h;
+}
+
 void enableBuiltin(BuiltinList *builtins, const char *name, bool enable) {
 	getBuiltin(builtins, name)->enabled = enable;
+	noteBinding(name);
 }
@@ -8,13 +8,83 @@ typedef struct Builtin {
 	bool enabled;
 } Builtin;
 
+typedef struct Iter Iter;
 typedef RunResult (*BuiltinFn)(Scope*, const char*, size_t, const Node**);
 typedef struct BuiltinList BuiltinList;
 
+enum {
+	// The builtin runs every argument exactly once, in order, and doesn't look
+	// at the unevaluated arguments. The heap evaluator evaluates the
+	// arguments of strict builtins itself and passes the values.
+	BUILTIN_STRICT = 1 << 0,
+	// The builtin has no side effects and its result only depends on the
+	// values of its arguments, so a call with literal arguments can be
+	// evaluated ahead of time, see ast_optimize.
+	BUILTIN_PURE = 1 << 1,
+};
+
 BuiltinList *builtins_make(bool);
 BuiltinList *builtins_copy(const BuiltinList *builtins);
 void builtins_free(BuiltinList *builtins);
 
 Builtin *getBuiltin(BuiltinList *builtins, const char *name);
+// A hash of the names of the builtins in the list, in order, enabled or not.
+uint64_t builtins_hash(const BuiltinList *builtins);
 void addBuiltin(BuiltinList *builtins, const char *name, BuiltinFn fn);
+void addBuiltinFlags(BuiltinList *builtins, const char *name, BuiltinFn fn, unsigned flags);
 void enableBuiltin(BuiltinList *builtins, const char *name, bool enable);
+
+// Every builtin name and every name that has been bound as a variable has an
+// entry that counts how often a variable with that name was bound, anywhere in
+// the isolate.
+// Disabling a builtin counts as a binding. Code that resolved a name ahead of
+// time keeps checking the count, or watches the name.
+//
+// The count stays valid forever. If there's no room for a new name, it's
+// SIZE_MAX so nothing relies on it.
+const size_t *bindingCount(const char *name);
+// Makes every later binding of name bump bindingEpoch.
+void watchBinding(const char *name);
+extern _Thread_local size_t bindingEpoch;
+// Called for every variable binding.
+void noteBinding(const char *name);
+// Frees the table of the isolate, once it's done running code.
+void bindings_free(void);
+// An isolate that runs on the thread of another one, inside it, has a table
+// of its own: bindings_enter switches to a new one and returns the table of
+// the outer isolate, bindings_leave frees the inner table and switches back.
+// The outer isolate's code stays valid, whatever the inner one binds.
+typedef struct Bindings Bindings;
+Bindings *bindings_enter(void);
+void bindings_leave(Bindings *outer);
+// An isolate that runs on the threads of others from time to time keeps its
+// table: bindings_swap switches to the given one and returns the table it
+// switches from, which the isolate switches back to when it's done.
+Bindings *bindings_make(void);
+Bindings *bindings_swap(Bindings*);
+void bindings_destroy(Bindings*);
+
+// The forms the heap evaluator evaluates itself.
+RunResult builtin_do(Scope*, const char*, size_t, const Node**);
+RunResult builtin_if(Scope*, const char*, size_t, const Node**);
+RunResult builtin_cond(Scope*, const char*, size_t, const Node**);
+RunResult builtin_while(Scope*, const char*, size_t, const Node**);
+
+// The forms that bind variables, which ast_optimize doesn't rewrite the
+// names of.
+RunResult builtin_set(Scope*, const char*, size_t, const Node**);
+RunResult builtin_let(Scope*, const char*, size_t, const Node**);
+RunResult builtin_fun(Scope*, const char*, size_t, const Node**);
+RunResult builtin_times(Scope*, const char*, size_t, const Node**);
+RunResult builtin_for(Scope*, const char*, size_t, const Node**);
+RunResult builtin_each(Scope*, const char*, size_t, const Node**);
+
+// Evaluates the head of a times, for or each loop into the items the loop
+// variable goes through.
+RunResult loop_head(Scope*, BuiltinFn form, size_t nargs, const Node **args, Iter*);
+// Binds the loop variable to item i. Numbers are stored in the binding of the
+// last item if it's still a number, so loops over ranges don't allocate.
+void loop_bind(Scope*, const char *var, Iter*, size_t i);
+
+Node *makeVar(const char *name);
+Node *mkQuotedExpr(size_t len);
@@ -0,0 +1,217 @@
+#include <math.h>
+
+#include "../../ast.h"
+#include "../../util.h"
+#include "../../stringify.h"
+#include "../coro.h"
+#include "../interpreter.h"
+#include "../output.h"
+#include "coroutines.h"
+
+// Runs the given node and checks that it results in a number of seconds.
+static RunResult run_secs(Scope *scope, const Node *node, double *secs) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_NUM || isnan(rr.node->num.val)) {
+		node_free(rr.node);
+		return rr_errf("expected a number of seconds");
+	}
+	*secs = rr.node->num.val;
+	node_free(rr.node);
+	return rr_null();
+}
+
+RunResult run_fd(Scope *scope, const Node *node, int *fd) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (
+		rr.node == NULL || rr.node->type != AST_NUM ||
+		rr.node->num.val < 0 || rr.node->num.val > 1 << 30 ||
+		rr.node->num.val != floor(rr.node->num.val)
+	) {
+		node_free(rr.node);
+		return rr_errf("expected a file descriptor");
+	}
+	*fd = rr.node->num.val;
+	node_free(rr.node);
+	return rr_null();
+}
+
+// Starts a coroutine with the function and arguments in args.
+static RunResult start(Scope *scope, double delay, size_t nargs, const Node **args) {
+	Node **vals = calloc(nargs, sizeof(Node*));
+	RunResult res = rr_null();
+	for (size_t i = 0; i < nargs && res.err == NULL; i++) {
+		res = takeArg(scope, args[i]);
+		vals[i] = res.node;
+	}
+
+	if (res.err == NULL && (vals[0] == NULL || vals[0]->type != AST_FUN)) {
+		res = rr_errf("expected a function");
+	}
+	if (res.err != NULL) {
+		for (size_t i = 0; i < nargs; i++) {
+			node_free(vals[i]);
+		}
+		free(vals);
+		return res;
+	}
+
+	// the coroutine takes the arguments without the function
+	Node **fnargs = malloc((nargs - 1), sizeof(Node*));
+	for (size_t i = 1; i < nargs; i++) {
+		fnargs[i - 1] = vals[i];
+	}
+	res = coro_start(scope, delay, vals[0], nargs - 1, fnargs);
+	free(vals);
+	return res;
+}
+
+// (go fn args...) starts a coroutine that calls fn, which runs once the
+// running one waits.
+RunResult builtin_go(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 1);
+	return start(scope, 0, nargs, args);
+}
+
+// (after secs fn args...) starts a coroutine that calls fn once secs seconds
+// have passed.
+RunResult builtin_after(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 2);
+
+	double secs = 0;
+	RunResult rr = run_secs(scope, args[0], &secs);
+	if (rr.err != NULL) {
+		return rr;
+	}
+	return start(scope, secs, nargs - 1, args + 1);
+}
+
+// (join co) waits for the coroutine co to return, and returns what it
+// returned.
+RunResult builtin_join(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	RunResult rr = takeArg(scope, args[0]);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_COROUTINE) {
+		const char *type = rr.node == NULL ? "nil" : typetostr(rr.node);
+		node_free(rr.node);
+		return rr_errf("expected a coroutine, got %s", type);
+	}
+
+	RunResult res = coro_join(rr.node->coroutine);
+	node_free(rr.node);
+	return res;
+}
+
+// (sleep secs) lets the other coroutines run for secs seconds. (sleep 0) lets
+// those that are ready run.
+RunResult builtin_sleep(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	double secs = 0;
+	RunResult rr = run_secs(scope, args[0], &secs);
+	if (rr.err != NULL) {
+		return rr;
+	}
+	char *err = coro_sleep(secs);
+	return err != NULL ? rr_err(err) : rr_null();
+}
+
+// (read-line) or (read-line fd) reads a line from fd, standard input by
+// default, without the newline. Returns nil at the end.
+RunResult builtin_read_line(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(<=, 1);
+
+	int fd = 0;
+	if (nargs == 1) {
+		RunResult rr = run_fd(scope, args[0], &fd);
+		if (rr.err != NULL) {
+			return rr;
+		}
+	}
+	return coro_read_line(fd, false);
+}
+
+// (write fd str) writes all of str to fd.
+RunResult builtin_write(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	int fd = 0;
+	RunResult rr = run_fd(scope, args[0], &fd);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	rr = takeArg(scope, args[1]);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_STR) {
+		node_free(rr.node);
+		return rr_errf("expected a string");
+	}
+
+	char *err = coro_write(fd, rr.node->str.str, rr.node->str.size);
+	node_free(rr.node);
+	return err != NULL ? rr_err(err) : rr_null();
+}
+
+// (pipe) makes a pipe, and returns its read and write ends.
+RunResult builtin_pipe(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)scope;
+	(void)name;
+	(void)args;
+	EXPECT(==, 0);
+
+	int fds[2];
+	char *err = coro_pipe(fds);
+	if (err != NULL) {
+		return rr_err(err);
+	}
+
+	Node *res = mkQuotedExpr(2);
+	res->quoted.node->expr.nodes[0] = num_node(fds[0]);
+	res->quoted.node->expr.nodes[1] = num_node(fds[1]);
+	return rr_node(res);
+}
+
+// (close fd)
+RunResult builtin_close(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	int fd = 0;
+	RunResult rr = run_fd(scope, args[0], &fd);
+	if (rr.err != NULL) {
+		return rr;
+	}
+	char *err = output_forget(fd);
+	char *closeErr = coro_close(fd);
+	if (err == NULL) {
+		err = closeErr;
+	} else {
+		free(closeErr);
+	}
+	return err != NULL ? rr_err(err) : rr_null();
+}
+
+void init_builtins_coroutines(BuiltinList *ls) {
+	addBuiltinFlags(ls, "go", builtin_go, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "after", builtin_after, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "join", builtin_join, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "sleep", builtin_sleep, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "read-line", builtin_read_line, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "write", builtin_write, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "pipe", builtin_pipe, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "close", builtin_close, BUILTIN_STRICT);
+}
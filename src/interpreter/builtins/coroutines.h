@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../builtins.h"
+
+// Runs the given node and checks that it results in a file descriptor.
+RunResult run_fd(Scope*, const Node*, int *fd);
+
+void init_builtins_coroutines(BuiltinList*);
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../ast.h"
+#include "../../util.h"
+#include "../frames.h"
+#include "../interpreter.h"
+#include "files.h"
+
+// How much is read at a time from files that can't be mapped, like pipes.
+#define CHUNK (64 << 10)
+
+// The contents of a file. Regular files are mapped as a whole, others are read
+// into a buffer as far as they're needed.
+typedef struct Source {
+	int fd;
+	char *data;
+	// the bytes in data, and where the unread ones start
+	size_t len;
+	size_t pos;
+	// the size of the buffer, 0 if data is mapped
+	size_t cap;
+	bool eof;
+} Source;
+
+static Node *str_node(const char *str, size_t len) {
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_STR;
+	node->str.size = len;
+	node->str.str = malloc((len + 1), sizeof(char));
+	memcpy(node->str.str, str, len);
+	node->str.str[len] = '\0';
+	return node;
+}
+
+// Runs the given node and checks that it results in a path.
+static RunResult run_path(Scope *scope, const Node *node, char **path) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_STR) {
+		node_free(rr.node);
+		return rr_errf("expected a path");
+	}
+	*path = astrcpy(rr.node->str.str);
+	node_free(rr.node);
+	return rr_null();
+}
+
+static char *source_open(Source *src, const char *path) {
+	memset(src, 0, sizeof(Source));
+	src->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (src->fd < 0) {
+		return rr_errf("couldn't open %s: %s", path, strerror(errno)).err;
+	}
+
+	struct stat st;
+	if (fstat(src->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		return NULL;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	src->data = data;
+	src->len = st.st_size;
+	src->eof = true;
+	return NULL;
+}
+
+// Reads the next chunk of a file that isn't mapped, after dropping what's been
+// used.
+static char *source_fill(Source *src) {
+	if (src->pos > 0) {
+		memmove(src->data, src->data + src->pos, src->len - src->pos);
+		src->len -= src->pos;
+		src->pos = 0;
+	}
+	if (src->cap - src->len < CHUNK) {
+		src->cap = src->cap == 0 ? CHUNK : src->cap * 2;
+		src->data = realloc(src->data, src->cap, sizeof(char));
+	}
+
+	ssize_t n;
+	do {
+		n = read(src->fd, src->data + src->len, src->cap - src->len);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0) {
+		return rr_errf("can't read from fd %d: %s", src->fd, strerror(errno)).err;
+	} else if (n == 0) {
+		src->eof = true;
+	}
+	src->len += n;
+	return NULL;
+}
+
+static void source_close(Source *src) {
+	if (src->cap == 0 && src->data != NULL) {
+		munmap(src->data, src->len);
+	} else {
+		free(src->data);
+	}
+	if (src->fd >= 0) {
+		close(src->fd);
+	}
+}
+
+// (read-file path) returns what's in the file at path, as a string.
+RunResult builtin_read_file(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	char *path = NULL;
+	RunResult rr = run_path(scope, args[0], &path);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	Source src;
+	char *err = source_open(&src, path);
+	free(path);
+	while (err == NULL && !src.eof) {
+		err = source_fill(&src);
+	}
+
+	// strings own their bytes, so a mapped file is copied once
+	rr = err != NULL ? rr_err(err) : rr_node(str_node(src.data + src.pos, src.len - src.pos));
+	source_close(&src);
+	return rr;
+}
+
+static RunResult next_line(void *state, bool *done) {
+	Source *src = state;
+	for (;;) {
+		const char *start = src->data + src->pos;
+		const char *nl = src->len > src->pos ? memchr(start, '\n', src->len - src->pos) : NULL;
+		if (nl != NULL || (src->eof && src->len > src->pos)) {
+			const size_t len = nl != NULL ? (size_t)(nl - start) : src->len - src->pos;
+			src->pos += nl != NULL ? len + 1 : len;
+			return rr_node(str_node(start, len));
+		} else if (src->eof) {
+			*done = true;
+			return rr_null();
+		}
+
+		char *err = source_fill(src);
+		if (err != NULL) {
+			return rr_err(err);
+		}
+	}
+}
+
+static void free_lines(void *state) {
+	source_close(state);
+	free(state);
+}
+
+// (file-lines path) returns a generator of the lines of the file at path,
+// without their newlines, which only reads the file as the lines are taken.
+RunResult builtin_file_lines(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	char *path = NULL;
+	RunResult rr = run_path(scope, args[0], &path);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	Source *src = malloc(1, sizeof(Source));
+	char *err = source_open(src, path);
+	free(path);
+	if (err != NULL) {
+		free(src);
+		return rr_err(err);
+	}
+
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_GENERATOR;
+	res->generator = generator_native((GeneratorSource){
+		.next = next_line,
+		.free = free_lines,
+		.state = src,
+	});
+	return rr_node(res);
+}
+
+// (write-file path str) replaces what's in the file at path with str.
+RunResult builtin_write_file(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	char *path = NULL;
+	RunResult rr = run_path(scope, args[0], &path);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	rr = takeArg(scope, args[1]);
+	if (rr.err != NULL) {
+		free(path);
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_STR) {
+		free(path);
+		node_free(rr.node);
+		return rr_errf("expected a string");
+	}
+	Node *str = rr.node;
+
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		rr = rr_errf("couldn't open %s: %s", path, strerror(errno));
+	} else {
+		char *err = NULL;
+		const char *buf = str->str.str;
+		size_t left = str->str.size;
+		while (left > 0 && err == NULL) {
+			const ssize_t n = write(fd, buf, left);
+			if (n < 0 && errno != EINTR) {
+				err = rr_errf("couldn't write %s: %s", path, strerror(errno)).err;
+			} else if (n > 0) {
+				buf += n;
+				left -= n;
+			}
+		}
+
+		if (close(fd) != 0 && err == NULL) {
+			err = rr_errf("couldn't write %s: %s", path, strerror(errno)).err;
+		}
+		rr = err != NULL ? rr_err(err) : rr_null();
+	}
+
+	free(path);
+	node_free(str);
+	return rr;
+}
+
+void init_builtins_files(BuiltinList *ls) {
+	addBuiltinFlags(ls, "read-file", builtin_read_file, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "file-lines", builtin_file_lines, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "write-file", builtin_write_file, BUILTIN_STRICT);
+}
@@ -0,0 +1,163 @@
+#include "../../ast.h"
+#include "../../util.h"
+#include "../../stringify.h"
+#include "../interpreter.h"
+#include "../frames.h"
+#include "generators.h"
+
+// Runs the given node and checks that it results in a generator.
+static RunResult run_generator(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_GENERATOR) {
+		char *type = rr.node == NULL ? "nil" : typetostr(rr.node);
+		node_free(rr.node);
+		return rr_errf("expected a generator, got %s", type);
+	}
+	return rr;
+}
+
+// (generator fn args...) makes a generator that calls fn with the given
+// arguments.
+RunResult builtin_generator(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(>=, 1);
+
+	Node **vals = malloc(nargs, sizeof(Node*));
+	RunResult res = rr_null();
+	size_t i;
+	for (i = 0; i < nargs; i++) {
+		RunResult rr = takeArg(scope, args[i]);
+		if (rr.err != NULL) {
+			res = rr;
+			break;
+		}
+		vals[i] = rr.node;
+	}
+
+	if (res.err == NULL && (vals[0] == NULL || vals[0]->type != AST_FUN)) {
+		res = rr_errf("expected a function");
+	}
+
+	if (res.err == NULL) {
+		Node *node = malloc(1, sizeof(Node));
+		node->type = AST_GENERATOR;
+		node->generator = generator_make(scope, vals[0], nargs - 1, (const Node**)vals + 1);
+		res = rr_node(node);
+	}
+
+	for (size_t j = 0; j < i; j++) {
+		node_free(vals[j]);
+	}
+	free(vals);
+	return res;
+}
+
+RunResult builtin_yield(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)scope;
+	(void)name;
+	(void)nargs;
+	(void)args;
+
+	return rr_errf(YIELD_ERR);
+}
+
+// (next gen) resumes gen and returns the value it yields, or nil when it's
+// done.
+RunResult builtin_next(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult gen = run_generator(scope, args[0]);
+	if (gen.err != NULL) {
+		return gen;
+	}
+
+	RunResult res = generator_fill(gen.node->generator);
+	if (res.err == NULL && !generator_done(gen.node->generator)) {
+		res = rr_node(generator_take(gen.node->generator));
+	}
+
+	node_free(gen.node);
+	return res;
+}
+
+// (done? gen) runs gen up to its next yield, and returns whether it returned
+// instead.
+RunResult builtin_done(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult gen = run_generator(scope, args[0]);
+	if (gen.err != NULL) {
+		return gen;
+	}
+
+	RunResult res = generator_fill(gen.node->generator);
+	if (res.err == NULL) {
+		res = rr_node(num_node(generator_done(gen.node->generator)));
+	}
+
+	node_free(gen.node);
+	return res;
+}
+
+// (generator->list gen) collects the remaining values of gen.
+RunResult builtin_generator_to_list(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult gen = run_generator(scope, args[0]);
+	if (gen.err != NULL) {
+		return gen;
+	}
+
+	size_t len = 0, cap = 8;
+	Node **items = malloc(cap, sizeof(Node*));
+	RunResult res;
+	for (;;) {
+		res = generator_fill(gen.node->generator);
+		if (res.err != NULL || generator_done(gen.node->generator)) {
+			break;
+		}
+
+		Node *item = generator_take(gen.node->generator);
+		if (len == cap) {
+			cap *= 2;
+			items = realloc(items, cap, sizeof(Node*));
+		}
+		items[len++] = item == NULL ? makeVar("nil") : item;
+	}
+	node_free(gen.node);
+
+	if (res.err != NULL) {
+		for (size_t i = 0; i < len; i++) {
+			node_free(items[i]);
+		}
+		free(items);
+		return res;
+	}
+
+	Node *expr = malloc(1, sizeof(Node));
+	expr->type = AST_EXPR;
+	expr->expr.len = len;
+	expr->expr.nodes = items;
+
+	Node *list = malloc(1, sizeof(Node));
+	list->type = AST_QUOTED;
+	list->quoted.node = expr;
+	return rr_node(list);
+}
+
+void init_builtins_generators(BuiltinList *ls) {
+	addBuiltinFlags(ls, "generator", builtin_generator, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "yield", builtin_yield, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "next", builtin_next, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "done?", builtin_done, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "generator->list", builtin_generator_to_list, BUILTIN_STRICT);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "../builtins.h"
+
+// Only meaningful in a generator, where the heap evaluator handles it.
+RunResult builtin_yield(Scope*, const char*, size_t, const Node**);
+// What yield fails with anywhere else, also when the generator reaches it
+// through a builtin the heap evaluator calls natively, see frames.h.
+#define YIELD_ERR "yield can only be used in a generator, and not from code that builtins like map or set run natively"
+
+
+void init_builtins_generators(BuiltinList*);
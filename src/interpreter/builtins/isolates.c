@@ -0,0 +1,153 @@
+#include "../../ast.h"
+#include "../../util.h"
+#include "../../channel.h"
+#include "../../stringify.h"
+#include "../coro.h"
+#include "../interpreter.h"
+#include "../isolate.h"
+#include "isolates.h"
+
+// The size of channels made without one.
+#define DEFAULT_CHAN_SIZE 16
+
+// Runs the given node and checks that it results in a channel.
+static RunResult run_channel(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_CHANNEL) {
+		const char *type = rr.node == NULL ? "nil" : typetostr(rr.node);
+		node_free(rr.node);
+		return rr_errf("expected a channel, got %s", type);
+	}
+	return rr;
+}
+
+// A message on its way in or out of a channel.
+typedef struct Message {
+	Channel *ch;
+	Node *val;
+	char *err;
+} Message;
+
+static bool try_send(void *ctx) {
+	Message *m = ctx;
+	return chan_try_send(m->ch, m->val, m->err);
+}
+
+static bool try_recv(void *ctx) {
+	Message *m = ctx;
+	return chan_try_recv(m->ch, &m->val, &m->err);
+}
+
+// (spawn fn args...) calls fn in a new isolate and returns a channel that gets
+// its result.
+RunResult builtin_spawn(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 1);
+
+	Node **vals = calloc(nargs, sizeof(Node*));
+	RunResult res = rr_null();
+	for (size_t i = 0; i < nargs && res.err == NULL; i++) {
+		res = takeArg(scope, args[i]);
+		vals[i] = res.node;
+	}
+
+	if (res.err == NULL) {
+		res = isolate_spawn(scope, vals[0], nargs - 1, (const Node**)vals + 1);
+	}
+
+	for (size_t i = 0; i < nargs; i++) {
+		node_free(vals[i]);
+	}
+	free(vals);
+	return res;
+}
+
+// (chan) or (chan size) makes a channel that holds at least size values.
+RunResult builtin_chan(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(<=, 1);
+
+	size_t size = DEFAULT_CHAN_SIZE;
+	if (nargs == 1) {
+		RunResult rr = takeArg(scope, args[0]);
+		if (rr.err != NULL) {
+			return rr;
+		} else if (rr.node == NULL || rr.node->type != AST_NUM || rr.node->num.val < 1) {
+			node_free(rr.node);
+			return rr_errf("expected the size of a channel to be a positive number");
+		}
+		size = rr.node->num.val;
+		node_free(rr.node);
+	}
+
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_CHANNEL;
+	res->channel = chan_make(size);
+	return rr_node(res);
+}
+
+// (send ch val) waits while ch is full, letting other coroutines run.
+RunResult builtin_send(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	RunResult ch = run_channel(scope, args[0]);
+	if (ch.err != NULL) {
+		return ch;
+	}
+	RunResult val = takeArg(scope, args[1]);
+	if (val.err != NULL) {
+		node_free(ch.node);
+		return val;
+	}
+
+	RunResult msg = isolate_transfer(val.node);
+	node_free(val.node);
+	if (msg.err == NULL) {
+		// through the event loop, so other coroutines can receive it
+		Message m = { .ch = ch.node->channel, .val = msg.node };
+		msg.err = coro_wait(chan_watchers(m.ch), try_send, &m);
+		if (msg.err != NULL) {
+			node_free(m.val);
+		}
+	}
+
+	node_free(ch.node);
+	return msg.err != NULL ? msg : rr_null();
+}
+
+// (recv ch) waits while ch is empty, letting other coroutines run. Receiving
+// the error of a spawned function fails.
+RunResult builtin_recv(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	RunResult ch = run_channel(scope, args[0]);
+	if (ch.err != NULL) {
+		return ch;
+	}
+
+	Message m = { .ch = ch.node->channel };
+	char *waitErr = coro_wait(chan_watchers(m.ch), try_recv, &m);
+	node_free(ch.node);
+
+	Node *val = m.val;
+	char *err = m.err;
+	if (waitErr != NULL) {
+		return rr_err(waitErr);
+	} else if (err != NULL) {
+		RunResult rr = rr_errf("error in spawned function: %s", err);
+		free(err);
+		return rr;
+	}
+	return rr_node(val);
+}
+
+void init_builtins_isolates(BuiltinList *ls) {
+	addBuiltinFlags(ls, "spawn", builtin_spawn, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "chan", builtin_chan, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "send", builtin_send, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "recv", builtin_recv, BUILTIN_STRICT);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "../builtins.h"
+
+void init_builtins_isolates(BuiltinList*);
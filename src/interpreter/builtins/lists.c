@@ -1,14 +1,14 @@
 #include <string.h>
 #include "../../ast.h"
 #include "../../util.h"
+#include "../../ast_manip.h"
+#include "../../dict.h"
 #include "../interpreter.h"
+#include "../iter.h"
 #include "lists.h"
 
 static Node *bool_node(bool val) {
-	Node *node = malloc(1, sizeof(Node));
-	node->type = AST_NUM;
-	node->num.val = val;
-	return node;
+	return num_node(val);
 }
 
 static Node *makeList(size_t size) {
@@ -32,7 +32,7 @@ RunResult builtin_list(Scope *scope, const char *name, size_t nargs, const Node
 
 	for (size_t i = 0; i < nargs; i++) {
 		const Node *node = args[i];
-		RunResult rr = run(scope, node);
+		RunResult rr = takeArg(scope, node);
 
 		if (rr.err != NULL) {
 			return rr;
@@ -44,33 +44,356 @@ RunResult builtin_list(Scope *scope, const char *name, size_t nargs, const Node
 	return rr_node(res);
 }
 
-RunResult builtin_car(Scope *scope, const char *name, size_t nargs, const Node **args) {
-	(void)name;
+// Runs the given node and checks that it results in a list.
+static RunResult run_list(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (
+		rr.node == NULL ||
+		rr.node->type != AST_QUOTED ||
+		rr.node->quoted.node->type != AST_EXPR
+	) {
+		node_free(rr.node);
+		return rr_errf("expected list");
+	}
+	return rr;
+}
+
+static bool truthy(const Node *node) {
+	if (node == NULL) {
+		return false;
+	} else if (node->type == AST_NUM) {
+		return node->num.val != 0;
+	}
+	return true;
+}
 
+// Takes the item at index i out of the given list and frees the rest.
+static Node *take_item(Node *list, size_t i) {
+	Node *res = list->quoted.node->expr.nodes[i];
+	list->quoted.node->expr.nodes[i] = NULL;
+	node_free(list);
+	return iter_item(res);
+}
+
+// Implements car, cdr and all their c[ad]+r combinations. The operations are
+// applied from right to left on the (owned) result of the argument, so no
+// list is ever copied.
+RunResult builtin_cxr(Scope *scope, const char *name, size_t nargs, const Node **args) {
 	EXPECT(==, 1);
-	RunResult rr = run(scope, args[0]);
+
+	RunResult rr = takeArg(scope, args[0]);
 	if (rr.err != NULL) {
 		return rr;
 	}
+	Node *node = rr.node;
+
+	size_t len = strlen(name);
+	for (size_t i = len - 2; i > 0; i--) {
+		if (
+			node == NULL ||
+			node->type != AST_QUOTED ||
+			node->quoted.node->type != AST_EXPR
+		) {
+			node_free(node);
+			return rr_errf("%s: expected list", name);
+		} else if (node->quoted.node->expr.len == 0) {
+			node_free(node);
+			return rr_errf("%s: list is empty", name);
+		}
+
+		if (name[i] == 'a') {
+			node = take_item(node, 0);
+		} else {
+			expr_remove(node, 0);
+		}
+	}
 
-	// REVIEW
-	Node *node = rr.node->quoted.node->expr.nodes[0];
 	return rr_node(node);
 }
 
-RunResult builtin_cdr(Scope *scope, const char *name, size_t nargs, const Node **args) {
+RunResult builtin_list_ref(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	Iter it;
+	RunResult rr = iter_run(scope, args[0], &it);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	RunResult n = takeArg(scope, args[1]);
+	if (n.err != NULL) {
+		iter_free(&it);
+		return n;
+	} else if (n.node == NULL || n.node->type != AST_NUM) {
+		iter_free(&it);
+		node_free(n.node);
+		return rr_errf("expected index to be a number");
+	}
+
+	const double idx = n.node->num.val;
+	node_free(n.node);
+
+	if (idx < 0 || idx >= it.len || idx != (size_t)idx) {
+		iter_free(&it);
+		return rr_errf("index %g out of range for sequence of length %zu", idx, it.len);
+	}
+
+	Node *res = iter_take(&it, idx);
+	iter_free(&it);
+	return rr_node(res);
+}
+
+RunResult builtin_length(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	RunResult rr = takeArg(scope, args[0]);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	Node *res;
+	Iter it;
+	if (rr.node != NULL && rr.node->type == AST_DICT) {
+		res = num_node(dict_size(rr.node->dict));
+		node_free(rr.node);
+	} else if (iter_make(&it, rr.node)) {
+		res = num_node(it.len);
+		iter_free(&it);
+	} else {
+		node_free(rr.node);
+		return rr_errf("expected sequence or dict");
+	}
+
+	return rr_node(res);
+}
+
+RunResult builtin_reverse(Scope *scope, const char *name, size_t nargs, const Node **args) {
 	(void)name;
 	EXPECT(==, 1);
-	RunResult rr = run(scope, args[0]);
+
+	Iter it;
+	RunResult rr = iter_run(scope, args[0], &it);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	Node *res = makeList(it.len);
+	Expression *out = &res->quoted.node->expr;
+	for (size_t i = 0; i < it.len; i++) {
+		out->nodes[it.len - 1 - i] = iter_take(&it, i);
+	}
+
+	iter_free(&it);
+	return rr_node(res);
+}
+
+RunResult builtin_map(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	Iter it;
+	RunResult rr = iter_run(scope, args[0], &it);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	RunResult fn = takeArg(scope, args[1]);
+	if (fn.err != NULL) {
+		iter_free(&it);
+		return fn;
+	}
+
+	// the items are ours, so they are given to fn
+	Node *res = makeList(it.len);
+	Expression *out = &res->quoted.node->expr;
+
+	rr = rr_node(res);
+	for (size_t i = 0; i < it.len; i++) {
+		Node *val = iter_take(&it, i);
+		RunResult item = callFunctionMoved(scope, fn.node, 1, &val);
+		if (item.err != NULL) {
+			node_free(res);
+			rr = item;
+			break;
+		} else if (item.node == NULL) {
+			item.node = makeVar("nil");
+		}
+		out->nodes[i] = item.node;
+	}
+
+	node_free(fn.node);
+	iter_free(&it);
+	return rr;
+}
+
+// Calls fn on the given item and returns whether the result is truthy, or
+// sets err.
+static bool run_predicate(Scope *scope, const Node *fn, const Node *item, RunResult *err) {
+	RunResult rr = callFunction(scope, fn, 1, &item);
+	if (rr.err != NULL) {
+		*err = rr;
+		return false;
+	}
+
+	const bool res = truthy(rr.node);
+	node_free(rr.node);
+	return res;
+}
+
+RunResult builtin_filter(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	Iter it;
+	RunResult rr = iter_run(scope, args[0], &it);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	RunResult fn = takeArg(scope, args[1]);
+	if (fn.err != NULL) {
+		iter_free(&it);
+		return fn;
+	}
+
+	// the kept items are moved over, the result grows as they come so that
+	// filtering a long range doesn't allocate for all of it
+	Node *res = makeList(0);
+	Expression *out = &res->quoted.node->expr;
+	size_t cap = 0;
+
+	Node *item;
+	while ((item = iter_next(&it)) != NULL) {
+		const bool keep = run_predicate(scope, fn.node, item, &rr);
+		if (rr.err != NULL) {
+			node_free(item);
+			node_free(res);
+			res = NULL;
+			break;
+		} else if (!keep) {
+			node_free(item);
+			continue;
+		}
+
+		if (out->len == cap) {
+			cap = cap == 0 ? 8 : cap * 2;
+			out->nodes = realloc(out->nodes, cap, sizeof(Node*));
+		}
+		out->nodes[out->len++] = item;
+	}
+
+	node_free(fn.node);
+	iter_free(&it);
+	return res == NULL ? rr : rr_node(res);
+}
+
+RunResult builtin_drop_while(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	Iter it;
+	RunResult rr = iter_run(scope, args[0], &it);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	RunResult fn = takeArg(scope, args[1]);
+	if (fn.err != NULL) {
+		iter_free(&it);
+		return fn;
+	}
+
+	// the first item that doesn't match is kept, with everything after it
+	Node *first = NULL;
+	while ((first = iter_next(&it)) != NULL) {
+		const bool match = run_predicate(scope, fn.node, first, &rr);
+		if (rr.err != NULL) {
+			node_free(first);
+			node_free(fn.node);
+			iter_free(&it);
+			return rr;
+		} else if (!match) {
+			break;
+		}
+		node_free(first);
+	}
+	node_free(fn.node);
+
+	const size_t len = first == NULL ? 0 : it.len - it.i + 1;
+	Node *res = makeList(len);
+	Expression *out = &res->quoted.node->expr;
+	for (size_t i = 0; i < len; i++) {
+		out->nodes[i] = i == 0 ? first : iter_next(&it);
+	}
+
+	iter_free(&it);
+	return rr_node(res);
+}
+
+RunResult builtin_fold(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 3);
+
+	Iter it;
+	RunResult rr = iter_run(scope, args[0], &it);
 	if (rr.err != NULL) {
 		return rr;
 	}
 
-	// TODO: typecheck
-	// REVIEW
-	rr.node->quoted.node->expr.len--;
-	rr.node->quoted.node->expr.nodes = rr.node->quoted.node->expr.nodes+1;
-	return rr_node(rr.node);
+	RunResult acc = takeArg(scope, args[1]);
+	if (acc.err != NULL) {
+		iter_free(&it);
+		return acc;
+	}
+
+	RunResult fn = takeArg(scope, args[2]);
+	if (fn.err != NULL) {
+		node_free(acc.node);
+		iter_free(&it);
+		return fn;
+	}
+
+	for (size_t i = 0; i < it.len; i++) {
+		Node *fnargs[] = { acc.node, iter_take(&it, i) };
+		acc = callFunctionMoved(scope, fn.node, 2, fnargs);
+		if (acc.err != NULL) {
+			break;
+		}
+	}
+
+	node_free(fn.node);
+	iter_free(&it);
+	return acc;
+}
+
+// (range to), (range from to) or (range from to step) makes a lazy sequence of
+// numbers from from (or 0) up to but not including to.
+RunResult builtin_range(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 1);
+	EXPECT(<=, 3);
+
+	double vals[3];
+	for (size_t i = 0; i < nargs; i++) {
+		RunResult rr = takeArg(scope, args[i]);
+		if (rr.err != NULL) {
+			return rr;
+		} else if (rr.node == NULL || rr.node->type != AST_NUM) {
+			node_free(rr.node);
+			return rr_errf("expected argument %zu of range to be a number", i);
+		}
+		vals[i] = rr.node->num.val;
+		node_free(rr.node);
+	}
+
+	const double from = nargs == 1 ? 0 : vals[0];
+	const double to = nargs == 1 ? vals[0] : vals[1];
+	const double step = nargs == 3 ? vals[2] : 1;
+	return range_make(from, to, step);
 }
 
 // TODO: handle strings and then builtin concat into prelude
@@ -78,24 +401,22 @@ RunResult builtin_append(Scope *scope, const char *name, size_t nargs, const Nod
 	(void)name;
 	EXPECT(==, 2);
 
-	RunResult list = run(scope, args[0]);
+	RunResult list = run_list(scope, args[0]);
 	if (list.err != NULL) {
 		return list;
 	}
 
-	RunResult val = run(scope, args[1]);
+	RunResult val = takeArg(scope, args[1]);
 	if (val.err != NULL) {
+		node_free(list.node);
 		return val;
 	}
 
-	if (list.node->type != AST_QUOTED) {
-		return rr_errf("expected list");
-	}
-
-	list.node->quoted.node->expr.len++;
-	list.node->quoted.node->expr.nodes = realloc(list.node->quoted.node->expr.nodes, list.node->quoted.node->expr.len, sizeof(Node*));
-	list.node->quoted.node->expr.nodes[list.node->quoted.node->expr.len-1] = node_copy(val.node);
+	Expression *expr = &list.node->quoted.node->expr;
+	expr->nodes = realloc(expr->nodes, (expr->len + 1), sizeof(Node*));
+	expr->nodes[expr->len++] = val.node == NULL ? makeVar("nil") : val.node;
 
+	node_free(list.node);
 	return rr_null();
 }
 
@@ -103,57 +424,316 @@ RunResult builtin_cons(Scope *scope, const char *name, size_t nargs, const Node
 	(void)name;
 	EXPECT(==, 2);
 
-	// TODO: do this how it's actually supposed to be.
-
-	RunResult item = run(scope, args[0]);
+	RunResult item = takeArg(scope, args[0]);
 	if (item.err != NULL) {
 		return item;
 	}
 
-	RunResult list = run(scope, args[1]);
+	RunResult list = run_list(scope, args[1]);
 	if (list.err != NULL) {
+		node_free(item.node);
 		return list;
 	}
-	if (list.node->type != AST_QUOTED) {
-		return rr_errf("expected list");
-	}
-
-	Node *listcpy = node_copy(list.node);
-	Node *itemcpy = node_copy(item.node);
 
-	listcpy->quoted.node->expr.len++;
-	listcpy->quoted.node->expr.nodes = realloc(
-		listcpy->quoted.node->expr.nodes,
-		listcpy->quoted.node->expr.len,
-		sizeof(Node*)
-	);
-	memmove(listcpy->quoted.node->expr.nodes + 1, listcpy->quoted.node->expr.nodes, listcpy->quoted.node->expr.len-1);
-	listcpy->quoted.node->expr.nodes[0] = itemcpy;
+	// both values are ours, so the item is moved into the list itself
+	Expression *expr = &list.node->quoted.node->expr;
+	expr->nodes = realloc(expr->nodes, (expr->len + 1), sizeof(Node*));
+	memmove(expr->nodes + 1, expr->nodes, expr->len * sizeof(Node*));
+	expr->nodes[0] = item.node == NULL ? makeVar("nil") : item.node;
+	expr->len++;
 
-	return rr_node(listcpy);
+	return list;
 }
 
 RunResult builtin_null(Scope *scope, const char *name, size_t nargs, const Node **args) {
 	(void)name;
 	EXPECT(==, 1);
 
-	RunResult list = run(scope, args[0]);
+	RunResult list = takeArg(scope, args[0]);
 	if (list.err != NULL) {
 		return list;
 	}
-	if (list.node->type != AST_QUOTED) {
+	if (list.node == NULL) { // nil, like an exhausted generator returns
+		return rr_node(bool_node(true));
+	}
+
+	Iter it;
+	if (!iter_make(&it, list.node)) {
+		node_free(list.node);
 		return rr_node(bool_node(false));
 	}
 
-	const bool val = list.node->quoted.node->expr.len == 0;
+	const bool val = it.len == 0;
+	iter_free(&it);
 	return rr_node(bool_node(val));
 }
 
+static Node *dict_node(Dict *dict) {
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_DICT;
+	node->dict = dict;
+	return node;
+}
+
+// Runs the given node and checks that it results in a dict.
+static RunResult run_dict(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_DICT) {
+		node_free(rr.node);
+		return rr_errf("expected dict");
+	}
+	return rr;
+}
+
+// Runs the given node and checks that it results in something that can be
+// used as a dict key: a string, a number or a quoted symbol or list.
+static RunResult run_key(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (
+		rr.node == NULL || (
+			rr.node->type != AST_STR &&
+			rr.node->type != AST_NUM &&
+			rr.node->type != AST_QUOTED
+		)
+	) {
+		const char *type = rr.node == NULL ? "nil" : typetostr(rr.node);
+		node_free(rr.node);
+		return rr_errf("%s can't be used as a dict key", type);
+	}
+	return rr;
+}
+
+// Implements dict and hash-map, which take alternating keys and values.
+RunResult builtin_dict(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	if (nargs % 2 != 0) {
+		return rr_errf("%s expects pairs of keys and values", name);
+	}
+
+	bool isMutable = streq(name, "hash-map");
+	Dict *dict = dict_make(isMutable);
+
+	for (size_t i = 0; i < nargs; i += 2) {
+		RunResult key = run_key(scope, args[i]);
+		if (key.err != NULL) {
+			dict_release(dict);
+			return key;
+		}
+		RunResult val = takeArg(scope, args[i + 1]);
+		if (val.err != NULL) {
+			node_free(key.node);
+			dict_release(dict);
+			return val;
+		}
+
+		if (isMutable) {
+			dict_put_mut(dict, key.node, val.node);
+		} else {
+			Dict *next = dict_put(dict, key.node, val.node);
+			dict_release(dict);
+			dict = next;
+		}
+	}
+
+	return rr_node(dict_node(dict));
+}
+
+// (get dict key [default]) returns default (or nil) for missing keys.
+RunResult builtin_get(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 2);
+	EXPECT(<=, 3);
+
+	RunResult dict = run_dict(scope, args[0]);
+	if (dict.err != NULL) {
+		return dict;
+	}
+	RunResult key = run_key(scope, args[1]);
+	if (key.err != NULL) {
+		node_free(dict.node);
+		return key;
+	}
+
+	const Node *val;
+	RunResult res;
+	if (dict_get(dict.node->dict, key.node, &val)) {
+		res = rr_node(node_copy(val));
+	} else if (nargs == 3) {
+		res = takeArg(scope, args[2]);
+	} else {
+		res = rr_null();
+	}
+
+	node_free(key.node);
+	node_free(dict.node);
+	return res;
+}
+
+RunResult builtin_has(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 2);
+
+	RunResult dict = run_dict(scope, args[0]);
+	if (dict.err != NULL) {
+		return dict;
+	}
+	RunResult key = run_key(scope, args[1]);
+	if (key.err != NULL) {
+		node_free(dict.node);
+		return key;
+	}
+
+	const Node *val;
+	Node *res = bool_node(dict_get(dict.node->dict, key.node, &val));
+
+	node_free(key.node);
+	node_free(dict.node);
+	return rr_node(res);
+}
+
+// Implements put and put!. put returns a new dict, put! updates a mutable dict
+// in place.
+RunResult builtin_put(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	EXPECT(==, 3);
+
+	const bool inPlace = streq(name, "put!");
+
+	RunResult dict = run_dict(scope, args[0]);
+	if (dict.err != NULL) {
+		return dict;
+	} else if (inPlace && !dict_is_mutable(dict.node->dict)) {
+		node_free(dict.node);
+		return rr_errf("put! expects a mutable dict, use put instead");
+	}
+
+	RunResult key = run_key(scope, args[1]);
+	if (key.err != NULL) {
+		node_free(dict.node);
+		return key;
+	}
+	RunResult val = takeArg(scope, args[2]);
+	if (val.err != NULL) {
+		node_free(key.node);
+		node_free(dict.node);
+		return val;
+	}
+
+	if (inPlace) {
+		dict_put_mut(dict.node->dict, key.node, val.node);
+		node_free(dict.node);
+		return rr_null();
+	}
+
+	Node *res = dict_node(dict_put(dict.node->dict, key.node, val.node));
+	node_free(dict.node);
+	return rr_node(res);
+}
+
+// Implements remove and remove!, like put and put!.
+RunResult builtin_remove(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	EXPECT(==, 2);
+
+	const bool inPlace = streq(name, "remove!");
+
+	RunResult dict = run_dict(scope, args[0]);
+	if (dict.err != NULL) {
+		return dict;
+	} else if (inPlace && !dict_is_mutable(dict.node->dict)) {
+		node_free(dict.node);
+		return rr_errf("remove! expects a mutable dict, use remove instead");
+	}
+
+	RunResult key = run_key(scope, args[1]);
+	if (key.err != NULL) {
+		node_free(dict.node);
+		return key;
+	}
+
+	Node *res;
+	if (inPlace) {
+		res = bool_node(dict_remove_mut(dict.node->dict, key.node));
+	} else {
+		res = dict_node(dict_remove(dict.node->dict, key.node));
+	}
+
+	node_free(key.node);
+	node_free(dict.node);
+	return rr_node(res);
+}
+
+// Implements keys, values and entries, which list the contents of a dict.
+// entries returns (key value) pairs.
+RunResult builtin_dict_items(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	EXPECT(==, 1);
+
+	RunResult dict = run_dict(scope, args[0]);
+	if (dict.err != NULL) {
+		return dict;
+	}
+
+	Node *res = makeList(dict_size(dict.node->dict));
+	Expression *out = &res->quoted.node->expr;
+
+	DictIter it;
+	dict_iter_init(&it, dict.node->dict);
+	const Node *key, *val;
+	for (size_t i = 0; dict_iter_next(&it, &key, &val); i++) {
+		Node *valcpy = val == NULL ? makeVar("nil") : node_copy(val);
+		if (streq(name, "keys")) {
+			out->nodes[i] = node_copy(key);
+			node_free(valcpy);
+		} else if (streq(name, "values")) {
+			out->nodes[i] = valcpy;
+		} else {
+			Node *pair = makeList(2);
+			pair->quoted.node->expr.nodes[0] = node_copy(key);
+			pair->quoted.node->expr.nodes[1] = valcpy;
+			out->nodes[i] = pair;
+		}
+	}
+
+	node_free(dict.node);
+	return rr_node(res);
+}
+
 void init_builtins_lists(BuiltinList *ls) {
-	addBuiltin(ls, "list", builtin_list);
-	addBuiltin(ls, "car", builtin_car);
-	addBuiltin(ls, "cdr", builtin_cdr);
-	addBuiltin(ls, "append", builtin_append);
-	addBuiltin(ls, "cons", builtin_cons);
-	addBuiltin(ls, "null?", builtin_null);
+	static const char *cxrs[] = {
+		"car", "cdr",
+		"caar", "cadr", "cdar", "cddr",
+		"caaar", "caadr", "cadar", "caddr", "cdaar", "cdadr", "cddar", "cdddr",
+		"caaaar", "caaadr", "caadar", "caaddr", "cadaar", "cadadr", "caddar", "cadddr",
+		"cdaaar", "cdaadr", "cdadar", "cdaddr", "cddaar", "cddadr", "cdddar", "cddddr",
+	};
+
+	addBuiltinFlags(ls, "list", builtin_list, BUILTIN_STRICT);
+	for (size_t i = 0; i < sizeof(cxrs)/sizeof(cxrs[0]); i++) {
+		addBuiltinFlags(ls, cxrs[i], builtin_cxr, BUILTIN_STRICT);
+	}
+	addBuiltinFlags(ls, "append", builtin_append, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "cons", builtin_cons, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "null?", builtin_null, BUILTIN_STRICT);
+
+	addBuiltinFlags(ls, "range", builtin_range, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "length", builtin_length, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "list-ref", builtin_list_ref, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "reverse", builtin_reverse, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "map", builtin_map, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "filter", builtin_filter, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "drop-while", builtin_drop_while, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "fold", builtin_fold, BUILTIN_STRICT);
+
+	addBuiltinFlags(ls, "dict", builtin_dict, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "hash-map", builtin_dict, BUILTIN_STRICT);
+	addBuiltin(ls, "get", builtin_get);
+	addBuiltinFlags(ls, "has?", builtin_has, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "put", builtin_put, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "put!", builtin_put, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "remove", builtin_remove, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "remove!", builtin_remove, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "keys", builtin_dict_items, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "values", builtin_dict_items, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "entries", builtin_dict_items, BUILTIN_STRICT);
 }
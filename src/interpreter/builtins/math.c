@@ -5,6 +5,7 @@
 #include "../../util.h"
 #include "../interpreter.h"
 #include "../../stringify.h"
+#include "../../f64array.h"
 #include "math.h"
 
 #define CHECKNUM(node) do { \
@@ -16,41 +17,43 @@
 RunResult builtin_arith(Scope *scope, const char *name, size_t nargs, const Node **args) {
 	EXPECT(>=, 2);
 
-	Node *res = malloc(1, sizeof(Node));
-	res->type = AST_NUM;
-
-	RunResult rr = run(scope, args[0]);
+	RunResult rr = takeArg(scope, args[0]);
 	CHECKNUM(rr.node);
-	res->num.val = rr.node->num.val;
+	double res = rr.node->num.val;
+	node_free(rr.node);
 
 	for (size_t i = 1; i < nargs; i++) {
-		const RunResult rr = run(scope, args[i]);
+		const RunResult rr = takeArg(scope, args[i]);
 		CHECKNUM(rr.node);
 		const double n = rr.node->num.val;
+		node_free(rr.node);
 
 		switch (name[0]) {
 		case '+':
-			res->num.val += n;
+			res += n;
 			break;
 		case '-':
-			res->num.val -= n;
+			res -= n;
 			break;
 		case '/':
-			res->num.val /= n;
+			res /= n;
 			break;
 		case '*':
-			res->num.val *= n;
+			res *= n;
 			break;
 		case '^':
-			res->num.val = pow(res->num.val, n);
+			res = pow(res, n);
 			break;
 		case '%':
-			res->num.val = fmod(res->num.val, n);
+			res = fmod(res, n);
 			break;
 		}
 	}
 
-	return rr_node(res);
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_NUM;
+	node->num.val = res;
+	return rr_node(node);
 }
 
 RunResult builtin_comp(Scope *scope, const char *name, size_t nargs, const Node **args) {
@@ -86,32 +89,454 @@ RunResult builtin_and_or(Scope *scope, const char *name, size_t nargs, const Nod
 
 	RunResult rr;
 	for (size_t i = 0; i < nargs; i++) {
-		rr = run(scope, args[i]);
+		rr = takeArg(scope, args[i]);
 		CHECKNUM(rr.node);
 		const double n = rr.node->num.val;
 
-		if ((doAnd && !n) || (!doAnd && n)) {
+		if ((doAnd && !n) || (!doAnd && n) || i == nargs-1) {
 			break;
 		}
+		node_free(rr.node);
 	}
 	return rr;
 }
 
+static Node *array_node(F64Array *arr) {
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_ARRAY;
+	node->array = arr;
+	return node;
+}
+
+// Runs the given node and checks that it results in an f64 array.
+static RunResult run_array(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_ARRAY) {
+		node_free(rr.node);
+		return rr_errf("expected an f64 array");
+	}
+	return rr;
+}
+
+// Runs the given node and checks that it results in a number.
+static RunResult run_num(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_NUM) {
+		node_free(rr.node);
+		return rr_errf("expected a number");
+	}
+	return rr;
+}
+
+// Runs the given node and checks that it results in an index below max.
+static RunResult run_index(Scope *scope, const Node *node, size_t max, size_t *idx) {
+	RunResult rr = run_num(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	double val = rr.node->num.val;
+	node_free(rr.node);
+	if (val < 0 || val > max || val != floor(val)) {
+		return rr_errf("index %g out of range [0, %zu]", val, max);
+	}
+
+	*idx = val;
+	return rr_null();
+}
+
+RunResult builtin_f64_array(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	F64Array *arr = f64_make(nargs);
+	for (size_t i = 0; i < nargs; i++) {
+		RunResult rr = run_num(scope, args[i]);
+		if (rr.err != NULL) {
+			f64_release(arr);
+			return rr;
+		}
+		arr->data[i] = rr.node->num.val;
+		node_free(rr.node);
+	}
+
+	return rr_node(array_node(arr));
+}
+
+RunResult builtin_f64_make(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(>=, 1);
+	EXPECT(<=, 2);
+
+	size_t len;
+	RunResult rr = run_index(scope, args[0], SIZE_MAX / sizeof(double), &len);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	double val = 0;
+	if (nargs == 2) {
+		rr = run_num(scope, args[1]);
+		if (rr.err != NULL) {
+			return rr;
+		}
+		val = rr.node->num.val;
+		node_free(rr.node);
+	}
+
+	F64Array *arr = f64_make(len);
+	for (size_t i = 0; i < len; i++) {
+		arr->data[i] = val;
+	}
+	return rr_node(array_node(arr));
+}
+
+RunResult builtin_list_to_f64(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult list = takeArg(scope, args[0]);
+	if (list.err != NULL) {
+		return list;
+	} else if (
+		list.node == NULL ||
+		list.node->type != AST_QUOTED ||
+		list.node->quoted.node->type != AST_EXPR
+	) {
+		node_free(list.node);
+		return rr_errf("expected list");
+	}
+
+	const Expression *expr = &list.node->quoted.node->expr;
+	F64Array *arr = f64_make(expr->len);
+	for (size_t i = 0; i < expr->len; i++) {
+		const Node *item = expr->nodes[i];
+		if (item == NULL || item->type != AST_NUM) {
+			f64_release(arr);
+			node_free(list.node);
+			return rr_errf("all list items should be a number");
+		}
+		arr->data[i] = item->num.val;
+	}
+
+	node_free(list.node);
+	return rr_node(array_node(arr));
+}
+
+RunResult builtin_f64_to_list(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult arr = run_array(scope, args[0]);
+	if (arr.err != NULL) {
+		return arr;
+	}
+
+	size_t len = arr.node->array->len;
+	Node *res = mkQuotedExpr(len);
+	for (size_t i = 0; i < len; i++) {
+		res->quoted.node->expr.nodes[i] = num_node(arr.node->array->data[i]);
+	}
+
+	node_free(arr.node);
+	return rr_node(res);
+}
+
+RunResult builtin_f64_length(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult arr = run_array(scope, args[0]);
+	if (arr.err != NULL) {
+		return arr;
+	}
+
+	Node *res = num_node(arr.node->array->len);
+	node_free(arr.node);
+	return rr_node(res);
+}
+
+RunResult builtin_f64_ref(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 2);
+
+	RunResult arr = run_array(scope, args[0]);
+	if (arr.err != NULL) {
+		return arr;
+	}
+
+	size_t idx;
+	RunResult rr = run_index(scope, args[1], arr.node->array->len, &idx);
+	if (rr.err == NULL && idx == arr.node->array->len) {
+		rr = rr_errf("index %zu out of range for array of length %zu", idx, arr.node->array->len);
+	}
+	if (rr.err != NULL) {
+		node_free(arr.node);
+		return rr;
+	}
+
+	Node *res = num_node(arr.node->array->data[idx]);
+	node_free(arr.node);
+	return rr_node(res);
+}
+
+RunResult builtin_f64_slice(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 3);
+
+	RunResult arr = run_array(scope, args[0]);
+	if (arr.err != NULL) {
+		return arr;
+	}
+
+	size_t from, to;
+	RunResult rr = run_index(scope, args[1], arr.node->array->len, &from);
+	if (rr.err == NULL) {
+		rr = run_index(scope, args[2], arr.node->array->len, &to);
+	}
+	if (rr.err == NULL && from > to) {
+		rr = rr_errf("slice start %zu is past its end %zu", from, to);
+	}
+	if (rr.err != NULL) {
+		node_free(arr.node);
+		return rr;
+	}
+
+	Node *res = array_node(f64_slice(arr.node->array, from, to));
+	node_free(arr.node);
+	return rr_node(res);
+}
+
+// Implements f64-sum, f64-min and f64-max.
+RunResult builtin_f64_reduce(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	EXPECT(==, 1);
+
+	RunResult arr = run_array(scope, args[0]);
+	if (arr.err != NULL) {
+		return arr;
+	}
+
+	const F64Kernels *k = f64_kernels();
+	const F64Array *a = arr.node->array;
+
+	RunResult res;
+	if (streq(name, "f64-sum")) {
+		res = rr_node(num_node(k->sum(a->data, a->len)));
+	} else if (a->len == 0) {
+		res = rr_errf("%s of an empty array", name);
+	} else if (streq(name, "f64-min")) {
+		res = rr_node(num_node(k->min(a->data, a->len)));
+	} else {
+		res = rr_node(num_node(k->max(a->data, a->len)));
+	}
+
+	node_free(arr.node);
+	return res;
+}
+
+RunResult builtin_f64_dot(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 2);
+
+	RunResult a = run_array(scope, args[0]);
+	if (a.err != NULL) {
+		return a;
+	}
+	RunResult b = run_array(scope, args[1]);
+	if (b.err != NULL) {
+		node_free(a.node);
+		return b;
+	}
+
+	RunResult res;
+	if (a.node->array->len != b.node->array->len) {
+		res = rr_errf("arrays have different lengths");
+	} else {
+		const double dot = f64_kernels()->dot(
+			a.node->array->data,
+			b.node->array->data,
+			a.node->array->len
+		);
+		res = rr_node(num_node(dot));
+	}
+
+	node_free(a.node);
+	node_free(b.node);
+	return res;
+}
+
+static bool f64op(char c, F64Op *op) {
+	switch (c) {
+	case '+': *op = F64_ADD; return true;
+	case '-': *op = F64_SUB; return true;
+	case '*': *op = F64_MUL; return true;
+	case '/': *op = F64_DIV; return true;
+	default: return false;
+	}
+}
+
+// Implements f64+, f64-, f64* and f64/. The second argument is either an array
+// of the same length or a number.
+RunResult builtin_f64_arith(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	EXPECT(==, 2);
+
+	F64Op op;
+	bool ok = f64op(name[3], &op);
+	assert(ok);
+
+	RunResult a = run_array(scope, args[0]);
+	if (a.err != NULL) {
+		return a;
+	}
+	RunResult b = takeArg(scope, args[1]);
+	if (b.err != NULL) {
+		node_free(a.node);
+		return b;
+	}
+
+	const F64Kernels *k = f64_kernels();
+	const F64Array *arr = a.node->array;
+	F64Array *out = f64_make(arr->len);
+
+	RunResult res = rr_node(array_node(out));
+	if (b.node != NULL && b.node->type == AST_NUM) {
+		k->scalarop[op](out->data, arr->data, b.node->num.val, arr->len);
+	} else if (b.node != NULL && b.node->type == AST_ARRAY) {
+		if (b.node->array->len != arr->len) {
+			node_free(res.node);
+			res = rr_errf("arrays have different lengths");
+		} else {
+			k->binop[op](out->data, arr->data, b.node->array->data, arr->len);
+		}
+	} else {
+		node_free(res.node);
+		res = rr_errf("expected an f64 array or a number");
+	}
+
+	node_free(a.node);
+	node_free(b.node);
+	return res;
+}
+
+// (f64-map arr fn [operand]) applies fn to every item of arr, passing operand
+// as the second argument if given. The arithmetic builtins are mapped with the
+// vectorized kernels, any other function is called for every item.
+RunResult builtin_f64_map(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(>=, 2);
+	EXPECT(<=, 3);
+
+	RunResult a = run_array(scope, args[0]);
+	if (a.err != NULL) {
+		return a;
+	}
+	RunResult fn = takeArg(scope, args[1]);
+	if (fn.err != NULL) {
+		node_free(a.node);
+		return fn;
+	} else if (fn.node == NULL || fn.node->type != AST_FUN) {
+		node_free(a.node);
+		node_free(fn.node);
+		return rr_errf("expected a function");
+	}
+	RunResult operand = rr_null();
+	if (nargs == 3) {
+		operand = run_num(scope, args[2]);
+		if (operand.err != NULL) {
+			node_free(a.node);
+			node_free(fn.node);
+			return operand;
+		}
+	}
+
+	const F64Array *arr = a.node->array;
+	F64Array *out = f64_make(arr->len);
+	RunResult res = rr_node(array_node(out));
+
+	const Function *f = &fn.node->function;
+	F64Op op;
+	if (
+		f->isBuiltin &&
+		f->fn == builtin_arith &&
+		operand.node != NULL &&
+		f64op(f->name[0], &op)
+	) {
+		f64_kernels()->scalarop[op](out->data, arr->data, operand.node->num.val, arr->len);
+	} else if (f->isBuiltin && f->fn == builtin_arith && operand.node != NULL) {
+		const double s = operand.node->num.val;
+		for (size_t i = 0; i < arr->len; i++) {
+			out->data[i] = f->name[0] == '^' ? pow(arr->data[i], s) : fmod(arr->data[i], s);
+		}
+	} else {
+		Node *item = num_node(0);
+		const Node *fnargs[] = { item, operand.node };
+		for (size_t i = 0; i < arr->len; i++) {
+			item->num.val = arr->data[i];
+			RunResult rr = callFunction(scope, fn.node, nargs - 1, fnargs);
+			if (rr.err == NULL && (rr.node == NULL || rr.node->type != AST_NUM)) {
+				node_free(rr.node);
+				rr = rr_errf("f64-map function should return a number");
+			}
+			if (rr.err != NULL) {
+				node_free(res.node);
+				res = rr;
+				break;
+			}
+			out->data[i] = rr.node->num.val;
+			node_free(rr.node);
+		}
+		node_free(item);
+	}
+
+	node_free(a.node);
+	node_free(fn.node);
+	node_free(operand.node);
+	return res;
+}
+
 void init_builtins_math(BuiltinList *ls) {
-	addBuiltin(ls, "+", builtin_arith);
-	addBuiltin(ls, "-", builtin_arith);
-	addBuiltin(ls, "/", builtin_arith);
-	addBuiltin(ls, "*", builtin_arith);
-	addBuiltin(ls, "^", builtin_arith);
-	addBuiltin(ls, "%", builtin_arith);
-
-	addBuiltin(ls, "==", builtin_comp);
-	addBuiltin(ls, "!=", builtin_comp);
-	addBuiltin(ls, "<", builtin_comp);
-	addBuiltin(ls, ">", builtin_comp);
-	addBuiltin(ls, "<=", builtin_comp);
-	addBuiltin(ls, ">=", builtin_comp);
-
-	addBuiltin(ls, "and", builtin_and_or);
-	addBuiltin(ls, "or", builtin_and_or);
+	addBuiltinFlags(ls, "+", builtin_arith, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "-", builtin_arith, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "/", builtin_arith, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "*", builtin_arith, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "^", builtin_arith, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "%", builtin_arith, BUILTIN_STRICT | BUILTIN_PURE);
+
+	addBuiltinFlags(ls, "==", builtin_comp, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "!=", builtin_comp, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "<", builtin_comp, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, ">", builtin_comp, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "<=", builtin_comp, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, ">=", builtin_comp, BUILTIN_STRICT | BUILTIN_PURE);
+
+	addBuiltinFlags(ls, "and", builtin_and_or, BUILTIN_PURE);
+	addBuiltinFlags(ls, "or", builtin_and_or, BUILTIN_PURE);
+
+	addBuiltinFlags(ls, "f64-array", builtin_f64_array, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-make", builtin_f64_make, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "list->f64", builtin_list_to_f64, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64->list", builtin_f64_to_list, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-length", builtin_f64_length, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-ref", builtin_f64_ref, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-slice", builtin_f64_slice, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-sum", builtin_f64_reduce, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-min", builtin_f64_reduce, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-max", builtin_f64_reduce, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-dot", builtin_f64_dot, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64+", builtin_f64_arith, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-", builtin_f64_arith, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64*", builtin_f64_arith, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64/", builtin_f64_arith, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "f64-map", builtin_f64_map, BUILTIN_STRICT);
 }
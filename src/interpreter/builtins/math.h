@@ -2,4 +2,8 @@
 
 #include "../builtins.h"
 
+// Compiled code evaluates these itself, see compile.c and jit.c.
+RunResult builtin_arith(Scope*, const char*, size_t, const Node**);
+RunResult builtin_comp(Scope*, const char*, size_t, const Node**);
+
 void init_builtins_math(BuiltinList*);
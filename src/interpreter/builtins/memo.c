@@ -0,0 +1,156 @@
+#include <math.h>
+
+#include "../../ast.h"
+#include "../../util.h"
+#include "../../stringify.h"
+#include "../../dict.h"
+#include "../interpreter.h"
+#include "../memo.h"
+#include "memo.h"
+
+static Node *symbol_node(const char *name) {
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_QUOTED;
+	node->quoted.node = makeVar(name);
+	return node;
+}
+
+// Makes a memoized copy of the user defined function fn, which has its own
+// cache. Copies of the new function share it.
+static Node *memoize(const Node *fn, size_t limit) {
+	const Lambda *src = fn->function.lambda;
+
+	Lambda *lambda = malloc(1, sizeof(Lambda));
+	*lambda = (Lambda){
+		.refs = 1,
+		.body = node_copy(src->body),
+		.memo = memo_make(limit),
+	};
+	lambda->args.len = src->args.len;
+	lambda->args.nodes = malloc(src->args.len, sizeof(Node*));
+	for (size_t i = 0; i < src->args.len; i++) {
+		lambda->args.nodes[i] = node_copy(src->args.nodes[i]);
+	}
+
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_FUN;
+	node->function.isBuiltin = false;
+	node->function.lambda = lambda;
+	return node;
+}
+
+// Runs the given node and checks that it results in a user defined function.
+static RunResult run_lambda(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_FUN || rr.node->function.isBuiltin) {
+		char *type = rr.node == NULL ? "nil" : typetostr(rr.node);
+		node_free(rr.node);
+		return rr_errf("expected a user defined function, got %s", type);
+	}
+	return rr;
+}
+
+// (memo fn [limit]) returns a memoized copy of fn, which keeps at most limit
+// results if it's given.
+RunResult builtin_memo(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(>=, 1);
+	EXPECT(<=, 2);
+
+	size_t limit = 0;
+	if (nargs == 2) {
+		RunResult rr = takeArg(scope, args[1]);
+		if (rr.err != NULL) {
+			return rr;
+		}
+		double val = rr.node != NULL && rr.node->type == AST_NUM ? rr.node->num.val : -1;
+		node_free(rr.node);
+		if (val < 1 || val != floor(val)) {
+			return rr_errf("expected the limit to be a positive integer");
+		}
+		limit = val;
+	}
+
+	RunResult fn = run_lambda(scope, args[0]);
+	if (fn.err != NULL) {
+		return fn;
+	}
+
+	Node *res = memoize(fn.node, limit);
+	node_free(fn.node);
+	return rr_node(res);
+}
+
+// (set-memo name (params) body...) defines a memoized function, like set.
+RunResult builtin_set_memo(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(>=, 3);
+	EXPECT_TYPE(0, AST_VAR);
+
+	RunResult fn = builtin_fun(scope, "fun", nargs - 1, args + 1);
+	if (fn.err != NULL) {
+		return fn;
+	}
+
+	// function values evaluate to themselves
+	Node *memoized = memoize(fn.node, 0);
+	node_free(fn.node);
+	const Node *setArgs[] = { args[0], memoized };
+	RunResult res = builtin_set(scope, "set", 2, setArgs);
+	node_free(memoized);
+	return res;
+}
+
+// (memo-stats fn) returns a dict with the number of cache hits and misses of
+// the memoized function fn, the number of cached results and the limit, which
+// is 0 if there's none.
+RunResult builtin_memo_stats(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult fn = run_lambda(scope, args[0]);
+	if (fn.err != NULL) {
+		return fn;
+	}
+
+	const Memo *memo = fn.node->function.lambda->memo;
+	if (memo == NULL) {
+		node_free(fn.node);
+		return rr_errf("expected a memoized function");
+	}
+	MemoStats stats = memo_stats(memo);
+	node_free(fn.node);
+
+	const struct {
+		const char *name;
+		size_t val;
+	} fields[] = {
+		{ "hits", stats.hits },
+		{ "misses", stats.misses },
+		{ "size", stats.size },
+		{ "limit", stats.limit },
+	};
+
+	Dict *dict = dict_make(false);
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		Dict *next = dict_put(dict, symbol_node(fields[i].name), num_node(fields[i].val));
+		dict_release(dict);
+		dict = next;
+	}
+
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_DICT;
+	node->dict = dict;
+	return rr_node(node);
+}
+
+void init_builtins_memo(BuiltinList *ls) {
+	addBuiltinFlags(ls, "memo", builtin_memo, BUILTIN_STRICT);
+	addBuiltin(ls, "set-memo", builtin_set_memo);
+	addBuiltinFlags(ls, "memo-stats", builtin_memo_stats, BUILTIN_STRICT);
+}
@@ -0,0 +1,380 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../../ast.h"
+#include "../../util.h"
+#include "../future.h"
+#include "../image.h"
+#include "../interpreter.h"
+#include "../isolate.h"
+#include "../iter.h"
+#include "../pool.h"
+#include "parallel.h"
+
+// pmap, pfilter and preduce split a sequence into chunks, which the workers of
+// the pool evaluate in isolates of their own: every worker that gets a chunk
+// starts with copies of the caller's variables and function, like spawn does.
+// The results are put together in order on the calling thread, so they don't
+// depend on which worker ran what.
+
+typedef enum ParOp {
+	PAR_MAP,
+	PAR_FILTER,
+	PAR_REDUCE,
+} ParOp;
+
+typedef struct Par {
+	ParOp op;
+
+	// the caller's, which the workers only read
+	const Scope *scope;
+	// the image of its root scope, which the workers start from
+	const Image *image;
+	const Node *fn;
+	const Iter *items;
+	size_t chunk;
+
+	// MAP: the result of every item, REDUCE: the result of every chunk
+	Node **results;
+	// FILTER: whether every item is kept
+	bool *keep;
+
+	// the index of the first item that failed and its error, chunks after it
+	// are skipped
+	atomic_size_t errAt;
+	pthread_mutex_t lock;
+	char *err;
+} Par;
+
+// The isolate of a worker for the duration of a job.
+typedef struct Worker {
+	Scope *root;
+	Node *fn;
+} Worker;
+
+static bool truthy(const Node *node) {
+	if (node == NULL) {
+		return false;
+	} else if (node->type == AST_NUM) {
+		return node->num.val != 0;
+	}
+	return true;
+}
+
+static void *par_enter(void *ctx) {
+	const Par *par = ctx;
+	Worker *w = malloc(1, sizeof(Worker));
+	w->root = image_scope(par->image);
+	isolate_import(w->root, par->scope);
+	// the caller made sure this works
+	w->fn = isolate_transfer(par->fn).node;
+	return w;
+}
+
+static void par_leave(void *ctx, void *state) {
+	(void)ctx;
+	Worker *w = state;
+	node_free(w->fn);
+	scope_free(w->root);
+	free(w);
+}
+
+// Keeps the error if it's the first one in order.
+static void fail(Par *par, size_t i, char *err) {
+	pthread_mutex_lock(&par->lock);
+	if (i < atomic_load(&par->errAt)) {
+		free(par->err);
+		par->err = err;
+		atomic_store(&par->errAt, i);
+	} else {
+		free(err);
+	}
+	pthread_mutex_unlock(&par->lock);
+}
+
+// Makes a copy of item i that belongs to the worker.
+static RunResult par_item(const Par *par, size_t i) {
+	double val;
+	if (iter_num(par->items, i, &val)) {
+		return rr_node(num_node(val));
+	}
+	RunResult rr = isolate_transfer(iter_peek(par->items, i));
+	if (rr.err == NULL) {
+		rr.node = iter_item(rr.node);
+	}
+	return rr;
+}
+
+// Hands a result of the worker over to the caller.
+static bool par_result(Par *par, size_t i, RunResult rr, Node **out) {
+	if (rr.err != NULL) {
+		fail(par, i, rr.err);
+		return false;
+	}
+
+	RunResult res = isolate_transfer(rr.node);
+	node_free(rr.node);
+	if (res.err != NULL) {
+		fail(par, i, res.err);
+		return false;
+	}
+	*out = res.node == NULL ? makeVar("nil") : res.node;
+	return true;
+}
+
+static void par_run(void *ctx, void *state, size_t chunk) {
+	Par *par = ctx;
+	Worker *w = state;
+
+	const size_t from = chunk * par->chunk;
+	const size_t to = from + par->chunk < par->items->len ? from + par->chunk : par->items->len;
+	if (atomic_load(&par->errAt) < from) {
+		return;
+	}
+
+	Node *acc = NULL;
+	for (size_t i = from; i < to; i++) {
+		RunResult item = par_item(par, i);
+		if (item.err != NULL) {
+			fail(par, i, item.err);
+			node_free(acc);
+			return;
+		}
+
+		switch (par->op) {
+		case PAR_MAP: {
+			RunResult rr = callFunctionMoved(w->root, w->fn, 1, &item.node);
+			if (!par_result(par, i, rr, &par->results[i])) {
+				return;
+			}
+			break;
+		}
+
+		case PAR_FILTER: {
+			RunResult rr = callFunction(w->root, w->fn, 1, (const Node**)&item.node);
+			node_free(item.node);
+			if (rr.err != NULL) {
+				fail(par, i, rr.err);
+				return;
+			}
+			par->keep[i] = truthy(rr.node);
+			node_free(rr.node);
+			break;
+		}
+
+		case PAR_REDUCE:
+			if (i == from) {
+				acc = item.node;
+				break;
+			}
+
+			Node *fnargs[] = { acc, item.node };
+			RunResult rr = callFunctionMoved(w->root, w->fn, 2, fnargs);
+			if (rr.err != NULL) {
+				fail(par, i, rr.err);
+				return;
+			}
+			acc = rr.node;
+			break;
+		}
+	}
+
+	if (par->op == PAR_REDUCE) {
+		par_result(par, from, rr_node(acc), &par->results[chunk]);
+	}
+}
+
+// Runs the chunks of par on the pool, or on this thread if it's a worker
+// itself or there's just one chunk. Returns the error of the first item that
+// failed.
+static char *par_start(Par *par, size_t nchunks) {
+	atomic_init(&par->errAt, SIZE_MAX);
+	pthread_mutex_init(&par->lock, NULL);
+	par->err = NULL;
+
+	PoolJob job = {
+		.ctx = par,
+		.nchunks = nchunks,
+		.enter = par_enter,
+		.run = par_run,
+		.leave = par_leave,
+	};
+	if (pool_worker() || nchunks == 1) {
+		void *state = par_enter(par);
+		for (size_t i = 0; i < nchunks; i++) {
+			par_run(par, state, i);
+		}
+		par_leave(par, state);
+	} else {
+		pool_run(&job);
+	}
+
+	pthread_mutex_destroy(&par->lock);
+	return par->err;
+}
+
+// Implements (pmap seq fn [chunk]), (pfilter seq fn [chunk]) and
+// (preduce seq init fn [chunk]). fn has to be associative for preduce, the
+// result of every chunk is folded into init in order.
+static RunResult parallel(Scope *scope, ParOp op, size_t nargs, const Node **args) {
+	const size_t nfixed = op == PAR_REDUCE ? 3 : 2;
+	EXPECT(>=, nfixed);
+	EXPECT(<=, nfixed + 1);
+
+	Iter it;
+	RunResult rr = iter_run(scope, args[0], &it);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	Node *vals[3] = { NULL, NULL, NULL };
+	for (size_t i = 1; i < nargs; i++) {
+		rr = takeArg(scope, args[i]);
+		if (rr.err != NULL) {
+			goto exit;
+		}
+		vals[i - 1] = rr.node;
+	}
+
+	const Node *fn = vals[nfixed - 2];
+	const Node *init = op == PAR_REDUCE ? vals[0] : NULL;
+	const Node *chunkNode = nargs > nfixed ? vals[nfixed - 1] : NULL;
+	if (fn == NULL || fn->type != AST_FUN) {
+		rr = rr_errf("expected a function");
+		goto exit;
+	} else if (chunkNode != NULL && (chunkNode->type != AST_NUM || chunkNode->num.val < 1)) {
+		rr = rr_errf("expected the chunk size to be a positive number");
+		goto exit;
+	}
+
+	// every worker copies fn, check that that works before they start
+	rr = isolate_transfer(fn);
+	if (rr.err != NULL) {
+		goto exit;
+	}
+	node_free(rr.node);
+
+	if (it.len == 0) {
+		rr = rr_node(op == PAR_REDUCE ? node_copy(init) : mkQuotedExpr(0));
+		goto exit;
+	}
+
+	// a few chunks per worker by default, so stealing can even things out
+	size_t chunk = chunkNode != NULL
+		? chunkNode->num.val
+		: (it.len + pool_size() * 4 - 1) / (pool_size() * 4);
+	if (it.len / chunk >= UINT32_MAX) {
+		chunk = it.len / (UINT32_MAX - 1) + 1;
+	}
+	const size_t nchunks = (it.len + chunk - 1) / chunk;
+
+	Par par = {
+		.op = op,
+		.scope = scope,
+		.image = scope_get_root(scope)->image,
+		.fn = fn,
+		.items = &it,
+		.chunk = chunk,
+		.results = op == PAR_FILTER ? NULL : calloc(op == PAR_MAP ? it.len : nchunks, sizeof(Node*)),
+		.keep = op == PAR_FILTER ? calloc(it.len, sizeof(bool)) : NULL,
+	};
+	char *err = par_start(&par, nchunks);
+
+	if (err != NULL) {
+		rr = rr_err(err);
+	} else if (op == PAR_MAP) {
+		Node *res = mkQuotedExpr(it.len);
+		for (size_t i = 0; i < it.len; i++) {
+			res->quoted.node->expr.nodes[i] = par.results[i];
+			par.results[i] = NULL;
+		}
+		rr = rr_node(res);
+	} else if (op == PAR_FILTER) {
+		size_t count = 0;
+		for (size_t i = 0; i < it.len; i++) {
+			count += par.keep[i];
+		}
+		Node *res = mkQuotedExpr(count);
+		for (size_t i = 0, j = 0; i < it.len; i++) {
+			if (par.keep[i]) {
+				res->quoted.node->expr.nodes[j++] = iter_take(&it, i);
+			}
+		}
+		rr = rr_node(res);
+	} else {
+		// fold the chunks into init on this thread, with the caller's fn
+		Node *acc = node_copy(init);
+		rr = rr_null();
+		for (size_t i = 0; i < nchunks; i++) {
+			Node *fnargs[] = { acc, par.results[i] };
+			par.results[i] = NULL;
+			rr = callFunctionMoved(scope, fn, 2, fnargs);
+			if (rr.err != NULL) {
+				break;
+			}
+			acc = rr.node;
+		}
+	}
+
+	if (par.results != NULL) {
+		for (size_t i = 0; i < (op == PAR_MAP ? it.len : nchunks); i++) {
+			node_free(par.results[i]);
+		}
+	}
+	free(par.results);
+	free(par.keep);
+
+exit:
+	for (size_t i = 0; i < 3; i++) {
+		node_free(vals[i]);
+	}
+	iter_free(&it);
+	return rr;
+}
+
+RunResult builtin_pmap(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	return parallel(scope, PAR_MAP, nargs, args);
+}
+
+RunResult builtin_pfilter(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	return parallel(scope, PAR_FILTER, nargs, args);
+}
+
+RunResult builtin_preduce(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	return parallel(scope, PAR_REDUCE, nargs, args);
+}
+
+// (future expr) evaluates expr on a worker, see future.h.
+RunResult builtin_future(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+	return future_make(scope, args[0]);
+}
+
+// (touch x) waits for the value of the future x. Values that aren't futures
+// are their own value, so code can take either.
+RunResult builtin_touch(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(==, 1);
+
+	RunResult rr = takeArg(scope, args[0]);
+	if (rr.err != NULL || rr.node == NULL || rr.node->type != AST_FUTURE) {
+		return rr;
+	}
+
+	RunResult res = future_touch(rr.node->future);
+	node_free(rr.node);
+	return res;
+}
+
+void init_builtins_parallel(BuiltinList *ls) {
+	addBuiltinFlags(ls, "pmap", builtin_pmap, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "pfilter", builtin_pfilter, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "preduce", builtin_preduce, BUILTIN_STRICT);
+	addBuiltin(ls, "future", builtin_future);
+	addBuiltinFlags(ls, "touch", builtin_touch, BUILTIN_STRICT);
+}
@@ -1,9 +1,19 @@
+#define _GNU_SOURCE
+
 #include <strings.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include "../../ast.h"
 #include "../../util.h"
+#include "../coro.h"
+#include "../image.h"
 #include "../interpreter.h"
+#include "../output.h"
 #include "../../stringify.h"
+#include "coroutines.h"
 #include "stdio.h"
 
 static char *nodesToStrings(Scope *scope, size_t nargs, const Node **args, char **output) {
@@ -11,56 +21,208 @@ static char *nodesToStrings(Scope *scope, size_t nargs, const Node **args, char
 		const Node *node = args[i];
 		assert(node);
 
-		RunResult rr = run(scope, node);
+		RunResult rr = takeArg(scope, node);
 		if (rr.err != NULL) {
 			return rr.err;
 		}
 
 		output[i] = toString(rr.node);
+		node_free(rr.node);
 	}
 
 	return NULL;
 }
 
-static bool isQuoted(const Node *node, const char *str) {
-	return (
-		node->type == AST_QUOTED &&
-		node->quoted.node->type == AST_VAR &&
-		streq(node->quoted.node->var.name, str)
-	);
+// Prints the values of args to the sink of fd, separated by spaces and ended
+// by a newline, unless the first argument is 'raw, which does neither.
+static RunResult print(Scope *scope, int fd, size_t nargs, const Node **args) {
+	// TODO: raw mode should do more
+	const bool rawMode = nargs > 0 && isQuoted(args[0], "raw");
+	const size_t start = rawMode ? 1 : 0;
+
+	// everything is evaluated first, so what's printed isn't mixed with what
+	// the arguments print
+	Node **vals = calloc(nargs, sizeof(Node*));
+	RunResult res = rr_null();
+	for (size_t i = start; i < nargs && res.err == NULL; i++) {
+		res = takeArg(scope, args[i]);
+		vals[i] = res.node;
+	}
+
+	char *err = NULL;
+	Output *out = res.err == NULL ? output_lock(fd, &err) : NULL;
+	if (out != NULL) {
+		for (size_t i = start; i < nargs && err == NULL; i++) {
+			if (i != start) {
+				err = output_write(out, " ", 1);
+			}
+			if (err == NULL) {
+				err = output_value(out, vals[i]);
+			}
+		}
+		if (err == NULL && !rawMode) {
+			err = output_write(out, "\n", 1);
+		}
+
+		char *unlockErr = output_unlock(out);
+		if (err == NULL) {
+			err = unlockErr;
+		} else {
+			free(unlockErr);
+		}
+	}
+	if (res.err == NULL) {
+		res = err != NULL ? rr_err(err) : rr_null();
+	}
+
+	for (size_t i = 0; i < nargs; i++) {
+		node_free(vals[i]);
+	}
+	free(vals);
+	return res;
 }
 
 RunResult builtin_print(Scope *scope, const char *name, size_t nargs, const Node **args) {
 	(void)name;
+	return print(scope, STDOUT_FILENO, nargs, args);
+}
 
-	RunResult res;
-	char **strings = malloc(nargs, sizeof(char*));
-	char *err = nodesToStrings(scope, nargs, args, strings);
+// (print-to fd ...) prints like print, to fd.
+RunResult builtin_print_to(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 1);
 
-	// TODO: raw mode should do more
-	bool rawMode = nargs > 0 && isQuoted(args[0], "raw");
+	int fd;
+	RunResult rr = run_fd(scope, args[0], &fd);
+	if (rr.err != NULL) {
+		return rr;
+	}
+	return print(scope, fd, nargs - 1, args + 1);
+}
 
-	if (err != NULL) {
-		res = rr_errf(err);
-	} else {
-		size_t start = rawMode ? 1 : 0;
-		for (size_t i = start; i < nargs; i++) {
-			if (i != start) {
-				putchar(' ');
-			}
+// (flush) writes what's buffered for standard output, (flush fd) for fd.
+RunResult builtin_flush(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(<=, 1);
+
+	int fd = STDOUT_FILENO;
+	if (nargs == 1) {
+		RunResult rr = run_fd(scope, args[0], &fd);
+		if (rr.err != NULL) {
+			return rr;
+		}
+	}
+	char *err = output_flush(fd);
+	return err != NULL ? rr_err(err) : rr_null();
+}
+
+// Runs the mode and size of open-output and buffer-output, which start at
+// args[0], if they're there.
+static RunResult run_mode(Scope *scope, size_t nargs, const Node **args, OutputMode *mode, size_t *size) {
+	RunResult rr = nargs > 0 ? takeArg(scope, args[0]) : rr_null();
+	if (rr.err != NULL) {
+		return rr;
+	}
 
-			printf("%s", strings[i]);
-			free(strings[i]);
+	static const char *const modes[] = {
+		[OUTPUT_LINE] = "line",
+		[OUTPUT_BLOCK] = "block",
+		[OUTPUT_EXPLICIT] = "explicit",
+	};
+	bool found = false;
+	for (size_t i = 0; rr.node != NULL && i < sizeof(modes) / sizeof(modes[0]); i++) {
+		if (isQuoted(rr.node, modes[i])) {
+			*mode = i;
+			found = true;
 		}
+	}
+	node_free(rr.node);
+	if (nargs > 0 && !found) {
+		return rr_errf("expected 'line, 'block or 'explicit");
+	}
 
-		if (!rawMode) {
-			putchar('\n');
+	rr = nargs > 1 ? takeArg(scope, args[1]) : rr_null();
+	if (rr.err != NULL) {
+		return rr;
+	} else if (nargs > 1) {
+		const bool ok = rr.node != NULL && rr.node->type == AST_NUM && rr.node->num.val >= 1 && rr.node->num.val <= 1 << 30;
+		*size = ok ? rr.node->num.val : 0;
+		node_free(rr.node);
+		if (!ok) {
+			return rr_errf("expected a buffer size");
 		}
-		res = rr_null();
 	}
+	return rr_null();
+}
 
-	free(strings);
-	return res;
+// (open-output path) opens the file at path for writing, emptying it, and
+// returns its file descriptor. (open-output path mode size) buffers it like
+// buffer-output says.
+RunResult builtin_open_output(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 1);
+	EXPECT(<=, 3);
+
+	RunResult rr = takeArg(scope, args[0]);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_STR) {
+		node_free(rr.node);
+		return rr_errf("expected a path");
+	}
+	char *path = astrcpy(rr.node->str.str);
+	node_free(rr.node);
+
+	OutputMode mode = OUTPUT_BLOCK;
+	size_t size = 0;
+	rr = run_mode(scope, nargs - 1, args + 1, &mode, &size);
+	if (rr.err != NULL) {
+		free(path);
+		return rr;
+	}
+
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		rr = rr_errf("couldn't open %s: %s", path, strerror(errno));
+		free(path);
+		return rr;
+	}
+	free(path);
+
+	// a descriptor that was closed may have left a sink behind, which isn't
+	// written into the new file
+	output_discard(fd);
+	char *err = output_set_mode(fd, mode, size);
+	if (err != NULL) {
+		close(fd);
+		return rr_err(err);
+	}
+	return rr_node(num_node(fd));
+}
+
+// (buffer-output fd mode) sets how what's printed to fd is buffered: 'line
+// writes it after every line, 'block when the buffer is full, and 'explicit
+// only when it's flushed. (buffer-output fd mode size) also gives the buffer
+// size bytes.
+RunResult builtin_buffer_output(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+	EXPECT(>=, 2);
+	EXPECT(<=, 3);
+
+	int fd;
+	RunResult rr = run_fd(scope, args[0], &fd);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	OutputMode mode;
+	size_t size = 0;
+	rr = run_mode(scope, nargs - 1, args + 1, &mode, &size);
+	if (rr.err != NULL) {
+		return rr;
+	}
+	char *err = output_set_mode(fd, mode, size);
+	return err != NULL ? rr_err(err) : rr_null();
 }
 
 RunResult builtin_input(Scope *scope, const char *name, size_t nargs, const Node **args) {
@@ -70,15 +232,16 @@ RunResult builtin_input(Scope *scope, const char *name, size_t nargs, const Node
 
 	EXPECT(==, 0);
 
-	char *line = NULL;
-	size_t len = 0;
-	getline(&line, &len, stdin);
-
-	Node *res = malloc(1, sizeof(Node));
-	res->type = AST_STR;
-	res->str.str = line;
-	res->str.size = len;
-	return rr_node(res);
+	// through the event loop, so other coroutines run while it waits
+	RunResult rr = coro_read_line(STDIN_FILENO, true);
+	if (rr.err == NULL && rr.node == NULL) {
+		Node *res = malloc(1, sizeof(Node));
+		res->type = AST_STR;
+		res->str.str = astrcpy("");
+		res->str.size = 0;
+		rr = rr_node(res);
+	}
+	return rr;
 }
 
 RunResult builtin_load(Scope *scope, const char *name, size_t nargs, const Node **args) {
@@ -87,7 +250,17 @@ RunResult builtin_load(Scope *scope, const char *name, size_t nargs, const Node
 
 	RunResult res;
 	char **files = malloc(nargs, sizeof(char*));
-	nodesToStrings(scope, nargs, args, files);
+	char *err = nodesToStrings(scope, nargs, args, files);
+	if (err != NULL) {
+		free(files);
+		res = rr_errf("%s", err);
+		free(err);
+		return res;
+	} else if (image_has(scope_get_root(scope)->image, files[0])) {
+		free(files[0]);
+		free(files);
+		return rr_null();
+	}
 
 	char *input;
 	for (int i = 0; i < 2; i++) {
@@ -115,14 +288,22 @@ RunResult builtin_load(Scope *scope, const char *name, size_t nargs, const Node
 		res = rr_errf("error while reading file");
 	} else {
 		res = runProgram(input, scope, true);
+		if (res.err == NULL) {
+			image_loaded(files[0]);
+		}
 	}
 
+	free(files[0]);
 	free(files);
 	return res;
 }
 
 void init_builtins_stdio(BuiltinList *ls) {
 	addBuiltin(ls, "print", builtin_print);
-	addBuiltin(ls, "input", builtin_input);
-	addBuiltin(ls, "load", builtin_load);
+	addBuiltin(ls, "print-to", builtin_print_to);
+	addBuiltinFlags(ls, "flush", builtin_flush, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "open-output", builtin_open_output, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "buffer-output", builtin_buffer_output, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "input", builtin_input, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "load", builtin_load, BUILTIN_STRICT);
 }
@@ -2,4 +2,13 @@
 
 #include "../builtins.h"
 
+// Evaluates all of its arguments, except for a leading 'raw.
+RunResult builtin_print(Scope*, const char*, size_t, const Node**);
+// Evaluates all of its arguments, except for a 'raw after the first.
+RunResult builtin_print_to(Scope*, const char*, size_t, const Node**);
+
+// Runs src/<lib>.schym, or src/examples<lib>.schym, in the scope, unless the
+// image of the scope has the library already.
+RunResult builtin_load(Scope*, const char*, size_t, const Node**);
+
 void init_builtins_stdio(BuiltinList*);
@@ -11,12 +11,16 @@ static char *nodesToStrings(Scope *scope, size_t nargs, const Node **args, char
 		const Node *node = args[i];
 		assert(node);
 
-		RunResult rr = run(scope, node);
+		RunResult rr = takeArg(scope, node);
 		if (rr.err != NULL) {
+			for (size_t j = 0; j < i; j++) {
+				free(output[j]);
+			}
 			return rr.err;
 		}
 
 		output[i] = toString(rr.node);
+		node_free(rr.node);
 	}
 
 	return NULL;
@@ -27,26 +31,36 @@ RunResult builtin_streq(Scope *scope, const char *name, size_t nargs, const Node
 
 	EXPECT(==, 2);
 
-	Node *res = malloc(1, sizeof(Node));
-	res->type = AST_NUM;
-
 	// TODO: using `run` copies the string, so making the intern equality check
 	// always ending up being `false`, should find something for that.
-	RunResult rr1 = run(scope, args[0]);
-	RunResult rr2 = run(scope, args[1]);
+	RunResult rr1 = takeArg(scope, args[0]);
+	if (rr1.err != NULL) {
+		return rr1;
+	}
+	RunResult rr2 = takeArg(scope, args[1]);
+	if (rr2.err != NULL) {
+		node_free(rr1.node);
+		return rr2;
+	}
 
 	if (
-		(rr1.node->type != AST_STR) ||
-		(rr2.node->type != AST_STR)
+		rr1.node == NULL || rr1.node->type != AST_STR ||
+		rr2.node == NULL || rr2.node->type != AST_STR
 	) {
+		node_free(rr1.node);
+		node_free(rr2.node);
 		return rr_errf("both arguments should be a string");
 	}
 
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_NUM;
 	res->num.val = (
 		rr1.node->str.str == rr2.node->str.str ||
 		streq(rr1.node->str.str, rr2.node->str.str)
 	);
 
+	node_free(rr1.node);
+	node_free(rr2.node);
 	return rr_node(res);
 }
 
@@ -83,23 +97,27 @@ RunResult builtin_to_number(Scope *scope, const char *name, size_t nargs, const
 	(void)name;
 
 	EXPECT(==, 1);
-	RunResult rr = run(scope, args[0]);
+	RunResult rr = takeArg(scope, args[0]);
 	if (rr.err != NULL) {
 		return rr;
 	}
 
 	switch (rr.node->type) {
 	case AST_NUM:
-		return rr_node(node_copy(rr.node));
+		return rr;
 
 	case AST_STR: {
 		ParseResult pr = parse(rr.node->str.str);
 		assert(pr.err == NULL && pr.node != NULL && pr.node->type == AST_NUM);
+		node_free(rr.node);
 		return rr_node(pr.node);
 	}
 
-	default:
-		return rr_errf("expected string or number, got %s", typetostr(rr.node));
+	default: {
+		RunResult err = rr_errf("expected string or number, got %s", typetostr(rr.node));
+		node_free(rr.node);
+		return err;
+	}
 	}
 }
 
@@ -108,7 +126,7 @@ RunResult builtin_to_string(Scope *scope, const char *name, size_t nargs, const
 	(void)name;
 
 	EXPECT(==, 1);
-	RunResult rr = run(scope, args[0]);
+	RunResult rr = takeArg(scope, args[0]);
 	if (rr.err != NULL) {
 		return rr;
 	}
@@ -124,8 +142,8 @@ RunResult builtin_to_string(Scope *scope, const char *name, size_t nargs, const
 }
 
 void init_builtins_strings(BuiltinList *ls) {
-	addBuiltin(ls, "streq", builtin_streq);
-	addBuiltin(ls, "concat", builtin_concat);
-	addBuiltin(ls, "to-number", builtin_to_number);
-	addBuiltin(ls, "to-string", builtin_to_string);
+	addBuiltinFlags(ls, "streq", builtin_streq, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "concat", builtin_concat, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "to-number", builtin_to_number, BUILTIN_STRICT | BUILTIN_PURE);
+	addBuiltinFlags(ls, "to-string", builtin_to_string, BUILTIN_STRICT | BUILTIN_PURE);
 }
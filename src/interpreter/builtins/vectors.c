@@ -0,0 +1,224 @@
+#include <math.h>
+#include "../../ast.h"
+#include "../../util.h"
+#include "../../vector.h"
+#include "../../stringify.h"
+#include "../interpreter.h"
+#include "vectors.h"
+
+static Node *vector_node(Vector *vec) {
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_VECTOR;
+	node->vector = vec;
+	return node;
+}
+
+// Runs the given node and checks that it results in a vector.
+static RunResult run_vector(Scope *scope, const Node *node) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (rr.node == NULL || rr.node->type != AST_VECTOR) {
+		char *type = rr.node == NULL ? "nil" : typetostr(rr.node);
+		node_free(rr.node);
+		return rr_errf("expected a vector, got %s", type);
+	}
+	return rr;
+}
+
+// Runs the given node and checks that it results in a valid index in vec.
+// The index is stored in idx.
+static char *run_index(Scope *scope, const Node *node, const Vector *vec, size_t *idx) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr.err;
+	} else if (rr.node == NULL || rr.node->type != AST_NUM) {
+		node_free(rr.node);
+		return rr_errf("expected index to be a number").err;
+	}
+
+	double val = rr.node->num.val;
+	node_free(rr.node);
+
+	if (val < 0 || val != floor(val) || val >= vector_length(vec)) {
+		return rr_errf("index %g out of range for vector of length %zu", val, vector_length(vec)).err;
+	}
+
+	*idx = val;
+	return NULL;
+}
+
+RunResult builtin_vector(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	Node **items = malloc(nargs, sizeof(Node*));
+	for (size_t i = 0; i < nargs; i++) {
+		RunResult rr = takeArg(scope, args[i]);
+		if (rr.err != NULL) {
+			for (size_t j = 0; j < i; j++) {
+				node_free(items[j]);
+			}
+			free(items);
+			return rr;
+		} else if (rr.node == NULL) {
+			rr.node = makeVar("nil");
+		}
+		items[i] = rr.node;
+	}
+
+	Vector *vec = vector_from_array((const Node**)items, nargs);
+	for (size_t i = 0; i < nargs; i++) {
+		node_free(items[i]);
+	}
+	free(items);
+
+	return rr_node(vector_node(vec));
+}
+
+RunResult builtin_vector_ref(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 2);
+
+	RunResult vec = run_vector(scope, args[0]);
+	if (vec.err != NULL) {
+		return vec;
+	}
+
+	size_t idx;
+	char *err = run_index(scope, args[1], vec.node->vector, &idx);
+	if (err != NULL) {
+		node_free(vec.node);
+		return (RunResult){ .node = NULL, .err = err };
+	}
+
+	const Node *item = vector_get(vec.node->vector, idx);
+	Node *res = NULL;
+	if (item->type != AST_VAR) { // nil is stored as a variable named nil
+		res = node_copy(item);
+	}
+
+	node_free(vec.node);
+	return rr_node(res);
+}
+
+RunResult builtin_vector_set(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 3);
+
+	RunResult vec = run_vector(scope, args[0]);
+	if (vec.err != NULL) {
+		return vec;
+	}
+
+	size_t idx;
+	char *err = run_index(scope, args[1], vec.node->vector, &idx);
+	if (err != NULL) {
+		node_free(vec.node);
+		return (RunResult){ .node = NULL, .err = err };
+	}
+
+	RunResult val = takeArg(scope, args[2]);
+	if (val.err != NULL) {
+		node_free(vec.node);
+		return val;
+	} else if (val.node == NULL) {
+		val.node = makeVar("nil");
+	}
+
+	Vector *res = vector_set(vec.node->vector, idx, val.node);
+	node_free(vec.node);
+	return rr_node(vector_node(res));
+}
+
+RunResult builtin_vector_push(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 2);
+
+	RunResult vec = run_vector(scope, args[0]);
+	if (vec.err != NULL) {
+		return vec;
+	}
+
+	RunResult val = takeArg(scope, args[1]);
+	if (val.err != NULL) {
+		node_free(vec.node);
+		return val;
+	} else if (val.node == NULL) {
+		val.node = makeVar("nil");
+	}
+
+	Vector *res = vector_push(vec.node->vector, val.node);
+	node_free(vec.node);
+	return rr_node(vector_node(res));
+}
+
+RunResult builtin_vector_length(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult vec = run_vector(scope, args[0]);
+	if (vec.err != NULL) {
+		return vec;
+	}
+
+	Node *res = num_node(vector_length(vec.node->vector));
+	node_free(vec.node);
+	return rr_node(res);
+}
+
+RunResult builtin_list_to_vector(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult list = takeArg(scope, args[0]);
+	if (list.err != NULL) {
+		return list;
+	} else if (
+		list.node == NULL ||
+		list.node->type != AST_QUOTED ||
+		list.node->quoted.node->type != AST_EXPR
+	) {
+		node_free(list.node);
+		return rr_errf("expected list");
+	}
+
+	const Expression *expr = &list.node->quoted.node->expr;
+	Vector *vec = vector_from_array((const Node**)expr->nodes, expr->len);
+	node_free(list.node);
+	return rr_node(vector_node(vec));
+}
+
+RunResult builtin_vector_to_list(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	(void)name;
+
+	EXPECT(==, 1);
+
+	RunResult vec = run_vector(scope, args[0]);
+	if (vec.err != NULL) {
+		return vec;
+	}
+
+	size_t len = vector_length(vec.node->vector);
+	Node *res = mkQuotedExpr(len);
+	for (size_t i = 0; i < len; i++) {
+		res->quoted.node->expr.nodes[i] = node_copy(vector_get(vec.node->vector, i));
+	}
+
+	node_free(vec.node);
+	return rr_node(res);
+}
+
+void init_builtins_vectors(BuiltinList *ls) {
+	addBuiltinFlags(ls, "vector", builtin_vector, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "vector-ref", builtin_vector_ref, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "vector-set", builtin_vector_set, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "vector-push", builtin_vector_push, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "vector-length", builtin_vector_length, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "list->vector", builtin_list_to_vector, BUILTIN_STRICT);
+	addBuiltinFlags(ls, "vector->list", builtin_vector_to_list, BUILTIN_STRICT);
+}
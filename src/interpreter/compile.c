@@ -0,0 +1,972 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "compile.h"
+#include "../ast_manip.h"
+#include "../stringify.h"
+#include "../util.h"
+#include "./builtins.h"
+#include "./jit.h"
+#include "./memo.h"
+#include "builtins/math.h"
+
+typedef struct Ctx {
+	Scope *scope;
+	char *err;
+
+	// A tail call to a user function, for code_run to make.
+	Node *tailFn;
+	Node **tailVals;
+	size_t tailNargs;
+
+	// the values of the parameters, in numeric bodies
+	const double *nums;
+} Ctx;
+
+typedef struct Closure Closure;
+
+// Closures return an owned value, or set ctx->err and return NULL.
+typedef Node *(*ClosureFn)(const Closure*, Ctx*);
+// The same for closures in numeric bodies that are known to give a number, so
+// that it doesn't have to be boxed.
+typedef double (*NumFn)(const Closure*, Ctx*);
+
+struct Closure {
+	ClosureFn fn;
+	NumFn num;
+	// the node the closure was compiled from, used by the fallbacks
+	const Node *node;
+
+	// variables: the name; calls to builtins: the resolved builtin, which
+	// is only valid while its name hasn't been bound as a variable
+	const char *name;
+	Function builtin;
+	const size_t *bindings;
+
+	// literals
+	Node *value;
+	// parameters in numeric bodies: the index in ctx->nums
+	size_t slot;
+	// let blocks: the number of bindings, whose values are the first items
+	size_t nbound;
+
+	// operands, or the function and its arguments for calls
+	size_t len;
+	Closure **items;
+};
+
+// Functions whose parameters can be numbers get a second body, compiled with
+// the parameters read as doubles and arithmetic, comparisons, do, if and cond
+// passing doubles between them. It's used for calls where all arguments are
+// numbers, the others run the generic body.
+//
+// The numeric body is only valid while none of the builtins it resolved have
+// been bound as variables, which is checked before it's run.
+struct Code {
+	Closure *body;
+	Closure *numBody;
+
+	const size_t **guards;
+	size_t nguards;
+};
+
+// Functions with more parameters don't get a numeric body.
+#define MAX_NUM_PARAMS 8
+
+// For what closures and code_run do besides running their operands, like
+// falling back when a builtin was rebound, failing, and unboxing. Out of line
+// it takes no room in the C frames of a recursion through compiled code.
+#define NOINLINE __attribute__((noinline))
+
+static Node *take(Ctx *ctx, RunResult rr) {
+	while (rr.err == NULL && rr.tail != NULL) {
+		rr = run(ctx->scope, rr.tail);
+	}
+	if (rr.err != NULL) {
+		ctx->err = rr.err;
+		return NULL;
+	}
+	return rr.node;
+}
+
+NOINLINE static Node *run_generic(const Closure *c, Ctx *ctx) {
+	return take(ctx, run(ctx->scope, c->node));
+}
+
+static Node *run_const(const Closure *c, Ctx *ctx) {
+	(void)ctx;
+	return node_copy(c->value);
+}
+
+// Parameters are bound in the frame itself, unless they were set to nil.
+static Node *run_local(const Closure *c, Ctx *ctx) {
+	const Node *val = varmap_getItem(ctx->scope->variables, c->name);
+	if (val != NULL) {
+		return node_copy(val);
+	}
+	return run_generic(c, ctx);
+}
+
+static double num_const(const Closure *c, Ctx *ctx) {
+	(void)ctx;
+	return c->value->num.val;
+}
+
+static Node *run_param(const Closure *c, Ctx *ctx) {
+	return num_node(ctx->nums[c->slot]);
+}
+
+static double num_param(const Closure *c, Ctx *ctx) {
+	return ctx->nums[c->slot];
+}
+
+static Node *run_boxed(const Closure *c, Ctx *ctx) {
+	double val = c->num(c, ctx);
+	return ctx->err != NULL ? NULL : num_node(val);
+}
+
+// Takes the number out of val, failing with the given message if it isn't one.
+NOINLINE static double unbox(Ctx *ctx, Node *val, const char *err) {
+	if (ctx->err != NULL) {
+		return 0;
+	} else if (val == NULL || val->type != AST_NUM) {
+		node_free(val);
+		ctx->err = rr_errf("%s", err).err;
+		return 0;
+	}
+	double res = val->num.val;
+	node_free(val);
+	return res;
+}
+
+NOINLINE static double num_generic(const Closure *c, Ctx *ctx, const char *err) {
+	return unbox(ctx, run_generic(c, ctx), err);
+}
+
+static double num_of(const Closure *c, Ctx *ctx, const char *err) {
+	if (c->num != NULL) {
+		return c->num(c, ctx);
+	}
+	return unbox(ctx, c->fn(c, ctx), err);
+}
+
+// Evaluates the operands of c into vals. Returns false on error, after
+// freeing the values so far.
+static bool run_items(const Closure *c, Ctx *ctx, size_t from, Node **vals) {
+	for (size_t i = from; i < c->len; i++) {
+		vals[i - from] = c->items[i]->fn(c->items[i], ctx);
+		if (ctx->err != NULL) {
+			for (size_t j = from; j < i; j++) {
+				node_free(vals[j - from]);
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+// Calls fn, a builtin, with the given values, which it consumes.
+static Node *call_builtin(const Function *fn, Ctx *ctx, size_t nargs, Node **vals) {
+	return take(ctx, callBuiltinMoved(ctx->scope, fn, nargs, vals));
+}
+
+#define ARITH_ERR "all arguments should be a number"
+
+static double arith(char op, double res, double n) {
+	switch (op) {
+	case '+': return res + n;
+	case '-': return res - n;
+	case '/': return res / n;
+	case '*': return res * n;
+	case '^': return pow(res, n);
+	case '%': return fmod(res, n);
+	}
+	return res;
+}
+
+static Node *run_arith(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+
+	double res = 0;
+	for (size_t i = 0; i < c->len; i++) {
+		Node *val = c->items[i]->fn(c->items[i], ctx);
+		if (ctx->err != NULL) {
+			return NULL;
+		} else if (val == NULL || val->type != AST_NUM) {
+			node_free(val);
+			ctx->err = rr_errf(ARITH_ERR).err;
+			return NULL;
+		}
+
+		double n = val->num.val;
+		node_free(val);
+		res = i == 0 ? n : arith(c->builtin.name[0], res, n);
+	}
+
+	return num_node(res);
+}
+
+static double num_arith(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return num_generic(c, ctx, ARITH_ERR);
+	}
+
+	double res = 0;
+	for (size_t i = 0; i < c->len; i++) {
+		double n = num_of(c->items[i], ctx, ARITH_ERR);
+		if (ctx->err != NULL) {
+			return 0;
+		}
+		res = i == 0 ? n : arith(c->builtin.name[0], res, n);
+	}
+	return res;
+}
+
+static bool compare(const char *op, double a, double b) {
+	if (op[0] == '=') {
+		return a == b;
+	} else if (op[0] == '!') {
+		return a != b;
+	} else if (op[0] == '<') {
+		return op[1] == '=' ? a <= b : a < b;
+	} else if (op[0] == '>') {
+		return op[1] == '=' ? a >= b : a > b;
+	}
+	return false;
+}
+
+static Node *run_comp(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+
+	Node *vals[2];
+	if (!run_items(c, ctx, 0, vals)) {
+		return NULL;
+	}
+
+	if (
+		vals[0] == NULL || vals[0]->type != AST_NUM ||
+		vals[1] == NULL || vals[1]->type != AST_NUM
+	) {
+		// strings and symbols are compared by builtin_comp
+		return call_builtin(&c->builtin, ctx, 2, vals);
+	}
+
+	double a = vals[0]->num.val, b = vals[1]->num.val;
+	node_free(vals[0]);
+	node_free(vals[1]);
+	return num_node(compare(c->builtin.name, a, b));
+}
+
+// Only for numeric operands.
+static double num_comp(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return num_generic(c, ctx, "expected a number");
+	}
+
+	double a = c->items[0]->num(c->items[0], ctx);
+	if (ctx->err != NULL) {
+		return 0;
+	}
+	double b = c->items[1]->num(c->items[1], ctx);
+	return compare(c->builtin.name, a, b);
+}
+
+static Node *run_strict_builtin(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+
+	Node **vals = malloc(c->len, sizeof(Node*));
+	Node *res = NULL;
+	if (run_items(c, ctx, 0, vals)) {
+		res = call_builtin(&c->builtin, ctx, c->len, vals);
+	}
+	free(vals);
+	return res;
+}
+
+static Node *run_lazy_builtin(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+
+	const Node **args = (const Node**)c->node->expr.nodes + 1;
+	return take(ctx, callBuiltin(ctx->scope, &c->builtin, c->node->expr.len - 1, args));
+}
+
+static bool truthy_num(Ctx *ctx, Node *val) {
+	if (val == NULL || val->type != AST_NUM) {
+		node_free(val);
+		ctx->err = rr_errf("expected cond to have type AST_NUM").err;
+		return false;
+	}
+	bool res = val->num.val;
+	node_free(val);
+	return res;
+}
+
+// Evaluates the condition of an if or cond clause, check ctx->err after.
+static bool test(const Closure *cond, Ctx *ctx) {
+	if (cond->num != NULL) {
+		return cond->num(cond, ctx);
+	}
+
+	Node *val = cond->fn(cond, ctx);
+	return ctx->err == NULL && truthy_num(ctx, val);
+}
+
+static Node *run_if(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+
+	bool cond = test(c->items[0], ctx);
+	if (ctx->err != NULL) {
+		return NULL;
+	} else if (cond) {
+		return c->items[1]->fn(c->items[1], ctx);
+	} else if (c->len == 3) {
+		return c->items[2]->fn(c->items[2], ctx);
+	}
+	return NULL;
+}
+
+// Only with an else branch, and numeric branches.
+static double num_if(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return num_generic(c, ctx, "expected a number");
+	}
+
+	bool cond = test(c->items[0], ctx);
+	if (ctx->err != NULL) {
+		return 0;
+	}
+	const Closure *branch = c->items[cond ? 1 : 2];
+	return branch->num(branch, ctx);
+}
+
+// Runs all but the last item.
+static bool run_init(const Closure *c, Ctx *ctx) {
+	for (size_t i = 0; i < c->len - 1; i++) {
+		node_free(c->items[i]->fn(c->items[i], ctx));
+		if (ctx->err != NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static Node *run_seq(const Closure *c, Ctx *ctx) {
+	if (!run_init(c, ctx)) {
+		return NULL;
+	}
+	return c->items[c->len - 1]->fn(c->items[c->len - 1], ctx);
+}
+
+static double num_seq(const Closure *c, Ctx *ctx) {
+	if (!run_init(c, ctx)) {
+		return 0;
+	}
+	return c->items[c->len - 1]->num(c->items[c->len - 1], ctx);
+}
+
+static Node *run_do(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+	return run_seq(c, ctx);
+}
+
+static double num_do(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return num_generic(c, ctx, "expected a number");
+	}
+	return num_seq(c, ctx);
+}
+
+static bool isElse(const Node *cond) {
+	return (
+		cond->type == AST_QUOTED &&
+		cond->quoted.node->type == AST_VAR &&
+		streq(cond->quoted.node->var.name, "else")
+	);
+}
+
+// The items of a cond are pairs of a condition and a run_seq closure for the
+// body of the clause. Returns the body of the clause that's taken, if any.
+static const Closure *pick_clause(const Closure *c, Ctx *ctx) {
+	for (size_t i = 0; i < c->len; i += 2) {
+		const Closure *cond = c->items[i];
+		bool taken;
+		if (cond->num != NULL) {
+			taken = cond->num(cond, ctx);
+		} else {
+			Node *val = cond->fn(cond, ctx);
+			if (ctx->err != NULL) {
+				return NULL;
+			} else if (val == NULL || val->type == AST_QUOTED) {
+				node_free(val);
+				continue;
+			}
+			taken = truthy_num(ctx, val);
+		}
+
+		if (ctx->err != NULL) {
+			return NULL;
+		} else if (taken) {
+			return c->items[i + 1];
+		}
+	}
+
+	for (size_t i = 0; i < c->len; i += 2) {
+		if (isElse(c->items[i]->node)) {
+			return c->items[i + 1];
+		}
+	}
+	return NULL;
+}
+
+static Node *run_cond(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+
+	const Closure *body = pick_clause(c, ctx);
+	return body == NULL ? NULL : body->fn(body, ctx);
+}
+
+// Only with an else clause, and numeric bodies.
+static double num_cond(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return num_generic(c, ctx, "expected a number");
+	}
+
+	const Closure *body = pick_clause(c, ctx);
+	return body == NULL ? 0 : body->num(body, ctx);
+}
+
+// A let block whose body makes no functions, so its scope can live on the
+// stack. Its body isn't in tail position, since calls made from it have to see
+// the bindings.
+static Node *run_let(const Closure *c, Ctx *ctx) {
+	if (*c->bindings != 0) {
+		return run_generic(c, ctx);
+	}
+
+	Scope local;
+	scope_enter(&local, ctx->scope);
+	for (size_t i = 0; i < c->nbound; i++) {
+		Node *val = c->items[i]->fn(c->items[i], ctx);
+		if (ctx->err != NULL) {
+			scope_leave(&local);
+			return NULL;
+		}
+
+		const Node *pair = c->node->expr.nodes[1]->expr.nodes[i];
+		varmap_moveItem(local.variables, pair->expr.nodes[0]->var.name, val);
+	}
+
+	Scope *outer = ctx->scope;
+	ctx->scope = &local;
+	Node *res = NULL;
+	for (size_t i = c->nbound; i < c->len && ctx->err == NULL; i++) {
+		node_free(res);
+		res = c->items[i]->fn(c->items[i], ctx);
+	}
+	ctx->scope = outer;
+
+	scope_leave(&local);
+	return res;
+}
+
+NOINLINE static void callee_err(const Closure *c, Ctx *ctx, Node *fn) {
+	if (fn == NULL) {
+		ctx->err = rr_errf("cannot call nil value '%s'", stringify(c->node->expr.nodes[0], 0)).err;
+	} else {
+		ctx->err = rr_errf("Cannot call non-function (type %s)", typetostr(c->node->expr.nodes[0])).err;
+		node_free(fn);
+	}
+}
+
+// Evaluates the function of a call and checks that it is one.
+static Node *run_callee(const Closure *c, Ctx *ctx) {
+	Node *fn = c->items[0]->fn(c->items[0], ctx);
+	if (ctx->err != NULL) {
+		return NULL;
+	} else if (fn == NULL || fn->type != AST_FUN) {
+		callee_err(c, ctx, fn);
+		return NULL;
+	}
+	return fn;
+}
+
+// Calls a builtin found at run time, like eval() would.
+static Node *call_dynamic_builtin(const Closure *c, Ctx *ctx, Node *fn) {
+	Function builtin = fn->function;
+	node_free(fn);
+
+	const size_t nargs = c->len - 1;
+	if (!(builtin.flags & BUILTIN_STRICT)) {
+		const Node **args = (const Node**)c->node->expr.nodes + 1;
+		return take(ctx, callBuiltin(ctx->scope, &builtin, nargs, args));
+	}
+
+	Node **vals = malloc(nargs, sizeof(Node*));
+	Node *res = NULL;
+	if (run_items(c, ctx, 1, vals)) {
+		res = call_builtin(&builtin, ctx, nargs, vals);
+	}
+	free(vals);
+	return res;
+}
+
+static Node *run_call(const Closure *c, Ctx *ctx) {
+	Node *fn = run_callee(c, ctx);
+	if (fn == NULL) {
+		return NULL;
+	} else if (fn->function.isBuiltin) {
+		return call_dynamic_builtin(c, ctx, fn);
+	}
+
+	const size_t nargs = c->len - 1;
+	Node **vals = malloc(nargs, sizeof(Node*));
+	Node *res = NULL;
+	if (run_items(c, ctx, 1, vals)) {
+		res = take(ctx, callFunctionMoved(ctx->scope, fn, nargs, vals));
+	}
+	free(vals);
+	node_free(fn);
+	return res;
+}
+
+// A call in tail position of the body. Calls to user functions are left to
+// code_run, so they don't grow the stack.
+static Node *run_tail_call(const Closure *c, Ctx *ctx) {
+	Node *fn = run_callee(c, ctx);
+	if (fn == NULL) {
+		return NULL;
+	} else if (fn->function.isBuiltin) {
+		return call_dynamic_builtin(c, ctx, fn);
+	}
+
+	const size_t nargs = c->len - 1;
+	Node **vals = malloc(nargs, sizeof(Node*));
+	if (!run_items(c, ctx, 1, vals)) {
+		free(vals);
+		node_free(fn);
+		return NULL;
+	}
+
+	ctx->tailFn = fn;
+	ctx->tailVals = vals;
+	ctx->tailNargs = nargs;
+	return NULL;
+}
+
+// What the body of a function is compiled with.
+typedef struct Compiler {
+	const Lambda *lambda;
+	Scope *root;
+
+	// whether the parameters are numbers, the guards are added to code
+	bool numeric;
+	Code *code;
+} Compiler;
+
+static Closure *compile(const Compiler*, const Node *node, bool tail);
+
+static Closure *closure_make(ClosureFn fn, const Node *node, size_t len) {
+	Closure *c = calloc(1, sizeof(Closure));
+	assert(c);
+	c->fn = fn;
+	c->node = node;
+	c->len = len;
+	c->items = calloc(len, sizeof(Closure*));
+	return c;
+}
+
+static void closure_free(Closure *c) {
+	if (c == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < c->len; i++) {
+		closure_free(c->items[i]);
+	}
+	free(c->items);
+	node_free(c->value);
+	free(c);
+}
+
+// Returns the index of the parameter with the given name, or SIZE_MAX.
+static size_t paramIndex(const Lambda *lambda, const char *name) {
+	for (size_t i = 0; i < lambda->args.len; i++) {
+		if (streq(lambda->args.nodes[i]->var.name, name)) {
+			return i;
+		}
+	}
+	return SIZE_MAX;
+}
+
+static bool isParam(const Lambda *lambda, const char *name) {
+	return paramIndex(lambda, name) != SIZE_MAX;
+}
+
+// Returns the builtin the head of the given call refers to, if it can be
+// resolved ahead of time.
+static const Builtin *resolve(const Compiler *cc, const Node *head, const size_t **bindings) {
+	if (head->type != AST_VAR || isParam(cc->lambda, head->var.name)) {
+		return NULL;
+	}
+
+	*bindings = bindingCount(head->var.name);
+	if (**bindings != 0) {
+		return NULL;
+	}
+	return getBuiltin(cc->root->builtins, head->var.name);
+}
+
+static Closure *compile_items(const Compiler *cc, Closure *c, Node *const *nodes, bool lastTail) {
+	for (size_t i = 0; i < c->len; i++) {
+		c->items[i] = compile(cc, nodes[i], lastTail && i == c->len - 1);
+	}
+	return c;
+}
+
+static bool hasElse(const Closure *c) {
+	for (size_t i = 0; i < c->len; i += 2) {
+		if (isElse(c->items[i]->node)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Lets c pass a double to its parent if it's known to give a number.
+static void specialise(const Compiler *cc, Closure *c) {
+	const Closure *last = c->len > 0 ? c->items[c->len - 1] : NULL;
+
+	if (c->fn == run_arith) {
+		c->num = num_arith;
+	} else if (c->fn == run_comp && c->items[0]->num != NULL && c->items[1]->num != NULL) {
+		c->num = num_comp;
+	} else if (c->fn == run_if && c->len == 3 && c->items[1]->num != NULL && last->num != NULL) {
+		c->num = num_if;
+	} else if (c->fn == run_do && last->num != NULL) {
+		c->num = num_do;
+	} else if (c->fn == run_cond && hasElse(c)) {
+		c->num = num_cond;
+		for (size_t i = 1; i < c->len; i += 2) {
+			if (c->items[i]->num == NULL) {
+				c->num = NULL;
+			}
+		}
+	}
+
+	if (c->num != NULL) {
+		c->fn = run_boxed;
+		Code *code = cc->code;
+		code->guards = realloc(code->guards, (code->nguards + 1), sizeof(size_t*));
+		code->guards[code->nguards++] = c->bindings;
+	}
+}
+
+// Returns whether the let block node can be run by run_let.
+static bool isLocalLet(const Node *node) {
+	Node *const *args = node->expr.nodes + 1;
+	const size_t nargs = node->expr.len - 1;
+	if (nargs < 2 || args[0]->type != AST_EXPR) {
+		return false;
+	}
+
+	for (size_t i = 0; i < args[0]->expr.len; i++) {
+		const Node *pair = args[0]->expr.nodes[i];
+		if (pair->type != AST_EXPR || pair->expr.len != 2 || pair->expr.nodes[0]->type != AST_VAR) {
+			return false;
+		}
+	}
+	for (size_t i = 1; i < nargs; i++) {
+		if (captures_scope(args[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static Closure *compile_let(const Compiler *cc, const Node *node) {
+	const Expression *bindings = &node->expr.nodes[1]->expr;
+	const size_t nbody = node->expr.len - 2;
+
+	Closure *c = closure_make(run_let, node, bindings->len + nbody);
+	c->nbound = bindings->len;
+	for (size_t i = 0; i < bindings->len; i++) {
+		c->items[i] = compile(cc, bindings->nodes[i]->expr.nodes[1], false);
+	}
+
+	// the body runs in the scope of the block, where parameters may be
+	// shadowed, so it reads them from the scope
+	Compiler inner = *cc;
+	inner.numeric = false;
+	for (size_t i = 0; i < nbody; i++) {
+		c->items[c->nbound + i] = compile(&inner, node->expr.nodes[2 + i], false);
+	}
+	return c;
+}
+
+static Closure *compile_call(const Compiler *cc, const Node *node, bool tail) {
+	Node *const *nodes = node->expr.nodes;
+	Node *const *args = nodes + 1;
+	const size_t nargs = node->expr.len - 1;
+
+	const size_t *bindings = NULL;
+	const Builtin *builtin = resolve(cc, nodes[0], &bindings);
+	if (builtin == NULL) {
+		Closure *c = closure_make(tail ? run_tail_call : run_call, node, node->expr.len);
+		return compile_items(cc, c, nodes, false);
+	}
+
+	const BuiltinFn fn = builtin->function.fn;
+	Closure *c;
+
+	if (fn == builtin_do && nargs >= 1) {
+		c = compile_items(cc, closure_make(run_do, node, nargs), args, tail);
+	} else if (fn == builtin_if && nargs >= 2 && nargs <= 3) {
+		c = closure_make(run_if, node, nargs);
+		c->items[0] = compile(cc, args[0], false);
+		for (size_t i = 1; i < nargs; i++) {
+			c->items[i] = compile(cc, args[i], tail);
+		}
+	} else if (fn == builtin_cond) {
+		for (size_t i = 0; i < nargs; i++) {
+			if (args[i]->type != AST_EXPR || args[i]->expr.len < 2) {
+				return closure_make(run_generic, node, 0);
+			}
+		}
+
+		c = closure_make(run_cond, node, 2 * nargs);
+		for (size_t i = 0; i < nargs; i++) {
+			const Expression *clause = &args[i]->expr;
+			c->items[2*i] = compile(cc, clause->nodes[0], false);
+			Closure *body = compile_items(
+				cc,
+				closure_make(run_seq, args[i], clause->len - 1),
+				clause->nodes + 1,
+				tail
+			);
+			if (body->items[body->len - 1]->num != NULL) {
+				body->num = num_seq;
+			}
+			c->items[2*i + 1] = body;
+		}
+	} else if (fn == builtin_let && isLocalLet(node)) {
+		c = compile_let(cc, node);
+	} else if (fn == builtin_arith && nargs >= 2) {
+		c = compile_items(cc, closure_make(run_arith, node, nargs), args, false);
+	} else if (fn == builtin_comp && nargs == 2) {
+		c = compile_items(cc, closure_make(run_comp, node, nargs), args, false);
+	} else if (builtin->function.flags & BUILTIN_STRICT) {
+		c = compile_items(cc, closure_make(run_strict_builtin, node, nargs), args, false);
+	} else {
+		c = closure_make(run_lazy_builtin, node, 0);
+	}
+
+	c->builtin = builtin->function;
+	c->bindings = bindings;
+	if (cc->numeric) {
+		specialise(cc, c);
+	}
+	return c;
+}
+
+static Closure *compile(const Compiler *cc, const Node *node, bool tail) {
+	switch (node->type) {
+	case AST_QUOTED:
+	case AST_STR:
+	case AST_NUM: {
+		Closure *c = closure_make(run_const, node, 0);
+		c->value = node_copy(node);
+		if (cc->numeric && node->type == AST_NUM) {
+			c->num = num_const;
+		}
+		return c;
+	}
+
+	case AST_VAR:
+		if (cc->numeric && isParam(cc->lambda, node->var.name)) {
+			Closure *c = closure_make(run_param, node, 0);
+			c->num = num_param;
+			c->slot = paramIndex(cc->lambda, node->var.name);
+			return c;
+		} else if (isParam(cc->lambda, node->var.name)) {
+			Closure *c = closure_make(run_local, node, 0);
+			c->name = node->var.name;
+			return c;
+		}
+		return closure_make(run_generic, node, 0);
+
+	case AST_EXPR:
+		if (node->expr.len == 0) {
+			return closure_make(run_generic, node, 0);
+		}
+		return compile_call(cc, node, tail);
+
+	default:
+		return closure_make(run_generic, node, 0);
+	}
+}
+
+void code_free(Code *code) {
+	if (code == NULL) {
+		return;
+	}
+	closure_free(code->body);
+	closure_free(code->numBody);
+	free(code->guards);
+	free(code);
+}
+
+NOINLINE static Code *code_get(Lambda *lambda, Scope *scope) {
+	if (lambda->code == NULL) {
+		Code *code = calloc(1, sizeof(Code));
+		Compiler cc = { .lambda = lambda, .root = scope_get_root(scope), .code = code };
+		code->body = compile(&cc, lambda->body, true);
+
+		// there is no point to a numeric body that only boxes its parameters
+		const size_t nargs = lambda->args.len;
+		if (nargs > 0 && nargs <= MAX_NUM_PARAMS) {
+			cc.numeric = true;
+			code->numBody = compile(&cc, lambda->body, true);
+			if (code->nguards == 0) {
+				closure_free(code->numBody);
+				code->numBody = NULL;
+			}
+		}
+		lambda->code = code;
+	}
+	return lambda->code;
+}
+
+#define POOL_SIZE 64
+
+// The values of the parameters of numeric bodies are kept off the C stack,
+// as the bodies may recurse, in arrays pooled like the maps of scopes, see
+// scope_enter.
+static _Thread_local double *pool[POOL_SIZE];
+static _Thread_local size_t pooled = 0;
+
+static void nums_leave(double *nums) {
+	if (nums == NULL) {
+		return;
+	} else if (pooled == POOL_SIZE) {
+		free(nums);
+		return;
+	}
+	pool[pooled++] = nums;
+}
+
+void code_pool_free(void) {
+	while (pooled > 0) {
+		free(pool[--pooled]);
+	}
+}
+
+// Returns the values of the parameters if the numeric body of code can run in
+// frame, NULL if not.
+NOINLINE static double *numeric_entry(const Code *code, const Lambda *lambda, Scope *frame) {
+	if (code->numBody == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < code->nguards; i++) {
+		if (*code->guards[i] != 0) {
+			return NULL;
+		}
+	}
+
+	double *nums = pooled > 0 ? pool[--pooled] : malloc(MAX_NUM_PARAMS, sizeof(double));
+	for (size_t i = 0; i < lambda->args.len; i++) {
+		const Node *val = varmap_getItem(frame->variables, lambda->args.nodes[i]->var.name);
+		if (val == NULL || val->type != AST_NUM) {
+			nums_leave(nums);
+			return NULL;
+		}
+		nums[i] = val->num.val;
+	}
+	return nums;
+}
+
+// Makes the tail call the body left in ctx. Returns whether the body of the
+// function it calls runs next, in frame, and sets rr to the result of the
+// call if not.
+NOINLINE static bool tail_call(Scope *frame, Lambda **lambda, Ctx *ctx, RunResult *rr) {
+	Lambda *next = ctx->tailFn->function.lambda;
+	if (ctx->tailNargs != next->args.len) {
+		*rr = rr_errf("expected number of args to == %d but is %d", next->args.len, ctx->tailNargs);
+		for (size_t i = 0; i < ctx->tailNargs; i++) {
+			node_free(ctx->tailVals[i]);
+		}
+		free(ctx->tailVals);
+		node_free(ctx->tailFn);
+		return false;
+	}
+
+	bool called = true;
+	Node *val;
+	if (next->memo != NULL) {
+		*rr = memo_call(frame, next, ctx->tailNargs, (const Node**)ctx->tailVals);
+	} else if (jit_call(frame, next, ctx->tailNargs, ctx->tailVals, &val, false)) {
+		*rr = rr_node(val);
+	} else {
+		called = false;
+	}
+	if (called) {
+		for (size_t i = 0; i < ctx->tailNargs; i++) {
+			node_free(ctx->tailVals[i]);
+		}
+		free(ctx->tailVals);
+		node_free(ctx->tailFn);
+		return false;
+	}
+
+	lambda_retain(next);
+	node_free(ctx->tailFn);
+	lambda_release(*lambda);
+	*lambda = next;
+
+	for (size_t i = 0; i < ctx->tailNargs; i++) {
+		varmap_moveItem(frame->variables, next->args.nodes[i]->var.name, ctx->tailVals[i]);
+	}
+	free(ctx->tailVals);
+	return true;
+}
+
+RunResult code_run(Scope *frame, Lambda **lambda) {
+	for (;;) {
+		Code *code = code_get(*lambda, frame);
+
+		Ctx ctx = { .scope = frame };
+		const Closure *body = code->body;
+		double *nums = numeric_entry(code, *lambda, frame);
+		if (nums != NULL) {
+			ctx.nums = nums;
+			body = code->numBody;
+		}
+		Node *res = body->fn(body, &ctx);
+		nums_leave(nums);
+		if (ctx.err != NULL) {
+			node_free(ctx.tailFn);
+			return (RunResult){ .err = ctx.err };
+		} else if (ctx.tailFn == NULL) {
+			return rr_node(res);
+		}
+
+		RunResult rr;
+		if (!tail_call(frame, lambda, &ctx, &rr)) {
+			return rr;
+		}
+	}
+}
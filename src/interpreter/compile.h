@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// Compiles the bodies of user defined functions into trees of C closures.
+// Every closure is specialised for its node when the function is first
+// called: literals are copied without dispatching on their type, parameters
+// are looked up in the frame of the call only, and calls to builtins and the
+// do, if and cond forms are resolved ahead of time. Those only stay valid
+// while no variable with the name of the builtin has been bound, which is
+// checked on every evaluation; once one is, the closure falls back to run().
+//
+// Functions also get a body specialised for numeric parameters, in which
+// numbers are passed between closures as doubles. It's taken when all
+// arguments of a call are numbers and is otherwise the same as the generic
+// body.
+
+typedef struct Code Code;
+
+void code_free(Code*);
+
+// Runs the body of *lambda in frame, in which its arguments are bound. Tail
+// calls to other user functions rebind the arguments in frame and replace
+// *lambda, which is owned by the caller.
+RunResult code_run(Scope *frame, Lambda **lambda);
+// Frees what code_run pooled for the isolate, once it's done running code.
+void code_pool_free(void);
@@ -0,0 +1,727 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "coro.h"
+#include "output.h"
+#include "../util.h"
+
+// The size of the stack of a coroutine, as much as the main thread usually
+// gets. Its pages only take memory once they're used.
+#define STACK_SIZE (8 << 20)
+// Stacks of coroutines that returned are kept for new ones, up to this many.
+#define SPARE_STACKS 16
+#define MAX_EVENTS 64
+
+enum {
+	CORO_READY,
+	CORO_RUNNING,
+	CORO_WAITING,
+	CORO_DONE,
+};
+
+struct Coroutine {
+	size_t refs;
+	int state;
+	ucontext_t ctx;
+	// NULL for the main program
+	char *stack;
+
+	// what it runs, until it starts
+	Scope *scope;
+	Node *fn;
+	size_t nargs;
+	Node **vals;
+
+	// what it returned, once it's done
+	Node *val;
+	char *err;
+
+	// the coroutines that wait for this one to return
+	size_t njoiners;
+	Coroutine **joiners;
+
+	// the error it was woken with instead of what it waited for
+	char *wakeErr;
+	// when a sleeping coroutine wakes up
+	double wakeAt;
+	// the next in the queue of coroutines that are ready
+	Coroutine *next;
+};
+
+// What the event loop knows about a file descriptor.
+typedef struct Fd {
+	Coroutine *reader;
+	Coroutine *writer;
+	// whether it's registered with epoll, and whether it can't be because it's
+	// always ready, like a regular file
+	bool added;
+	bool always;
+
+	// what was read past the last line
+	char *buf;
+	size_t len;
+	size_t cap;
+	bool eof;
+} Fd;
+
+// A coroutine that waits for the notifier, and what it watches.
+typedef struct Notified {
+	Coroutine *co;
+	Watchers *watchers;
+} Notified;
+
+typedef struct Loop {
+	Coroutine main;
+	Coroutine *current;
+
+	Coroutine *first;
+	Coroutine *last;
+
+	// sleeping coroutines, a binary heap on wakeAt
+	size_t ntimers;
+	size_t timerCap;
+	Coroutine **timers;
+
+	int epfd;
+	// the number of coroutines waiting for a descriptor
+	size_t waiting;
+	size_t nfds;
+	Fd *fds;
+
+	// the eventfd that what's watched writes to, see watchers.h
+	int notifier;
+	size_t nnotified;
+	size_t notifiedCap;
+	Notified *notified;
+
+	// a coroutine that returned, whose stack is freed once it's switched away
+	// from
+	Coroutine *dead;
+	size_t nspare;
+	char *spare[SPARE_STACKS];
+} Loop;
+
+// every isolate has its own loop
+static _Thread_local Loop *loop = NULL;
+
+static Loop *get_loop(void) {
+	if (loop == NULL) {
+		loop = calloc(1, sizeof(Loop));
+		loop->main.refs = 1;
+		loop->main.state = CORO_RUNNING;
+		loop->current = &loop->main;
+		loop->epfd = -1;
+		loop->notifier = -1;
+	}
+	return loop;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *errf(const char *fmt, int fd) {
+	return rr_errf(fmt, fd, strerror(errno)).err;
+}
+
+static void make_ready(Loop *l, Coroutine *co) {
+	co->state = CORO_READY;
+	co->next = NULL;
+	if (l->last != NULL) {
+		l->last->next = co;
+	} else {
+		l->first = co;
+	}
+	l->last = co;
+}
+
+static Coroutine *pop_ready(Loop *l) {
+	Coroutine *co = l->first;
+	if (co != NULL) {
+		l->first = co->next;
+		if (l->first == NULL) {
+			l->last = NULL;
+		}
+	}
+	return co;
+}
+
+static void timer_push(Loop *l, Coroutine *co) {
+	if (l->ntimers == l->timerCap) {
+		l->timerCap = l->timerCap == 0 ? 8 : l->timerCap * 2;
+		l->timers = realloc(l->timers, l->timerCap, sizeof(Coroutine*));
+	}
+
+	size_t i = l->ntimers++;
+	while (i > 0 && l->timers[(i - 1) / 2]->wakeAt > co->wakeAt) {
+		l->timers[i] = l->timers[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	l->timers[i] = co;
+}
+
+static Coroutine *timer_pop(Loop *l) {
+	Coroutine *res = l->timers[0];
+	Coroutine *last = l->timers[--l->ntimers];
+
+	size_t i = 0;
+	for (;;) {
+		size_t child = 2*i + 1;
+		if (child >= l->ntimers) {
+			break;
+		} else if (child + 1 < l->ntimers && l->timers[child + 1]->wakeAt < l->timers[child]->wakeAt) {
+			child++;
+		}
+		if (last->wakeAt <= l->timers[child]->wakeAt) {
+			break;
+		}
+		l->timers[i] = l->timers[child];
+		i = child;
+	}
+	if (l->ntimers > 0) {
+		l->timers[i] = last;
+	}
+	return res;
+}
+
+static char *stack_make(Loop *l) {
+	if (l->nspare > 0) {
+		return l->spare[--l->nspare];
+	}
+
+	char *stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED) {
+		return NULL;
+	}
+	// a guard page, so running out of stack faults instead of overwriting
+	// whatever is below it
+	mprotect(stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+	return stack;
+}
+
+static void stack_free(Loop *l, char *stack) {
+	if (l->nspare < SPARE_STACKS) {
+		l->spare[l->nspare++] = stack;
+	} else {
+		munmap(stack, STACK_SIZE);
+	}
+}
+
+Coroutine *coro_retain(Coroutine *co) {
+	co->refs++;
+	return co;
+}
+
+void coro_release(Coroutine *co) {
+	if (co == NULL || --co->refs > 0) {
+		return;
+	}
+
+	node_free(co->fn);
+	for (size_t i = 0; co->vals != NULL && i < co->nargs; i++) {
+		node_free(co->vals[i]);
+	}
+	free(co->vals);
+	node_free(co->val);
+	free(co->err);
+	free(co->joiners);
+	free(co->wakeErr);
+	free(co);
+}
+
+// Frees what's left of a coroutine that returned, which is only safe once
+// another one runs.
+static void reap(Loop *l) {
+	Coroutine *dead = l->dead;
+	if (dead != NULL && dead != l->current) {
+		l->dead = NULL;
+		stack_free(l, dead->stack);
+		dead->stack = NULL;
+		// the reference of the loop
+		coro_release(dead);
+	}
+}
+
+static void switch_to(Loop *l, Coroutine *from, Coroutine *to) {
+	// the values moved to the builtins that are running in from stay with it
+	Moved *moved = moved_swap(NULL);
+	l->current = to;
+	to->state = CORO_RUNNING;
+	swapcontext(&from->ctx, &to->ctx);
+
+	moved_swap(moved);
+	reap(l);
+}
+
+static void fd_ready(Loop *l, int fd, uint32_t events) {
+	Fd *st = &l->fds[fd];
+	const uint32_t closed = EPOLLERR | EPOLLHUP;
+	if (st->reader != NULL && (events & (EPOLLIN | closed))) {
+		make_ready(l, st->reader);
+		st->reader = NULL;
+		l->waiting--;
+	}
+	if (st->writer != NULL && (events & (EPOLLOUT | closed))) {
+		make_ready(l, st->writer);
+		st->writer = NULL;
+		l->waiting--;
+	}
+
+	if (st->reader != NULL || st->writer != NULL) {
+		struct epoll_event ev = {
+			.events = EPOLLONESHOT | (st->reader != NULL ? EPOLLIN : 0) | (st->writer != NULL ? EPOLLOUT : 0),
+			.data.fd = fd,
+		};
+		epoll_ctl(l->epfd, EPOLL_CTL_MOD, fd, &ev);
+	}
+}
+
+// Wakes every coroutine that waits for the notifier, since it can't tell
+// which of the things they watch changed. The ones whose didn't wait again.
+static void notified(Loop *l) {
+	uint64_t count;
+	ssize_t n = read(l->notifier, &count, sizeof(count));
+	(void)n;
+	for (size_t i = 0; i < l->nnotified; i++) {
+		make_ready(l, l->notified[i].co);
+	}
+	l->waiting -= l->nnotified;
+	l->nnotified = 0;
+}
+
+// Waits until a descriptor is ready or the first timer is due, and makes the
+// coroutines that waited for them ready.
+static void poll_events(Loop *l) {
+	int timeout = -1;
+	if (l->ntimers > 0) {
+		const double left = l->timers[0]->wakeAt - now();
+		timeout = left <= 0 ? 0 : left * 1000 >= INT_MAX ? INT_MAX : (int)ceil(left * 1000);
+	}
+
+	if (l->waiting > 0) {
+		struct epoll_event events[MAX_EVENTS];
+		const int n = epoll_wait(l->epfd, events, MAX_EVENTS, timeout);
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.fd == l->notifier) {
+				notified(l);
+			} else {
+				fd_ready(l, events[i].data.fd, events[i].events);
+			}
+		}
+	} else if (timeout > 0) {
+		const struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+		nanosleep(&ts, NULL);
+	}
+
+	const double t = now();
+	while (l->ntimers > 0 && l->timers[0]->wakeAt <= t) {
+		make_ready(l, timer_pop(l));
+	}
+}
+
+// Runs the other coroutines until the current one, which is waiting for
+// something, is woken. Returns the error it was woken with.
+static char *park(Loop *l) {
+	Coroutine *self = l->current;
+	for (;;) {
+		Coroutine *next = pop_ready(l);
+		if (next == self) {
+			self->state = CORO_RUNNING;
+			break;
+		} else if (next != NULL) {
+			switch_to(l, self, next);
+			break;
+		}
+
+		if (l->ntimers == 0 && l->waiting == 0) {
+			// only joins are left, which nothing can end
+			char *err = astrcpy("deadlock: every coroutine is waiting for another one");
+			if (self == &l->main) {
+				self->state = CORO_RUNNING;
+				return err;
+			}
+			l->main.wakeErr = err;
+			make_ready(l, &l->main);
+			continue;
+		}
+		poll_events(l);
+	}
+
+	char *err = self->wakeErr;
+	self->wakeErr = NULL;
+	return err;
+}
+
+static void entry(void) {
+	Loop *l = loop;
+	reap(l);
+
+	Coroutine *co = l->current;
+	RunResult rr = callFunctionMoved(co->scope, co->fn, co->nargs, co->vals);
+	node_free(co->fn);
+	free(co->vals);
+	co->fn = NULL;
+	co->vals = NULL;
+
+	co->val = rr.node;
+	co->err = rr.err;
+	co->state = CORO_DONE;
+	for (size_t i = 0; i < co->njoiners; i++) {
+		make_ready(l, co->joiners[i]);
+	}
+	co->njoiners = 0;
+
+	l->dead = co;
+	park(l);
+	assert(false);
+}
+
+// On its own, since getcontext returns twice.
+static void init_context(Coroutine *co) {
+	getcontext(&co->ctx);
+	co->ctx.uc_stack.ss_sp = co->stack;
+	co->ctx.uc_stack.ss_size = STACK_SIZE;
+	co->ctx.uc_link = NULL;
+	makecontext(&co->ctx, entry, 0);
+}
+
+RunResult coro_start(Scope *scope, double delay, Node *fn, size_t nargs, Node **vals) {
+	Loop *l = get_loop();
+
+	Coroutine *co = calloc(1, sizeof(Coroutine));
+	// the caller's, and the loop's until it returns
+	co->refs = 2;
+	co->scope = scope_get_root(scope);
+	co->fn = fn;
+	co->nargs = nargs;
+	co->vals = vals;
+
+	co->stack = stack_make(l);
+	if (co->stack == NULL) {
+		co->refs = 1;
+		coro_release(co);
+		return rr_errf("couldn't make a stack for a coroutine: %s", strerror(errno));
+	}
+	init_context(co);
+
+	if (delay > 0) {
+		co->state = CORO_WAITING;
+		co->wakeAt = now() + delay;
+		timer_push(l, co);
+	} else {
+		make_ready(l, co);
+	}
+
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_COROUTINE;
+	res->coroutine = co;
+	return rr_node(res);
+}
+
+RunResult coro_join(Coroutine *co) {
+	Loop *l = get_loop();
+	Coroutine *self = l->current;
+	if (co == self) {
+		return rr_errf("a coroutine can't join itself");
+	}
+
+	if (co->state != CORO_DONE) {
+		co->joiners = realloc(co->joiners, (co->njoiners + 1), sizeof(Coroutine*));
+		co->joiners[co->njoiners++] = self;
+		self->state = CORO_WAITING;
+
+		char *err = park(l);
+		if (err != NULL) {
+			for (size_t i = 0; i < co->njoiners; i++) {
+				if (co->joiners[i] == self) {
+					co->joiners[i] = co->joiners[--co->njoiners];
+					break;
+				}
+			}
+			return rr_err(err);
+		}
+	}
+
+	if (co->err != NULL) {
+		return rr_errf("error in coroutine: %s", co->err);
+	}
+	return rr_node(node_copy(co->val));
+}
+
+char *coro_sleep(double secs) {
+	Loop *l = get_loop();
+	Coroutine *self = l->current;
+	self->state = CORO_WAITING;
+	self->wakeAt = now() + (secs > 0 ? secs : 0);
+	timer_push(l, self);
+	return park(l);
+}
+
+static Fd *fd_get(Loop *l, int fd) {
+	if ((size_t)fd >= l->nfds) {
+		const size_t nfds = fd < 16 ? 16 : 2 * fd;
+		l->fds = realloc(l->fds, nfds, sizeof(Fd));
+		memset(l->fds + l->nfds, 0, (nfds - l->nfds) * sizeof(Fd));
+		l->nfds = nfds;
+	}
+	return &l->fds[fd];
+}
+
+// Waits until fd can be read from or written to without blocking.
+static char *wait_fd(Loop *l, int fd, bool write) {
+	Fd *st = fd_get(l, fd);
+	if (st->always) {
+		return NULL;
+	}
+
+	Coroutine **slot = write ? &st->writer : &st->reader;
+	if (*slot != NULL) {
+		return rr_errf("another coroutine is already waiting for fd %d", fd).err;
+	} else if (l->epfd < 0 && (l->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		return errf("can't wait for fd %d: %s", fd);
+	}
+
+	*slot = l->current;
+	struct epoll_event ev = {
+		.events = EPOLLONESHOT | (st->reader != NULL ? EPOLLIN : 0) | (st->writer != NULL ? EPOLLOUT : 0),
+		.data.fd = fd,
+	};
+	if (epoll_ctl(l->epfd, st->added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0) {
+		*slot = NULL;
+		if (errno == EPERM) {
+			st->always = true;
+			return NULL;
+		}
+		return errf("can't wait for fd %d: %s", fd);
+	}
+	st->added = true;
+
+	l->waiting++;
+	l->current->state = CORO_WAITING;
+	return park(l);
+}
+
+// Makes the notifier, and the epoll instance it's watched by, if they aren't
+// there yet.
+static char *make_notifier(Loop *l) {
+	if (l->notifier >= 0) {
+		return NULL;
+	} else if (l->epfd < 0 && (l->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		return rr_errf("can't make an event loop: %s", strerror(errno)).err;
+	}
+
+	l->notifier = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = l->notifier };
+	if (l->notifier < 0 || epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->notifier, &ev) != 0) {
+		char *err = rr_errf("can't make an event loop: %s", strerror(errno)).err;
+		if (l->notifier >= 0) {
+			close(l->notifier);
+			l->notifier = -1;
+		}
+		return err;
+	}
+	return NULL;
+}
+
+// Takes the running coroutine off the notified ones, if it's still there
+// because it was woken some other way.
+static void unnotify(Loop *l) {
+	for (size_t i = 0; i < l->nnotified; i++) {
+		if (l->notified[i].co == l->current) {
+			l->notified[i] = l->notified[--l->nnotified];
+			l->waiting--;
+			return;
+		}
+	}
+}
+
+char *coro_wait(Watchers *w, bool (*try)(void*), void *ctx) {
+	Loop *l = get_loop();
+	while (!try(ctx)) {
+		char *err = make_notifier(l);
+		if (err != NULL) {
+			return err;
+		}
+
+		// what's watched may have changed before it was, so it's tried again
+		// before the wait
+		watchers_add(w, l->notifier);
+		if (try(ctx)) {
+			watchers_remove(w, l->notifier);
+			break;
+		}
+
+		if (l->nnotified == l->notifiedCap) {
+			l->notifiedCap = l->notifiedCap == 0 ? 4 : l->notifiedCap * 2;
+			l->notified = realloc(l->notified, l->notifiedCap, sizeof(Notified));
+		}
+		l->notified[l->nnotified++] = (Notified){ .co = l->current, .watchers = w };
+		l->waiting++;
+		l->current->state = CORO_WAITING;
+
+		err = park(l);
+		unnotify(l);
+		watchers_remove(w, l->notifier);
+		if (err != NULL) {
+			return err;
+		}
+	}
+	return NULL;
+}
+
+RunResult coro_read_line(int fd, bool keepNewline) {
+	Loop *l = get_loop();
+	// so a prompt shows before the input it asks for
+	if (fd == STDIN_FILENO) {
+		char *err = output_flush(STDOUT_FILENO);
+		if (err != NULL) {
+			return rr_err(err);
+		}
+	}
+	for (;;) {
+		// the table may have moved while this coroutine waited
+		Fd *st = fd_get(l, fd);
+		const char *nl = st->len > 0 ? memchr(st->buf, '\n', st->len) : NULL;
+		if (nl != NULL || (st->eof && st->len > 0)) {
+			const size_t end = nl != NULL ? (size_t)(nl - st->buf) + 1 : st->len;
+			const size_t size = nl != NULL && !keepNewline ? end - 1 : end;
+
+			Node *res = malloc(1, sizeof(Node));
+			res->type = AST_STR;
+			res->str.str = malloc((size + 1), sizeof(char));
+			memcpy(res->str.str, st->buf, size);
+			res->str.str[size] = '\0';
+			res->str.size = size;
+
+			memmove(st->buf, st->buf + end, st->len - end);
+			st->len -= end;
+			return rr_node(res);
+		} else if (st->eof) {
+			// a terminal can be read from again after an end of file
+			st->eof = false;
+			return rr_null();
+		}
+
+		char *err = wait_fd(l, fd, false);
+		if (err != NULL) {
+			return rr_err(err);
+		}
+
+		st = fd_get(l, fd);
+		if (st->cap - st->len < 4096) {
+			st->cap = st->cap == 0 ? 4096 : st->cap * 2;
+			st->buf = realloc(st->buf, st->cap, sizeof(char));
+		}
+		const ssize_t n = read(fd, st->buf + st->len, st->cap - st->len);
+		if (n > 0) {
+			st->len += n;
+		} else if (n == 0) {
+			st->eof = true;
+		} else if (errno != EAGAIN && errno != EINTR) {
+			return rr_err(errf("can't read from fd %d: %s", fd));
+		}
+	}
+}
+
+char *coro_write(int fd, const char *buf, size_t len) {
+	Loop *l = get_loop();
+	// what print buffered for fd goes first
+	char *err = output_flush(fd);
+	if (err != NULL) {
+		return err;
+	}
+
+	while (len > 0) {
+		err = wait_fd(l, fd, true);
+		if (err != NULL) {
+			return err;
+		}
+
+		// a descriptor that's ready for writing has room for at least
+		// PIPE_BUF bytes, so a write of that many doesn't block even if the
+		// descriptor isn't non-blocking
+		const size_t size = fd_get(l, fd)->always || len < PIPE_BUF ? len : PIPE_BUF;
+		const ssize_t n = write(fd, buf, size);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			return errf("can't write to fd %d: %s", fd);
+		}
+		buf += n;
+		len -= n;
+	}
+	return NULL;
+}
+
+char *coro_pipe(int fds[2]) {
+	if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+		return rr_errf("can't make a pipe: %s", strerror(errno)).err;
+	}
+	return NULL;
+}
+
+char *coro_close(int fd) {
+	Loop *l = get_loop();
+	if ((size_t)fd < l->nfds) {
+		Fd *st = &l->fds[fd];
+		if (st->reader != NULL || st->writer != NULL) {
+			return rr_errf("a coroutine is waiting for fd %d", fd).err;
+		} else if (st->added) {
+			epoll_ctl(l->epfd, EPOLL_CTL_DEL, fd, NULL);
+		}
+		free(st->buf);
+		*st = (Fd){ 0 };
+	}
+
+	if (close(fd) != 0) {
+		return errf("can't close fd %d: %s", fd);
+	}
+	return NULL;
+}
+
+void coro_loop_free(void) {
+	Loop *l = loop;
+	if (l == NULL) {
+		return;
+	}
+
+	reap(l);
+	for (size_t i = 0; i < l->nfds; i++) {
+		free(l->fds[i].buf);
+	}
+	// what the coroutines that never woke up watch mustn't write to the
+	// descriptor once it's closed
+	for (size_t i = 0; i < l->nnotified; i++) {
+		watchers_remove(l->notified[i].watchers, l->notifier);
+	}
+	free(l->notified);
+	if (l->notifier >= 0) {
+		close(l->notifier);
+	}
+	for (size_t i = 0; i < l->nspare; i++) {
+		munmap(l->spare[i], STACK_SIZE);
+	}
+	if (l->epfd >= 0) {
+		close(l->epfd);
+	}
+	free(l->fds);
+	free(l->timers);
+	free(l);
+	loop = NULL;
+}
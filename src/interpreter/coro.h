@@ -0,0 +1,55 @@
+#pragma once
+
+#include "../ast.h"
+#include "../watchers.h"
+#include "./internal.h"
+
+// Coroutines are green threads: each runs a function on a C stack of its own,
+// and the coroutines of a thread take turns, switching only when the running
+// one waits. What they wait for is handled by the event loop of the thread,
+// which waits for file descriptors with epoll and for timers, so one
+// interpreter can read and write many pipes at once without threads.
+//
+// The main program is a coroutine too: when it waits, the others run. It
+// doesn't wait for them when it's done, join does that.
+//
+// Like generators, a coroutine runs in the root scope, since the scope it was
+// made in may be gone by the time it runs. Coroutines are reference counted
+// and shared by their copies. They belong to the isolate that made them.
+typedef struct Coroutine Coroutine;
+
+// Starts a coroutine that calls fn with the given values once delay seconds
+// have passed, and returns it. Consumes fn and the values, and the array of
+// them.
+RunResult coro_start(Scope*, double delay, Node *fn, size_t nargs, Node **vals);
+Coroutine *coro_retain(Coroutine*);
+void coro_release(Coroutine*);
+
+// Waits for the coroutine to return, and returns a copy of its value, or its
+// error.
+RunResult coro_join(Coroutine*);
+
+// Lets the other coroutines run for at least the given number of seconds.
+// Returns an error if nothing could ever wake the running coroutine.
+char *coro_sleep(double secs);
+
+// Calls try(ctx) until it returns true. In between, the other coroutines run
+// until something watched by w changes, which is how coroutines wait for
+// channels and futures, which other threads change. Returns an error if the
+// wait fails, without the call having returned true.
+char *coro_wait(Watchers *w, bool (*try)(void*), void *ctx);
+
+// Reads the next line from fd, with the newline if keepNewline, or nil at
+// the end. Lines are buffered per descriptor, so everything that reads from
+// one has to go through here.
+RunResult coro_read_line(int fd, bool keepNewline);
+// Writes all of buf to fd.
+char *coro_write(int fd, const char *buf, size_t len);
+// Makes a pipe that only the event loop waits on, the read end goes in fds[0].
+char *coro_pipe(int fds[2]);
+// Closes fd, which no coroutine can be waiting for.
+char *coro_close(int fd);
+
+// Frees the event loop of the isolate, once it's done running code.
+// Coroutines that haven't returned are left as they are.
+void coro_loop_free(void);
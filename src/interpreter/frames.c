@@ -0,0 +1,672 @@
+#include <assert.h>
+#include <string.h>
+
+#include "frames.h"
+#include "../stringify.h"
+#include "../util.h"
+#include "./builtins.h"
+#include "./iter.h"
+#include "./jit.h"
+#include "./memo.h"
+#include "builtins/generators.h"
+
+typedef enum FrameKind {
+	FRAME_CALL, // evaluating the function and arguments of a call
+	FRAME_IF,   // evaluating the condition of an if
+	FRAME_SEQ,  // evaluating the body of a do or cond clause
+	FRAME_COND, // evaluating the conditions of a cond
+	FRAME_WHILE, // evaluating the condition or the body of a while
+	FRAME_EACH, // evaluating the body of a times, for or each
+	FRAME_LET,  // evaluating the bindings or waiting for the body of a let
+} FrameKind;
+
+typedef struct Frame Frame;
+struct Frame {
+	Frame *parent;
+	FrameKind kind;
+	Scope *scope;
+
+	// CALL: the call expression, otherwise the argument nodes of the form.
+	Node *const *nodes;
+	size_t len;
+	size_t i;
+
+	// CALL: the evaluated function and arguments.
+	Node **vals;
+	// CALL: the function has been looked at.
+	bool checked;
+
+	// EACH: the loop variable and the items it goes through, the nodes are
+	// the body.
+	const char *var;
+	Iter iter;
+
+	// LET: the scope of the body, in which the values of the bindings are
+	// bound as they come, until a frame for the body takes it over. The
+	// nodes are the arguments of the let.
+	Scope *let;
+
+	// The scope and code of the function body this frame evaluates, if any.
+	// Tail calls rebind the arguments in the same scope, like eval() does.
+	Scope *owned;
+	Lambda *lambda;
+};
+
+typedef struct Machine {
+	Frame *top;
+	// Only generator machines may yield.
+	bool generator;
+	// The top frame is waiting for the value of a yield.
+	bool resumed;
+} Machine;
+
+typedef enum Step {
+	STEP_PUSHED, // a frame was pushed for a sub expression
+	STEP_AGAIN,  // the frame now evaluates a tail expression
+	STEP_DONE,   // the frame has a value
+	STEP_ERROR,
+	STEP_YIELD,
+} Step;
+
+static void push_call(Machine *m, Scope *scope, const Node *expr) {
+	Frame *f = calloc(1, sizeof(Frame));
+	assert(f);
+	f->parent = m->top;
+	f->kind = FRAME_CALL;
+	f->scope = scope;
+	f->nodes = expr->expr.nodes;
+	f->len = expr->expr.len;
+	f->vals = calloc(f->len, sizeof(Node*));
+	m->top = f;
+}
+
+static void free_vals(Frame *f) {
+	if (f->vals == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < f->len; i++) {
+		node_free(f->vals[i]);
+	}
+	free(f->vals);
+	f->vals = NULL;
+}
+
+static void pop(Machine *m) {
+	Frame *f = m->top;
+	m->top = f->parent;
+
+	free_vals(f);
+	iter_free(&f->iter);
+	scope_free(f->let);
+	scope_free(f->owned);
+	lambda_release(f->lambda);
+	free(f);
+}
+
+static void unwind(Machine *m) {
+	while (m->top != NULL) {
+		pop(m);
+	}
+}
+
+static bool nonEmptyExpr(const Node *node) {
+	return node->type == AST_EXPR && node->expr.len > 0;
+}
+
+// Evaluates node in the scope of f. If that needs a frame, it's pushed and
+// false is returned. Otherwise the result is stored in rr.
+static bool eval_child(Machine *m, Frame *f, const Node *node, RunResult *rr) {
+	if (nonEmptyExpr(node)) {
+		push_call(m, f->scope, node);
+		return false;
+	}
+	*rr = run(f->scope, node);
+	return true;
+}
+
+// Makes f evaluate node in its place.
+static Step become(Frame *f, const Node *node, RunResult *rr) {
+	free_vals(f);
+
+	if (!nonEmptyExpr(node)) {
+		*rr = run(f->scope, node);
+		return rr->err != NULL ? STEP_ERROR : STEP_DONE;
+	}
+
+	f->kind = FRAME_CALL;
+	f->nodes = node->expr.nodes;
+	f->len = node->expr.len;
+	f->i = 0;
+	f->checked = false;
+	f->vals = calloc(f->len, sizeof(Node*));
+	return STEP_AGAIN;
+}
+
+static Step become_seq(Frame *f, Node *const *nodes, size_t len, RunResult *rr) {
+	if (len == 0) {
+		*rr = rr_errf("expected number of args to >= 1 but is 0");
+		return STEP_ERROR;
+	}
+
+	free_vals(f);
+	f->kind = FRAME_SEQ;
+	f->nodes = nodes;
+	f->len = len;
+	f->i = 0;
+	return STEP_AGAIN;
+}
+
+// Whether the bindings of a let are all written out as pairs, otherwise they
+// are evaluated natively.
+static bool literalBindings(const Node *bindings) {
+	for (size_t i = 0; i < bindings->expr.len; i++) {
+		const Node *pair = bindings->expr.nodes[i];
+		if (pair->type != AST_EXPR || pair->expr.len != 2 || pair->expr.nodes[0]->type != AST_VAR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool isElse(const Node *node) {
+	return (
+		node->type == AST_QUOTED &&
+		node->quoted.node->type == AST_VAR &&
+		streq(node->quoted.node->var.name, "else")
+	);
+}
+
+// Looks at the evaluated function of a call. The forms the machine evaluates
+// itself take over the frame, other builtins that aren't strict are called
+// natively with the unevaluated arguments.
+static Step check_function(Frame *f, RunResult *rr) {
+	const Node *fn = f->vals[0];
+	Node *const *args = f->nodes + 1;
+	const size_t nargs = f->len - 1;
+
+	f->checked = true;
+
+	if (fn == NULL) {
+		*rr = rr_errf("cannot call nil value '%s'", stringify(f->nodes[0], 0));
+		return STEP_ERROR;
+	} else if (fn->type != AST_FUN) {
+		*rr = rr_errf("Cannot call non-function (type %s)", typetostr(f->nodes[0]));
+		return STEP_ERROR;
+	}
+
+	const Function *function = &fn->function;
+	if (!function->isBuiltin || (function->flags & BUILTIN_STRICT)) {
+		return STEP_AGAIN;
+	}
+
+	if (function->fn == builtin_do && nargs >= 1) {
+		return become_seq(f, args, nargs, rr);
+	} else if (function->fn == builtin_if && nargs >= 2 && nargs <= 3) {
+		free_vals(f);
+		f->kind = FRAME_IF;
+		f->nodes = args;
+		f->len = nargs;
+		f->i = 0;
+		return STEP_AGAIN;
+	} else if (function->fn == builtin_cond) {
+		bool clauses = true;
+		for (size_t i = 0; i < nargs; i++) {
+			clauses = clauses && args[i]->type == AST_EXPR && args[i]->expr.len > 0;
+		}
+		if (clauses) {
+			free_vals(f);
+			f->kind = FRAME_COND;
+			f->nodes = args;
+			f->len = nargs;
+			f->i = 0;
+			return STEP_AGAIN;
+		}
+	} else if (
+		function->fn == builtin_let &&
+		nargs >= 2 &&
+		args[0]->type == AST_EXPR &&
+		literalBindings(args[0])
+	) {
+		free_vals(f);
+		f->kind = FRAME_LET;
+		f->let = scope_make(f->scope, true);
+		f->nodes = args;
+		f->len = nargs;
+		f->i = 0;
+		return STEP_AGAIN;
+	} else if (function->fn == builtin_while && nargs >= 1) {
+		free_vals(f);
+		f->kind = FRAME_WHILE;
+		f->nodes = args;
+		f->len = nargs;
+		f->i = 0;
+		return STEP_AGAIN;
+	} else if (
+		function->fn == builtin_times ||
+		function->fn == builtin_for ||
+		function->fn == builtin_each
+	) {
+		// the head is evaluated natively, only the body may yield
+		Iter it;
+		*rr = loop_head(f->scope, function->fn, nargs, (const Node**)args, &it);
+		if (rr->err != NULL) {
+			return STEP_ERROR;
+		}
+		free_vals(f);
+		f->kind = FRAME_EACH;
+		f->var = args[0]->var.name;
+		f->iter = it;
+		f->nodes = args + 2;
+		f->len = nargs - 2;
+		f->i = f->len;
+		return STEP_AGAIN;
+	}
+
+	*rr = callBuiltin(f->scope, function, nargs, (const Node**)args);
+	if (rr->err != NULL) {
+		return STEP_ERROR;
+	} else if (rr->tail != NULL) {
+		return become(f, rr->tail, rr);
+	}
+	return STEP_DONE;
+}
+
+// Calls the function of f with the evaluated arguments.
+static Step apply(Machine *m, Frame *f, RunResult *rr) {
+	const Function *fn = &f->vals[0]->function;
+	Node **vals = f->vals + 1;
+	const size_t nargs = f->len - 1;
+
+	if (fn->isBuiltin && fn->fn == builtin_yield) {
+		if (nargs != 1) {
+			*rr = rr_errf("expected number of args to == 1 but is %d", nargs);
+			return STEP_ERROR;
+		} else if (!m->generator) {
+			*rr = rr_errf(YIELD_ERR);
+			return STEP_ERROR;
+		}
+		*rr = rr_node(vals[0]);
+		vals[0] = NULL;
+		return STEP_YIELD;
+	}
+
+	if (fn->isBuiltin) {
+		*rr = callBuiltinMoved(f->scope, fn, nargs, vals);
+		return rr->err != NULL ? STEP_ERROR : STEP_DONE;
+	}
+
+	if (nargs != fn->lambda->args.len) {
+		*rr = rr_errf("expected number of args to == %d but is %d", fn->lambda->args.len, nargs);
+		return STEP_ERROR;
+	}
+
+	// memoized functions are called natively, and so is machine code that
+	// doesn't recurse on the C stack
+	Node *val;
+	if (fn->lambda->memo != NULL) {
+		*rr = memo_call(f->scope, fn->lambda, nargs, (const Node**)vals);
+		return rr->err != NULL ? STEP_ERROR : STEP_DONE;
+	} else if (jit_call(f->scope, fn->lambda, nargs, vals, &val, true)) {
+		*rr = rr_node(val);
+		return STEP_DONE;
+	}
+
+	// f->nodes may point into the body of the current lambda, it's not used
+	// after this.
+	Lambda *next = lambda_retain(fn->lambda);
+	lambda_release(f->lambda);
+	f->lambda = next;
+
+	if (f->owned == NULL) {
+		f->owned = scope_make(f->scope, false);
+		f->scope = f->owned;
+	}
+	for (size_t i = 0; i < nargs; i++) {
+		varmap_moveItem(f->owned->variables, next->args.nodes[i]->var.name, vals[i]);
+		vals[i] = NULL;
+	}
+
+	return become(f, next->body, rr);
+}
+
+// Gets the value of src into val, unless a frame had to be pushed for it or it
+// failed.
+#define NEXT_VALUE(src) do { \
+	if (!hasVal) { \
+		RunResult child; \
+		if (!eval_child(m, f, (src), &child)) { \
+			return STEP_PUSHED; \
+		} else if (child.err != NULL) { \
+			*rr = child; \
+			return STEP_ERROR; \
+		} \
+		val = child.node; \
+	} \
+	hasVal = false; \
+} while (0)
+
+// Advances the top frame f, after giving it the value of the frame that was
+// popped last if hasVal is set.
+static Step advance(Machine *m, Frame *f, Node *val, bool hasVal, RunResult *rr) {
+	switch (f->kind) {
+	case FRAME_CALL:
+		for (;;) {
+			if (f->i == 1 && !f->checked) {
+				Step step = check_function(f, rr);
+				if (step != STEP_AGAIN || f->kind != FRAME_CALL || !f->checked) {
+					return step;
+				}
+			}
+			if (f->i == f->len) {
+				return apply(m, f, rr);
+			}
+
+			NEXT_VALUE(f->nodes[f->i]);
+			f->vals[f->i++] = val;
+		}
+
+	case FRAME_IF: {
+		NEXT_VALUE(f->nodes[0]);
+
+		if (val == NULL || val->type != AST_NUM) {
+			node_free(val);
+			*rr = rr_errf("expected cond to have type AST_NUM");
+			return STEP_ERROR;
+		}
+		bool cond = val->num.val;
+		node_free(val);
+
+		if (cond) {
+			return become(f, f->nodes[1], rr);
+		} else if (f->len == 3) {
+			return become(f, f->nodes[2], rr);
+		}
+		*rr = rr_null();
+		return STEP_DONE;
+	}
+
+	case FRAME_SEQ:
+		while (f->i < f->len - 1) {
+			NEXT_VALUE(f->nodes[f->i]);
+			node_free(val);
+			f->i++;
+		}
+		return become(f, f->nodes[f->len - 1], rr);
+
+	case FRAME_COND:
+		for (; f->i < f->len; f->i++) {
+			const Expression *clause = &f->nodes[f->i]->expr;
+			NEXT_VALUE(clause->nodes[0]);
+
+			if (val == NULL || val->type == AST_QUOTED) {
+				node_free(val);
+				continue;
+			} else if (val->type != AST_NUM) {
+				node_free(val);
+				*rr = rr_errf("expected cond to have type AST_NUM");
+				return STEP_ERROR;
+			}
+
+			bool cond = val->num.val;
+			node_free(val);
+			if (cond) {
+				return become_seq(f, clause->nodes + 1, clause->len - 1, rr);
+			}
+		}
+
+		for (size_t i = 0; i < f->len; i++) {
+			const Expression *clause = &f->nodes[i]->expr;
+			if (isElse(clause->nodes[0])) {
+				return become_seq(f, clause->nodes + 1, clause->len - 1, rr);
+			}
+		}
+		*rr = rr_null();
+		return STEP_DONE;
+
+	case FRAME_WHILE:
+		// i is 0 while evaluating the condition, the body comes after it
+		for (;;) {
+			if (f->i == 0) {
+				NEXT_VALUE(f->nodes[0]);
+
+				if (val == NULL || val->type != AST_NUM) {
+					node_free(val);
+					*rr = rr_errf("expected cond to have type AST_NUM");
+					return STEP_ERROR;
+				}
+				bool cond = val->num.val;
+				node_free(val);
+
+				if (!cond) {
+					*rr = rr_null();
+					return STEP_DONE;
+				}
+				f->i = 1;
+			}
+
+			for (; f->i < f->len; f->i++) {
+				NEXT_VALUE(f->nodes[f->i]);
+				node_free(val);
+			}
+			f->i = 0;
+		}
+
+	case FRAME_EACH:
+		// i is len once the body is done with an item
+		for (;;) {
+			if (f->i == f->len) {
+				if (f->iter.i == f->iter.len) {
+					varmap_removeItem(f->scope->variables, f->var);
+					*rr = rr_null();
+					return STEP_DONE;
+				}
+				loop_bind(f->scope, f->var, &f->iter, f->iter.i++);
+				f->i = 0;
+			}
+
+			for (; f->i < f->len; f->i++) {
+				NEXT_VALUE(f->nodes[f->i]);
+				node_free(val);
+			}
+		}
+
+	case FRAME_LET: {
+		// i goes through the bindings, and is past them once the body runs
+		const Expression *bindings = &f->nodes[0]->expr;
+		if (f->i > bindings->len) {
+			*rr = rr_node(val);
+			return STEP_DONE;
+		}
+
+		// the values are evaluated in the enclosing scope
+		for (; f->i < bindings->len; f->i++) {
+			const Expression *pair = &bindings->nodes[f->i]->expr;
+			NEXT_VALUE(pair->nodes[1]);
+			varmap_moveItem(f->let->variables, pair->nodes[0]->var.name, val);
+		}
+
+		// the body gets a frame of its own, which owns the scope and may
+		// rebind it for tail calls like the frame of a function does
+		Frame *body = calloc(1, sizeof(Frame));
+		assert(body);
+		body->parent = m->top;
+		body->kind = FRAME_SEQ;
+		body->scope = body->owned = f->let;
+		body->nodes = f->nodes + 1;
+		body->len = f->len - 1;
+		m->top = body;
+		f->let = NULL;
+		f->i++;
+		return STEP_PUSHED;
+	}
+	}
+
+	assert(false);
+	return STEP_ERROR;
+}
+
+#undef NEXT_VALUE
+
+// Runs the machine until its frame stack is empty, or it yields. On STEP_DONE
+// and STEP_YIELD the value is in rr, on STEP_ERROR the stack is unwound.
+static Step machine_run(Machine *m, RunResult *rr) {
+	Node *val = NULL;
+	bool hasVal = m->resumed;
+	m->resumed = false;
+
+	while (m->top != NULL) {
+		Frame *f = m->top;
+		Step step = advance(m, f, val, hasVal, rr);
+		val = NULL;
+		hasVal = false;
+
+		switch (step) {
+		case STEP_PUSHED:
+		case STEP_AGAIN:
+			break;
+
+		case STEP_DONE:
+			pop(m);
+			val = rr->node;
+			hasVal = true;
+			break;
+
+		case STEP_YIELD:
+			// the yield returns nil when the generator is resumed
+			pop(m);
+			m->resumed = true;
+			return STEP_YIELD;
+
+		case STEP_ERROR:
+			unwind(m);
+			return STEP_ERROR;
+		}
+	}
+
+	*rr = rr_node(val);
+	return STEP_DONE;
+}
+
+RunResult frames_run(Scope *scope, const Node *node) {
+	assert(nonEmptyExpr(node));
+
+	Machine m = { .top = NULL, .generator = false, .resumed = false };
+	push_call(&m, scope, node);
+
+	RunResult rr;
+	machine_run(&m, &rr);
+	return rr;
+}
+
+struct Generator {
+	size_t refs;
+	Machine machine;
+	// where the values of a builtin generator come from
+	GeneratorSource source;
+
+	// the value of the last yield, if ready
+	Node *next;
+	bool ready;
+	bool done;
+	bool running;
+};
+
+Generator *generator_make(Scope *scope, const Node *fn, size_t nargs, const Node **values) {
+	Generator *gen = calloc(1, sizeof(Generator));
+	assert(gen);
+	gen->refs = 1;
+	gen->machine.generator = true;
+
+	// the values are what the arguments evaluated to, they aren't evaluated
+	// again, which would make a call of a list
+	Frame *f = calloc(1, sizeof(Frame));
+	assert(f);
+	f->kind = FRAME_CALL;
+	f->scope = scope_get_root(scope);
+	f->len = nargs + 1;
+	f->i = f->len;
+	f->checked = true;
+	f->vals = malloc(f->len, sizeof(Node*));
+	f->vals[0] = node_copy(fn);
+	for (size_t i = 0; i < nargs; i++) {
+		f->vals[i + 1] = node_copy(values[i]);
+	}
+	gen->machine.top = f;
+	return gen;
+}
+
+Generator *generator_native(GeneratorSource source) {
+	Generator *gen = calloc(1, sizeof(Generator));
+	assert(gen);
+	gen->refs = 1;
+	gen->source = source;
+	return gen;
+}
+
+Generator *generator_retain(Generator *gen) {
+	gen->refs++;
+	return gen;
+}
+
+void generator_release(Generator *gen) {
+	if (gen == NULL || --gen->refs > 0) {
+		return;
+	}
+
+	unwind(&gen->machine);
+	node_free(gen->next);
+	if (gen->source.free != NULL) {
+		gen->source.free(gen->source.state);
+	}
+	free(gen);
+}
+
+RunResult generator_fill(Generator *gen) {
+	if (gen->ready || gen->done) {
+		return rr_null();
+	} else if (gen->running) {
+		return rr_errf("generator resumed from inside itself");
+	} else if (gen->source.next != NULL) {
+		bool done = false;
+		RunResult rr = gen->source.next(gen->source.state, &done);
+		if (rr.err != NULL || done) {
+			gen->done = true;
+			return rr;
+		}
+		gen->next = rr.node;
+		gen->ready = true;
+		return rr_null();
+	}
+
+	RunResult rr;
+	gen->running = true;
+	Step step = machine_run(&gen->machine, &rr);
+	gen->running = false;
+
+	switch (step) {
+	case STEP_YIELD:
+		gen->next = rr.node;
+		gen->ready = true;
+		return rr_null();
+
+	case STEP_DONE:
+		node_free(rr.node);
+		gen->done = true;
+		return rr_null();
+
+	default:
+		gen->done = true;
+		return rr;
+	}
+}
+
+bool generator_done(const Generator *gen) {
+	return gen->done;
+}
+
+Node *generator_take(Generator *gen) {
+	Node *res = gen->next;
+	gen->next = NULL;
+	gen->ready = false;
+	return res;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// An evaluator that keeps its continuation in heap allocated frames instead
+// of on the C stack. Calls to user functions and strict builtins, and the do,
+// if, cond, let, while, times, for and each forms are evaluated by pushing
+// frames, so recursion through them is only limited by memory. Other
+// builtins, like set, map and print, are still called natively.
+
+RunResult frames_run(Scope*, const Node*);
+
+// A generator runs a function on its own frame stack, which is kept between
+// resumes so (yield value) can suspend the function from any depth of calls
+// and forms the evaluator handles itself, but not from code a builtin runs
+// natively, like the function given to map. Generators are reference counted
+// and shared by their copies.
+//
+// A generator runs in the root scope, since the scope it was made in may be
+// gone by the time it's resumed.
+typedef struct Generator Generator;
+
+// Makes a generator that calls fn with copies of the given values.
+Generator *generator_make(Scope*, const Node *fn, size_t nargs, const Node **values);
+
+// What a builtin generator yields: next returns the next value, or sets done
+// once there are no more, and free frees state with the generator.
+typedef struct GeneratorSource {
+	RunResult (*next)(void *state, bool *done);
+	void (*free)(void *state);
+	void *state;
+} GeneratorSource;
+// Makes a generator that yields what the source gives, without a function.
+Generator *generator_native(GeneratorSource);
+Generator *generator_retain(Generator*);
+void generator_release(Generator*);
+
+// Runs the generator up to its next yield, if that hasn't happened yet.
+RunResult generator_fill(Generator*);
+// Whether the function has returned, only valid after generator_fill.
+bool generator_done(const Generator*);
+// Takes the value of the last yield, only valid after generator_fill.
+Node *generator_take(Generator*);
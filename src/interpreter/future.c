@@ -0,0 +1,384 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "coro.h"
+#include "future.h"
+#include "image.h"
+#include "isolate.h"
+#include "pool.h"
+#include "../deque.h"
+#include "../util.h"
+
+// How many futures a waiting worker runs inside each other before it just
+// waits, which bounds how deep its stack gets.
+#define MAX_HELPING 32
+
+enum {
+	FUTURE_PENDING,
+	FUTURE_RUNNING,
+	FUTURE_DONE,
+};
+
+struct Future {
+	atomic_size_t refs;
+	atomic_int state;
+
+	// the expression and the variables it starts with, all transferred, until
+	// the future runs
+	Node *expr;
+	size_t nvars;
+	size_t cap;
+	char **names;
+	Node **vals;
+	// the image of the isolate that made it, which it starts from too
+	const Image *image;
+
+	// the transferred value or the error, once it's done
+	Node *val;
+	char *err;
+
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	// the event loops of the coroutines that wait for it
+	Watchers watchers;
+
+	// the next future in the queue of those made by other threads than the
+	// workers
+	Future *next;
+};
+
+static struct {
+	pthread_once_t once;
+	size_t size;
+	Deque **deques;
+
+	pthread_mutex_t lock;
+	Future *first;
+	Future *last;
+	// the length of that queue, which is read without the lock
+	atomic_size_t queued;
+	// idle workers wait for new futures on wake
+	pthread_cond_t wake;
+	atomic_size_t sleeping;
+} sched = { .once = PTHREAD_ONCE_INIT };
+
+// the worker on this thread, SIZE_MAX if it isn't one
+static _Thread_local size_t self = SIZE_MAX;
+static _Thread_local uint32_t seed = 0;
+static _Thread_local size_t helping = 0;
+
+Future *future_retain(Future *f) {
+	atomic_fetch_add_explicit(&f->refs, 1, memory_order_relaxed);
+	return f;
+}
+
+static void free_task(Future *f) {
+	node_free(f->expr);
+	f->expr = NULL;
+	for (size_t i = 0; i < f->nvars; i++) {
+		free(f->names[i]);
+		node_free(f->vals[i]);
+	}
+	free(f->names);
+	free(f->vals);
+	f->names = NULL;
+	f->vals = NULL;
+	f->nvars = 0;
+}
+
+void future_release(Future *f) {
+	if (f == NULL || atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) > 1) {
+		return;
+	}
+
+	free_task(f);
+	node_free(f->val);
+	free(f->err);
+	pthread_mutex_destroy(&f->lock);
+	pthread_cond_destroy(&f->done);
+	watchers_free(&f->watchers);
+	free(f);
+}
+
+static void add_var(void *ctx, const char *name, Node *val) {
+	Future *f = ctx;
+	if (f->nvars == f->cap) {
+		f->cap = f->cap == 0 ? 8 : f->cap * 2;
+		f->names = realloc(f->names, f->cap, sizeof(char*));
+		f->vals = realloc(f->vals, f->cap, sizeof(Node*));
+	}
+	f->names[f->nvars] = astrcpy(name);
+	f->vals[f->nvars] = val;
+	f->nvars++;
+}
+
+// Whether this thread gets to run the future.
+static bool claim(Future *f) {
+	int pending = FUTURE_PENDING;
+	return atomic_compare_exchange_strong(&f->state, &pending, FUTURE_RUNNING);
+}
+
+// Runs a claimed future on this thread.
+static void run_future(Future *f) {
+	// binding counts of its own, so code compiled for the future can rely on
+	// its functions, and the isolate it may be running inside can too
+	Bindings *outer = bindings_enter();
+	Scope *root = image_scope(f->image);
+	for (size_t i = 0; i < f->nvars; i++) {
+		varmap_moveItem(root->variables, f->names[i], f->vals[i]);
+		f->vals[i] = NULL;
+	}
+
+	RunResult rr = run(root, f->expr);
+	// the value may still share values with the root scope
+	if (rr.err == NULL) {
+		RunResult res = isolate_transfer(rr.node);
+		node_free(rr.node);
+		rr = res;
+	}
+	scope_free(root);
+	bindings_leave(outer);
+	free_task(f);
+
+	pthread_mutex_lock(&f->lock);
+	f->val = rr.node;
+	f->err = rr.err;
+	atomic_store(&f->state, FUTURE_DONE);
+	pthread_cond_broadcast(&f->done);
+	watchers_notify(&f->watchers);
+	pthread_mutex_unlock(&f->lock);
+}
+
+static uint32_t next_random(void) {
+	// xorshift
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static Future *dequeue(void) {
+	pthread_mutex_lock(&sched.lock);
+	Future *f = sched.first;
+	if (f != NULL) {
+		sched.first = f->next;
+		atomic_fetch_sub(&sched.queued, 1);
+		if (sched.first == NULL) {
+			sched.last = NULL;
+		}
+	}
+	pthread_mutex_unlock(&sched.lock);
+	return f;
+}
+
+// Takes a queued future: from the worker's own deque, then from those made
+// elsewhere, then from another worker, starting at a random one.
+static Future *next_queued(void) {
+	Future *f = NULL;
+	if (self != SIZE_MAX) {
+		f = deque_take(sched.deques[self]);
+	}
+	if (f == NULL && atomic_load(&sched.queued) > 0) {
+		f = dequeue();
+	}
+
+	const size_t start = next_random() % sched.size;
+	for (size_t i = 0; f == NULL && i < sched.size; i++) {
+		const size_t victim = (start + i) % sched.size;
+		if (victim != self) {
+			f = deque_steal(sched.deques[victim]);
+		}
+	}
+	return f;
+}
+
+// Returns a queued future that this thread claimed, the queues hold on to
+// futures that were touched before a worker got to them.
+static Future *find_work(void) {
+	for (;;) {
+		Future *f = next_queued();
+		if (f == NULL || claim(f)) {
+			return f;
+		}
+		future_release(f);
+	}
+}
+
+static bool has_work(void) {
+	if (atomic_load(&sched.queued) > 0) {
+		return true;
+	}
+	for (size_t i = 0; i < sched.size; i++) {
+		if (deque_busy(sched.deques[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static struct timespec deadline(long ns) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += ns;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+	return ts;
+}
+
+static void *worker_main(void *arg) {
+	self = (size_t)arg;
+	seed = self + 1;
+
+	for (;;) {
+		Future *f = find_work();
+		if (f != NULL) {
+			run_future(f);
+			future_release(f);
+			continue;
+		}
+
+		// the timeout covers a wake-up that was missed, and steals that lost
+		// a race but would succeed now
+		pthread_mutex_lock(&sched.lock);
+		atomic_fetch_add(&sched.sleeping, 1);
+		if (!has_work()) {
+			const struct timespec ts = deadline(10 * 1000 * 1000);
+			pthread_cond_timedwait(&sched.wake, &sched.lock, &ts);
+		}
+		atomic_fetch_sub(&sched.sleeping, 1);
+		pthread_mutex_unlock(&sched.lock);
+	}
+	return NULL;
+}
+
+static void start(void) {
+	sched.size = pool_default_size();
+	sched.deques = malloc(sched.size, sizeof(Deque*));
+	for (size_t i = 0; i < sched.size; i++) {
+		sched.deques[i] = deque_make();
+	}
+	pthread_mutex_init(&sched.lock, NULL);
+	pthread_cond_init(&sched.wake, NULL);
+	atomic_init(&sched.sleeping, 0);
+	atomic_init(&sched.queued, 0);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, 8 << 20);
+	for (size_t i = 0; i < sched.size; i++) {
+		pthread_t thread;
+		pthread_create(&thread, &attr, worker_main, (void*)i);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+// Queues a future, which the queue holds a reference to.
+static void submit(Future *f) {
+	pthread_once(&sched.once, start);
+
+	future_retain(f);
+	if (self != SIZE_MAX) {
+		deque_push(sched.deques[self], f);
+	} else {
+		pthread_mutex_lock(&sched.lock);
+		f->next = NULL;
+		if (sched.last != NULL) {
+			sched.last->next = f;
+		} else {
+			sched.first = f;
+		}
+		sched.last = f;
+		atomic_fetch_add(&sched.queued, 1);
+		pthread_mutex_unlock(&sched.lock);
+	}
+
+	// pairs with the check of a worker that's going to sleep
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&sched.sleeping) > 0) {
+		pthread_mutex_lock(&sched.lock);
+		pthread_cond_signal(&sched.wake);
+		pthread_mutex_unlock(&sched.lock);
+	}
+}
+
+RunResult future_make(Scope *scope, const Node *expr) {
+	RunResult rr = isolate_transfer(expr);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	Future *f = calloc(1, sizeof(Future));
+	atomic_init(&f->refs, 1);
+	atomic_init(&f->state, FUTURE_PENDING);
+	f->expr = rr.node;
+	f->image = scope_get_root(scope)->image;
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->done, NULL);
+	watchers_init(&f->watchers, &f->lock);
+	isolate_capture(scope, expr, add_var, f);
+
+	if (pool_default_size() == 1) {
+		claim(f);
+		run_future(f);
+	} else {
+		submit(f);
+	}
+
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_FUTURE;
+	res->future = f;
+	return rr_node(res);
+}
+
+static bool is_done(void *f) {
+	return atomic_load(&((Future*)f)->state) == FUTURE_DONE;
+}
+
+// Waits for a future that another thread is running. Workers run queued
+// futures in the meantime, which are usually the ones the future they wait
+// for is waiting for. Other threads let their coroutines run.
+static char *wait_for(Future *f) {
+	if (self == SIZE_MAX) {
+		return coro_wait(&f->watchers, is_done, f);
+	}
+
+	while (atomic_load(&f->state) != FUTURE_DONE) {
+		if (self != SIZE_MAX && helping < MAX_HELPING) {
+			Future *other = find_work();
+			if (other != NULL) {
+				helping++;
+				run_future(other);
+				helping--;
+				future_release(other);
+				continue;
+			}
+		}
+
+		pthread_mutex_lock(&f->lock);
+		if (atomic_load(&f->state) != FUTURE_DONE) {
+			const struct timespec ts = deadline(1000 * 1000);
+			pthread_cond_timedwait(&f->done, &f->lock, &ts);
+		}
+		pthread_mutex_unlock(&f->lock);
+	}
+	return NULL;
+}
+
+RunResult future_touch(Future *f) {
+	if (claim(f)) {
+		run_future(f);
+	} else {
+		char *err = wait_for(f);
+		if (err != NULL) {
+			return rr_err(err);
+		}
+	}
+
+	if (f->err != NULL) {
+		return rr_errf("error in future: %s", f->err);
+	}
+	return isolate_transfer(f->val);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// A future evaluates an expression in an isolate of its own, see isolate.h,
+// which starts with copies of the variables the expression uses. Futures are
+// run by a scheduler with a work-stealing deque per worker thread: a future
+// made on a worker goes on the bottom of its deque, and idle workers steal
+// from the top of the others', so the oldest and usually biggest pieces of a
+// divide-and-conquer computation are the ones that move between threads.
+//
+// Touching a future that hasn't started runs it on the spot. A worker that
+// waits for a future another worker is running runs queued futures in the
+// meantime. With a single worker, futures run where they're made, which gives
+// the same results since they're isolated either way.
+//
+// Futures themselves are shared between isolates, like channels, so their
+// reference count is atomic. Their value belongs to no isolate, touching one
+// gives a copy.
+
+RunResult future_make(Scope*, const Node *expr);
+Future *future_retain(Future*);
+void future_release(Future*);
+
+// Waits for the value of the future, or its error.
+RunResult future_touch(Future*);
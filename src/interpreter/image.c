@@ -0,0 +1,439 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "image.h"
+#include "isolate.h"
+#include "snapshot.h"
+#include "builtins/stdio.h"
+#include "../util.h"
+
+// A variable of an image file: its name and its snapshot, in the mapping.
+typedef struct Entry {
+	const char *name;
+	const char *start;
+	const char *end;
+} Entry;
+
+struct Image {
+	BuiltinList *builtins;
+	// the variables of an image that was made
+	VarMap *vars;
+	// or those of an image file, sorted by name, which are read when they're
+	// first used
+	const char *map;
+	size_t size;
+	size_t nentries;
+	Entry *entries;
+
+	size_t nlibs;
+	char **libs;
+};
+
+// An image file has a header, then the names of its libraries, then a
+// table of its variables with the offsets and sizes of their snapshots, then
+// the snapshots. Files made by a build with other builtins can't be read.
+#define IMAGE_MAGIC "schymimg"
+#define IMAGE_VERSION 1
+
+// the image that's being made on this thread, which loaded libraries are
+// added to
+static _Thread_local Image *making = NULL;
+
+static const Image *base = NULL;
+static pthread_once_t baseOnce = PTHREAD_ONCE_INIT;
+
+static Image *image_empty(void) {
+	Image *res = malloc(1, sizeof(Image));
+	res->builtins = builtins_make(true);
+	res->vars = varmap_make();
+	res->map = NULL;
+	res->size = 0;
+	res->nentries = 0;
+	res->entries = NULL;
+	res->nlibs = 0;
+	res->libs = NULL;
+	return res;
+}
+
+// Leaves out the builtin the variable name shadows, if there is one, so code
+// that resolves builtins ahead of time looks the name up instead.
+static void shadow(Image *image, const char *name) {
+	if (getBuiltin(image->builtins, name) != NULL) {
+		enableBuiltin(image->builtins, name, false);
+	}
+}
+
+Image *image_make(size_t nlibs, const char *const *libs, char **err) {
+	Image *res = image_empty();
+	*err = NULL;
+
+	// the libraries run as an isolate of their own, so nothing they bind
+	// counts for the one that makes the image
+	Bindings *outer = bindings_enter();
+	Image *const outerMaking = making;
+	making = res;
+
+	Scope root = {
+		.parent = NULL,
+		.variables = varmap_make(),
+		.builtins = res->builtins,
+		.image = NULL,
+		.root = &root,
+	};
+	for (size_t i = 0; i < nlibs && *err == NULL; i++) {
+		Node lib = { .type = AST_STR, .str = { .size = strlen(libs[i]), .str = (char*)libs[i] } };
+		RunResult rr = builtin_load(&root, "load", 1, (const Node*[]){ &lib });
+		node_free(rr.node);
+		if (rr.err != NULL) {
+			*err = rr_errf("couldn't load %s: %s", libs[i], rr.err).err;
+			free(rr.err);
+		}
+	}
+
+	// nothing in the image may be shared with the isolate that made it
+	for (size_t i = 0; i < varmap_length(root.variables) && *err == NULL; i++) {
+		const char *name = varmap_keyAt(root.variables, i);
+		RunResult rr = isolate_transfer(varmap_itemAt(root.variables, i));
+		if (rr.err != NULL) {
+			*err = rr_errf("can't put %s in an image: %s", name, rr.err).err;
+			free(rr.err);
+			break;
+		}
+		varmap_moveItem(res->vars, name, rr.node);
+		shadow(res, name);
+	}
+
+	varmap_free(root.variables);
+	making = outerMaking;
+	bindings_leave(outer);
+
+	if (*err != NULL) {
+		image_free(res);
+		return NULL;
+	}
+	return res;
+}
+
+void image_free(Image *image) {
+	if (image == NULL) {
+		return;
+	}
+
+	builtins_free(image->builtins);
+	varmap_free(image->vars);
+	if (image->map != NULL) {
+		munmap((void*)image->map, image->size);
+	}
+	free(image->entries);
+	for (size_t i = 0; i < image->nlibs; i++) {
+		free(image->libs[i]);
+	}
+	free(image->libs);
+	free(image);
+}
+
+static int entry_cmp(const void *a, const void *b) {
+	return strcmp(((const Entry*)a)->name, ((const Entry*)b)->name);
+}
+
+// Returns a copy of the value of name in the image, which belongs to the
+// isolate that asks for it, or NULL and sets err if its snapshot is damaged.
+static Node *fault(const void *ctx, const char *name, char **err) {
+	const Image *image = ctx;
+	*err = NULL;
+	if (image->map == NULL) {
+		const Node *val = varmap_getOwnItem(image->vars, name);
+		if (val == NULL) {
+			return NULL;
+		}
+		// values that can't be transferred never make it into an image
+		RunResult rr = isolate_transfer(val);
+		assert(rr.err == NULL);
+		return rr.node;
+	}
+
+	const Entry key = { .name = name };
+	const Entry *entry = bsearch(&key, image->entries, image->nentries, sizeof(Entry), entry_cmp);
+	if (entry == NULL) {
+		return NULL;
+	}
+	SnapReader r = { .pos = entry->start, .end = entry->end };
+	RunResult rr = snapshot_read(&r, image->builtins);
+	if (rr.err != NULL) {
+		*err = rr_errf("couldn't read %s from the image: %s", name, rr.err).err;
+		free(rr.err);
+	}
+	return rr.node;
+}
+
+Scope *image_scope(const Image *image) {
+	if (image == NULL) {
+		image = image_base();
+	}
+
+	Scope *res = malloc(1, sizeof(Scope));
+	res->parent = NULL;
+	res->variables = varmap_make();
+	varmap_setBase(res->variables, fault, image);
+	res->builtins = image->builtins;
+	res->image = image;
+	res->root = res;
+	res->above = 0;
+	res->epoch = 0;
+	return res;
+}
+
+// A variable to save, and whether the value was made for that.
+typedef struct Saved {
+	const char *name;
+	Node *val;
+	bool owned;
+} Saved;
+
+static int saved_cmp(const void *a, const void *b) {
+	return strcmp(((const Saved*)a)->name, ((const Saved*)b)->name);
+}
+
+// Adds the variables of the image that root doesn't bind itself, or sets err
+// if one of them can't be read.
+static size_t add_image_vars(const Scope *root, Saved *vars, size_t n, char **err) {
+	const Image *image = root->image;
+	const size_t len = image->map != NULL ? image->nentries : varmap_length(image->vars);
+	for (size_t i = 0; i < len; i++) {
+		const char *name = image->map != NULL ? image->entries[i].name : varmap_keyAt(image->vars, i);
+		if (varmap_getOwnItem(root->variables, name) != NULL) {
+			continue;
+		}
+		Node *val = fault(image, name, err);
+		if (*err != NULL) {
+			break;
+		} else if (val != NULL) {
+			vars[n++] = (Saved){ .name = name, .val = val, .owned = true };
+		}
+	}
+	return n;
+}
+
+// Writes the file next to path and renames it into place, since processes that
+// opened the image at path may still read variables from their mapping of it.
+static char *write_file(const char *path, const SnapWriter *w) {
+	const size_t len = strlen(path) + 32;
+	char *tmp = malloc(len, sizeof(char));
+	snprintf(tmp, len, "%s.%ld.tmp", path, (long)getpid());
+
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	bool ok = fd >= 0;
+	for (size_t done = 0; ok && done < w->len;) {
+		const ssize_t n = write(fd, w->data + done, w->len - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		ok = n > 0;
+		done += ok ? (size_t)n : 0;
+	}
+	ok = ok && fsync(fd) == 0;
+	if (fd >= 0 && close(fd) != 0) {
+		ok = false;
+	}
+	ok = ok && rename(tmp, path) == 0;
+
+	char *err = NULL;
+	if (!ok) {
+		err = rr_errf("couldn't write %s: %s", path, strerror(errno)).err;
+		unlink(tmp);
+	}
+	free(tmp);
+	return err;
+}
+
+char *image_save(Scope *root, const char *path) {
+	const Image *image = root->image;
+	size_t cap = varmap_length(root->variables);
+	if (image != NULL) {
+		cap += image->map != NULL ? image->nentries : varmap_length(image->vars);
+	}
+
+	Saved *vars = malloc(cap, sizeof(Saved));
+	size_t n = 0;
+	for (size_t i = 0; i < varmap_length(root->variables); i++) {
+		vars[n++] = (Saved){
+			.name = varmap_keyAt(root->variables, i),
+			.val = (Node*)varmap_itemAt(root->variables, i),
+			.owned = false,
+		};
+	}
+	char *err = NULL;
+	if (image != NULL) {
+		n = add_image_vars(root, vars, n, &err);
+	}
+	qsort(vars, n, sizeof(Saved), saved_cmp);
+
+	SnapWriter snaps = { 0 };
+	uint64_t *offsets = malloc((n + 1), sizeof(uint64_t));
+	for (size_t i = 0; i < n && err == NULL; i++) {
+		offsets[i] = snaps.len;
+		err = snapshot_write(&snaps, root->builtins, vars[i].val);
+		if (err != NULL) {
+			char *msg = rr_errf("can't save %s: %s", vars[i].name, err).err;
+			free(err);
+			err = msg;
+		}
+	}
+	offsets[n] = snaps.len;
+
+	SnapWriter out = { 0 };
+	if (err == NULL) {
+		snap_bytes(&out, IMAGE_MAGIC, 8);
+		snap_u64(&out, IMAGE_VERSION);
+		snap_u64(&out, builtins_hash(root->builtins));
+
+		const size_t nlibs = image != NULL ? image->nlibs : 0;
+		snap_u64(&out, nlibs);
+		for (size_t i = 0; i < nlibs; i++) {
+			snap_str(&out, image->libs[i]);
+		}
+
+		snap_u64(&out, n);
+		for (size_t i = 0; i < n; i++) {
+			snap_str(&out, vars[i].name);
+			snap_u64(&out, offsets[i]);
+			snap_u64(&out, offsets[i + 1] - offsets[i]);
+		}
+		snap_bytes(&out, snaps.data, snaps.len);
+
+		err = write_file(path, &out);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (vars[i].owned) {
+			node_free(vars[i].val);
+		}
+	}
+	free(vars);
+	free(offsets);
+	free(snaps.data);
+	free(out.data);
+	return err;
+}
+
+// Reads the header, libraries and table of the mapped file into image.
+static bool read_file(Image *image) {
+	SnapReader r = { .pos = image->map, .end = image->map + image->size };
+	uint64_t version, hash, nlibs, nentries;
+	if (
+		image->size < 8 || memcmp(r.pos, IMAGE_MAGIC, 8) != 0 ||
+		(r.pos += 8, !snap_read_u64(&r, &version)) || version != IMAGE_VERSION ||
+		!snap_read_u64(&r, &hash) || hash != builtins_hash(image->builtins) ||
+		!snap_read_u64(&r, &nlibs) || nlibs > image->size
+	) {
+		return false;
+	}
+
+	image->libs = calloc(nlibs, sizeof(char*));
+	for (; image->nlibs < nlibs; image->nlibs++) {
+		const char *lib;
+		if (!snap_read_str(&r, &lib)) {
+			return false;
+		}
+		image->libs[image->nlibs] = astrcpy(lib);
+	}
+
+	if (!snap_read_u64(&r, &nentries) || nentries > image->size) {
+		return false;
+	}
+	image->entries = calloc(nentries, sizeof(Entry));
+	uint64_t *bounds = calloc(2 * nentries, sizeof(uint64_t));
+	bool ok = true;
+	for (size_t i = 0; i < nentries && ok; i++) {
+		ok = (
+			snap_read_str(&r, &image->entries[i].name) &&
+			snap_read_u64(&r, &bounds[2*i]) &&
+			snap_read_u64(&r, &bounds[2*i + 1]) &&
+			(i == 0 || strcmp(image->entries[i - 1].name, image->entries[i].name) < 0)
+		);
+	}
+
+	// the snapshots follow the table
+	const uint64_t len = r.end - r.pos;
+	for (size_t i = 0; i < nentries && ok; i++) {
+		const uint64_t offset = bounds[2*i], size = bounds[2*i + 1];
+		ok = offset <= len && size <= len - offset;
+		image->entries[i].start = r.pos + offset;
+		image->entries[i].end = r.pos + offset + size;
+		image->nentries++;
+		shadow(image, image->entries[i].name);
+	}
+	free(bounds);
+	return ok;
+}
+
+Image *image_open(const char *path, char **err) {
+	*err = NULL;
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		*err = rr_errf("couldn't open %s: %s", path, strerror(errno)).err;
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	void *map = st.st_size == 0 ? MAP_FAILED : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		*err = rr_errf("%s isn't an image made by this build", path).err;
+		return NULL;
+	}
+
+	Image *res = image_empty();
+	res->map = map;
+	res->size = st.st_size;
+	if (!read_file(res)) {
+		*err = rr_errf("%s isn't an image made by this build", path).err;
+		image_free(res);
+		return NULL;
+	}
+	return res;
+}
+
+bool image_has(const Image *image, const char *lib) {
+	for (size_t i = 0; image != NULL && i < image->nlibs; i++) {
+		if (streq(image->libs[i], lib)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void image_loaded(const char *lib) {
+	if (making == NULL || image_has(making, lib)) {
+		return;
+	}
+	making->libs = realloc(making->libs, (making->nlibs + 1), sizeof(char*));
+	making->libs[making->nlibs++] = astrcpy(lib);
+}
+
+static void make_base(void) {
+	if (base == NULL) {
+		base = image_empty();
+	}
+}
+
+const Image *image_base(void) {
+	pthread_once(&baseOnce, make_base);
+	return base;
+}
+
+void setBaseImage(const Image *image) {
+	base = image;
+}
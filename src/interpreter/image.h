@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// An image is a frozen root scope: the builtins, and the variables some
+// libraries bound when they were loaded into it. It never changes once it's
+// made, so any number of root scopes on any number of threads can start from
+// the same one without copying it.
+//
+// A root scope made from an image looks up the names it doesn't bind itself
+// in the image, and binds a copy of the value the first time, see
+// varmap_setBase. Binding a name of the image only changes the root scope.
+// Loading a library that was loaded into the image does nothing.
+//
+// Images are never freed while a scope made from them may still be used.
+typedef struct Image Image;
+
+// Makes an image of the builtins and of what loading the given libraries, in
+// order, binds. Returns NULL and sets err if one of them fails, or binds a
+// value that can't be transferred, see isolate_transfer.
+Image *image_make(size_t nlibs, const char *const *libs, char **err);
+// Opens an image file written by image_save. The file is mapped, and a
+// variable is only read from it when a scope first uses it.
+Image *image_open(const char *path, char **err);
+void image_free(Image*);
+
+// Makes a root scope that starts from the image, or from the base image if
+// it's NULL.
+Scope *image_scope(const Image*);
+
+// Writes the variables visible in the root scope, those of its image
+// included, to an image file, and the libraries of its image. Returns an error
+// if one of the values can't be saved, see snapshot_write.
+char *image_save(Scope *root, const char *path);
+
+// Whether lib was loaded into the image, or one of the libraries that were.
+bool image_has(const Image*, const char *lib);
+// Called when a library is done loading.
+void image_loaded(const char *lib);
+
+// The image scope_make starts root scopes from. It only has the builtins,
+// unless it's set before any scope is made.
+const Image *image_base(void);
+void setBaseImage(const Image*);
@@ -22,17 +22,68 @@ typedef struct RunResult {
 	// Not-NULL values need to be freed.
 	Node *node;
 	char *err;
+
+	// Builtins can return the node that produces their result instead of
+	// evaluating it themselves, the caller will evaluate it in the same scope.
+	// This is how tail calls through do, if and cond avoid growing the stack.
+	// run() never returns a tail.
+	const Node *tail;
 } RunResult;
 
 RunResult rr_null(void);
 RunResult rr_errf(const char*, ...);
 RunResult rr_node(Node*);
+RunResult rr_tail(const Node*);
+// Takes ownership of the error.
+RunResult rr_err(char*);
+
+Node *num_node(double);
+// Whether node is the quoted symbol str, like 'else.
+bool isQuoted(const Node*, const char*);
 
 Node *getVar(const Scope*, const char*);
+// Like getVar, but sets err if the value couldn't be read from an image.
+Node *findVar(const Scope*, const char*, char **err);
 
 RunResult run(Scope*, const Node*);
 
+// Ownership of argument values. RunResult.node is owned by whoever receives
+// it, so passing a value on usually means copying it. Instead, a caller that
+// owns the values of the arguments can give them away:
+//
+//  - callBuiltinMoved passes the values of a strict builtin as the argument
+//    expressions, since values evaluate to themselves. The builtin gets them
+//    with takeArg, which hands over the value itself where run() would copy
+//    it. Values that aren't taken are freed after the call.
+//  - callFunctionMoved binds the values to the parameters of a user defined
+//    function without copying them.
+//
+// Every call of a builtin goes through callBuiltin or callBuiltinMoved, so
+// takeArg only ever moves the arguments of the innermost running builtin.
+RunResult callBuiltin(Scope*, const Function*, size_t, const Node**);
+RunResult callBuiltinMoved(Scope*, const Function*, size_t, Node**);
+RunResult takeArg(Scope*, const Node*);
+
+// The values moved to the builtins that are running, which a coroutine takes
+// with it when it's switched out, see coro.h. Sets them and returns the old
+// ones.
+typedef struct Moved Moved;
+Moved *moved_swap(Moved*);
+
+// Calls the given function with already evaluated arguments. A NULL value is
+// passed as nil. The values are borrowed, or consumed by callFunctionMoved.
+RunResult callFunction(Scope*, const Node*, size_t, const Node**);
+RunResult callFunctionMoved(Scope*, const Node*, size_t, Node**);
+// Calls a user defined function without looking at its memo cache, the number
+// of values has to match. The values are borrowed.
+RunResult callLambda(Scope*, Lambda*, size_t, const Node**);
+
 double getNumVal(Scope*, const Node*);
 
-// ugly, should be removed later
+// Runs the given top level nodes in order, like the main program, and returns
+// the value of the last one, or the first error. Consumes the nodes and the
+// array.
+RunResult runNodes(Scope *scope, size_t len, Node **nodes, bool intern);
+// Parses input, which it frees, and runs it with runNodes. Errors say where
+// they happened.
 RunResult runProgram(char *input, Scope *scope, bool intern);
@@ -7,13 +7,43 @@
 #include "interpreter.h"
 #include "internal.h"
 #include "../stringify.h"
+#include "../ast_manip.h"
 #include "../util.h"
 #include "./builtins.h"
+#include "./frames.h"
+#include "./compile.h"
+#include "./jit.h"
+#include "./memo.h"
 
 // TODO: some way to handle builtins
 
 #define DEBUG 0
 
+// Whether expressions are evaluated by the heap frame evaluator in frames.c.
+static bool heapFrames = false;
+
+void setHeapFrames(bool enable) {
+	heapFrames = enable;
+}
+
+// Whether programs are optimized before they're run.
+static bool optimizePrograms = true;
+
+void setOptimize(bool enable) {
+	optimizePrograms = enable;
+}
+
+bool getOptimize(void) {
+	return optimizePrograms;
+}
+
+// Whether the bodies of user defined functions are compiled, see compile.c.
+static bool compileBodies = true;
+
+void setCompile(bool enable) {
+	compileBodies = enable;
+}
+
 RunResult rr_null(void) {
 	RunResult res = {
 		.node = NULL,
@@ -67,6 +97,38 @@ RunResult rr_node(Node *node) {
 	return res;
 }
 
+RunResult rr_tail(const Node *node) {
+	RunResult res = {
+		.node = NULL,
+		.err = NULL,
+		.tail = node,
+	};
+	return res;
+}
+
+RunResult rr_err(char *err) {
+	RunResult res = {
+		.node = NULL,
+		.err = err,
+	};
+	return res;
+}
+
+Node *num_node(double val) {
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_NUM;
+	node->num.val = val;
+	return node;
+}
+
+bool isQuoted(const Node *node, const char *str) {
+	return (
+		node->type == AST_QUOTED &&
+		node->quoted.node->type == AST_VAR &&
+		streq(node->quoted.node->var.name, str)
+	);
+}
+
 double getNumVal(Scope *scope, const Node *node) {
 	switch (node->type) {
 	case AST_NUM:
@@ -101,66 +163,326 @@ double getNumVal(Scope *scope, const Node *node) {
 	}
 }
 
-static RunResult runFunction(Scope *scope, const Function *fn, const char *name, const Node **args, size_t nargs) {
-#if DEBUG
-	printf("------- calling %s (scope=%p)\n", name, scope);
-	varmap_print(scope->variables);
-	puts("---------");
-	puts("");
-#endif
+// Evaluates the arguments of a call to a user defined function, storing the
+// values in vals.
+static RunResult evalArgs(Scope *scope, const Lambda *lambda, const Node **args, size_t nargs, Node **vals) {
+	size_t fn_nargs = lambda->args.len;
+	EXPECT(==, fn_nargs);
 
-	if (fn->isBuiltin) {
-		return fn->fn(scope, name, nargs, args);
+	for (size_t i = 0; i < nargs; i++) {
+		RunResult rr = run(scope, args[i]);
+		if (rr.err != NULL) {
+			for (size_t j = 0; j < i; j++) {
+				node_free(vals[j]);
+			}
+			return rr;
+		}
+		vals[i] = rr.node;
 	}
 
-	size_t fn_nargs = fn->args.len;
-	EXPECT(==, fn_nargs);
+	return rr_null();
+}
+
+// Binds the given values to the parameters of lambda in frame, consuming them.
+static void bindArgs(Scope *frame, const Lambda *lambda, Node **vals) {
+	for (size_t i = 0; i < lambda->args.len; i++) {
+#if DEBUG
+		printf("(scope %p) binding %s\n", frame, lambda->args.nodes[i]->var.name);
+#endif
+		varmap_moveItem(frame->variables, lambda->args.nodes[i]->var.name, vals[i]);
+	}
+}
 
-	Scope *newScope = scope_make(scope, false);
+// The evaluation loop. Instead of recursing, tail positions are evaluated by
+// going around the loop again:
+//
+//  - builtins like do, if and cond return the node that produces their value
+//    as RunResult.tail, which is evaluated in the same scope;
+//  - a call to a user defined function binds its arguments in frame and
+//    continues with the body. The first call creates the frame, later (tail)
+//    calls reuse it: the frame would have been the parent scope of the new
+//    one, and it can't be returned to, so overwriting the parameters it
+//    shares with the callee is invisible.
+//
+// frame and lambda are owned by eval and may be NULL.
+static RunResult eval(Scope *scope, const Node *node, Scope *frame, Lambda *lambda) {
 	RunResult res;
 
-	for (size_t i = 0; i < fn_nargs; i++) {
-		RunResult rr = run(scope, args[i]);
+	for (;;) {
+		assert(scope);
+		assert(node);
+
+		if (node->type != AST_EXPR) {
+			res = run(scope, node);
+			break;
+		}
+
+		if (node->expr.len == 0) {
+			res = rr_errf("Non-quoted expression can't be empty");
+			break;
+		}
+
+		RunResult rr = run(scope, node->expr.nodes[0]);
 		if (rr.err != NULL) {
 			res = rr;
-			goto done;
+			break;
+		}
+
+		if (rr.node == NULL) {
+			res = rr_errf("cannot call nil value '%s'", stringify(node->expr.nodes[0], 0));
+			break;
+		} else if (rr.node->type != AST_FUN) {
+			res = rr_errf(
+				"Cannot call non-function (type %s)",
+				typetostr(node->expr.nodes[0])
+			);
+			node_free(rr.node);
+			break;
 		}
 
+		const Function *fn = &rr.node->function;
+		const Node **args = (const Node**)node->expr.nodes + 1;
+		const size_t nargs = node->expr.len - 1;
+
 #if DEBUG
-		printf("(scope %p) varmap_setItem(%s, %s, %s);\n", newScope, "newScope->variables", fn->args.nodes[i]->var.name, "rr.node");
+		printf("------- calling %s (scope=%p)\n", stringify(node->expr.nodes[0], 0), scope);
+		varmap_print(scope->variables);
+		puts("---------");
+		puts("");
 #endif
-		varmap_setItem(newScope->variables, fn->args.nodes[i]->var.name, rr.node);
+
+		if (fn->isBuiltin) {
+			res = callBuiltin(scope, fn, nargs, args);
+			node_free(rr.node);
+			if (res.err == NULL && res.tail != NULL) {
+				node = res.tail;
+				continue;
+			}
+			break;
+		}
+
+		Node **vals = malloc(nargs, sizeof(Node*));
+		res = evalArgs(scope, fn->lambda, args, nargs, vals);
+		if (res.err != NULL) {
+			free(vals);
+			node_free(rr.node);
+			break;
+		}
+
+		// memoized calls have to store their result, so they aren't tail calls
+		bool called = true;
+		Node *val;
+		if (fn->lambda->memo != NULL) {
+			res = memo_call(scope, fn->lambda, nargs, (const Node**)vals);
+		} else if (jit_call(scope, fn->lambda, nargs, vals, &val, false)) {
+			res = rr_node(val);
+		} else {
+			called = false;
+		}
+		if (called) {
+			for (size_t i = 0; i < nargs; i++) {
+				node_free(vals[i]);
+			}
+			free(vals);
+			node_free(rr.node);
+			break;
+		}
+
+		// node may point into the body of the current lambda, so it has to be
+		// kept alive until the arguments are evaluated.
+		Lambda *next = lambda_retain(fn->lambda);
+		node_free(rr.node);
+		lambda_release(lambda);
+		lambda = next;
+
+		if (frame == NULL) {
+			frame = scope_make(scope, false);
+			scope = frame;
+		}
+		bindArgs(frame, lambda, vals);
+		free(vals);
+
+		if (compileBodies) {
+			res = code_run(frame, &lambda);
+			break;
+		}
+
+		node = lambda->body;
 	}
 
-	res = run(newScope, fn->body);
-	if (res.err != NULL) {
-		goto done;
+	scope_free(frame);
+	lambda_release(lambda);
+	return res;
+}
+
+// nil is passed to builtins as a variable that can't be set.
+static Node nil = { .type = AST_VAR, .var = { .name = "nil" } };
+
+// The values given away to the running builtin, see callBuiltinMoved. Calls
+// of builtins that don't get any push an empty entry, so that takeArg never
+// takes the values of an outer call.
+struct Moved {
+	Moved *prev;
+	size_t nargs;
+	Node **vals;
+};
+
+static _Thread_local Moved *moved = NULL;
+
+RunResult callBuiltin(Scope *scope, const Function *fn, size_t nargs, const Node **args) {
+	Moved entry = { .prev = moved };
+	moved = &entry;
+	RunResult res = fn->fn(scope, fn->name, nargs, args);
+	moved = entry.prev;
+	return res;
+}
+
+RunResult callBuiltinMoved(Scope *scope, const Function *fn, size_t nargs, Node **vals) {
+	const Node *small[4];
+	const Node **args = nargs <= 4 ? small : malloc(nargs, sizeof(Node*));
+	for (size_t i = 0; i < nargs; i++) {
+		args[i] = vals[i] == NULL ? &nil : vals[i];
 	}
 
-	res.node = node_copy(res.node); // REVIEW
+	Moved entry = { .prev = moved, .nargs = nargs, .vals = vals };
+	moved = &entry;
+	RunResult res = fn->fn(scope, fn->name, nargs, args);
+	moved = entry.prev;
 
-done:
-	scope_free(newScope);
+	// the tail may be one of the values
+	if (res.err == NULL && res.tail != NULL) {
+		res = run(scope, res.tail);
+	}
+	for (size_t i = 0; i < nargs; i++) {
+		node_free(vals[i]);
+		vals[i] = NULL;
+	}
+	if (args != small) {
+		free(args);
+	}
 	return res;
 }
 
-Node *getVar(const Scope *scope, const char *name) {
-#if DEBUG
-	int x = 0;
-#endif
-	while (scope != NULL) {
-#if DEBUG
-		printf("getting %s (try %d) (scope %p)\n", name, ++x, scope);
-#endif
-		Node *res = varmap_getItem(scope->variables, name);
-		if (res != NULL) {
-			return res;
+Moved *moved_swap(Moved *other) {
+	Moved *res = moved;
+	moved = other;
+	return res;
+}
+
+RunResult takeArg(Scope *scope, const Node *arg) {
+	if (moved != NULL) {
+		for (size_t i = 0; i < moved->nargs; i++) {
+			if (moved->vals[i] == arg) {
+				moved->vals[i] = NULL;
+				return rr_node((Node*)arg);
+			}
 		}
+	}
+	return run(scope, arg);
+}
 
-		scope = scope->parent;
+RunResult callFunction(Scope *scope, const Node *fn, size_t nargs, const Node **values) {
+	if (fn == NULL || fn->type != AST_FUN) {
+		return rr_errf("cannot call non-function");
 	}
 
-	return NULL;
+	if (fn->function.isBuiltin) {
+		// Not all values evaluate to themselves, like the items of a list,
+		// so the builtin takes copies of them instead of running them as
+		// argument expressions.
+		Node **vals = malloc(nargs, sizeof(Node*));
+		for (size_t i = 0; i < nargs; i++) {
+			vals[i] = node_copy(values[i]);
+		}
+		RunResult res = callBuiltinMoved(scope, &fn->function, nargs, vals);
+		free(vals);
+		return res;
+	}
+
+	Lambda *lambda = fn->function.lambda;
+	EXPECT(==, lambda->args.len);
+
+	if (lambda->memo != NULL) {
+		return memo_call(scope, lambda, nargs, values);
+	}
+	return callLambda(scope, lambda, nargs, values);
+}
+
+// Runs lambda with the given values, which are moved into its frame if owned
+// is set and copied otherwise.
+static RunResult runLambda(Scope *scope, Lambda *lambda, size_t nargs, Node **values, bool owned) {
+	Node *val;
+	if (jit_call(scope, lambda, nargs, values, &val, false)) {
+		return rr_node(val);
+	}
+
+	Scope stackFrame;
+	Scope *frame = &stackFrame;
+	if (compileBodies) {
+		scope_enter(frame, scope);
+	} else {
+		frame = scope_make(scope, false);
+	}
+
+	for (size_t i = 0; i < nargs; i++) {
+		const char *name = lambda->args.nodes[i]->var.name;
+		if (owned) {
+			varmap_moveItem(frame->variables, name, values[i]);
+			values[i] = NULL;
+		} else {
+			varmap_setItem(frame->variables, name, values[i]);
+		}
+	}
+
+	if (!compileBodies) {
+		return eval(frame, lambda->body, frame, lambda_retain(lambda));
+	}
+
+	lambda = lambda_retain(lambda);
+	RunResult res = code_run(frame, &lambda);
+	lambda_release(lambda);
+	scope_leave(frame);
+	return res;
+}
+
+RunResult callLambda(Scope *scope, Lambda *lambda, size_t nargs, const Node **values) {
+	return runLambda(scope, lambda, nargs, (Node**)values, false);
+}
+
+RunResult callFunctionMoved(Scope *scope, const Node *fn, size_t nargs, Node **values) {
+	RunResult res;
+	if (fn == NULL || fn->type != AST_FUN) {
+		res = rr_errf("cannot call non-function");
+	} else if (fn->function.isBuiltin) {
+		return callBuiltinMoved(scope, &fn->function, nargs, values);
+	} else if (nargs != fn->function.lambda->args.len) {
+		res = rr_errf("expected number of args to == %d but is %d", fn->function.lambda->args.len, nargs);
+	} else if (fn->function.lambda->memo != NULL) {
+		res = memo_call(scope, fn->function.lambda, nargs, (const Node**)values);
+	} else {
+		res = runLambda(scope, fn->function.lambda, nargs, values, true);
+	}
+
+	for (size_t i = 0; i < nargs; i++) {
+		node_free(values[i]);
+		values[i] = NULL;
+	}
+	return res;
+}
+
+Node *findVar(const Scope *scope, const char *name, char **err) {
+	Scope *found = scope_find(scope, name);
+#if DEBUG
+	printf("getting %s (scope %p, found in %p)\n", name, scope, found);
+#endif
+	return varmap_findItem(found->variables, name, err);
+}
+
+Node *getVar(const Scope *scope, const char *name) {
+	char *err;
+	Node *res = findVar(scope, name, &err);
+	free(err);
+	return res;
 }
 
 RunResult run(Scope *scope, const Node *node) {
@@ -170,55 +492,33 @@ RunResult run(Scope *scope, const Node *node) {
 	switch (node->type) {
 	case AST_QUOTED:
 	case AST_STR:
-	case AST_NUM: {
+	case AST_NUM:
+	case AST_FUN:
+	case AST_VECTOR:
+	case AST_ARRAY:
+	case AST_DICT:
+	case AST_GENERATOR:
+	case AST_RANGE:
+	case AST_CHANNEL:
+	case AST_FUTURE:
+	case AST_COROUTINE: {
 		Node *copy = node_copy(node);
 		return rr_node(copy);
 	}
 
-	case AST_EXPR: {
-		if (node->expr.len == 0) {
-			return rr_errf("Non-quoted expression can't be empty");
-		}
-
-		RunResult rr = run(scope, node->expr.nodes[0]);
-		if (rr.err != NULL) {
-			return rr;
-		}
-
-		if (rr.node == NULL) {
-			return rr_errf("cannot call nil value '%s'", stringify(node->expr.nodes[0], 0));
-		} else if (rr.node->type != AST_FUN) {
-			return rr_errf(
-				"Cannot call non-function (type %s)",
-				typetostr(node->expr.nodes[0])
-			);
+	case AST_EXPR:
+		if (heapFrames && node->expr.len > 0) {
+			return frames_run(scope, node);
 		}
-
-		// REVIEW
-		assert(
-			!rr.node->function.isBuiltin ||
-			node->expr.nodes[0]->type == AST_VAR
-		);
-
-		const Node **args = (const Node**)node->expr.nodes + 1;
-
-		RunResult res = runFunction(
-			scope,
-			//rr.node->function.isBuiltin ?
-			//	scope :
-			//	rr.node->function.scope,
-			&rr.node->function,
-			node->expr.nodes[0]->var.name,
-			args,
-			node->expr.len - 1
-		);
-		return res;
-	}
+		return eval(scope, node, NULL, NULL);
 
 	case AST_VAR: {
-		const Node *val = getVar(scope, node->var.name);
+		char *err;
+		const Node *val = findVar(scope, node->var.name, &err);
 		if (val != NULL) {
 			return rr_node(node_copy(val));
+		} else if (err != NULL) {
+			return rr_err(err);
 		}
 
 		Scope *rootScope = scope_get_root(scope);
@@ -246,55 +546,76 @@ RunResult in_run(Scope *scope, const InternedNode node) {
 	return run(scope, node.node);
 }
 
-RunResult runProgram(char *input, Scope *scope, bool doIntern) {
+RunResult runNodes(Scope *scope, size_t len, Node **nodes, bool doIntern) {
 	RunResult res = rr_null();
 
-	ProgramParseResult program = parseprogram(input);
-	free(input);
-
-	if (program.err) {
-		char *err;
-		asprintf(
-			&err,
-			"Program error: %s at line %d col %d\n",
-			program.err,
-			program.errloc.line,
-			program.errloc.col
-		);
-		res.err = err;
-
-		return res;
-	}
-
 	InternEnvironment *env = NULL;
 	if (doIntern) {
 		env = ie_make();
 	}
 
-	for (size_t i = 0; i < program.len; i++) {
-		if (program.nodes[i]->type != AST_EXPR) {
+	BoundNames *bound = bound_names(nodes, len);
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (nodes[i]->type != AST_EXPR) {
 			continue;
 		}
 
+		if (optimizePrograms) {
+			nodes[i] = ast_optimize(scope, bound, nodes[i]);
+		}
+
 		InternedNode interned;
 		if (doIntern) {
-			interned = intern(program.nodes[i], env);
+			interned = intern(nodes[i], env);
 		} else {
-			interned = skipIntern(program.nodes[i]);
+			interned = skipIntern(nodes[i]);
 		}
 
+		node_free(res.node);
 		res = in_run(scope, interned);
 		node_free(interned.node);
 
 		if (res.err != NULL) {
-			char *err;
-			asprintf(&err, "Error while executing code: %s\n", res.err);
-			res.err = err;
-
-			return res;
+			break;
 		}
 	}
 
+	for (i = 0; i < len; i++) {
+		node_free(nodes[i]);
+	}
+	free(nodes);
 	ie_free(env, false);
+	bound_names_free(bound);
+	return res;
+}
+
+RunResult runProgram(char *input, Scope *scope, bool doIntern) {
+	RunResult res = rr_null();
+
+	ProgramParseResult program = parseprogram(input);
+	free(input);
+
+	if (program.err) {
+		char *err;
+		asprintf(
+			&err,
+			"Program error: %s at line %d col %d\n",
+			program.err,
+			program.errloc.line,
+			program.errloc.col
+		);
+		res.err = err;
+
+		return res;
+	}
+
+	res = runNodes(scope, program.len, program.nodes, doIntern);
+	if (res.err != NULL) {
+		char *err;
+		asprintf(&err, "Error while executing code: %s\n", res.err);
+		free(res.err);
+		res.err = err;
+	}
 	return res;
 }
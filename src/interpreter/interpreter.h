@@ -4,3 +4,24 @@
 #include "./internal.h"
 
 RunResult in_run(Scope*, const InternedNode);
+
+// Switches between evaluating on the C stack, which is the default, and
+// evaluating with heap allocated frames. See frames.h.
+void setHeapFrames(bool);
+
+// Optimizing each top level expression of a program right before it's run is
+// on by default, see ast_optimize.
+void setOptimize(bool);
+bool getOptimize(void);
+
+// Compiling the bodies of user defined functions is on by default.
+void setCompile(bool);
+
+// Compiling hot numeric functions to machine code is on by default, see
+// jit.h.
+void setJit(bool);
+
+// The number of threads pmap, pfilter and preduce run on, see pool.h, and
+// futures, see future.h. 0, the default, is the number of CPUs. Only has an
+// effect before the first of them runs.
+void setWorkers(size_t);
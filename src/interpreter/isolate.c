@@ -0,0 +1,443 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "compile.h"
+#include "coro.h"
+#include "image.h"
+#include "isolate.h"
+#include "memo.h"
+#include "../channel.h"
+#include "../stringify.h"
+#include "../dict.h"
+#include "../f64array.h"
+#include "../vector.h"
+#include "../util.h"
+
+static Node *make_node(ASTtype type) {
+	Node *node = malloc(1, sizeof(Node));
+	node->type = type;
+	return node;
+}
+
+static RunResult transfer_lambda(const Lambda *src) {
+	RunResult body = isolate_transfer(src->body);
+	if (body.err != NULL) {
+		return body;
+	}
+
+	// compiled code is left behind, it refers to the binding counts of the
+	// isolate it was made in
+	Lambda *lambda = malloc(1, sizeof(Lambda));
+	*lambda = (Lambda){
+		.refs = 1,
+		.body = body.node,
+		.memo = src->memo == NULL ? NULL : memo_make(memo_stats(src->memo).limit),
+	};
+	lambda->args.len = src->args.len;
+	lambda->args.nodes = malloc(src->args.len, sizeof(Node*));
+	for (size_t i = 0; i < src->args.len; i++) {
+		lambda->args.nodes[i] = node_copy(src->args.nodes[i]);
+	}
+
+	Node *res = make_node(AST_FUN);
+	res->function.isBuiltin = false;
+	res->function.lambda = lambda;
+	return rr_node(res);
+}
+
+static RunResult transfer_vector(const Vector *src) {
+	const size_t len = vector_length(src);
+	Node **items = malloc(len, sizeof(Node*));
+
+	RunResult rr = rr_null();
+	size_t i;
+	for (i = 0; i < len && rr.err == NULL; i++) {
+		rr = isolate_transfer(vector_get(src, i));
+		items[i] = rr.node == NULL ? makeVar("nil") : rr.node;
+	}
+
+	if (rr.err == NULL) {
+		Node *res = make_node(AST_VECTOR);
+		res->vector = vector_from_array((const Node**)items, len);
+		rr = rr_node(res);
+	}
+	for (size_t j = 0; j < i; j++) {
+		node_free(items[j]);
+	}
+	free(items);
+	return rr;
+}
+
+static RunResult transfer_dict(Dict *src) {
+	const bool isMutable = dict_is_mutable(src);
+	Dict *dict = dict_make(isMutable);
+
+	DictIter it;
+	dict_iter_init(&it, src);
+	const Node *key, *val;
+	while (dict_iter_next(&it, &key, &val)) {
+		RunResult k = isolate_transfer(key);
+		if (k.err != NULL) {
+			dict_release(dict);
+			return k;
+		}
+		RunResult v = isolate_transfer(val);
+		if (v.err != NULL) {
+			node_free(k.node);
+			dict_release(dict);
+			return v;
+		}
+
+		if (isMutable) {
+			dict_put_mut(dict, k.node, v.node);
+		} else {
+			Dict *next = dict_put(dict, k.node, v.node);
+			dict_release(dict);
+			dict = next;
+		}
+	}
+
+	Node *res = make_node(AST_DICT);
+	res->dict = dict;
+	return rr_node(res);
+}
+
+RunResult isolate_transfer(const Node *val) {
+	if (val == NULL) {
+		return rr_null();
+	}
+
+	switch (val->type) {
+	case AST_QUOTED: {
+		RunResult rr = isolate_transfer(val->quoted.node);
+		if (rr.err != NULL) {
+			return rr;
+		}
+		Node *res = make_node(AST_QUOTED);
+		res->quoted.node = rr.node;
+		return rr_node(res);
+	}
+
+	case AST_EXPR: {
+		Node *res = make_node(AST_EXPR);
+		res->expr.len = val->expr.len;
+		res->expr.nodes = calloc(val->expr.len, sizeof(Node*));
+		for (size_t i = 0; i < val->expr.len; i++) {
+			RunResult rr = isolate_transfer(val->expr.nodes[i]);
+			if (rr.err != NULL) {
+				node_free(res);
+				return rr;
+			}
+			res->expr.nodes[i] = rr.node;
+		}
+		return rr_node(res);
+	}
+
+	case AST_FUN:
+		if (val->function.isBuiltin) {
+			return rr_node(node_copy(val));
+		}
+		return transfer_lambda(val->function.lambda);
+
+	case AST_VECTOR:
+		return transfer_vector(val->vector);
+
+	case AST_ARRAY: {
+		Node *res = make_node(AST_ARRAY);
+		res->array = f64_make(val->array->len);
+		memcpy(res->array->data, val->array->data, val->array->len * sizeof(double));
+		return rr_node(res);
+	}
+
+	case AST_DICT:
+		return transfer_dict(val->dict);
+
+	case AST_GENERATOR:
+		return rr_errf("a generator can't be sent to another isolate");
+
+	case AST_COROUTINE:
+		return rr_errf("a coroutine can't be sent to another isolate");
+
+	// these own all of their memory, channels and futures are shared on
+	// purpose
+	case AST_VAR:
+	case AST_STR:
+	case AST_NUM:
+	case AST_COMMENT:
+	case AST_RANGE:
+	case AST_CHANNEL:
+	case AST_FUTURE:
+		return rr_node(node_copy(val));
+	}
+
+	return rr_errf("can't send a %s to another isolate", typetostr(val));
+}
+
+// Everything a new isolate starts with, all of it transferred.
+typedef struct Task {
+	Node *fn;
+	size_t nargs;
+	Node **args;
+
+	size_t nvars;
+	char **names;
+	Node **vals;
+	const Image *image;
+
+	Channel *result;
+} Task;
+
+// Frees the values the task still owns.
+static void task_free(Task *task) {
+	node_free(task->fn);
+	for (size_t i = 0; i < task->nargs; i++) {
+		node_free(task->args[i]);
+	}
+	for (size_t i = 0; i < task->nvars; i++) {
+		free(task->names[i]);
+		node_free(task->vals[i]);
+	}
+	chan_release(task->result);
+	free(task->args);
+	free(task->names);
+	free(task->vals);
+	free(task);
+}
+
+static void *run_task(void *arg) {
+	Task *task = arg;
+
+	Scope *root = image_scope(task->image);
+	for (size_t i = 0; i < task->nvars; i++) {
+		varmap_moveItem(root->variables, task->names[i], task->vals[i]);
+		task->vals[i] = NULL;
+	}
+
+	RunResult rr = callFunctionMoved(root, task->fn, task->nargs, task->args);
+
+	// the result may still share values with the root scope, and refer to
+	// code compiled for this isolate
+	if (rr.err == NULL) {
+		RunResult res = isolate_transfer(rr.node);
+		node_free(rr.node);
+		rr = res;
+	}
+	scope_free(root);
+	scope_pool_free();
+	code_pool_free();
+	bindings_free();
+	coro_loop_free();
+	chan_send(task->result, rr.node, rr.err);
+
+	task_free(task);
+	return NULL;
+}
+
+// Whether a scope between scope and end binds name, so end's binding of it
+// isn't visible from scope.
+static bool shadowed(const Scope *scope, const Scope *end, const char *name) {
+	for (; scope != end; scope = scope->parent) {
+		if (varmap_getItem(scope->variables, name) != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Calls fn with a transferred copy of every variable visible from scope.
+// Values that can't be transferred are left out.
+static void each_var(const Scope *scope, void (*fn)(void*, const char*, Node*), void *ctx) {
+	for (const Scope *s = scope; s != NULL; s = s->parent) {
+		for (size_t i = 0; i < varmap_length(s->variables); i++) {
+			const char *name = varmap_keyAt(s->variables, i);
+			if (shadowed(scope, s, name)) {
+				continue;
+			}
+
+			RunResult rr = isolate_transfer(varmap_itemAt(s->variables, i));
+			if (rr.err != NULL) {
+				free(rr.err);
+				continue;
+			}
+			fn(ctx, name, rr.node);
+		}
+	}
+}
+
+static void add_var(void *ctx, const char *name, Node *val) {
+	Task *task = ctx;
+	task->names[task->nvars] = astrcpy(name);
+	task->vals[task->nvars] = val;
+	task->nvars++;
+}
+
+// Transfers the variables visible from scope to task, they're bound on the
+// thread of the task.
+static void transfer_vars(Task *task, const Scope *scope) {
+	size_t cap = 0;
+	for (const Scope *s = scope; s != NULL; s = s->parent) {
+		cap += varmap_length(s->variables);
+	}
+	task->names = malloc(cap, sizeof(char*));
+	task->vals = malloc(cap, sizeof(Node*));
+	task->nvars = 0;
+	each_var(scope, add_var, task);
+}
+
+static void bind_var(void *ctx, const char *name, Node *val) {
+	Scope *root = ctx;
+	varmap_moveItem(root->variables, name, val);
+}
+
+void isolate_import(Scope *root, const Scope *scope) {
+	each_var(scope, bind_var, root);
+}
+
+// A set of names, in the order they were added.
+typedef struct Names {
+	size_t len;
+	size_t cap;
+	const char **items;
+} Names;
+
+static bool names_has(const Names *names, const char *name) {
+	for (size_t i = 0; i < names->len; i++) {
+		if (strcmp(names->items[i], name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void names_add(Names *names, const char *name) {
+	if (names_has(names, name)) {
+		return;
+	} else if (names->len == names->cap) {
+		names->cap = names->cap == 0 ? 8 : names->cap * 2;
+		names->items = realloc(names->items, names->cap, sizeof(char*));
+	}
+	names->items[names->len++] = name;
+}
+
+static bool is_param(const Expression *params, const char *name) {
+	for (size_t i = 0; params != NULL && i < params->len; i++) {
+		if (strcmp(params->nodes[i]->var.name, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Adds the names node refers to, except the parameters of the function it's
+// the body of.
+static void collect(Names *names, const Node *node, const Expression *params) {
+	if (node == NULL) {
+		return;
+	}
+
+	switch (node->type) {
+	case AST_VAR:
+		if (!is_param(params, node->var.name)) {
+			names_add(names, node->var.name);
+		}
+		break;
+
+	case AST_EXPR:
+		for (size_t i = 0; i < node->expr.len; i++) {
+			collect(names, node->expr.nodes[i], params);
+		}
+		break;
+
+	case AST_FUN:
+		if (!node->function.isBuiltin) {
+			collect(names, node->function.lambda->body, &node->function.lambda->args);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+// The image's variables are left to the root scope of the other isolate, which
+// starts from the same image.
+static const Node *lookup(const Scope *scope, const char *name) {
+	for (; scope != NULL; scope = scope->parent) {
+		const Node *val = varmap_getOwnItem(scope->variables, name);
+		if (val != NULL) {
+			return val;
+		}
+	}
+	return NULL;
+}
+
+void isolate_capture(const Scope *scope, const Node *expr, void (*fn)(void*, const char*, Node*), void *ctx) {
+	Names names = { 0 };
+	collect(&names, expr, NULL);
+
+	// names grows as the functions among the values are looked into
+	for (size_t i = 0; i < names.len; i++) {
+		const Node *val = lookup(scope, names.items[i]);
+		if (val == NULL) {
+			continue;
+		} else if (val->type == AST_FUN) {
+			collect(&names, val, NULL);
+		}
+
+		RunResult rr = isolate_transfer(val);
+		if (rr.err != NULL) {
+			free(rr.err);
+			continue;
+		}
+		fn(ctx, names.items[i], rr.node);
+	}
+	free(names.items);
+}
+
+RunResult isolate_spawn(Scope *scope, const Node *fn, size_t nargs, const Node **vals) {
+	if (fn == NULL || fn->type != AST_FUN) {
+		return rr_errf("cannot spawn non-function");
+	}
+
+	RunResult rr = isolate_transfer(fn);
+	if (rr.err != NULL) {
+		return rr;
+	}
+
+	Task *task = calloc(1, sizeof(Task));
+	task->fn = rr.node;
+	task->nargs = nargs;
+	task->args = calloc(nargs, sizeof(Node*));
+	for (size_t i = 0; i < nargs; i++) {
+		rr = isolate_transfer(vals[i]);
+		if (rr.err != NULL) {
+			task_free(task);
+			return rr;
+		}
+		task->args[i] = rr.node;
+	}
+	transfer_vars(task, scope);
+	task->image = scope_get_root(scope)->image;
+
+	Channel *result = chan_make(1);
+	task->result = chan_retain(result);
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	// as much stack as the main thread usually gets, schym recurses deeply
+	pthread_attr_setstacksize(&attr, 8 << 20);
+	const int err = pthread_create(&thread, &attr, run_task, task);
+	pthread_attr_destroy(&attr);
+
+	if (err != 0) {
+		task_free(task);
+		chan_release(result);
+		return rr_errf("couldn't start a thread: %s", strerror(err));
+	}
+
+	Node *res = make_node(AST_CHANNEL);
+	res->channel = result;
+	return rr_node(res);
+}
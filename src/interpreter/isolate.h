@@ -0,0 +1,33 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// Isolates run a function on their own OS thread, in their own root scope.
+// They share no values, except for channels: everything that's sent to or
+// returned from an isolate is copied, down to the code of functions. Each
+// isolate has its own binding counts, compiled code and memo caches.
+
+// Copies val so that the copy shares nothing with it but channels, which is
+// what values in a channel have to be. Fails for values that can't leave their
+// isolate, like generators.
+RunResult isolate_transfer(const Node *val);
+
+// Binds copies of the variables visible from scope in root. scope may belong
+// to another isolate, as long as that isolate is blocked while this runs.
+void isolate_import(Scope *root, const Scope *scope);
+
+// Calls fn with a copy of every variable that evaluating expr in scope can
+// use: the variables it names, and those named by the functions among them,
+// as far as they're visible from scope. Those of the image of the root scope
+// are left out, the isolate that runs expr starts from the same image.
+// Variables that only code made at run
+// time uses, like that of eval, are left out, as are values that can't be
+// transferred. The name is the caller's to copy.
+void isolate_capture(const Scope *scope, const Node *expr, void (*fn)(void *ctx, const char *name, Node *val), void *ctx);
+
+// Calls fn with the given values on a new thread. Its root scope starts from
+// the image of scope's, with copies of the variables visible from scope that
+// can be transferred. Returns
+// a channel that gets the result, or the error, of the call.
+RunResult isolate_spawn(Scope *scope, const Node *fn, size_t nargs, const Node **vals);
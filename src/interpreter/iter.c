@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "iter.h"
+#include "../f64array.h"
+#include "../vector.h"
+#include "../util.h"
+
+static bool isList(const Node *node) {
+	return (
+		node != NULL &&
+		node->type == AST_QUOTED &&
+		node->quoted.node->type == AST_EXPR
+	);
+}
+
+RunResult range_make(double from, double to, double step) {
+	if (step == 0 || isnan(step)) {
+		return rr_errf("range step has to be a non-zero number");
+	}
+
+	const double len = ceil((to - from) / step);
+	if (!(len < (double)SIZE_MAX)) {
+		return rr_errf("range from %g to %g by %g is too long", from, to, step);
+	}
+
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_RANGE;
+	res->range = (Range){ .from = from, .step = step, .len = len > 0 ? len : 0 };
+	return rr_node(res);
+}
+
+bool iter_make(Iter *it, Node *seq) {
+	size_t len;
+	if (isList(seq)) {
+		len = seq->quoted.node->expr.len;
+	} else if (seq != NULL && seq->type == AST_VECTOR) {
+		len = vector_length(seq->vector);
+	} else if (seq != NULL && seq->type == AST_ARRAY) {
+		len = seq->array->len;
+	} else if (seq != NULL && seq->type == AST_RANGE) {
+		len = seq->range.len;
+	} else {
+		return false;
+	}
+
+	*it = (Iter){ .seq = seq, .len = len, .i = 0 };
+	return true;
+}
+
+RunResult iter_run(Scope *scope, const Node *node, Iter *it) {
+	RunResult rr = takeArg(scope, node);
+	if (rr.err != NULL) {
+		return rr;
+	} else if (!iter_make(it, rr.node)) {
+		node_free(rr.node);
+		return rr_errf("expected list, vector, f64 array or range");
+	}
+	return rr_null();
+}
+
+Node *iter_item(Node *item) {
+	if (item == NULL || item->type != AST_EXPR) {
+		return item;
+	}
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_QUOTED;
+	res->quoted.node = item;
+	return res;
+}
+
+Node *iter_take(Iter *it, size_t i) {
+	assert(i < it->len);
+
+	Node *seq = it->seq;
+	switch (seq->type) {
+	case AST_QUOTED: {
+		Node *res = seq->quoted.node->expr.nodes[i];
+		seq->quoted.node->expr.nodes[i] = NULL;
+		return iter_item(res);
+	}
+
+	case AST_VECTOR:
+		return node_copy(vector_get(seq->vector, i));
+
+	case AST_ARRAY:
+	case AST_RANGE: {
+		double val;
+		iter_num(it, i, &val);
+		return num_node(val);
+	}
+
+	default:
+		assert(false);
+		return NULL;
+	}
+}
+
+bool iter_num(const Iter *it, size_t i, double *val) {
+	assert(i < it->len);
+
+	if (it->seq->type == AST_RANGE) {
+		*val = it->seq->range.from + i * it->seq->range.step;
+		return true;
+	} else if (it->seq->type == AST_ARRAY) {
+		*val = it->seq->array->data[i];
+		return true;
+	}
+	return false;
+}
+
+const Node *iter_peek(const Iter *it, size_t i) {
+	assert(i < it->len);
+
+	if (it->seq->type == AST_QUOTED) {
+		return it->seq->quoted.node->expr.nodes[i];
+	} else if (it->seq->type == AST_VECTOR) {
+		return vector_get(it->seq->vector, i);
+	}
+	return NULL;
+}
+
+Node *iter_next(Iter *it) {
+	if (it->i == it->len) {
+		return NULL;
+	}
+	return iter_take(it, it->i++);
+}
+
+void iter_free(Iter *it) {
+	node_free(it->seq);
+	it->seq = NULL;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// A pull-based iterator over the items of a sequence: a list, a vector, an
+// f64 array or a range. The length is known up front, and items of arrays and
+// ranges are only made when they're pulled, so a range is never materialized.
+typedef struct Iter {
+	// owned by the iterator
+	Node *seq;
+	size_t len;
+	size_t i;
+} Iter;
+
+// Makes a range from from up to but not including to. Fails if step is 0 or
+// NaN, or the range is too long.
+RunResult range_make(double from, double to, double step);
+
+// Starts iterating over seq, which is consumed. Returns false and leaves seq
+// alone if it isn't a sequence.
+bool iter_make(Iter*, Node *seq);
+
+// Starts iterating over the value of node, an argument of the running
+// builtin. Fails if it isn't a sequence.
+RunResult iter_run(Scope*, const Node *node, Iter*);
+
+// Returns item i, which is owned by the caller. Items of lists are moved out
+// of the list instead of copied, so each can only be taken once.
+Node *iter_take(Iter*, size_t i);
+
+// Lists written in a list aren't quoted themselves, like the items of
+// '((1 2) 3). Quotes item if it's one of those, so it's a list rather than a
+// call once it's out of the list. iter_take does this, iter_peek doesn't.
+Node *iter_item(Node *item);
+
+// Stores item i in val without making a node if it's a number of a range or
+// an f64 array, returns false for the other sequences.
+bool iter_num(const Iter*, size_t i, double *val);
+
+// Returns item i of a list or a vector without taking it, or NULL for the
+// other sequences, whose items are made by iter_take.
+const Node *iter_peek(const Iter*, size_t i);
+
+// Returns the next item like iter_take, or NULL once all have been pulled.
+Node *iter_next(Iter*);
+
+void iter_free(Iter*);
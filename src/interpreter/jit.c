@@ -0,0 +1,625 @@
+// for MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "jit.h"
+#include "interpreter.h"
+#include "../util.h"
+#include "./builtins.h"
+#include "builtins/math.h"
+
+// Whether hot functions are compiled to machine code.
+static bool enabled = true;
+
+void setJit(bool enable) {
+	enabled = enable;
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+typedef enum JitState {
+	JIT_COMPILING,
+	JIT_READY,
+	JIT_FAILED,
+} JitState;
+
+struct Jit {
+	JitState state;
+	// bindingEpoch when the code was made, it's invalid once that changes
+	size_t epoch;
+	// whether the code calls or jumps to other functions, so the C stack it
+	// takes isn't bounded
+	bool calls;
+
+	// Machine code is always called through entry, so a function can call
+	// functions whose code isn't placed yet.
+	void *entry;
+	size_t mapped;
+
+	// the code while it's being emitted
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+};
+
+// One translation, which includes every function it calls that wasn't
+// translated before.
+typedef struct Session {
+	Scope *root;
+	bool failed;
+
+	size_t len;
+	size_t cap;
+	Lambda **lambdas;
+} Session;
+
+// The translation of one function body.
+//
+// Code is generated as if for a stack machine: every expression leaves its
+// value in xmm0, and operands waiting for the rest of the expression are
+// spilled to temporaries in the stack frame. The frame holds the parameters,
+// followed by the temporaries, and its size is fixed so the stack stays
+// aligned for calls.
+typedef struct Emitter {
+	Session *s;
+	Lambda *lambda;
+	Jit *jit;
+
+	size_t temps;
+	// offset of the code after the prologue, tail calls to the function
+	// itself jump there
+	size_t body;
+} Emitter;
+
+static Jit *translate(Session*, Lambda*);
+
+static void emit(Emitter *e, size_t n, const uint8_t *bytes) {
+	Jit *jit = e->jit;
+	if (jit->len + n > jit->cap) {
+		jit->cap = jit->cap * 2 + n;
+		jit->buf = realloc(jit->buf, jit->cap, sizeof(uint8_t));
+	}
+	memcpy(jit->buf + jit->len, bytes, n);
+	jit->len += n;
+}
+
+#define EMIT(e, ...) emit((e), sizeof((uint8_t[]){ __VA_ARGS__ }), (uint8_t[]){ __VA_ARGS__ })
+
+static void emit32(Emitter *e, uint32_t val) {
+	EMIT(e, val, val >> 8, val >> 16, val >> 24);
+}
+
+static void emit64(Emitter *e, uint64_t val) {
+	emit32(e, val);
+	emit32(e, val >> 32);
+}
+
+// Emits the opcode of a jump with a 32 bit displacement, returns the offset
+// of the displacement to patch.
+static size_t emit_jump(Emitter *e, size_t n, const uint8_t *opcode) {
+	emit(e, n, opcode);
+	size_t at = e->jit->len;
+	emit32(e, 0);
+	return at;
+}
+
+// Makes the jump with its displacement at the given offset go to the current
+// end of the code.
+static void patch(Emitter *e, size_t at) {
+	uint32_t rel = e->jit->len - (at + 4);
+	memcpy(e->jit->buf + at, &rel, sizeof(rel));
+}
+
+// The rbp relative offset of frame slot i.
+static int32_t slot(size_t i) {
+	return -8 * (int32_t)(i + 1);
+}
+
+static int32_t param(size_t i) {
+	return slot(i);
+}
+
+static int32_t temp(Emitter *e, size_t depth) {
+	if (depth + 1 > e->temps) {
+		e->temps = depth + 1;
+	}
+	return slot(e->lambda->args.len + depth);
+}
+
+// movsd xmm, [rbp + disp]
+static void load(Emitter *e, unsigned xmm, int32_t disp) {
+	EMIT(e, 0xF2, 0x0F, 0x10, 0x85 | xmm << 3);
+	emit32(e, disp);
+}
+
+// movsd [rbp + disp], xmm
+static void store(Emitter *e, int32_t disp, unsigned xmm) {
+	EMIT(e, 0xF2, 0x0F, 0x11, 0x85 | xmm << 3);
+	emit32(e, disp);
+}
+
+// mov rax, imm64
+static void load_rax(Emitter *e, uint64_t val) {
+	EMIT(e, 0x48, 0xB8);
+	emit64(e, val);
+}
+
+static void load_const(Emitter *e, unsigned xmm, double val) {
+	uint64_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	load_rax(e, bits);
+	// movq xmm, rax
+	EMIT(e, 0x66, 0x48, 0x0F, 0x6E, 0xC0 | xmm << 3);
+}
+
+static bool emit_expr(Emitter*, const Node*, size_t depth, bool tail);
+
+// Evaluates the operands from left to right, combining them with op, which
+// gets the accumulated value in xmm0 and the next operand in xmm1.
+static bool emit_fold(Emitter *e, const Node **args, size_t nargs, size_t depth, void (*op)(Emitter*, char), char name) {
+	if (!emit_expr(e, args[0], depth, false)) {
+		return false;
+	}
+
+	for (size_t i = 1; i < nargs; i++) {
+		store(e, temp(e, depth), 0);
+		if (!emit_expr(e, args[i], depth + 1, false)) {
+			return false;
+		}
+		EMIT(e, 0x66, 0x0F, 0x28, 0xC8); // movapd xmm1, xmm0
+		load(e, 0, temp(e, depth));
+		op(e, name);
+	}
+	return true;
+}
+
+static void emit_arith(Emitter *e, char name) {
+	switch (name) {
+	case '+':
+		EMIT(e, 0xF2, 0x0F, 0x58, 0xC1); // addsd xmm0, xmm1
+		break;
+	case '-':
+		EMIT(e, 0xF2, 0x0F, 0x5C, 0xC1); // subsd xmm0, xmm1
+		break;
+	case '*':
+		EMIT(e, 0xF2, 0x0F, 0x59, 0xC1); // mulsd xmm0, xmm1
+		break;
+	case '/':
+		EMIT(e, 0xF2, 0x0F, 0x5E, 0xC1); // divsd xmm0, xmm1
+		break;
+	case '^':
+	case '%':
+		load_rax(e, (uintptr_t)(name == '^' ? pow : fmod));
+		EMIT(e, 0xFF, 0xD0); // call rax
+		break;
+	default:
+		assert(false);
+	}
+}
+
+// The cmpsd predicate of a comparison, and whether its operands are swapped.
+// Only the ordered predicates that are false for NaN are used, except for !=,
+// so the results match C.
+static void emit_compare(Emitter *e, char pred) {
+	if (pred & 0x10) {
+		EMIT(e, 0xF2, 0x0F, 0xC2, 0xC8, pred & 0xF); // cmpsd xmm1, xmm0, pred
+		EMIT(e, 0x66, 0x0F, 0x28, 0xC1); // movapd xmm0, xmm1
+	} else {
+		EMIT(e, 0xF2, 0x0F, 0xC2, 0xC1, pred); // cmpsd xmm0, xmm1, pred
+	}
+
+	// turn the mask into 1 or 0
+	load_const(e, 1, 1);
+	EMIT(e, 0x66, 0x0F, 0x54, 0xC1); // andpd xmm0, xmm1
+}
+
+static char compare_predicate(const char *name) {
+	if (streq(name, "==")) {
+		return 0;
+	} else if (streq(name, "!=")) {
+		return 4;
+	} else if (streq(name, "<")) {
+		return 1;
+	} else if (streq(name, "<=")) {
+		return 2;
+	} else if (streq(name, ">")) {
+		return 0x10 | 1;
+	} else {
+		assert(streq(name, ">="));
+		return 0x10 | 2;
+	}
+}
+
+// Emits a jump that's taken when xmm0 is false, returns its displacement to
+// patch. NaN is true, like in the interpreter.
+static size_t emit_jump_false(Emitter *e) {
+	EMIT(e, 0x66, 0x0F, 0x57, 0xC9); // xorpd xmm1, xmm1
+	EMIT(e, 0x66, 0x0F, 0x2E, 0xC1); // ucomisd xmm0, xmm1
+	EMIT(e, 0x7A, 0x06); // jp over the je
+	return emit_jump(e, 2, (uint8_t[]){ 0x0F, 0x84 }); // je
+}
+
+static bool emit_if(Emitter *e, const Node **args, size_t nargs, size_t depth, bool tail) {
+	// without an else branch the result can be nil
+	if (nargs != 3 || !emit_expr(e, args[0], depth, false)) {
+		return false;
+	}
+
+	size_t otherwise = emit_jump_false(e);
+	if (!emit_expr(e, args[1], depth, tail)) {
+		return false;
+	}
+	size_t end = emit_jump(e, 1, (uint8_t[]){ 0xE9 }); // jmp
+	patch(e, otherwise);
+	if (!emit_expr(e, args[2], depth, tail)) {
+		return false;
+	}
+	patch(e, end);
+	return true;
+}
+
+static bool emit_do(Emitter *e, const Node **args, size_t nargs, size_t depth, bool tail) {
+	if (nargs == 0) {
+		return false;
+	}
+
+	for (size_t i = 0; i < nargs; i++) {
+		if (!emit_expr(e, args[i], depth, tail && i == nargs - 1)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Clauses with a quoted condition are skipped, the first else clause is
+// taken when no condition holds, see builtin_cond.
+static bool emit_cond(Emitter *e, const Node **args, size_t nargs, size_t depth, bool tail) {
+	const Expression *otherwise = NULL;
+	size_t *ends = malloc(nargs, sizeof(size_t));
+	size_t nends = 0;
+	bool ok = true;
+
+	for (size_t i = 0; ok && i < nargs; i++) {
+		if (args[i]->type != AST_EXPR || args[i]->expr.len < 2) {
+			ok = false;
+			break;
+		}
+
+		const Expression *clause = &args[i]->expr;
+		if (clause->nodes[0]->type == AST_QUOTED) {
+			if (otherwise == NULL && isQuoted(clause->nodes[0], "else")) {
+				otherwise = clause;
+			}
+			continue;
+		}
+
+		ok = emit_expr(e, clause->nodes[0], depth, false);
+		if (ok) {
+			size_t next = emit_jump_false(e);
+			ok = emit_do(e, (const Node**)clause->nodes + 1, clause->len - 1, depth, tail);
+			ends[nends++] = emit_jump(e, 1, (uint8_t[]){ 0xE9 }); // jmp
+			patch(e, next);
+		}
+	}
+
+	// without an else clause the result can be nil
+	ok = ok && otherwise != NULL &&
+		emit_do(e, (const Node**)otherwise->nodes + 1, otherwise->len - 1, depth, tail);
+	for (size_t i = 0; i < nends; i++) {
+		patch(e, ends[i]);
+	}
+	free(ends);
+	return ok;
+}
+
+// Calls are made with the arguments in xmm0 to xmm7, so every function can
+// jump to any other function for a tail call.
+static bool emit_call(Emitter *e, Lambda *callee, const Node **args, size_t nargs, size_t depth, bool tail) {
+	if (nargs != callee->args.len || nargs > 8 || callee->memo != NULL) {
+		return false;
+	}
+
+	for (size_t i = 0; i < nargs; i++) {
+		if (!emit_expr(e, args[i], depth + i, false)) {
+			return false;
+		}
+		store(e, temp(e, depth + i), 0);
+	}
+
+	if (tail && callee == e->lambda) {
+		for (size_t i = 0; i < nargs; i++) {
+			load(e, 0, temp(e, depth + i));
+			store(e, param(i), 0);
+		}
+		EMIT(e, 0xE9); // jmp
+		emit32(e, e->body - (e->jit->len + 4));
+		return true;
+	}
+
+	Jit *jit = translate(e->s, callee);
+	if (jit == NULL) {
+		return false;
+	}
+	e->jit->calls = true;
+
+	for (size_t i = 0; i < nargs; i++) {
+		load(e, i, temp(e, depth + i));
+	}
+	load_rax(e, (uintptr_t)&jit->entry);
+	if (tail) {
+		EMIT(e, 0xC9); // leave
+		EMIT(e, 0xFF, 0x20); // jmp [rax]
+	} else {
+		EMIT(e, 0xFF, 0x10); // call [rax]
+	}
+	return true;
+}
+
+static bool isParam(const Lambda *lambda, const char *name) {
+	for (size_t i = 0; i < lambda->args.len; i++) {
+		if (streq(lambda->args.nodes[i]->var.name, name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool emit_apply(Emitter *e, const Expression *expr, size_t depth, bool tail) {
+	if (expr->len == 0 || expr->nodes[0]->type != AST_VAR) {
+		return false;
+	}
+
+	const char *name = expr->nodes[0]->var.name;
+	const Node **args = (const Node**)expr->nodes + 1;
+	const size_t nargs = expr->len - 1;
+	if (isParam(e->lambda, name)) {
+		return false;
+	}
+
+	// Builtins must never have been shadowed, functions must have been bound
+	// once, at the root. From now on any binding invalidates the code.
+	const size_t bindings = *bindingCount(name);
+	if (bindings == 1) {
+		Node *fn = varmap_getItem(e->s->root->variables, name);
+		if (fn == NULL || fn->type != AST_FUN || fn->function.isBuiltin) {
+			return false;
+		}
+		watchBinding(name);
+		return emit_call(e, fn->function.lambda, args, nargs, depth, tail);
+	} else if (bindings != 0) {
+		return false;
+	}
+
+	const Builtin *builtin = getBuiltin(e->s->root->builtins, name);
+	if (builtin == NULL || !builtin->enabled) {
+		return false;
+	}
+	watchBinding(name);
+
+	BuiltinFn fn = builtin->function.fn;
+	if (fn == builtin_arith) {
+		return nargs >= 2 && emit_fold(e, args, nargs, depth, emit_arith, name[0]);
+	} else if (fn == builtin_comp) {
+		return nargs == 2 && emit_fold(e, args, nargs, depth, emit_compare, compare_predicate(name));
+	} else if (fn == builtin_if) {
+		return emit_if(e, args, nargs, depth, tail);
+	} else if (fn == builtin_cond) {
+		return emit_cond(e, args, nargs, depth, tail);
+	} else if (fn == builtin_do) {
+		return emit_do(e, args, nargs, depth, tail);
+	}
+	return false;
+}
+
+static bool emit_expr(Emitter *e, const Node *node, size_t depth, bool tail) {
+	switch (node->type) {
+	case AST_NUM:
+		load_const(e, 0, node->num.val);
+		return true;
+
+	case AST_VAR:
+		for (size_t i = 0; i < e->lambda->args.len; i++) {
+			if (streq(e->lambda->args.nodes[i]->var.name, node->var.name)) {
+				load(e, 0, param(i));
+				return true;
+			}
+		}
+		return false;
+
+	case AST_EXPR:
+		return emit_apply(e, &node->expr, depth, tail);
+
+	default:
+		return false;
+	}
+}
+
+// Translates lambda into the buffer of its Jit, or returns the Jit it already
+// has. Returns NULL and fails the session if it can't be translated.
+static Jit *translate(Session *s, Lambda *lambda) {
+	if (lambda->jit != NULL) {
+		if (lambda->jit->state == JIT_COMPILING ||
+			(lambda->jit->state == JIT_READY && lambda->jit->epoch == bindingEpoch)) {
+			return lambda->jit;
+		} else if (lambda->jit->state == JIT_FAILED) {
+			return NULL;
+		}
+		jit_free(lambda->jit);
+	}
+
+	Jit *jit = malloc(1, sizeof(Jit));
+	*jit = (Jit){ .state = JIT_COMPILING };
+	lambda->jit = jit;
+
+	if (s->len == s->cap) {
+		s->cap = s->cap * 2 + 4;
+		s->lambdas = realloc(s->lambdas, s->cap, sizeof(Lambda*));
+	}
+	s->lambdas[s->len++] = lambda;
+
+	const size_t nparams = lambda->args.len;
+	if (nparams > 8) {
+		s->failed = true;
+		return NULL;
+	}
+
+	Emitter e = { .s = s, .lambda = lambda, .jit = jit };
+	EMIT(&e, 0x55); // push rbp
+	EMIT(&e, 0x48, 0x89, 0xE5); // mov rbp, rsp
+	EMIT(&e, 0x48, 0x81, 0xEC); // sub rsp, imm32
+	size_t frameSize = jit->len;
+	emit32(&e, 0);
+	for (size_t i = 0; i < nparams; i++) {
+		store(&e, param(i), i);
+	}
+	e.body = jit->len;
+
+	if (!emit_expr(&e, lambda->body, 0, true)) {
+		s->failed = true;
+		return NULL;
+	}
+	EMIT(&e, 0xC9); // leave
+	EMIT(&e, 0xC3); // ret
+
+	// rsp is aligned after pushing rbp, keep it that way
+	uint32_t size = (nparams + e.temps) * 8;
+	size = (size + 15) & ~15u;
+	memcpy(jit->buf + frameSize, &size, sizeof(size));
+	return jit;
+}
+
+// Places the code of every function in the session, or gives up on all of
+// them. Only the function that got hot is marked as failed, the others are
+// tried again when they get hot themselves.
+static void finish(Session *s, Lambda *hot) {
+	for (size_t i = 0; i < s->len; i++) {
+		Jit *jit = s->lambdas[i]->jit;
+
+		void *mem = MAP_FAILED;
+		if (!s->failed) {
+			mem = mmap(NULL, jit->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
+		if (mem == MAP_FAILED) {
+			s->failed = true;
+			continue;
+		}
+
+		memcpy(mem, jit->buf, jit->len);
+		if (mprotect(mem, jit->len, PROT_READ | PROT_EXEC) != 0) {
+			munmap(mem, jit->len);
+			s->failed = true;
+			continue;
+		}
+		jit->entry = mem;
+		jit->mapped = jit->len;
+	}
+
+	for (size_t i = 0; i < s->len; i++) {
+		Lambda *lambda = s->lambdas[i];
+		Jit *jit = lambda->jit;
+		free(jit->buf);
+		jit->buf = NULL;
+
+		if (!s->failed) {
+			jit->state = JIT_READY;
+			jit->epoch = bindingEpoch;
+		} else if (lambda == hot) {
+			jit->state = JIT_FAILED;
+		} else {
+			jit_free(jit);
+			lambda->jit = NULL;
+			lambda->calls = 0;
+		}
+	}
+	free(s->lambdas);
+}
+
+void jit_free(Jit *jit) {
+	if (jit == NULL) {
+		return;
+	}
+
+	if (jit->mapped != 0) {
+		munmap(jit->entry, jit->mapped);
+	}
+	free(jit->buf);
+	free(jit);
+}
+
+bool jit_call(Scope *scope, Lambda *lambda, size_t nargs, Node *const *vals, Node **res, bool flat) {
+	if (!enabled || nargs != lambda->args.len) {
+		return false;
+	}
+
+	Jit *jit = lambda->jit;
+	if (jit != NULL && jit->state == JIT_READY && jit->epoch != bindingEpoch) {
+		jit_free(jit);
+		lambda->jit = jit = NULL;
+		lambda->calls = 0;
+	}
+
+	if (jit == NULL) {
+		if (++lambda->calls < JIT_THRESHOLD) {
+			return false;
+		}
+		Session s = { .root = scope_get_root(scope) };
+		translate(&s, lambda);
+		finish(&s, lambda);
+		jit = lambda->jit;
+	}
+
+	if (jit->state != JIT_READY || (flat && jit->calls)) {
+		return false;
+	}
+
+	double a[8];
+	for (size_t i = 0; i < nargs; i++) {
+		if (vals[i] == NULL || vals[i]->type != AST_NUM) {
+			return false;
+		}
+		a[i] = vals[i]->num.val;
+	}
+
+	double val;
+	switch (nargs) {
+	case 0: val = ((double(*)(void))jit->entry)(); break;
+	case 1: val = ((double(*)(double))jit->entry)(a[0]); break;
+	case 2: val = ((double(*)(double, double))jit->entry)(a[0], a[1]); break;
+	case 3: val = ((double(*)(double, double, double))jit->entry)(a[0], a[1], a[2]); break;
+	case 4: val = ((double(*)(double, double, double, double))jit->entry)(a[0], a[1], a[2], a[3]); break;
+	case 5: val = ((double(*)(double, double, double, double, double))jit->entry)(a[0], a[1], a[2], a[3], a[4]); break;
+	case 6: val = ((double(*)(double, double, double, double, double, double))jit->entry)(a[0], a[1], a[2], a[3], a[4], a[5]); break;
+	case 7: val = ((double(*)(double, double, double, double, double, double, double))jit->entry)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+	default: val = ((double(*)(double, double, double, double, double, double, double, double))jit->entry)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]); break;
+	}
+
+	Node *node = malloc(1, sizeof(Node));
+	node->type = AST_NUM;
+	node->num.val = val;
+	*res = node;
+	return true;
+}
+
+#else
+
+void jit_free(Jit *jit) {
+	(void)jit;
+}
+
+bool jit_call(Scope *scope, Lambda *lambda, size_t nargs, Node *const *vals, Node **res, bool flat) {
+	(void)scope;
+	(void)flat;
+	(void)lambda;
+	(void)nargs;
+	(void)vals;
+	(void)res;
+	return false;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// A baseline compiler from user defined functions to x86-64 machine code.
+// Once a function has been called JIT_THRESHOLD times, its body is translated
+// into SSE2 code if it only uses its parameters, number literals, the
+// arithmetic builtins, comparisons, do, if, cond and calls to other functions
+// that can be translated. Anything else leaves the function to the
+// interpreter.
+//
+// Everything the code relies on is checked when it's made: the builtins it
+// uses were never shadowed and the functions it calls were bound exactly once.
+// Those names are then watched, any later binding of one invalidates all
+// machine code, see bindingEpoch in builtins.h.
+//
+// On other platforms jit_call never runs anything.
+
+#define JIT_THRESHOLD 10
+
+typedef struct Jit Jit;
+
+void jit_free(Jit*);
+
+// Calls lambda with the given values through its machine code, making it
+// first when the function has become hot, and stores the result in *res.
+// Returns false without doing anything if the function has no valid machine
+// code or the values aren't all numbers; the caller has to run it instead.
+//
+// If flat is set, it also returns false if the code calls other functions, or
+// itself other than for a tail call, since the machine code of those calls
+// recurses on the C stack. The heap evaluator sets it.
+bool jit_call(Scope*, Lambda*, size_t nargs, Node *const *vals, Node **res, bool flat);
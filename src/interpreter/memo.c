@@ -0,0 +1,189 @@
+#include <assert.h>
+#include <stdint.h>
+
+#include "memo.h"
+#include "../ast_manip.h"
+#include "../util.h"
+
+typedef struct Entry Entry;
+struct Entry {
+	uint64_t hash;
+	// an expression holding the arguments
+	Node *key;
+	Node *val;
+
+	// the next entry in the same bucket
+	Entry *next;
+	// the recency list, newest first
+	Entry *newer;
+	Entry *older;
+};
+
+// A chained hash table, with all entries on a list in order of use.
+struct Memo {
+	size_t limit;
+	size_t size;
+	size_t hits;
+	size_t misses;
+
+	size_t nbuckets;
+	Entry **buckets;
+	Entry *newest;
+	Entry *oldest;
+};
+
+Memo *memo_make(size_t limit) {
+	Memo *memo = malloc(1, sizeof(Memo));
+	*memo = (Memo){ .limit = limit, .nbuckets = 16 };
+	memo->buckets = calloc(memo->nbuckets, sizeof(Entry*));
+	return memo;
+}
+
+void memo_free(Memo *memo) {
+	if (memo == NULL) {
+		return;
+	}
+
+	Entry *entry = memo->newest;
+	while (entry != NULL) {
+		Entry *older = entry->older;
+		node_free(entry->key);
+		node_free(entry->val);
+		free(entry);
+		entry = older;
+	}
+	free(memo->buckets);
+	free(memo);
+}
+
+MemoStats memo_stats(const Memo *memo) {
+	return (MemoStats){
+		.hits = memo->hits,
+		.misses = memo->misses,
+		.size = memo->size,
+		.limit = memo->limit,
+	};
+}
+
+static void unlink_recent(Memo *memo, Entry *entry) {
+	if (entry->newer != NULL) {
+		entry->newer->older = entry->older;
+	} else {
+		memo->newest = entry->older;
+	}
+	if (entry->older != NULL) {
+		entry->older->newer = entry->newer;
+	} else {
+		memo->oldest = entry->newer;
+	}
+}
+
+static void push_recent(Memo *memo, Entry *entry) {
+	entry->newer = NULL;
+	entry->older = memo->newest;
+	if (memo->newest != NULL) {
+		memo->newest->newer = entry;
+	} else {
+		memo->oldest = entry;
+	}
+	memo->newest = entry;
+}
+
+static Entry *find(const Memo *memo, uint64_t hash, const Node *key) {
+	Entry *entry = memo->buckets[hash % memo->nbuckets];
+	while (entry != NULL && (entry->hash != hash || !node_equal(entry->key, key))) {
+		entry = entry->next;
+	}
+	return entry;
+}
+
+static void evict(Memo *memo) {
+	Entry *entry = memo->oldest;
+	unlink_recent(memo, entry);
+
+	Entry **link = &memo->buckets[entry->hash % memo->nbuckets];
+	while (*link != entry) {
+		link = &(*link)->next;
+	}
+	*link = entry->next;
+
+	node_free(entry->key);
+	node_free(entry->val);
+	free(entry);
+	memo->size--;
+}
+
+static void grow(Memo *memo) {
+	size_t nbuckets = memo->nbuckets * 2;
+	Entry **buckets = calloc(nbuckets, sizeof(Entry*));
+	for (Entry *entry = memo->newest; entry != NULL; entry = entry->older) {
+		size_t i = entry->hash % nbuckets;
+		entry->next = buckets[i];
+		buckets[i] = entry;
+	}
+	free(memo->buckets);
+	memo->buckets = buckets;
+	memo->nbuckets = nbuckets;
+}
+
+// Takes ownership of key and val.
+static void insert(Memo *memo, uint64_t hash, Node *key, Node *val) {
+	if (memo->limit != 0 && memo->size == memo->limit) {
+		evict(memo);
+	}
+	if (memo->size >= memo->nbuckets) {
+		grow(memo);
+	}
+
+	Entry *entry = malloc(1, sizeof(Entry));
+	entry->hash = hash;
+	entry->key = key;
+	entry->val = val;
+
+	size_t i = hash % memo->nbuckets;
+	entry->next = memo->buckets[i];
+	memo->buckets[i] = entry;
+	push_recent(memo, entry);
+	memo->size++;
+}
+
+RunResult memo_call(Scope *scope, Lambda *lambda, size_t nargs, const Node **vals) {
+	static Node nil = { .type = AST_VAR, .var = { .name = "nil" } };
+
+	if (nargs != lambda->args.len) {
+		return rr_errf("expected number of args to == %d but is %d", lambda->args.len, nargs);
+	}
+
+	// look up with an expression that borrows the values
+	const Node **items = malloc(nargs, sizeof(Node*));
+	for (size_t i = 0; i < nargs; i++) {
+		items[i] = vals[i] == NULL ? &nil : vals[i];
+	}
+	Node args = { .type = AST_EXPR, .expr = { .len = nargs, .nodes = (Node**)items } };
+	const uint64_t hash = node_hash(&args);
+
+	Memo *memo = lambda->memo;
+	Entry *entry = find(memo, hash, &args);
+	if (entry != NULL) {
+		memo->hits++;
+		unlink_recent(memo, entry);
+		push_recent(memo, entry);
+		free(items);
+		return rr_node(node_copy(entry->val));
+	}
+	memo->misses++;
+
+	// the lambda and its cache have to outlive the call, even if the function
+	// is rebound while it runs
+	lambda_retain(lambda);
+	RunResult res = callLambda(scope, lambda, nargs, vals);
+
+	// a recursive call may have stored the same arguments already
+	if (res.err == NULL && find(memo, hash, &args) == NULL) {
+		Node *key = node_copy(&args);
+		insert(memo, hash, key, node_copy(res.node));
+	}
+	lambda_release(lambda);
+	free(items);
+	return res;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// Result caches for memoized user functions. A memoized function has its own
+// Lambda with a cache, which maps the argument values, compared structurally
+// with node_hash and node_equal, to the result. Errors aren't cached.
+//
+// A cache can be bounded, it then drops the least recently used result when
+// it's full. Calls to memoized functions are never evaluated as tail calls,
+// since their result has to be stored.
+
+typedef struct Memo Memo;
+
+// A limit of 0 means unbounded.
+Memo *memo_make(size_t limit);
+void memo_free(Memo*);
+
+typedef struct MemoStats {
+	size_t hits;
+	size_t misses;
+	size_t size;
+	size_t limit;
+} MemoStats;
+
+MemoStats memo_stats(const Memo*);
+
+// Calls lambda, which has a cache, with the given values. NULL values are
+// passed as nil.
+RunResult memo_call(Scope*, Lambda*, size_t nargs, const Node **vals);
@@ -0,0 +1,281 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "../stringify.h"
+#include "../util.h"
+
+// The size of the buffers of files, the standard streams get BUFSIZ bytes.
+#define FILE_BUFFER (64 << 10)
+
+struct Output {
+	pthread_mutex_t lock;
+	int fd;
+	OutputMode mode;
+	char *buf;
+	size_t len;
+	size_t cap;
+	// whether the buffer has a newline
+	bool newline;
+};
+
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	// by descriptor
+	Output **sinks;
+	size_t len;
+	// descriptors are below this
+	size_t limit;
+} outputs = { .once = PTHREAD_ONCE_INIT, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// What's left is written at exit, when there's no one to return errors to.
+static void flush_at_exit(void) {
+	char *err = output_flush_all();
+	if (err != NULL) {
+		fprintf(stderr, "%s\n", err);
+		free(err);
+	}
+}
+
+static void init(void) {
+	struct rlimit lim;
+	outputs.limit = getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY ? lim.rlim_cur : 1 << 20;
+	atexit(flush_at_exit);
+}
+
+// Writes all of the n buffers, waiting for fd if it's non-blocking.
+static char *write_all(int fd, struct iovec *iov, int n) {
+	while (n > 0) {
+		const ssize_t written = writev(fd, iov, n);
+		if (written < 0) {
+			if (errno == EAGAIN) {
+				struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+				poll(&pfd, 1, -1);
+				continue;
+			} else if (errno == EINTR) {
+				continue;
+			}
+			return rr_errf("can't write to fd %d: %s", fd, strerror(errno)).err;
+		}
+
+		size_t left = written;
+		while (n > 0 && left >= iov->iov_len) {
+			left -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char*)iov->iov_base + left;
+			iov->iov_len -= left;
+		}
+	}
+	return NULL;
+}
+
+// Writes the buffer and then len bytes of str, and empties the buffer.
+static char *drain(Output *o, const char *str, size_t len) {
+	if (o->len == 0 && len == 0) {
+		return NULL;
+	}
+
+	struct iovec iov[2] = {
+		{ .iov_base = o->buf, .iov_len = o->len },
+		{ .iov_base = (char*)str, .iov_len = len },
+	};
+	o->len = 0;
+	o->newline = false;
+	return write_all(o->fd, iov, 2);
+}
+
+static char *closed(int fd) {
+	return rr_errf("can't write to fd %d: it isn't open", fd).err;
+}
+
+static Output *make(int fd) {
+	Output *o = calloc(1, sizeof(Output));
+	pthread_mutex_init(&o->lock, NULL);
+	o->fd = fd;
+	if (fd == STDOUT_FILENO) {
+		o->mode = isatty(fd) ? OUTPUT_LINE : OUTPUT_BLOCK;
+	} else {
+		o->mode = fd == STDERR_FILENO ? OUTPUT_LINE : OUTPUT_BLOCK;
+	}
+	o->cap = fd <= STDERR_FILENO ? BUFSIZ : FILE_BUFFER;
+	o->buf = malloc(o->cap, sizeof(char));
+	return o;
+}
+
+// Locks and returns the sink of fd, making it if it has none and create is
+// set. Sinks are only made for open descriptors, so nothing is buffered for
+// a descriptor that's closed and then written into the file it's opened for
+// next.
+static Output *lock(int fd, bool create) {
+	pthread_once(&outputs.once, init);
+	pthread_mutex_lock(&outputs.lock);
+
+	Output *o = (size_t)fd < outputs.len ? outputs.sinks[fd] : NULL;
+	if (o == NULL && create && (fd < 0 || (size_t)fd >= outputs.limit || fcntl(fd, F_GETFD) < 0)) {
+		pthread_mutex_unlock(&outputs.lock);
+		return NULL;
+	} else if (o == NULL && create) {
+		if ((size_t)fd >= outputs.len) {
+			const size_t len = fd + 1;
+			outputs.sinks = realloc(outputs.sinks, len, sizeof(Output*));
+			memset(outputs.sinks + outputs.len, 0, (len - outputs.len) * sizeof(Output*));
+			outputs.len = len;
+		}
+		o = outputs.sinks[fd] = make(fd);
+	}
+
+	if (o != NULL) {
+		pthread_mutex_lock(&o->lock);
+	}
+	pthread_mutex_unlock(&outputs.lock);
+	return o;
+}
+
+Output *output_lock(int fd, char **err) {
+	Output *o = lock(fd, true);
+	*err = o == NULL ? closed(fd) : NULL;
+	return o;
+}
+
+char *output_unlock(Output *o) {
+	char *err = NULL;
+	if (o->mode == OUTPUT_LINE && o->newline) {
+		err = drain(o, NULL, 0);
+	}
+	pthread_mutex_unlock(&o->lock);
+	return err;
+}
+
+char *output_write(Output *o, const char *str, size_t len) {
+	const bool newline = o->mode == OUTPUT_LINE && memchr(str, '\n', len) != NULL;
+
+	if (len > o->cap - o->len) {
+		if (o->mode == OUTPUT_EXPLICIT) {
+			while (len > o->cap - o->len) {
+				o->cap *= 2;
+			}
+			o->buf = realloc(o->buf, o->cap, sizeof(char));
+		} else if (len >= o->cap) {
+			// it wouldn't fit anyway, so it's written from where it is
+			return drain(o, str, len);
+		} else {
+			char *err = drain(o, NULL, 0);
+			if (err != NULL) {
+				return err;
+			}
+		}
+	}
+
+	memcpy(o->buf + o->len, str, len);
+	o->len += len;
+	o->newline |= newline;
+	return NULL;
+}
+
+char *output_value(Output *o, const Node *val) {
+	if (val == NULL) {
+		return output_write(o, "nil", 3);
+	}
+
+	switch (val->type) {
+	case AST_STR:
+		return output_write(o, val->str.str, val->str.size);
+
+	case AST_NUM: {
+		char buf[32];
+		const int len = snprintf(buf, sizeof(buf), "%g", val->num.val);
+		return output_write(o, buf, len);
+	}
+
+	default: {
+		char *str = stringify(val, 0);
+		char *err = output_write(o, str, strlen(str));
+		free(str);
+		return err;
+	}
+	}
+}
+
+char *output_set_mode(int fd, OutputMode mode, size_t size) {
+	Output *o = lock(fd, true);
+	if (o == NULL) {
+		return closed(fd);
+	}
+	char *err = drain(o, NULL, 0);
+	o->mode = mode;
+	if (size > 0 && size != o->cap) {
+		o->cap = size;
+		o->buf = realloc(o->buf, o->cap, sizeof(char));
+	}
+	pthread_mutex_unlock(&o->lock);
+	return err;
+}
+
+char *output_flush(int fd) {
+	Output *o = lock(fd, false);
+	if (o == NULL) {
+		return NULL;
+	}
+	char *err = drain(o, NULL, 0);
+	pthread_mutex_unlock(&o->lock);
+	return err;
+}
+
+char *output_flush_all(void) {
+	char *res = NULL;
+	pthread_mutex_lock(&outputs.lock);
+	for (size_t i = 0; i < outputs.len; i++) {
+		Output *o = outputs.sinks[i];
+		if (o != NULL) {
+			pthread_mutex_lock(&o->lock);
+			char *err = drain(o, NULL, 0);
+			pthread_mutex_unlock(&o->lock);
+			if (res == NULL) {
+				res = err;
+			} else {
+				free(err);
+			}
+		}
+	}
+	pthread_mutex_unlock(&outputs.lock);
+	return res;
+}
+
+static char *forget(int fd, bool write) {
+	pthread_mutex_lock(&outputs.lock);
+	Output *o = (size_t)fd < outputs.len ? outputs.sinks[fd] : NULL;
+	if (o == NULL) {
+		pthread_mutex_unlock(&outputs.lock);
+		return NULL;
+	}
+	outputs.sinks[fd] = NULL;
+	// whoever has it locked got it from the table before it was taken out
+	pthread_mutex_lock(&o->lock);
+	pthread_mutex_unlock(&outputs.lock);
+
+	char *err = write ? drain(o, NULL, 0) : NULL;
+	pthread_mutex_unlock(&o->lock);
+	pthread_mutex_destroy(&o->lock);
+	free(o->buf);
+	free(o);
+	return err;
+}
+
+char *output_forget(int fd) {
+	return forget(fd, true);
+}
+
+void output_discard(int fd) {
+	free(forget(fd, false));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../ast.h"
+#include "./internal.h"
+
+// Output goes through sinks, a buffer for each file descriptor that's printed
+// to. Values are written into the buffer as they are, without stringifying
+// the strings and numbers first, and a string that doesn't fit is written
+// together with the buffer in one writev, so printing a lot costs writes
+// rather than allocations.
+//
+// Sinks are shared by the whole process, like the descriptors, and what one
+// print writes isn't mixed with what others write at the same time. What's
+// buffered is written when the process exits normally, see atexit, where
+// errors can only be reported on standard error.
+
+typedef enum OutputMode {
+	// written after every print that writes a newline, and when it's full
+	OUTPUT_LINE,
+	// written when it's full
+	OUTPUT_BLOCK,
+	// only written by output_flush, growing as much as it needs to
+	OUTPUT_EXPLICIT,
+} OutputMode;
+
+typedef struct Output Output;
+
+// Locks the sink of fd, making it if there's none. Standard output is line
+// buffered if it's a terminal and block buffered otherwise, standard error is
+// line buffered, and other descriptors are block buffered. Returns NULL and
+// sets err if fd isn't open.
+Output *output_lock(int fd, char **err);
+// Writes what the mode says should be written, and unlocks the sink.
+char *output_unlock(Output*);
+
+char *output_write(Output*, const char *str, size_t len);
+// Writes what print prints for the value: strings without quotes, nil as nil.
+char *output_value(Output*, const Node*);
+
+// Sets how the sink of fd is buffered, with a buffer of size bytes, or the
+// size it had if that's 0.
+char *output_set_mode(int fd, OutputMode, size_t size);
+
+// Writes what's buffered for fd, if it has a sink.
+char *output_flush(int fd);
+// Writes what's buffered for every descriptor, and returns the first error.
+char *output_flush_all(void);
+// Writes what's buffered for fd and forgets its sink, before it's closed.
+char *output_forget(int fd);
+// Forgets the sink of fd without writing it, for a descriptor that was closed
+// some other way and has been opened again.
+void output_discard(int fd);
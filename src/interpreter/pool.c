@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "interpreter.h"
+#include "../util.h"
+
+// The number of workers, 0 for the number of CPUs.
+static size_t workers = 0;
+
+void setWorkers(size_t n) {
+	workers = n;
+}
+
+// The chunks left in the run of a worker, with the first in the low half and
+// the end in the high half, so taking and stealing are single CASes.
+typedef struct Run {
+	_Atomic uint64_t bounds;
+} Run;
+
+static uint64_t pack(uint32_t lo, uint32_t hi) {
+	return (uint64_t)hi << 32 | lo;
+}
+
+static struct {
+	pthread_once_t once;
+	size_t size;
+
+	pthread_mutex_t lock;
+	// signalled when a job is posted, or when it's done
+	pthread_cond_t posted;
+	pthread_cond_t done;
+
+	// the running job, and a count of the jobs that were posted
+	const PoolJob *job;
+	size_t generation;
+	size_t finished;
+	Run *runs;
+} pool = { .once = PTHREAD_ONCE_INIT };
+
+static _Thread_local bool isWorker = false;
+
+// Takes the next chunk of the worker's own run.
+static bool take(Run *run, size_t *chunk) {
+	uint64_t bounds = atomic_load(&run->bounds);
+	for (;;) {
+		const uint32_t lo = bounds, hi = bounds >> 32;
+		if (lo == hi) {
+			return false;
+		} else if (atomic_compare_exchange_weak(&run->bounds, &bounds, pack(lo + 1, hi))) {
+			*chunk = lo;
+			return true;
+		}
+	}
+}
+
+// Takes the last chunk of the longest run of another worker.
+static bool steal(size_t self, size_t *chunk) {
+	for (;;) {
+		size_t victim = pool.size;
+		uint64_t bounds = 0;
+		uint32_t most = 0;
+		for (size_t i = 0; i < pool.size; i++) {
+			const uint64_t b = atomic_load(&pool.runs[i].bounds);
+			const uint32_t left = (uint32_t)(b >> 32) - (uint32_t)b;
+			if (i != self && left > most) {
+				victim = i;
+				bounds = b;
+				most = left;
+			}
+		}
+		if (victim == pool.size) {
+			return false;
+		}
+
+		const uint32_t lo = bounds, hi = bounds >> 32;
+		if (atomic_compare_exchange_strong(&pool.runs[victim].bounds, &bounds, pack(lo, hi - 1))) {
+			*chunk = hi - 1;
+			return true;
+		}
+	}
+}
+
+static void work(const PoolJob *job, size_t self) {
+	void *state = NULL;
+	bool entered = false;
+
+	size_t chunk;
+	while (take(&pool.runs[self], &chunk) || steal(self, &chunk)) {
+		if (!entered) {
+			state = job->enter(job->ctx);
+			entered = true;
+		}
+		job->run(job->ctx, state, chunk);
+	}
+
+	if (entered) {
+		job->leave(job->ctx, state);
+	}
+}
+
+static void *worker_main(void *arg) {
+	const size_t self = (size_t)arg;
+	isWorker = true;
+
+	size_t seen = 0;
+	for (;;) {
+		pthread_mutex_lock(&pool.lock);
+		while (pool.generation == seen) {
+			pthread_cond_wait(&pool.posted, &pool.lock);
+		}
+		seen = pool.generation;
+		const PoolJob *job = pool.job;
+		pthread_mutex_unlock(&pool.lock);
+
+		work(job, self);
+
+		pthread_mutex_lock(&pool.lock);
+		if (++pool.finished == pool.size) {
+			pthread_cond_broadcast(&pool.done);
+		}
+		pthread_mutex_unlock(&pool.lock);
+	}
+	return NULL;
+}
+
+size_t pool_default_size(void) {
+	const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return workers != 0 ? workers : ncpus > 0 ? (size_t)ncpus : 1;
+}
+
+static void start(void) {
+	pool.size = pool_default_size();
+	pool.runs = calloc(pool.size, sizeof(Run));
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.posted, NULL);
+	pthread_cond_init(&pool.done, NULL);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, 8 << 20);
+	for (size_t i = 0; i < pool.size; i++) {
+		pthread_t thread;
+		pthread_create(&thread, &attr, worker_main, (void*)i);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+size_t pool_size(void) {
+	pthread_once(&pool.once, start);
+	return pool.size;
+}
+
+bool pool_worker(void) {
+	return isWorker;
+}
+
+void pool_run(const PoolJob *job) {
+	pthread_once(&pool.once, start);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.job != NULL) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+
+	// deal the chunks out evenly
+	for (size_t i = 0; i < pool.size; i++) {
+		const uint32_t lo = job->nchunks * i / pool.size;
+		const uint32_t hi = job->nchunks * (i + 1) / pool.size;
+		atomic_store(&pool.runs[i].bounds, pack(lo, hi));
+	}
+
+	pool.job = job;
+	pool.finished = 0;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.posted);
+
+	while (pool.finished < pool.size) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pool.job = NULL;
+	// let the next caller in
+	pthread_cond_broadcast(&pool.done);
+	pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A fixed-size pool of worker threads for data-parallel builtins. A job is
+// split into chunks, which are dealt out to the workers in contiguous runs.
+// A worker that's done with its own run steals chunks from the back of the
+// longest run that's left.
+//
+// Every worker is an isolate of its own, see isolate.h. The thread that runs
+// a job is blocked until the job is done, so the workers can read its values
+// as long as they don't change them.
+
+typedef struct PoolJob {
+	void *ctx;
+	size_t nchunks;
+
+	// Called once on a worker before it runs its first chunk of the job,
+	// returns the state that's passed to run.
+	void *(*enter)(void *ctx);
+	void (*run)(void *ctx, void *state, size_t chunk);
+	// Called on every worker that ran enter, after the last chunk.
+	void (*leave)(void *ctx, void *state);
+} PoolJob;
+
+// Runs the job on the pool, starting it if needed. Only one job runs at a
+// time, callers from other isolates wait for their turn.
+void pool_run(const PoolJob*);
+
+// The number of workers.
+size_t pool_size(void);
+
+// The number of workers the pool starts with, see setWorkers, without
+// starting it.
+size_t pool_default_size(void);
+
+// Whether the calling thread is a worker, which can't wait for a job of its
+// own.
+bool pool_worker(void);
@@ -1,8 +1,38 @@
 #include <assert.h>
 #include "scope.h"
+#include "image.h"
 #include "../util.h"
 
+static void link(Scope *scope, Scope *parent) {
+	scope->parent = parent;
+	if (parent == NULL) {
+		scope->root = scope;
+		scope->above = 0;
+		scope->epoch = 0;
+		return;
+	}
+
+	scope->root = parent->root;
+	if (parent->parent == NULL) {
+		// the root's names aren't needed, so it's not adopted, and binding
+		// globals doesn't make the scopes below it stale
+		scope->above = 0;
+		scope->epoch = varmap_growth();
+		return;
+	}
+
+	varmap_adopt(parent->variables);
+	const size_t growth = varmap_growth();
+	scope->above = parent->above | varmap_names(parent->variables);
+	// a scope below a stale one is stale as well
+	scope->epoch = parent->epoch == growth ? growth : parent->epoch;
+}
+
 Scope *scope_make(Scope *parent, bool addPrelude) {
+	if (parent == NULL && addPrelude) {
+		return image_scope(NULL);
+	}
+
 	Scope *res = malloc(1, sizeof(Scope));
 	assert(res);
 
@@ -10,7 +40,8 @@ Scope *scope_make(Scope *parent, bool addPrelude) {
 	assert(res->variables);
 
 	res->builtins = NULL;
-	res->parent = parent;
+	res->image = NULL;
+	link(res, parent);
 
 	if (parent == NULL) {
 		res->builtins = builtins_make(addPrelude);
@@ -24,9 +55,10 @@ Scope *scope_copy(Scope *scope) {
 	Scope *res = malloc(1, sizeof(Scope));
 	assert(res);
 
-	res->builtins = builtins_copy(scope->builtins);
+	res->builtins = scope->image != NULL ? scope->builtins : builtins_copy(scope->builtins);
 	res->variables = varmap_copy(scope->variables);
-	res->parent = scope->parent;
+	res->image = scope->image;
+	link(res, scope->parent);
 
 	return res;
 }
@@ -36,14 +68,57 @@ void scope_free(Scope *scope) {
 		return;
 	}
 
-	builtins_free(scope->builtins);
+	// the builtins of an image are shared
+	if (scope->image == NULL) {
+		builtins_free(scope->builtins);
+	}
 	varmap_free(scope->variables);
 	free(scope);
 }
 
+#define POOL_SIZE 64
+
+// every isolate has its own pool
+static _Thread_local VarMap *pool[POOL_SIZE];
+static _Thread_local size_t pooled = 0;
+
+void scope_enter(Scope *scope, Scope *parent) {
+	assert(parent != NULL);
+	scope->builtins = NULL;
+	scope->image = NULL;
+	scope->variables = pooled > 0 ? pool[--pooled] : varmap_make();
+	link(scope, parent);
+}
+
+void scope_leave(Scope *scope) {
+	if (pooled == POOL_SIZE) {
+		varmap_free(scope->variables);
+		return;
+	}
+	varmap_clear(scope->variables);
+	pool[pooled++] = scope->variables;
+}
+
+void scope_pool_free(void) {
+	while (pooled > 0) {
+		varmap_free(pool[--pooled]);
+	}
+}
+
 Scope *scope_get_root(Scope *scope) {
+	return scope->root;
+}
+
+Scope *scope_find(const Scope *scope, const char *name) {
+	const uint64_t bit = varmap_nameBit(name);
+	const size_t growth = varmap_growth();
 	while (scope->parent != NULL) {
+		if ((varmap_names(scope->variables) & bit) && varmap_getOwnItem(scope->variables, name) != NULL) {
+			return (Scope*)scope;
+		} else if (scope->epoch == growth && !(scope->above & bit)) {
+			return scope->root;
+		}
 		scope = scope->parent;
 	}
-	return scope;
+	return (Scope*)scope;
 }
@@ -3,15 +3,41 @@
 #include "./varmap.h"
 #include "./builtins.h"
 
+typedef struct Image Image;
+
 typedef struct Scope Scope;
 struct Scope {
 	Scope *parent;
 	VarMap *variables;
 	BuiltinList *builtins;
+	// the image a root scope was made from, whose builtins it uses, see
+	// image.h
+	const Image *image;
+	// The root, and the bits of the names the scopes between this one and
+	// the root bound when it was made, see varmap_nameBit. They still do as
+	// long as varmap_growth returns epoch.
+	Scope *root;
+	uint64_t above;
+	size_t epoch;
 };
 
+// Root scopes with the prelude start from the base image, see image_base.
 Scope *scope_make(Scope *parent, bool addPrelude);
 Scope *scope_copy(Scope *scope);
 void scope_free(Scope *scope);
 
 Scope *scope_get_root(Scope *scope);
+// Returns the scope the value of name is found in, the root if it's not bound
+// at all. Calls chain their frames to the scope they're called from, so this
+// skips to the root when no scope in between can bind the name, instead of
+// looking into every frame of a deep recursion.
+Scope *scope_find(const Scope *scope, const char *name);
+
+// Scopes that can't outlive the evaluation they're made for, like the frames
+// of calls and let blocks whose bodies make no functions, can be stored
+// anywhere, usually on the stack. They take their variables from a pool of
+// cleared maps and give them back on scope_leave.
+void scope_enter(Scope *scope, Scope *parent);
+void scope_leave(Scope *scope);
+// Frees the pooled maps of the isolate, once it's done running code.
+void scope_pool_free(void);
@@ -0,0 +1,417 @@
+#include <string.h>
+#include "snapshot.h"
+#include "memo.h"
+#include "../dict.h"
+#include "../f64array.h"
+#include "../stringify.h"
+#include "../vector.h"
+#include "../util.h"
+
+// the tag of nil, the others are the ASTtype of the value
+#define TAG_NIL 0xff
+
+void snap_bytes(SnapWriter *w, const void *bytes, size_t len) {
+	if (w->len + len > w->cap) {
+		w->cap = w->cap == 0 ? 256 : w->cap;
+		while (w->len + len > w->cap) {
+			w->cap *= 2;
+		}
+		w->data = realloc(w->data, w->cap, sizeof(char));
+	}
+	memcpy(w->data + w->len, bytes, len);
+	w->len += len;
+}
+
+static void put_u8(SnapWriter *w, uint8_t val) {
+	snap_bytes(w, &val, 1);
+}
+
+static void put_f64(SnapWriter *w, double val) {
+	snap_bytes(w, &val, sizeof(double));
+}
+
+void snap_u64(SnapWriter *w, uint64_t val) {
+	snap_bytes(w, &val, sizeof(uint64_t));
+}
+
+static void put_sized(SnapWriter *w, const char *str, size_t len) {
+	snap_u64(w, len);
+	snap_bytes(w, str, len);
+	put_u8(w, '\0');
+}
+
+void snap_str(SnapWriter *w, const char *str) {
+	put_sized(w, str, strlen(str));
+}
+
+static char *write_lambda(SnapWriter *w, BuiltinList *builtins, const Lambda *lambda) {
+	snap_u64(w, lambda->args.len);
+	for (size_t i = 0; i < lambda->args.len; i++) {
+		snap_str(w, lambda->args.nodes[i]->var.name);
+	}
+	// the limit of the cache, which is left behind, plus one
+	snap_u64(w, lambda->memo == NULL ? 0 : memo_stats(lambda->memo).limit + 1);
+	return snapshot_write(w, builtins, lambda->body);
+}
+
+char *snapshot_write(SnapWriter *w, BuiltinList *builtins, const Node *val) {
+	if (val == NULL) {
+		put_u8(w, TAG_NIL);
+		return NULL;
+	}
+	put_u8(w, val->type);
+
+	switch (val->type) {
+	case AST_NUM:
+		put_f64(w, val->num.val);
+		return NULL;
+
+	case AST_STR:
+		put_sized(w, val->str.str, val->str.size);
+		return NULL;
+
+	case AST_VAR:
+		snap_str(w, val->var.name);
+		return NULL;
+
+	case AST_COMMENT:
+		snap_str(w, val->comment.content);
+		return NULL;
+
+	case AST_QUOTED:
+		return snapshot_write(w, builtins, val->quoted.node);
+
+	case AST_EXPR:
+		snap_u64(w, val->expr.len);
+		for (size_t i = 0; i < val->expr.len; i++) {
+			char *err = snapshot_write(w, builtins, val->expr.nodes[i]);
+			if (err != NULL) {
+				return err;
+			}
+		}
+		return NULL;
+
+	case AST_FUN: {
+		const Function *fn = &val->function;
+		put_u8(w, fn->isBuiltin);
+		if (!fn->isBuiltin) {
+			return write_lambda(w, builtins, fn->lambda);
+		}
+
+		const Builtin *builtin = getBuiltin(builtins, fn->name);
+		if (builtin == NULL || builtin->function.fn != fn->fn) {
+			return rr_errf("can't save the function %s, which isn't a builtin", fn->name).err;
+		}
+		snap_str(w, fn->name);
+		return NULL;
+	}
+
+	case AST_VECTOR: {
+		const size_t len = vector_length(val->vector);
+		snap_u64(w, len);
+		for (size_t i = 0; i < len; i++) {
+			char *err = snapshot_write(w, builtins, vector_get(val->vector, i));
+			if (err != NULL) {
+				return err;
+			}
+		}
+		return NULL;
+	}
+
+	case AST_ARRAY:
+		snap_u64(w, val->array->len);
+		snap_bytes(w, val->array->data, val->array->len * sizeof(double));
+		return NULL;
+
+	case AST_DICT: {
+		put_u8(w, dict_is_mutable(val->dict));
+		snap_u64(w, dict_size(val->dict));
+
+		DictIter it;
+		dict_iter_init(&it, val->dict);
+		const Node *key, *item;
+		while (dict_iter_next(&it, &key, &item)) {
+			char *err = snapshot_write(w, builtins, key);
+			if (err == NULL) {
+				err = snapshot_write(w, builtins, item);
+			}
+			if (err != NULL) {
+				return err;
+			}
+		}
+		return NULL;
+	}
+
+	case AST_RANGE:
+		put_f64(w, val->range.from);
+		put_f64(w, val->range.step);
+		snap_u64(w, val->range.len);
+		return NULL;
+
+	default:
+		return rr_errf("can't save a %s", typetostr(val)).err;
+	}
+}
+
+static bool get(SnapReader *r, void *bytes, size_t len) {
+	if ((size_t)(r->end - r->pos) < len) {
+		return false;
+	}
+	memcpy(bytes, r->pos, len);
+	r->pos += len;
+	return true;
+}
+
+bool snap_read_u64(SnapReader *r, uint64_t *val) {
+	return get(r, val, sizeof(uint64_t));
+}
+
+// Whether at least n more items, which take at least size bytes each, are
+// left.
+static bool has(const SnapReader *r, uint64_t n, size_t size) {
+	return n <= (uint64_t)(r->end - r->pos) / size;
+}
+
+static bool read_sized(SnapReader *r, const char **str, uint64_t *len) {
+	if (!snap_read_u64(r, len) || *len >= (uint64_t)(r->end - r->pos) || r->pos[*len] != '\0') {
+		return false;
+	}
+	*str = r->pos;
+	r->pos += *len + 1;
+	return true;
+}
+
+bool snap_read_str(SnapReader *r, const char **str) {
+	uint64_t len;
+	return read_sized(r, str, &len);
+}
+
+static RunResult corrupt(void) {
+	return rr_errf("the snapshot is corrupt");
+}
+
+static Node *make_node(ASTtype type) {
+	Node *res = malloc(1, sizeof(Node));
+	res->type = type;
+	return res;
+}
+
+static RunResult read_lambda(SnapReader *r, BuiltinList *builtins) {
+	uint64_t nargs, memo;
+	if (!snap_read_u64(r, &nargs) || !has(r, nargs, 9)) {
+		return corrupt();
+	}
+
+	Lambda *lambda = calloc(1, sizeof(Lambda));
+	lambda->refs = 1;
+	lambda->args.nodes = calloc(nargs, sizeof(Node*));
+	Node *res = make_node(AST_FUN);
+	res->function.isBuiltin = false;
+	res->function.lambda = lambda;
+
+	for (; lambda->args.len < nargs; lambda->args.len++) {
+		const char *name;
+		if (!snap_read_str(r, &name)) {
+			node_free(res);
+			return corrupt();
+		}
+		lambda->args.nodes[lambda->args.len] = makeVar(name);
+	}
+
+	if (!snap_read_u64(r, &memo)) {
+		node_free(res);
+		return corrupt();
+	}
+	lambda->memo = memo == 0 ? NULL : memo_make(memo - 1);
+
+	RunResult body = snapshot_read(r, builtins);
+	if (body.err != NULL) {
+		node_free(res);
+		return body;
+	}
+	lambda->body = body.node;
+	return rr_node(res);
+}
+
+static RunResult read_items(SnapReader *r, BuiltinList *builtins, size_t len, Node **items) {
+	for (size_t i = 0; i < len; i++) {
+		RunResult rr = snapshot_read(r, builtins);
+		if (rr.err != NULL) {
+			return rr;
+		}
+		items[i] = rr.node;
+	}
+	return rr_null();
+}
+
+static RunResult read_dict(SnapReader *r, BuiltinList *builtins) {
+	uint8_t isMutable;
+	uint64_t size;
+	if (!get(r, &isMutable, 1) || !snap_read_u64(r, &size) || !has(r, size, 2)) {
+		return corrupt();
+	}
+
+	Dict *dict = dict_make(isMutable);
+	for (uint64_t i = 0; i < size; i++) {
+		Node *kv[2] = { NULL, NULL };
+		RunResult rr = read_items(r, builtins, 2, kv);
+		if (rr.err != NULL) {
+			node_free(kv[0]);
+			dict_release(dict);
+			return rr;
+		}
+
+		if (isMutable) {
+			dict_put_mut(dict, kv[0], kv[1]);
+		} else {
+			Dict *next = dict_put(dict, kv[0], kv[1]);
+			dict_release(dict);
+			dict = next;
+		}
+	}
+
+	Node *res = make_node(AST_DICT);
+	res->dict = dict;
+	return rr_node(res);
+}
+
+RunResult snapshot_read(SnapReader *r, BuiltinList *builtins) {
+	uint8_t tag;
+	if (!get(r, &tag, 1)) {
+		return corrupt();
+	} else if (tag == TAG_NIL) {
+		return rr_null();
+	}
+
+	const char *str;
+	uint64_t len;
+	Node *res;
+	switch (tag) {
+	case AST_NUM:
+		res = make_node(AST_NUM);
+		if (!get(r, &res->num.val, sizeof(double))) {
+			free(res);
+			return corrupt();
+		}
+		return rr_node(res);
+
+	case AST_STR:
+		if (!read_sized(r, &str, &len)) {
+			return corrupt();
+		}
+		res = make_node(AST_STR);
+		res->str.size = len;
+		res->str.str = malloc((len + 1), sizeof(char));
+		memcpy(res->str.str, str, len + 1);
+		return rr_node(res);
+
+	case AST_VAR:
+		if (!snap_read_str(r, &str)) {
+			return corrupt();
+		}
+		return rr_node(makeVar(str));
+
+	case AST_COMMENT:
+		if (!snap_read_str(r, &str)) {
+			return corrupt();
+		}
+		res = make_node(AST_COMMENT);
+		res->comment.content = astrcpy(str);
+		return rr_node(res);
+
+	case AST_QUOTED: {
+		RunResult rr = snapshot_read(r, builtins);
+		if (rr.err != NULL) {
+			return rr;
+		}
+		res = make_node(AST_QUOTED);
+		res->quoted.node = rr.node;
+		return rr_node(res);
+	}
+
+	case AST_EXPR: {
+		if (!snap_read_u64(r, &len) || !has(r, len, 1)) {
+			return corrupt();
+		}
+		res = make_node(AST_EXPR);
+		res->expr.len = len;
+		res->expr.nodes = calloc(len, sizeof(Node*));
+		RunResult rr = read_items(r, builtins, len, res->expr.nodes);
+		if (rr.err != NULL) {
+			node_free(res);
+			return rr;
+		}
+		return rr_node(res);
+	}
+
+	case AST_FUN: {
+		uint8_t isBuiltin;
+		if (!get(r, &isBuiltin, 1)) {
+			return corrupt();
+		} else if (!isBuiltin) {
+			return read_lambda(r, builtins);
+		} else if (!snap_read_str(r, &str)) {
+			return corrupt();
+		}
+
+		const Builtin *builtin = getBuiltin(builtins, str);
+		if (builtin == NULL) {
+			return rr_errf("the snapshot refers to an unknown builtin %s", str);
+		}
+		res = make_node(AST_FUN);
+		res->function = builtin->function;
+		return rr_node(res);
+	}
+
+	case AST_VECTOR: {
+		if (!snap_read_u64(r, &len) || !has(r, len, 1)) {
+			return corrupt();
+		}
+		Node **items = calloc(len, sizeof(Node*));
+		RunResult rr = read_items(r, builtins, len, items);
+		if (rr.err == NULL) {
+			for (size_t i = 0; i < len; i++) {
+				if (items[i] == NULL) {
+					items[i] = makeVar("nil");
+				}
+			}
+			res = make_node(AST_VECTOR);
+			res->vector = vector_from_array((const Node**)items, len);
+			rr = rr_node(res);
+		}
+		for (size_t i = 0; i < len; i++) {
+			node_free(items[i]);
+		}
+		free(items);
+		return rr;
+	}
+
+	case AST_ARRAY:
+		if (!snap_read_u64(r, &len) || !has(r, len, sizeof(double))) {
+			return corrupt();
+		}
+		res = make_node(AST_ARRAY);
+		res->array = f64_make(len);
+		get(r, res->array->data, len * sizeof(double));
+		return rr_node(res);
+
+	case AST_DICT:
+		return read_dict(r, builtins);
+
+	case AST_RANGE:
+		res = make_node(AST_RANGE);
+		if (
+			!get(r, &res->range.from, sizeof(double)) ||
+			!get(r, &res->range.step, sizeof(double)) ||
+			!snap_read_u64(r, &len)
+		) {
+			free(res);
+			return corrupt();
+		}
+		res->range.len = len;
+		return rr_node(res);
+
+	default:
+		return corrupt();
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include "../ast.h"
+#include "./internal.h"
+
+// Snapshots are values written out as bytes that can be read back into
+// copies of them, like isolate_transfer does in memory. Images are saved as
+// snapshots, see image_save.
+//
+// Numbers are written as they're laid out in memory, so a snapshot can only
+// be read on the kind of machine it was written on.
+
+typedef struct SnapWriter {
+	char *data;
+	size_t len;
+	size_t cap;
+} SnapWriter;
+
+void snap_bytes(SnapWriter*, const void*, size_t);
+void snap_u64(SnapWriter*, uint64_t);
+// Writes the string with its length and its terminating nul, so it can be
+// used where it's read.
+void snap_str(SnapWriter*, const char*);
+// Writes val, which may be NULL for nil. Builtins are written by name, and
+// have to be in the given list. Fails for values that can't leave their
+// isolate, and for functions that aren't builtins of the list.
+char *snapshot_write(SnapWriter*, BuiltinList*, const Node *val);
+
+typedef struct SnapReader {
+	const char *pos;
+	const char *end;
+} SnapReader;
+
+// These return false if there aren't enough bytes left.
+bool snap_read_u64(SnapReader*, uint64_t*);
+// Points str into the bytes that are read.
+bool snap_read_str(SnapReader*, const char **str);
+// Reads a value written by snapshot_write, with builtins from the given list.
+// Fails if the bytes weren't written by it.
+RunResult snapshot_read(SnapReader*, BuiltinList*);
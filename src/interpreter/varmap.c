@@ -1,24 +1,40 @@
 #include "varmap.h"
+#include "builtins.h"
 #include "../util.h"
 #include "../stringify.h"
 #include <assert.h>
+#include <stdatomic.h>
 #include <string.h>
 
 typedef struct VarMap {
 	size_t nkeys;
+	size_t cap;
 	char **keys;
 	Node **values;
+	VarFault fault;
+	const void *base;
+	uint64_t names;
+	bool adopted;
 } VarMap;
 
+// Scopes of several isolates may be looked into on one thread, like those of
+// a context of libschym, so the counter is shared by all of them.
+static atomic_size_t growth = 0;
+
 VarMap *varmap_make(void) {
 	VarMap *map = malloc(1, sizeof(VarMap));
 	map->nkeys = 0;
+	map->cap = 0;
 	map->keys = malloc(0, sizeof(char*));
 	map->values = malloc(0, sizeof(Node*));
+	map->fault = NULL;
+	map->base = NULL;
+	map->names = 0;
+	map->adopted = false;
 	return map;
 }
 
-Node *varmap_getItem(VarMap *map, const char *key) {
+Node *varmap_getOwnItem(const VarMap *map, const char *key) {
 	if (streq(key, "nil")) {
 		return NULL;
 	}
@@ -32,15 +48,51 @@ Node *varmap_getItem(VarMap *map, const char *key) {
 	return NULL;
 }
 
+Node *varmap_findItem(VarMap *map, const char *key, char **err) {
+	*err = NULL;
+	Node *res = varmap_getOwnItem(map, key);
+	if (res != NULL || map->fault == NULL || streq(key, "nil")) {
+		return res;
+	}
+
+	// a value that failed isn't bound, so every lookup fails the same way
+	res = map->fault(map->base, key, err);
+	if (res != NULL) {
+		varmap_moveItem(map, key, res);
+	}
+	return res;
+}
+
+Node *varmap_getItem(VarMap *map, const char *key) {
+	char *err;
+	Node *res = varmap_findItem(map, key, &err);
+	free(err);
+	return res;
+}
+
 void varmap_setItem(VarMap *map, const char *key, const Node *node) {
+	varmap_moveItem(map, key, node_copy(node));
+}
+
+void varmap_moveItem(VarMap *map, const char *key, Node *node) {
 	varmap_removeItem(map, key);
+	noteBinding(key);
+
+	const uint64_t bit = varmap_nameBit(key);
+	if (map->adopted && !(map->names & bit)) {
+		atomic_fetch_add_explicit(&growth, 1, memory_order_relaxed);
+	}
+	map->names |= bit;
 
 	map->nkeys++;
-	map->keys = realloc(map->keys, map->nkeys, sizeof(char*));
-	map->values = realloc(map->values, map->nkeys, sizeof(Node*));
+	if (map->nkeys > map->cap) {
+		map->cap = map->cap == 0 ? 4 : 2 * map->cap;
+		map->keys = realloc(map->keys, map->cap, sizeof(char*));
+		map->values = realloc(map->values, map->cap, sizeof(Node*));
+	}
 
 	map->keys[map->nkeys-1] = astrcpy(key);
-	map->values[map->nkeys-1] = node_copy(node);
+	map->values[map->nkeys-1] = node;
 }
 
 void varmap_removeItem(VarMap *map, const char *key) {
@@ -71,12 +123,26 @@ void varmap_removeItem(VarMap *map, const char *key) {
 
 VarMap *varmap_copy(const VarMap *map) {
 	VarMap *res = varmap_make();
+	res->fault = map->fault;
+	res->base = map->base;
 	for (size_t i = 0; i < map->nkeys; i++) {
 		varmap_setItem(res, map->keys[i], map->values[i]);
 	}
 	return res;
 }
 
+size_t varmap_length(const VarMap *map) {
+	return map->nkeys;
+}
+
+const char *varmap_keyAt(const VarMap *map, size_t i) {
+	return map->keys[i];
+}
+
+const Node *varmap_itemAt(const VarMap *map, size_t i) {
+	return map->values[i];
+}
+
 void varmap_print(const VarMap *map) {
 	for (size_t i = 0; i < map->nkeys; i++) {
 		const char *key = map->keys[i];
@@ -85,11 +151,48 @@ void varmap_print(const VarMap *map) {
 	}
 }
 
-void varmap_free(VarMap *map) {
+void varmap_clear(VarMap *map) {
 	for (size_t i = 0; i < map->nkeys; i++) {
 		free(map->keys[i]);
-		free(map->values[i]);
+		node_free(map->values[i]);
+	}
+	map->nkeys = 0;
+	map->names = 0;
+	map->adopted = false;
+}
+
+void varmap_setBase(VarMap *map, VarFault fault, const void *base) {
+	map->fault = fault;
+	map->base = base;
+}
+
+uint64_t varmap_nameBit(const char *name) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037u;
+	for (; *name != '\0'; name++) {
+		hash = (hash ^ (unsigned char)*name) * 1099511628211u;
 	}
+	// the high bits of short names hardly differ, so they're mixed first
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdu;
+	hash ^= hash >> 33;
+	return (uint64_t)1 << (hash >> 58);
+}
+
+uint64_t varmap_names(const VarMap *map) {
+	return map->names;
+}
+
+void varmap_adopt(VarMap *map) {
+	map->adopted = true;
+}
+
+size_t varmap_growth(void) {
+	return atomic_load_explicit(&growth, memory_order_relaxed);
+}
+
+void varmap_free(VarMap *map) {
+	varmap_clear(map);
 	free(map->keys);
 	free(map->values);
 	free(map);
@@ -1,13 +1,50 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "../ast.h"
 
 typedef struct VarMap VarMap;
 
 VarMap *varmap_make(void);
 Node *varmap_getItem(VarMap*, const char*);
+// Like varmap_getItem, but sets err if the base has the name and its value
+// couldn't be made, instead of returning NULL as if it wasn't bound.
+Node *varmap_findItem(VarMap*, const char*, char **err);
+// Like varmap_getItem, but doesn't look in the base.
+Node *varmap_getOwnItem(const VarMap*, const char*);
+// Binds a copy of the given value.
 void varmap_setItem(VarMap*, const char*, const Node*);
+// Binds the given value itself, which the map takes ownership of.
+void varmap_moveItem(VarMap*, const char*, Node*);
 void varmap_removeItem(VarMap*, const char*);
 VarMap *varmap_copy(const VarMap*);
+// The number of items, and the name and value of item i, in the order they
+// were bound.
+size_t varmap_length(const VarMap*);
+const char *varmap_keyAt(const VarMap*, size_t);
+const Node *varmap_itemAt(const VarMap*, size_t);
+// Removes all items, keeping the memory for new ones.
+void varmap_clear(VarMap*);
+// Makes the map fall back to base, which never changes and may be shared
+// between isolates, like an image. Looking up a name the map doesn't bind
+// binds the value fault returns for it, if any, which has to be a value of
+// base made for the map alone, or NULL and an error in err. Removing that
+// binding makes the value of base visible again. The length and items of the
+// map are its own.
+typedef Node *(*VarFault)(const void *base, const char *name, char **err);
+void varmap_setBase(VarMap*, VarFault fault, const void *base);
 void varmap_print(const VarMap*);
+
+// Every name maps to one of 64 bits, and a map has the bits of the names it
+// has bound since it was made or cleared, so a map without the bit of a name
+// doesn't bind it.
+uint64_t varmap_nameBit(const char*);
+uint64_t varmap_names(const VarMap*);
+// Marks the map as one whose scope has child scopes, which may have taken its
+// names into account, see scope.h. Binding a name with a new bit in such a map
+// bumps a counter shared by all maps, which varmap_growth returns. Clearing
+// the map unmarks it.
+void varmap_adopt(VarMap*);
+size_t varmap_growth(void);
 void varmap_free(VarMap*);
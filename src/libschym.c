@@ -0,0 +1,389 @@
+#include <stddef.h>
+#include <string.h>
+#include "libschym.h"
+#include "ast.h"
+#include "stringify.h"
+#include "util.h"
+#include "interpreter/image.h"
+#include "interpreter/interpreter.h"
+#include "interpreter/isolate.h"
+#include "interpreter/output.h"
+
+// SchymImage, SchymProgram and SchymValue are never defined, pointers to them
+// are pointers to Image, Program and Node.
+#define IMAGE(image) ((const Image*)(image))
+#define NODE(val) ((const Node*)(val))
+#define VALUE(node) ((SchymValue*)(node))
+
+typedef struct Program {
+	size_t len;
+	Node **nodes;
+} Program;
+
+// Builtins get the name they were registered with, which for natives is the
+// one in their Native, so that's how call_native finds it.
+typedef struct Native {
+	SchymFn fn;
+	void *data;
+	char name[];
+} Native;
+
+struct SchymContext {
+	const Image *image;
+	Scope *root;
+	// the binding counts of the code of the context, which is an isolate
+	// running on the threads of its callers
+	Bindings *bindings;
+
+	size_t nnatives;
+	Native **natives;
+};
+
+// Sets err and returns NULL.
+static SchymValue *fail(char **err, char *msg) {
+	*err = msg;
+	return NULL;
+}
+
+// Returns the value of rr, copied so it shares nothing with the context.
+static SchymValue *result(RunResult rr, char **err) {
+	*err = NULL;
+	if (rr.err != NULL) {
+		return fail(err, rr.err);
+	}
+
+	RunResult res = isolate_transfer(rr.node);
+	node_free(rr.node);
+	if (res.err != NULL) {
+		return fail(err, res.err);
+	}
+	return VALUE(res.node);
+}
+
+// Writes what the code printed before control goes back to the host, whose
+// own output would come before it otherwise, or who may exit without
+// flushing.
+static RunResult flushed(RunResult rr) {
+	char *err = output_flush_all();
+	if (err != NULL && rr.err == NULL) {
+		node_free(rr.node);
+		rr = rr_err(err);
+	} else {
+		free(err);
+	}
+	return rr;
+}
+
+static RunResult call_native(Scope *scope, const char *name, size_t nargs, const Node **args) {
+	const Native *native = (const Native*)(name - offsetof(Native, name));
+
+	Node **vals = calloc(nargs, sizeof(Node*));
+	RunResult rr = rr_null();
+	for (size_t i = 0; i < nargs && rr.err == NULL; i++) {
+		rr = takeArg(scope, args[i]);
+		vals[i] = rr.node;
+	}
+
+	if (rr.err == NULL) {
+		char *err = NULL;
+		SchymValue *res = native->fn(native->data, nargs, (const SchymValue**)vals, &err);
+		rr = err != NULL ? rr_errf("%s: %s", native->name, err) : rr_node((Node*)res);
+		if (err != NULL) {
+			schym_value_free(res);
+			free(err);
+		}
+	}
+
+	for (size_t i = 0; i < nargs; i++) {
+		node_free(vals[i]);
+	}
+	free(vals);
+	return rr;
+}
+
+static void bind_native(SchymContext *ctx, const Native *native) {
+	Node *fn = malloc(1, sizeof(Node));
+	fn->type = AST_FUN;
+	fn->function.isBuiltin = true;
+	fn->function.fn = call_native;
+	fn->function.name = native->name;
+	fn->function.flags = BUILTIN_STRICT;
+	varmap_moveItem(ctx->root->variables, native->name, fn);
+}
+
+SchymImage *schym_image_make(size_t nlibs, const char *const *libs, char **err) {
+	return (SchymImage*)image_make(nlibs, libs, err);
+}
+
+SchymImage *schym_image_open(const char *path, char **err) {
+	return (SchymImage*)image_open(path, err);
+}
+
+void schym_image_save(SchymContext *ctx, const char *path, char **err) {
+	*err = image_save(ctx->root, path);
+}
+
+void schym_image_free(SchymImage *image) {
+	image_free((Image*)image);
+}
+
+SchymContext *schym_make(const SchymImage *image) {
+	SchymContext *ctx = malloc(1, sizeof(SchymContext));
+	ctx->image = IMAGE(image);
+	ctx->root = image_scope(ctx->image);
+	ctx->bindings = bindings_make();
+	ctx->nnatives = 0;
+	ctx->natives = NULL;
+	return ctx;
+}
+
+void schym_free(SchymContext *ctx) {
+	if (ctx == NULL) {
+		return;
+	}
+
+	Bindings *outer = bindings_swap(ctx->bindings);
+	scope_free(ctx->root);
+	bindings_swap(outer);
+	bindings_destroy(ctx->bindings);
+
+	for (size_t i = 0; i < ctx->nnatives; i++) {
+		free(ctx->natives[i]);
+	}
+	free(ctx->natives);
+	free(ctx);
+}
+
+void schym_reset(SchymContext *ctx) {
+	Bindings *outer = bindings_swap(ctx->bindings);
+	scope_free(ctx->root);
+	bindings_swap(outer);
+	bindings_destroy(ctx->bindings);
+
+	ctx->root = image_scope(ctx->image);
+	ctx->bindings = bindings_make();
+	outer = bindings_swap(ctx->bindings);
+	for (size_t i = 0; i < ctx->nnatives; i++) {
+		bind_native(ctx, ctx->natives[i]);
+	}
+	bindings_swap(outer);
+}
+
+SchymProgram *schym_parse(const char *src, char **err) {
+	*err = NULL;
+
+	ProgramParseResult parsed = parseprogram(src);
+	if (parsed.err != NULL) {
+		return (SchymProgram*)fail(err, rr_errf(
+			"%s at line %d col %d",
+			parsed.err,
+			parsed.errloc.line,
+			parsed.errloc.col
+		).err);
+	}
+
+	Program *program = malloc(1, sizeof(Program));
+	program->len = parsed.len;
+	program->nodes = parsed.nodes;
+	return (SchymProgram*)program;
+}
+
+void schym_program_free(SchymProgram *p) {
+	Program *program = (Program*)p;
+	if (program == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < program->len; i++) {
+		node_free(program->nodes[i]);
+	}
+	free(program->nodes);
+	free(program);
+}
+
+// Runs a copy of the program, which is optimized for the context.
+SchymValue *schym_run(SchymContext *ctx, const SchymProgram *p, char **err) {
+	const Program *program = (const Program*)p;
+	Node **nodes = malloc(program->len, sizeof(Node*));
+	for (size_t i = 0; i < program->len; i++) {
+		nodes[i] = node_copy(program->nodes[i]);
+	}
+
+	Bindings *outer = bindings_swap(ctx->bindings);
+	RunResult rr = flushed(runNodes(ctx->root, program->len, nodes, true));
+	SchymValue *res = result(rr, err);
+	bindings_swap(outer);
+	return res;
+}
+
+SchymValue *schym_eval(SchymContext *ctx, const char *src, char **err) {
+	SchymProgram *program = schym_parse(src, err);
+	if (program == NULL) {
+		return NULL;
+	}
+	SchymValue *res = schym_run(ctx, program, err);
+	schym_program_free(program);
+	return res;
+}
+
+void schym_define(SchymContext *ctx, const char *name, SchymFn fn, void *data) {
+	const size_t len = strlen(name);
+	Native *native = malloc(1, sizeof(Native) + len + 1);
+	native->fn = fn;
+	native->data = data;
+	memcpy(native->name, name, len + 1);
+
+	ctx->natives = realloc(ctx->natives, (ctx->nnatives + 1), sizeof(Native*));
+	ctx->natives[ctx->nnatives++] = native;
+
+	Bindings *outer = bindings_swap(ctx->bindings);
+	bind_native(ctx, native);
+	bindings_swap(outer);
+}
+
+void schym_set(SchymContext *ctx, const char *name, const SchymValue *val, char **err) {
+	*err = NULL;
+	RunResult rr = isolate_transfer(NODE(val));
+	if (rr.err != NULL) {
+		*err = rr.err;
+		return;
+	}
+
+	Bindings *outer = bindings_swap(ctx->bindings);
+	if (rr.node == NULL) {
+		varmap_removeItem(ctx->root->variables, name);
+	} else {
+		varmap_moveItem(ctx->root->variables, name, rr.node);
+	}
+	bindings_swap(outer);
+}
+
+SchymValue *schym_get(SchymContext *ctx, const char *name, char **err) {
+	Bindings *outer = bindings_swap(ctx->bindings);
+	char *lookupErr;
+	RunResult rr = rr_node(node_copy(findVar(ctx->root, name, &lookupErr)));
+	rr.err = lookupErr;
+	SchymValue *res = result(rr, err);
+	bindings_swap(outer);
+	return res;
+}
+
+SchymValue *schym_call(SchymContext *ctx, const SchymValue *fn, size_t nargs, const SchymValue **args, char **err) {
+	*err = NULL;
+
+	RunResult rr = isolate_transfer(NODE(fn));
+	if (rr.err != NULL) {
+		return fail(err, rr.err);
+	}
+	Node *f = rr.node;
+
+	Node **vals = calloc(nargs, sizeof(Node*));
+	for (size_t i = 0; i < nargs; i++) {
+		rr = isolate_transfer(NODE(args[i]));
+		if (rr.err != NULL) {
+			for (size_t j = 0; j < i; j++) {
+				node_free(vals[j]);
+			}
+			free(vals);
+			node_free(f);
+			return fail(err, rr.err);
+		}
+		vals[i] = rr.node;
+	}
+
+	Bindings *outer = bindings_swap(ctx->bindings);
+	SchymValue *res = result(flushed(callFunctionMoved(ctx->root, f, nargs, vals)), err);
+	bindings_swap(outer);
+
+	free(vals);
+	node_free(f);
+	return res;
+}
+
+SchymValue *schym_number(double val) {
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_NUM;
+	res->num.val = val;
+	return VALUE(res);
+}
+
+SchymValue *schym_string(const char *str, size_t len) {
+	Node *res = malloc(1, sizeof(Node));
+	res->type = AST_STR;
+	res->str.size = len;
+	res->str.str = malloc((len + 1), sizeof(char));
+	memcpy(res->str.str, str, len);
+	res->str.str[len] = '\0';
+	return VALUE(res);
+}
+
+SchymValue *schym_list(size_t len, SchymValue **items) {
+	Node *res = mkQuotedExpr(len);
+	for (size_t i = 0; i < len; i++) {
+		res->quoted.node->expr.nodes[i] = (Node*)items[i];
+	}
+	return VALUE(res);
+}
+
+SchymValue *schym_value_copy(const SchymValue *val) {
+	return VALUE(node_copy(NODE(val)));
+}
+
+void schym_value_free(SchymValue *val) {
+	node_free((Node*)val);
+}
+
+static const Expression *list(const SchymValue *val) {
+	const Node *node = NODE(val);
+	if (node == NULL || node->type != AST_QUOTED || node->quoted.node->type != AST_EXPR) {
+		return NULL;
+	}
+	return &node->quoted.node->expr;
+}
+
+SchymType schym_type(const SchymValue *val) {
+	const Node *node = NODE(val);
+	if (node == NULL) {
+		return SCHYM_NIL;
+	} else if (list(val) != NULL) {
+		return SCHYM_LIST;
+	}
+
+	switch (node->type) {
+	case AST_NUM:
+		return SCHYM_NUMBER;
+	case AST_STR:
+		return SCHYM_STRING;
+	case AST_FUN:
+		return SCHYM_FUNCTION;
+	default:
+		return SCHYM_OTHER;
+	}
+}
+
+double schym_to_number(const SchymValue *val) {
+	return schym_type(val) == SCHYM_NUMBER ? NODE(val)->num.val : 0;
+}
+
+const char *schym_to_string(const SchymValue *val, size_t *len) {
+	if (schym_type(val) != SCHYM_STRING) {
+		return NULL;
+	}
+	if (len != NULL) {
+		*len = NODE(val)->str.size;
+	}
+	return NODE(val)->str.str;
+}
+
+size_t schym_list_length(const SchymValue *val) {
+	const Expression *expr = list(val);
+	return expr == NULL ? 0 : expr->len;
+}
+
+const SchymValue *schym_list_item(const SchymValue *val, size_t i) {
+	const Expression *expr = list(val);
+	return expr == NULL || i >= expr->len ? NULL : VALUE(expr->nodes[i]);
+}
+
+char *schym_stringify(const SchymValue *val) {
+	return toString(NODE(val));
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+// The embedding API of libschym, the interpreter as a library: libschym.a and
+// libschym.so, see the Makefile. Nothing else in src/ is part of it, and the
+// shared library only exports what's declared here.
+//
+// A context is an interpreter with a root scope of its own. It starts from an
+// image, see image.h, so making one is cheap and a library loaded into the
+// image isn't loaded again for every context. Contexts can be reset and
+// reused, and different contexts can be used on different threads at the
+// same time, but a context is only used by one thread at a time.
+//
+// Values are owned by whoever gets them and freed with schym_value_free. They
+// don't belong to any context: values going in and out of one are copied, see
+// isolate_transfer.
+//
+// Errors are returned through err, which is set to a string the caller frees,
+// or to NULL if there's none.
+//
+// Files are loaded relative to the working directory, like with main.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the library is built with -fvisibility=hidden
+#pragma GCC visibility push(default)
+
+typedef struct SchymImage SchymImage;
+typedef struct SchymContext SchymContext;
+typedef struct SchymProgram SchymProgram;
+typedef struct SchymValue SchymValue;
+
+typedef enum SchymType {
+	SCHYM_NIL,
+	SCHYM_NUMBER,
+	SCHYM_STRING,
+	SCHYM_LIST,
+	SCHYM_FUNCTION,
+	// vectors, dicts, channels and the like, which can only be stringified
+	SCHYM_OTHER,
+} SchymType;
+
+// A native function. It gets the evaluated arguments, which it doesn't own,
+// and returns its result, which may be NULL for nil, or sets err to a string
+// that's freed for it. It may be called on any thread that code of the
+// context runs on, isolates included, until the context is freed.
+typedef SchymValue *(*SchymFn)(void *data, size_t nargs, const SchymValue **args, char **err);
+
+// Makes an image of the builtins and what loading the given libraries binds,
+// see image_make. It has to outlive the contexts made from it.
+SchymImage *schym_image_make(size_t nlibs, const char *const *libs, char **err);
+// Opens an image file saved by schym_image_save or main's --save-image.
+SchymImage *schym_image_open(const char *path, char **err);
+// Saves the variables of the context, and those of its image, to an image
+// file. Natives can't be saved.
+void schym_image_save(SchymContext*, const char *path, char **err);
+void schym_image_free(SchymImage*);
+
+// Makes a context that starts from the image, or from one with just the
+// builtins if it's NULL.
+SchymContext *schym_make(const SchymImage*);
+void schym_free(SchymContext*);
+// Forgets everything the context bound, except for its natives, as if it was
+// just made.
+void schym_reset(SchymContext*);
+
+// Evaluates the program in src and returns the value of its last expression.
+// What it printed has been written when it returns, like for schym_run and
+// schym_call.
+SchymValue *schym_eval(SchymContext*, const char *src, char **err);
+
+// Parses a program once, so it can be run many times, in any context.
+SchymProgram *schym_parse(const char *src, char **err);
+void schym_program_free(SchymProgram*);
+SchymValue *schym_run(SchymContext*, const SchymProgram*, char **err);
+
+// Binds name to a native function in the context, also after a reset.
+void schym_define(SchymContext*, const char *name, SchymFn fn, void *data);
+// Binds name to a copy of val in the context, nil removes the binding.
+void schym_set(SchymContext*, const char *name, const SchymValue *val, char **err);
+// Returns a copy of the value name is bound to in the context, NULL if none.
+SchymValue *schym_get(SchymContext*, const char *name, char **err);
+// Calls fn in the context with copies of the given values.
+SchymValue *schym_call(SchymContext*, const SchymValue *fn, size_t nargs, const SchymValue **args, char **err);
+
+SchymValue *schym_number(double);
+// Copies the len bytes of str.
+SchymValue *schym_string(const char *str, size_t len);
+// Consumes the items, but not the array.
+SchymValue *schym_list(size_t len, SchymValue **items);
+SchymValue *schym_value_copy(const SchymValue*);
+void schym_value_free(SchymValue*);
+
+SchymType schym_type(const SchymValue*);
+// 0 if it's not a number.
+double schym_to_number(const SchymValue*);
+// The bytes of a string, which belong to it, and their number, NULL if it's
+// not a string.
+const char *schym_to_string(const SchymValue*, size_t *len);
+// The length of a list and its items, which belong to it.
+size_t schym_list_length(const SchymValue*);
+const SchymValue *schym_list_item(const SchymValue*, size_t);
+// What print would print for the value, which the caller frees.
+char *schym_stringify(const SchymValue*);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
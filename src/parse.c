@@ -6,7 +6,17 @@
 #include "ast.h"
 #include "util.h"
 #include "stringify.h"
+#include "vector.h"
+#include "f64array.h"
+#include "dict.h"
+#include "channel.h"
 #include "interpreter/interpreter.h"
+#include "interpreter/frames.h"
+#include "interpreter/future.h"
+#include "interpreter/compile.h"
+#include "interpreter/coro.h"
+#include "interpreter/jit.h"
+#include "interpreter/memo.h"
 
 static Node *make_node(ASTtype type) {
 	Node *res = malloc(1, sizeof(Node));
@@ -148,7 +158,12 @@ static ParseResult parsestring(const char **codep) {
 		char c;
 
 		if (*code == '\\') {
-			c = '"';
+			// \n and \t, otherwise the escaped character itself, like \"
+			switch (code[1]) {
+			case 'n': c = '\n'; break;
+			case 't': c = '\t'; break;
+			default: c = code[1]; break;
+			}
 			code += 2;
 		} else {
 			c = *code;
@@ -438,16 +453,33 @@ void node_free(Node *node) {
 	}
 	case AST_FUN: {
 		if (!node->function.isBuiltin) {
-			Function *fn = &node->function;
-			node_free(fn->body);
-			for (size_t i = 0; i < fn->args.len; i++) {
-				node_free(fn->args.nodes[i]);
-			}
-			scope_free(fn->scope);
+			lambda_release(node->function.lambda);
 		}
 		break;
 	}
+	case AST_VECTOR:
+		vector_release(node->vector);
+		break;
+	case AST_ARRAY:
+		f64_release(node->array);
+		break;
+	case AST_DICT:
+		dict_release(node->dict);
+		break;
+	case AST_GENERATOR:
+		generator_release(node->generator);
+		break;
+	case AST_CHANNEL:
+		chan_release(node->channel);
+		break;
+	case AST_FUTURE:
+		future_release(node->future);
+		break;
+	case AST_COROUTINE:
+		coro_release(node->coroutine);
+		break;
 	case AST_NUM:
+	case AST_RANGE:
 		break;
 	}
 
@@ -500,12 +532,67 @@ Node *node_copy(const Node *src) {
 		res->function.isBuiltin = src->function.isBuiltin;
 		if (src->function.isBuiltin) {
 			res->function.fn = src->function.fn;
+			res->function.name = src->function.name;
+			res->function.flags = src->function.flags;
 		} else {
-			res->function.args = src->function.args; // REVIEW
-			res->function.body = node_copy(src->function.body);
-			res->function.scope = scope_copy(src->function.scope);
+			res->function.lambda = lambda_retain(src->function.lambda);
 		}
+		break;
+
+	case AST_VECTOR:
+		res->vector = vector_retain(src->vector);
+		break;
+
+	case AST_ARRAY:
+		res->array = f64_retain(src->array);
+		break;
+
+	case AST_DICT:
+		res->dict = dict_retain(src->dict);
+		break;
+
+	case AST_GENERATOR:
+		res->generator = generator_retain(src->generator);
+		break;
+
+	case AST_RANGE:
+		res->range = src->range;
+		break;
+
+	case AST_CHANNEL:
+		res->channel = chan_retain(src->channel);
+		break;
+
+	case AST_FUTURE:
+		res->future = future_retain(src->future);
+		break;
+
+	case AST_COROUTINE:
+		res->coroutine = coro_retain(src->coroutine);
+		break;
 	}
 
 	return res;
 }
+
+Lambda *lambda_retain(Lambda *lambda) {
+	lambda->refs++;
+	return lambda;
+}
+
+void lambda_release(Lambda *lambda) {
+	if (lambda == NULL || --lambda->refs > 0) {
+		return;
+	}
+
+	node_free(lambda->body);
+	for (size_t i = 0; i < lambda->args.len; i++) {
+		node_free(lambda->args.nodes[i]);
+	}
+	free(lambda->args.nodes);
+	scope_free(lambda->scope);
+	code_free(lambda->code);
+	jit_free(lambda->jit);
+	memo_free(lambda->memo);
+	free(lambda);
+}
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "serve.h"
+#include "util.h"
+
+// A request is this header, with the client's stdin, stdout and stderr
+// attached, followed by the working directory and the program or its path.
+typedef struct Header {
+	uint32_t isFile;
+	uint32_t cwdLen;
+	uint32_t len;
+} Header;
+
+// The largest working directory and program the server accepts.
+#define MAX_REQUEST (1u << 30)
+
+static bool read_all(int fd, void *buf, size_t len) {
+	char *p = buf;
+	while (len > 0) {
+		const ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool send_all(int fd, const void *buf, size_t len) {
+	const char *p = buf;
+	while (len > 0) {
+		const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool make_addr(const char *path, struct sockaddr_un *addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "the socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+// Reads a string of len bytes.
+static char *read_string(int fd, uint32_t len) {
+	char *res = malloc((len + 1), sizeof(char));
+	if (!read_all(fd, res, len)) {
+		free(res);
+		return NULL;
+	}
+	res[len] = '\0';
+	return res;
+}
+
+// Reads a request, with the streams that come with it.
+static bool receive(int conn, Header *hdr, int fds[3], char **cwd, char **src) {
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec iov = { .iov_base = hdr, .iov_len = sizeof(Header) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+
+	ssize_t n;
+	do {
+		n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+
+	const struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (
+		cmsg == NULL ||
+		cmsg->cmsg_level != SOL_SOCKET ||
+		cmsg->cmsg_type != SCM_RIGHTS ||
+		cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))
+	) {
+		return false;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+	if (
+		!read_all(conn, (char*)hdr + n, sizeof(Header) - n) ||
+		hdr->cwdLen > MAX_REQUEST || hdr->len > MAX_REQUEST ||
+		(*cwd = read_string(conn, hdr->cwdLen)) == NULL
+	) {
+		return false;
+	} else if ((*src = read_string(conn, hdr->len)) == NULL) {
+		free(*cwd);
+		return false;
+	}
+	return true;
+}
+
+// Runs the request in the fork that's going to exit with its status.
+static void work(const Header *hdr, const int fds[3], const char *cwd, char *src, ServeFn run, void *ctx) {
+	for (int i = 0; i < 3; i++) {
+		dup2(fds[i], i);
+		close(fds[i]);
+	}
+
+	int status = 1;
+	if (chdir(cwd) != 0) {
+		fprintf(stderr, "couldn't go to %s: %s\n", cwd, strerror(errno));
+	} else if (hdr->isFile) {
+		char *code = readfile(src);
+		if (code == NULL) {
+			fprintf(stderr, "couldn't read file: '%s'\n", src);
+		} else {
+			status = run(ctx, code);
+		}
+	} else {
+		status = run(ctx, src);
+		src = NULL;
+	}
+
+	free(src);
+	fflush(stdout);
+	fflush(stderr);
+	_exit(status);
+}
+
+// Handles a connection in a fork of the server: runs the request in a fork of
+// its own, so the status can be sent even if the program crashes.
+static void handle(int conn, ServeFn run, void *ctx) {
+	Header hdr;
+	int fds[3];
+	char *cwd, *src;
+	if (!receive(conn, &hdr, fds, &cwd, &src)) {
+		_exit(1);
+	}
+
+	signal(SIGCHLD, SIG_DFL);
+	const pid_t pid = fork();
+	if (pid == 0) {
+		close(conn);
+		work(&hdr, fds, cwd, src, run, ctx);
+	}
+
+	int32_t code = 1;
+	if (pid > 0) {
+		int status = 0;
+		pid_t waited;
+		while ((waited = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {}
+		if (waited == pid) {
+			code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		} else {
+			dprintf(fds[2], "couldn't wait for the program: %s\n", strerror(errno));
+		}
+	} else {
+		dprintf(fds[2], "couldn't start the program: %s\n", strerror(errno));
+	}
+	send_all(conn, &code, sizeof(code));
+	_exit(0);
+}
+
+// Whether the peer on conn runs as the same user as the server. This is
+// checked on top of the mode of the socket, which not every system enforces.
+static bool same_user(int conn) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+}
+
+int serve(const char *path, ServeFn run, void *ctx) {
+	struct sockaddr_un addr;
+	if (!make_addr(path, &addr)) {
+		return 1;
+	}
+
+	// only a socket is replaced, never a file that happens to be there
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+
+	// whoever can connect can run code as the server's user, so the socket is
+	// made 0600 from the start
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	const mode_t mask = umask(0177);
+	const bool bound = fd >= 0 && bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+	umask(mask);
+	if (!bound || listen(fd, SOMAXCONN) != 0) {
+		fprintf(stderr, "couldn't listen on %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	// the handlers are reaped by the kernel
+	signal(SIGCHLD, SIG_IGN);
+	for (;;) {
+		const int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			fprintf(stderr, "couldn't accept on %s: %s\n", path, strerror(errno));
+			return 1;
+		} else if (!same_user(conn)) {
+			fprintf(stderr, "refused a connection from another user\n");
+			close(conn);
+			continue;
+		}
+
+		// or the forks would write what's buffered too
+		fflush(NULL);
+		const pid_t pid = fork();
+		if (pid == 0) {
+			close(fd);
+			handle(conn, run, ctx);
+		} else if (pid < 0) {
+			fprintf(stderr, "couldn't fork: %s\n", strerror(errno));
+		}
+		close(conn);
+	}
+}
+
+int serve_connect(const char *path, const char *src, bool isFile) {
+	struct sockaddr_un addr;
+	if (!make_addr(path, &addr)) {
+		return 1;
+	}
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "couldn't connect to %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	char *cwd = getcwd(NULL, 0);
+	if (cwd == NULL) {
+		fprintf(stderr, "couldn't get the working directory: %s\n", strerror(errno));
+		return 1;
+	}
+
+	Header hdr = { .isFile = isFile, .cwdLen = strlen(cwd), .len = strlen(src) };
+	const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t n;
+	do {
+		n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+
+	int32_t code;
+	const bool ok = (
+		n >= 0 &&
+		send_all(fd, (char*)&hdr + n, sizeof(hdr) - n) &&
+		send_all(fd, cwd, hdr.cwdLen) &&
+		send_all(fd, src, hdr.len) &&
+		read_all(fd, &code, sizeof(code))
+	);
+	free(cwd);
+	close(fd);
+	if (!ok) {
+		fprintf(stderr, "lost the connection to %s\n", path);
+		return 1;
+	}
+	return code;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+
+// A server that keeps an interpreter warm for many short programs, and the
+// client for it. The server listens on a Unix socket and forks itself for
+// every program it gets, so each one starts from a copy of the server's root
+// scope and image, with the loaded libraries and the parsed code, that costs
+// a fork instead of a start.
+//
+// The client sends its standard streams along with the program, and the
+// program uses them as its own, so its output goes where the client's would
+// and it can read the client's input. It runs in the working directory of the
+// client. The client exits with the exit status of the program, which is
+// 128 plus the number of the signal if one killed it.
+
+// Runs a program that's been received, like main would, and returns its exit
+// status. It's called in a fork of the server. Consumes src.
+typedef int (*ServeFn)(void *ctx, char *src);
+
+// Serves programs on a socket at path, replacing the socket that's there. Only
+// the user the server runs as can connect.
+// Only returns, with an exit status, if it fails.
+//
+// The server mustn't have started any threads, like the workers of pmap or
+// futures, since its forks only have the thread that forked.
+int serve(const char *path, ServeFn run, void *ctx);
+
+// Runs the program src, or the file at the path src if isFile, on the server
+// at path, and returns its exit status.
+int serve_connect(const char *path, const char *src, bool isFile);
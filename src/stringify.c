@@ -3,6 +3,9 @@
 #include <assert.h>
 
 #include "stringify.h"
+#include "vector.h"
+#include "f64array.h"
+#include "dict.h"
 #include "util.h"
 
 char *typetostr(const Node *node) {
@@ -18,6 +21,14 @@ char *typetostr(const Node *node) {
 	case AST_NUM: return "number";
 	case AST_COMMENT: return "comment";
 	case AST_FUN: return "function";
+	case AST_VECTOR: return "vector";
+	case AST_ARRAY: return "f64 array";
+	case AST_DICT: return node->dict != NULL && dict_is_mutable(node->dict) ? "mutable dict" : "dict";
+	case AST_GENERATOR: return "generator";
+	case AST_RANGE: return "range";
+	case AST_CHANNEL: return "channel";
+	case AST_FUTURE: return "future";
+	case AST_COROUTINE: return "coroutine";
 
 	default: return "UNKNOWN";
 	}
@@ -92,8 +103,8 @@ char *stringify(const Node *node, int lvl) {
 		if (node->function.isBuiltin) {
 			strappend(&res, "[ builtin function ]");
 		} else {
-			const Expression *args = &node->function.args;
-			Node *body = node->function.body;
+			const Expression *args = &node->function.lambda->args;
+			Node *body = node->function.lambda->body;
 
 			strappend(&res, "(fun ");
 
@@ -109,6 +120,85 @@ char *stringify(const Node *node, int lvl) {
 		}
 		break;
 	}
+
+	case AST_VECTOR: {
+		strappend(&res, "#(");
+		size_t len = vector_length(node->vector);
+		for (size_t i = 0; i < len; i++) {
+			if (i != 0) {
+				strappend(&res, " ");
+			}
+			char *str = stringify(vector_get(node->vector, i), lvl);
+			strappend(&res, str);
+			free(str);
+		}
+		strappend(&res, ")");
+		break;
+	}
+
+	case AST_ARRAY: {
+		strappend(&res, "#f64(");
+		for (size_t i = 0; i < node->array->len; i++) {
+			char *buf;
+			asprintf(&buf, i == 0 ? "%g" : " %g", node->array->data[i]);
+			assert(buf);
+			strappend(&res, buf);
+			free(buf);
+		}
+		strappend(&res, ")");
+		break;
+	}
+
+	case AST_DICT: {
+		// {key value, key value}, prefixed with a # for mutable dicts
+		strappend(&res, dict_is_mutable(node->dict) ? "#{" : "{");
+		DictIter it;
+		dict_iter_init(&it, node->dict);
+		const Node *key, *val;
+		bool first = true;
+		while (dict_iter_next(&it, &key, &val)) {
+			if (!first) {
+				strappend(&res, ", ");
+			}
+			first = false;
+
+			char *str = stringify(key, lvl);
+			strappend(&res, str);
+			free(str);
+			strappend(&res, " ");
+			str = val == NULL ? astrcpy("nil") : stringify(val, lvl);
+			strappend(&res, str);
+			free(str);
+		}
+		strappend(&res, "}");
+		break;
+	}
+
+	case AST_GENERATOR:
+		strappend(&res, "[ generator ]");
+		break;
+
+	case AST_CHANNEL:
+		strappend(&res, "[ channel ]");
+		break;
+
+	case AST_FUTURE:
+		strappend(&res, "[ future ]");
+		break;
+
+	case AST_COROUTINE:
+		strappend(&res, "[ coroutine ]");
+		break;
+
+	case AST_RANGE: {
+		const Range *r = &node->range;
+		char *buf;
+		asprintf(&buf, "(range %g %g %g)", r->from, r->from + r->len * r->step, r->step);
+		assert(buf);
+		strappend(&res, buf);
+		free(buf);
+		break;
+	}
 	}
 
 	return res;
@@ -0,0 +1,255 @@
+#include <assert.h>
+#include "vector.h"
+#include "util.h"
+
+#define BITS 5
+#define WIDTH (1 << BITS)
+#define MASK (WIDTH - 1)
+
+// A trie node. On the leaf level the slots are Node*, on every other level
+// they are VNode*.
+typedef struct VNode {
+	size_t refs;
+	void *slots[WIDTH];
+} VNode;
+
+struct Vector {
+	size_t refs;
+	size_t len;
+	unsigned shift;
+	VNode *root;
+	VNode *tail;
+};
+
+static VNode *vnode_make(void) {
+	VNode *res = calloc(1, sizeof(VNode));
+	assert(res);
+	res->refs = 1;
+	return res;
+}
+
+static VNode *vnode_retain(VNode *node) {
+	if (node != NULL) {
+		node->refs++;
+	}
+	return node;
+}
+
+static void vnode_release(VNode *node, unsigned level) {
+	if (node == NULL || --node->refs > 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < WIDTH; i++) {
+		if (level == 0) {
+			node_free(node->slots[i]);
+		} else {
+			vnode_release(node->slots[i], level - BITS);
+		}
+	}
+	free(node);
+}
+
+// Copies the given node, retaining every child so both copies own them.
+static VNode *vnode_clone(const VNode *node, unsigned level) {
+	VNode *res = vnode_make();
+	if (node == NULL) {
+		return res;
+	}
+
+	for (size_t i = 0; i < WIDTH; i++) {
+		if (node->slots[i] == NULL) {
+			continue;
+		}
+
+		if (level == 0) {
+			res->slots[i] = node_copy(node->slots[i]);
+		} else {
+			res->slots[i] = vnode_retain(node->slots[i]);
+		}
+	}
+	return res;
+}
+
+static Vector *vector_alloc(void) {
+	Vector *res = malloc(1, sizeof(Vector));
+	assert(res);
+	res->refs = 1;
+	res->len = 0;
+	res->shift = BITS;
+	res->root = vnode_make();
+	res->tail = vnode_make();
+	return res;
+}
+
+static size_t tailoff(const Vector *vec) {
+	if (vec->len < WIDTH) {
+		return 0;
+	}
+	return ((vec->len - 1) >> BITS) << BITS;
+}
+
+Vector *vector_make(void) {
+	return vector_alloc();
+}
+
+Vector *vector_retain(Vector *vec) {
+	vec->refs++;
+	return vec;
+}
+
+void vector_release(Vector *vec) {
+	if (vec == NULL || --vec->refs > 0) {
+		return;
+	}
+
+	vnode_release(vec->root, vec->shift);
+	vnode_release(vec->tail, 0);
+	free(vec);
+}
+
+size_t vector_length(const Vector *vec) {
+	return vec->len;
+}
+
+// Returns the leaf that holds the item at index i.
+static const VNode *leaf_for(const Vector *vec, size_t i) {
+	if (i >= tailoff(vec)) {
+		return vec->tail;
+	}
+
+	const VNode *node = vec->root;
+	for (unsigned level = vec->shift; level > 0; level -= BITS) {
+		node = node->slots[(i >> level) & MASK];
+	}
+	return node;
+}
+
+const Node *vector_get(const Vector *vec, size_t i) {
+	assert(i < vec->len);
+	return leaf_for(vec, i)->slots[i & MASK];
+}
+
+static Vector *vector_dup(const Vector *vec) {
+	Vector *res = malloc(1, sizeof(Vector));
+	assert(res);
+	res->refs = 1;
+	res->len = vec->len;
+	res->shift = vec->shift;
+	res->root = vnode_retain(vec->root);
+	res->tail = vnode_retain(vec->tail);
+	return res;
+}
+
+// Pushes the given full leaf into the trie under parent, path copying the
+// nodes on the way down.
+static VNode *push_leaf(size_t len, unsigned level, const VNode *parent, VNode *leaf) {
+	VNode *res = vnode_clone(parent, level);
+	size_t subidx = ((len - 1) >> level) & MASK;
+
+	if (level == BITS) {
+		res->slots[subidx] = leaf;
+	} else {
+		VNode *child = res->slots[subidx];
+		res->slots[subidx] = push_leaf(len, level - BITS, child, leaf);
+		vnode_release(child, level - BITS);
+	}
+	return res;
+}
+
+// Moves the full tail of vec into the trie and leaves vec with an empty tail.
+// vec must not be shared yet.
+static void push_tail(Vector *vec) {
+	VNode *leaf = vec->tail;
+	VNode *root;
+
+	if ((vec->len >> BITS) > ((size_t)1 << vec->shift)) {
+		// root overflow, grow the trie by one level
+		root = vnode_make();
+		root->slots[0] = vnode_retain(vec->root);
+
+		VNode *path = leaf;
+		for (unsigned level = vec->shift; level > 0; level -= BITS) {
+			VNode *node = vnode_make();
+			node->slots[0] = path;
+			path = node;
+		}
+		root->slots[1] = path;
+
+		vnode_release(vec->root, vec->shift);
+		vec->shift += BITS;
+	} else {
+		root = push_leaf(vec->len, vec->shift, vec->root, leaf);
+		vnode_release(vec->root, vec->shift);
+	}
+
+	vec->root = root;
+	vec->tail = vnode_make();
+}
+
+Vector *vector_push(const Vector *vec, Node *node) {
+	Vector *res = vector_dup(vec);
+	size_t intail = vec->len - tailoff(vec);
+
+	if (intail == WIDTH) {
+		push_tail(res);
+		intail = 0;
+	} else {
+		vnode_release(res->tail, 0);
+		res->tail = vnode_clone(vec->tail, 0);
+	}
+
+	res->tail->slots[intail] = node;
+	res->len++;
+	return res;
+}
+
+static VNode *assoc(unsigned level, const VNode *node, size_t i, Node *val) {
+	VNode *res = vnode_clone(node, level);
+
+	if (level == 0) {
+		node_free(res->slots[i & MASK]);
+		res->slots[i & MASK] = val;
+	} else {
+		size_t subidx = (i >> level) & MASK;
+		VNode *child = res->slots[subidx];
+		res->slots[subidx] = assoc(level - BITS, child, i, val);
+		vnode_release(child, level - BITS);
+	}
+	return res;
+}
+
+Vector *vector_set(const Vector *vec, size_t i, Node *node) {
+	assert(i < vec->len);
+	Vector *res = vector_dup(vec);
+
+	if (i >= tailoff(vec)) {
+		vnode_release(res->tail, 0);
+		res->tail = assoc(0, vec->tail, i, node);
+	} else {
+		vnode_release(res->root, vec->shift);
+		res->root = assoc(vec->shift, vec->root, i, node);
+	}
+
+	return res;
+}
+
+Vector *vector_from_array(const Node **nodes, size_t len) {
+	// Nothing else can see the vector while it's being built, so instead of
+	// path copying for every item, whole leaves are filled in place.
+	Vector *res = vector_alloc();
+
+	for (size_t i = 0; i < len; i += WIDTH) {
+		if (i != 0) {
+			push_tail(res);
+		}
+
+		size_t n = len - i < WIDTH ? len - i : WIDTH;
+		for (size_t j = 0; j < n; j++) {
+			res->tail->slots[j] = node_copy(nodes[i + j]);
+		}
+		res->len += n;
+	}
+
+	return res;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "ast.h"
+
+// Persistent vector: a 32-way trie with a tail buffer, in the style of
+// Clojure's PersistentVector. Every update returns a new vector that shares
+// all untouched trie nodes with the original, so ref, set and push are
+// O(log32 n), which is effectively constant.
+//
+// Vectors are reference counted. The stored nodes are owned by the vector and
+// must never be mutated; copy them before handing them out.
+
+typedef struct Vector Vector;
+
+Vector *vector_make(void);
+Vector *vector_retain(Vector*);
+void vector_release(Vector*);
+
+size_t vector_length(const Vector*);
+const Node *vector_get(const Vector*, size_t);
+
+// These take ownership of the given node and return a new vector.
+Vector *vector_push(const Vector*, Node*);
+Vector *vector_set(const Vector*, size_t, Node*);
+
+// Builds a vector from copies of the given nodes.
+Vector *vector_from_array(const Node**, size_t);
@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include "watchers.h"
+#include "util.h"
+
+void watchers_init(Watchers *w, pthread_mutex_t *lock) {
+	w->lock = lock;
+	atomic_init(&w->len, 0);
+	w->cap = 0;
+	w->fds = NULL;
+}
+
+void watchers_free(Watchers *w) {
+	free(w->fds);
+}
+
+void watchers_add(Watchers *w, int fd) {
+	pthread_mutex_lock(w->lock);
+	const size_t len = atomic_load_explicit(&w->len, memory_order_relaxed);
+	if (len == w->cap) {
+		w->cap = w->cap == 0 ? 4 : w->cap * 2;
+		w->fds = realloc(w->fds, w->cap, sizeof(int));
+	}
+	w->fds[len] = fd;
+	// pairs with the fence of whoever notifies, like the waiting counts of
+	// channels
+	atomic_store(&w->len, len + 1);
+	pthread_mutex_unlock(w->lock);
+}
+
+void watchers_remove(Watchers *w, int fd) {
+	pthread_mutex_lock(w->lock);
+	const size_t len = atomic_load_explicit(&w->len, memory_order_relaxed);
+	for (size_t i = 0; i < len; i++) {
+		if (w->fds[i] == fd) {
+			w->fds[i] = w->fds[len - 1];
+			atomic_store(&w->len, len - 1);
+			break;
+		}
+	}
+	pthread_mutex_unlock(w->lock);
+}
+
+void watchers_notify(Watchers *w) {
+	const uint64_t one = 1;
+	const size_t len = atomic_load_explicit(&w->len, memory_order_relaxed);
+	for (size_t i = 0; i < len; i++) {
+		// an eventfd only fails to add one if it's about to overflow, and then
+		// it's readable anyway
+		ssize_t n = write(w->fds[i], &one, sizeof(one));
+		(void)n;
+	}
+}
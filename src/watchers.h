@@ -0,0 +1,31 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// The descriptors to write to when something that other threads wait for
+// changes, like a channel or a future. A thread that runs coroutines can't
+// block on a condition variable, since the other coroutines wouldn't run, so
+// it waits for an eventfd with the rest of its event loop instead, see
+// coro_wait.
+//
+// The list belongs to what it's in, whose lock guards it.
+typedef struct Watchers {
+	pthread_mutex_t *lock;
+	// read without the lock, to see whether anyone is watching
+	atomic_size_t len;
+	size_t cap;
+	int *fds;
+} Watchers;
+
+void watchers_init(Watchers*, pthread_mutex_t *lock);
+void watchers_free(Watchers*);
+
+// Take the lock. A descriptor can be added more than once, and is removed as
+// many times.
+void watchers_add(Watchers*, int fd);
+void watchers_remove(Watchers*, int fd);
+
+// Adds one to the eventfds, with the lock held.
+void watchers_notify(Watchers*);
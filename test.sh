@@ -4,7 +4,9 @@ errored=0
 
 for f in ./test/*.schym; do
 	echo "running $(basename $f)"
-	./main $f &>/dev/null
+	# a first line like ";; flags: --heap-frames" passes flags to main
+	flags=$(sed -n '1s/^;; flags: //p' $f)
+	./main $flags $f &>/dev/null
 	if [[ $? -ne 0 ]]; then
 		printf "\tERR\t(error code is $?)\n"
 		errored=1
@@ -13,6 +15,154 @@ for f in ./test/*.schym; do
 	fi
 done
 
+# yield outside of a generator fails the same way in both evaluators
+echo "running yield"
+msg="yield can only be used in a generator"
+if [[ $(./main -e '(yield 1)' 2>&1) == *"$msg"* ]] &&
+	[[ $(./main --heap-frames -e '(do (yield 1))' 2>&1) == *"$msg"* ]]; then
+	printf "\tOK\n"
+else
+	printf "\tERR\n"
+	errored=1
+fi
+
+# assert on nil is an error, not a crash
+echo "running assert"
+if [[ $(./main -e '(assert nil)' 2>&1) == *"expected cond"* ]]; then
+	printf "\tOK\n"
+else
+	printf "\tERR\n"
+	errored=1
+fi
+
+# printing to descriptors that aren't open fails, and nothing printed to a
+# closed one ends up in the file opened next, while write errors of what's
+# buffered fail the program
+echo "running output"
+out=$(mktemp /tmp/schym-test.XXXXXX)
+if ! ./main -e "(set f (open-output \"$out\")) (close f) (print-to f 1)" &>/dev/null &&
+	./main -e "(set f (open-output \"$out\")) (close f) (go (fun () (print-to f \"stale\")))
+		(sleep 0.01) (set g (open-output \"$out\")) (print-to g \"new\") (close g)" &>/dev/null &&
+	[[ $(cat $out) == new ]] &&
+	[[ $(./main -e '(print-to 100000000 1)' 2>&1) == *"isn't open"* ]] &&
+	[[ $(./main -e '(print 1)' 2>&1 >/dev/full) == *"No space left"* ]] &&
+	! ./main -e '(print 1)' &>/dev/full; then
+	printf "\tOK\n"
+else
+	printf "\tERR\n"
+	errored=1
+fi
+rm -f $out
+
+# every kernel implementation gives the same results
+echo "running f64 kernels"
+ok=1
+for simd in scalar sse2 avx2; do
+	SCHYM_SIMD=$simd ./main test/f64.schym &>/dev/null || ok=0
+done
+if [[ $ok -eq 1 ]]; then
+	printf "\tOK\n"
+else
+	printf "\tERR\n"
+	errored=1
+fi
+
+# the embedding API, built by make test
+if [[ -x ./test/embed ]]; then
+	echo "running embed"
+	if ./test/embed &>/dev/null; then
+		printf "\tOK\n"
+	else
+		printf "\tERR\n"
+		errored=1
+	fi
+fi
+
+# the shared library exports the functions of the embedding API and nothing
+# else, which could clash with what the program that loads it defines
+if [[ -f ./libschym.so ]]; then
+	echo "running exports"
+	exports=$(nm -D --defined-only ./libschym.so | awk '{ print $3 }')
+	if [[ $(grep -c '^schym_' <<< "$exports") -gt 0 ]] &&
+		! grep -qv '^schym_' <<< "$exports"; then
+		printf "\tOK\n"
+	else
+		printf "\tERR\n"
+		errored=1
+	fi
+fi
+
+# images saved and opened again. Variables are only read when they're used,
+# so a broken one doesn't keep the others from working but fails where it's
+# used, while a file that's truncated or isn't an image is rejected when it's
+# opened
+echo "running image"
+image=$(mktemp /tmp/schym-test.XXXXXX)
+./main --save-image $image -e '(set twice (x) (* x 2)) (set table (list 1 (list 2 "three")))
+	(set broken "a broken string")' &>/dev/null
+out=$(./main --image $image -e '(print (twice (car table)) (cadr table))' 2>&1)
+# a length that runs past the end of the file, in front of the broken string
+offset=$(grep -obUa "a broken string" $image | cut -d: -f1)
+printf '\xff%.0s' {1..8} | dd of=$image bs=1 seek=$((offset - 8)) conv=notrunc status=none
+head -c -1 $image > $image.short
+if [[ $out == "2 '(2 \"three\")" ]] &&
+	[[ $(./main --image $image -e '(print (twice 2))' 2>&1) == 4 ]] &&
+	[[ $(./main --image $image -e '(print broken)' 2>&1) == *"couldn't read broken"* ]] &&
+	! ./main --image $image -e '(print broken)' &>/dev/null &&
+	[[ $(./main --image $image.short -e '(print 1)' 2>&1) == *"isn't an image"* ]] &&
+	printf 'x' | dd of=$image bs=1 conv=notrunc status=none &&
+	! ./main --image $image -e '(print 1)' &>/dev/null; then
+	printf "\tOK\n"
+else
+	printf "\tERR\n"
+	errored=1
+fi
+rm -f $image $image.short
+
+# a server, and its clients: a program, a file, and one that fails
+echo "running serve"
+socket=$(mktemp -u /tmp/schym-test.XXXXXX)
+./main --base prelude/lists --serve $socket -e '(set twice (x) (* x 2))' &>/dev/null &
+server=$!
+for i in $(seq 50); do
+	[[ -S $socket ]] && break
+	sleep 0.1
+done
+if [[ $(stat -c %a $socket) == 600 ]] &&
+	[[ $(./main --connect $socket -e '(print (twice (not 0)))' 2>&1) == 2 ]] &&
+	./main --connect $socket test/let.schym &>/dev/null &&
+	! ./main --connect $socket -e '(twice (fail))' &>/dev/null; then
+	printf "\tOK\n"
+else
+	printf "\tERR\n"
+	errored=1
+fi
+kill $server
+rm -f $socket
+
+# a server started from an image keeps reading the variables it hasn't used
+# yet from the image it opened, also when the file is saved again
+echo "running serve image"
+image=$(mktemp /tmp/schym-test.XXXXXX)
+socket=$(mktemp -u /tmp/schym-test.XXXXXX)
+./main --save-image $image -e '(set a 1) (set b "before")' &>/dev/null
+./main --image $image --serve $socket -e '(set c a)' &>/dev/null &
+server=$!
+for i in $(seq 50); do
+	[[ -S $socket ]] && break
+	sleep 0.1
+done
+./main --save-image $image -e '(set b "after")' &>/dev/null
+if [[ $(./main --connect $socket -e '(print b c)' 2>&1) == "before 1" ]] &&
+	[[ $(./main --image $image -e '(print b)' 2>&1) == after ]]; then
+	printf "\tOK\n"
+else
+	printf "\tERR\n"
+	errored=1
+fi
+kill $server
+rm -f $socket $image
+
 if [[ $errored -ne 0 ]]; then
 	exit 1
 fi
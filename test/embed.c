@@ -0,0 +1,169 @@
+// Runs scripts through libschym, see src/libschym.h, like a program that
+// embeds the interpreter would.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/libschym.h"
+
+// Like assert, but what it checks is always evaluated, also with NDEBUG, as
+// the checks here are mostly calls.
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1); \
+	} \
+} while (0)
+
+static SchymValue *eval(SchymContext *ctx, const char *src) {
+	char *err;
+	SchymValue *res = schym_eval(ctx, src, &err);
+	if (err != NULL) {
+		fprintf(stderr, "%s: %s\n", src, err);
+		exit(1);
+	}
+	return res;
+}
+
+static double eval_number(SchymContext *ctx, const char *src) {
+	SchymValue *val = eval(ctx, src);
+	CHECK(schym_type(val) == SCHYM_NUMBER);
+	const double res = schym_to_number(val);
+	schym_value_free(val);
+	return res;
+}
+
+// (sum list) adds the numbers in the list, the counter given as data counts
+// the calls
+static SchymValue *sum(void *data, size_t nargs, const SchymValue **args, char **err) {
+	(*(int*)data)++;
+	if (nargs != 1 || schym_type(args[0]) != SCHYM_LIST) {
+		const char msg[] = "expected a list";
+		*err = malloc(sizeof(msg));
+		memcpy(*err, msg, sizeof(msg));
+		return NULL;
+	}
+
+	double res = 0;
+	for (size_t i = 0; i < schym_list_length(args[0]); i++) {
+		res += schym_to_number(schym_list_item(args[0], i));
+	}
+	return schym_number(res);
+}
+
+int main(void) {
+	char *err;
+
+	// contexts start from an image with the libraries loaded once
+	const char *libs[] = { "prelude/lists" };
+	SchymImage *image = schym_image_make(1, libs, &err);
+	CHECK(image != NULL && err == NULL);
+	SchymContext *ctx = schym_make(image);
+
+	CHECK(eval_number(ctx, "(+ 1 2)") == 3);
+	CHECK(eval_number(ctx, "(not 0)") == 1);
+	CHECK(eval(ctx, "(set x 5)") == NULL);
+	CHECK(eval_number(ctx, "(* x 2)") == 10);
+
+	// values going in and out
+	SchymValue *items[] = { schym_number(1), schym_number(2), schym_string("three", 5) };
+	// the list takes the items, so they're freed with it
+	SchymValue *list = schym_list(3, items);
+	schym_set(ctx, "xs", list, &err);
+	CHECK(err == NULL);
+	schym_value_free(list);
+	CHECK(eval_number(ctx, "(length xs)") == 3);
+
+	SchymValue *str = eval(ctx, "(concat \"a\" \"b\")");
+	size_t len;
+	CHECK(strcmp(schym_to_string(str, &len), "ab") == 0 && len == 2);
+	schym_value_free(str);
+
+	SchymValue *fn = eval(ctx, "(fun (a b) (+ a b x))");
+	CHECK(schym_type(fn) == SCHYM_FUNCTION);
+	const SchymValue *args[] = { schym_number(1), schym_number(2) };
+	SchymValue *res = schym_call(ctx, fn, 2, args, &err);
+	CHECK(err == NULL && schym_to_number(res) == 8);
+	schym_value_free(res);
+
+	// native functions, also when code calls them with values it made
+	int calls = 0;
+	schym_define(ctx, "sum", sum, &calls);
+	CHECK(eval_number(ctx, "(sum (map (list 1 2 3) (fun (n) (* n n))))") == 14);
+	CHECK(schym_eval(ctx, "(sum 1)", &err) == NULL && err != NULL);
+	CHECK(strstr(err, "expected a list") != NULL);
+	free(err);
+	CHECK(calls == 2);
+
+	// errors
+	CHECK(schym_eval(ctx, "(+ 1", &err) == NULL && err != NULL);
+	free(err);
+	CHECK(schym_eval(ctx, "(undefined-function 1)", &err) == NULL && err != NULL);
+	free(err);
+
+	// programs parsed once, run in many contexts
+	SchymProgram *program = schym_parse("(set n (+ n 1)) (do n)", &err);
+	CHECK(program != NULL);
+	schym_set(ctx, "n", NULL, &err);
+	CHECK(err == NULL);
+	res = schym_number(10);
+	schym_set(ctx, "n", res, &err);
+	CHECK(err == NULL);
+	schym_value_free(res);
+	for (int i = 1; i <= 3; i++) {
+		res = schym_run(ctx, program, &err);
+		CHECK(err == NULL && schym_to_number(res) == 10 + i);
+		schym_value_free(res);
+	}
+
+	// what code prints has been written when the call returns, also to
+	// descriptors that are block buffered
+	int fds[2];
+	CHECK(pipe(fds) == 0);
+	char src[64];
+	snprintf(src, sizeof(src), "(print-to %d \"printed\")", fds[1]);
+	CHECK(eval(ctx, src) == NULL);
+	close(fds[1]);
+	char buf[16];
+	CHECK(read(fds[0], buf, sizeof(buf)) == 8 && memcmp(buf, "printed\n", 8) == 0);
+	close(fds[0]);
+
+	// a reset forgets what was bound, but not the natives
+	schym_reset(ctx);
+	CHECK(schym_get(ctx, "x", &err) == NULL && err == NULL);
+	CHECK(eval_number(ctx, "(sum (list 4 5))") == 9);
+	CHECK(eval_number(ctx, "(not 1)") == 0);
+
+	// functions can be called in other contexts, where x isn't bound
+	SchymContext *other = schym_make(NULL);
+	res = schym_call(other, fn, 2, args, &err);
+	CHECK(res == NULL && err != NULL);
+	free(err);
+	schym_free(other);
+
+	// images saved from a context start others with what it bound
+	eval(ctx, "(set table (map (range 100) (fun (i) (* i i)))) (set sq (fun (x) (* x x)))");
+	schym_image_save(ctx, "test/embed.img", &err);
+	CHECK(err != NULL && strstr(err, "sum") != NULL);
+	free(err);
+	eval(ctx, "(set sum nil)");
+	schym_image_save(ctx, "test/embed.img", &err);
+	CHECK(err == NULL);
+	SchymImage *saved = schym_image_open("test/embed.img", &err);
+	remove("test/embed.img");
+	CHECK(saved != NULL && err == NULL);
+	other = schym_make(saved);
+	CHECK(eval_number(other, "(+ (list-ref table 99) (sq 3) (not 0))") == 9811);
+	schym_free(other);
+	schym_image_free(saved);
+
+	schym_value_free(fn);
+	schym_value_free((SchymValue*)args[0]);
+	schym_value_free((SchymValue*)args[1]);
+	schym_program_free(program);
+	schym_free(ctx);
+	schym_image_free(image);
+
+	printf("OK\n");
+	return 0;
+}